@@ -0,0 +1,482 @@
+// ZOIC - checks on the lens model core and the camera node, built against src/arnoldShim.h
+// Every built-in lens is set up and traced through the core directly, then the node is driven the way a render
+// would through the shim. Exits with 1 if any check fails.
+
+#include "../src/zoicCore.h"
+#include "../src/lensCatalog.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+static void check(bool ok, const char *what, const char *lens){
+    if (!ok){
+        std::printf("FAIL  %-24s %s\n", lens, what);
+        ++failures;
+    }
+}
+
+
+// builtinLens parameter value for a catalog lens, 0 [NONE] when it isn't there
+static int builtinLensParameter(const char *name){
+    for (int b = 0; b < builtinLensCount; b++){
+        if (std::string(builtinLenses[b].name) == name){
+            return b + 1;
+        }
+    }
+    return 0;
+}
+
+
+// a lens at 50mm f/4 focused at 2m on 35mm film, through the core alone
+static void checkBuiltinLens(int index){
+    const char *name = builtinLenses[index].name;
+    Lensdata ld;
+    loadBuiltinLens(index, &ld);
+    ld.filmDiagonal = std::sqrt(3.6f * 3.6f + 2.4f * 2.4f);
+
+    float tracedFocalLength = traceThroughLensElementsForFocalLength(&ld, false);
+    check(tracedFocalLength > 0.0f, "focal length trace", name);
+    if (tracedFocalLength <= 0.0f){ return; }
+
+    ld.focalLengthRatio = 5.0f / tracedFocalLength;
+    adjustFocalLength(&ld);
+    prepareLens(&ld, 4.0f, 200.0f);
+
+    float scaledFocalLength = traceThroughLensElementsForFocalLength(&ld, true);
+    check(std::abs(scaledFocalLength - 5.0f) < 0.01f, "focal length after scaling", name);
+
+    exitPupilLUT(&ld, 32, 10000, 1024, false);
+    check(!ld.apertureMap.empty(), "exit pupil LUT", name);
+
+    // the LUT has to cover all of the exit pupil on axis, or bokeh gets clipped
+    std::vector<lutAccuracyRecord> accuracy;
+    lutAccuracy(&ld, 1, 10000, &accuracy);
+    check(accuracy.size() == 1 && accuracy[0].missed < 0.01f && accuracy[0].efficiency > 0.5f, "LUT coverage of the exit pupil", name);
+
+    // rays from the sensor center through the LUT bounds, most of them should make it through
+    sensorPositionRecord rec;
+    sensorPositionLookup(&ld, 0.0f, 0.0f, &rec);
+    int passed = 0;
+    for (int i = 0; i < 1024; i++){
+        AtVector2 lens;
+        concentricDiskSample((i % 32 + 0.5f) / 32.0f, (i / 32 + 0.5f) / 32.0f, &lens);
+        AtVector origin(0.0f, 0.0f, ld.originShift);
+        AtVector dir = lutDirection(&ld, lens.x, lens.y, &rec, origin);
+        passed += traceThroughLensElements(&origin, &dir, &ld, NULL) ? 1 : 0;
+    }
+    check(passed > 256, "on axis rays through the LUT bounds", name);
+}
+
+
+// the lens data parser on small descriptions, and on the shipped lens files against the tables generated from them
+static bool parses(const char *text, Lensdata *ld, lensDataResult *result){
+    return parseTabularLensData(text, std::strlen(text), ld, result);
+}
+
+static void checkLensData(){
+    Lensdata ld;
+    lensDataResult result;
+    bool ok = parses("# comment\r\n\r\n50.0\t5.0 1.5;40.0\r\n0.0,2.0:0.0  30.0\r\n-60.0\t1.5\t1.7\t35.0", &ld, &result);
+    check(ok && ld.lensCount == 3 && result.columns == 4 && result.commentLines == 2, "4 column lens data", "parser");
+    check(ok && ld.lenses[0].curvature == -60.0f && ld.lenses[0].aperture == 35.0f && ld.lenses[2].aperture == 40.0f, "4 column values", "parser");
+
+    Lensdata five;
+    ok = parses("50.0 5.0 1.5 64.2 40.0\n0.0 2.0 0.0 0.0 30.0\n#ASPHERE 1 -1.0 1e-6\n#ZOOM 2 2.0 8.0 12.0\n", &five, &result);
+    check(ok && five.lensCount == 2 && five.lenses[1].abbe == 64.2f && five.lenses[1].type == SURFACE_ASPHERE, "5 column lens data", "parser");
+    check(ok && five.zoomElements.size() == 1 && five.zoomElements[0] == 0 && five.zoomThickness[0].size() == 3, "zoom directive", "parser");
+
+    struct { const char *text; lensDataStatus status; int line, column; } bad[] = {
+        { "50.0 5.0 1.5 40.0\n0.0 2.0 x 30.0\n", LENSDATA_BAD_NUMBER, 2, 3 },
+        { "50.0 5.0 1.5 40.0\n0.0 2.0 0.0 0.0 30.0\n", LENSDATA_INCONSISTENT_COLUMNS, 2, 0 },
+        { "50.0 5.0 1.5\n", LENSDATA_COLUMN_COUNT, 1, 0 },
+        { "1 2 3 4 5 6\n", LENSDATA_COLUMN_COUNT, 1, 6 },
+        { "0.0 5.0 1.5 40.0\n0.0 2.0 0.0 30.0\n", LENSDATA_MULTIPLE_APERTURES, 2, 1 },
+        { "50.0 5.0 1.5 40.0\n#ZOOM 3 1.0 2.0\n", LENSDATA_BAD_DIRECTIVE, 2, 0 },
+        { "50.0 5.0 1.5 1e39\n", LENSDATA_BAD_NUMBER, 1, 4 },
+        { "# nothing\n\n", LENSDATA_NO_ELEMENTS, 0, 0 },
+    };
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++){
+        Lensdata untouched;
+        ok = parses(bad[i].text, &untouched, &result);
+        check(!ok && result.status == bad[i].status && result.line == bad[i].line && result.column == bad[i].column &&
+              untouched.lenses.empty(), lensDataStatusText(bad[i].status), "parser");
+    }
+
+    check(!readTabularLensData("lenses_tabular/missing.dat", &ld, &result) && result.status == LENSDATA_UNREADABLE, "missing file", "parser");
+
+    for (int b = 0; b < builtinLensCount; b++){
+        Lensdata file;
+        if (!readTabularLensData(std::string("lenses_tabular/") + builtinLenses[b].name + ".dat", &file, &result)){
+            check(result.status == LENSDATA_UNREADABLE, "lens file", builtinLenses[b].name);
+            continue;
+        }
+        cleanupLensData(&file);
+
+        // cleanupLensData scales from mm to cm in float, the catalog rounds after scaling, so allow for the last bit
+        bool same = file.lensCount == builtinLenses[b].lensCount && file.apertureElement == builtinLenses[b].apertureElement;
+        for (int i = 0; same && i < file.lensCount; i++){
+            const builtinLensElement &e = builtinLenses[b].elements[i];
+            const float parsed[] = { file.lenses[i].curvature, file.lenses[i].thickness, file.lenses[i].ior, file.lenses[i].aperture, file.lenses[i].abbe };
+            const float table[] = { e.curvature, e.thickness, e.ior, e.aperture, e.abbe };
+            for (int k = 0; k < 5; k++){
+                same = same && std::abs(parsed[k] - table[k]) <= 1e-6f * std::abs(table[k]);
+            }
+            bool plane = builtinLenses[b].apertureStop && i == builtinLenses[b].apertureElement;
+            same = same && (file.lenses[i].type == SURFACE_PLANE) == plane;
+        }
+        check(same, "lens file matches the built-in table", builtinLenses[b].name);
+    }
+}
+
+
+// the node through the shim, a grid of camera rays for each lens model and back through camera_reverse_ray
+static void checkNode(const AtNodeMethods *methods){
+    AtNode *node = AiShimNodeCreate(methods, "zoicCheck");
+    AiNodeSetFlt(node, "focalLength", 5.0f);
+    AiNodeSetFlt(node, "fStop", 2.8f);
+    AiNodeSetFlt(node, "focalDistance", 200.0f);
+    AiNodeSetInt(node, "builtinLens", builtinLensParameter("F_2.0_DOUBLE_GAUSS"));
+
+    const char *models[] = { "THINLENS", "RAYTRACED" };
+    for (int model = 0; model < 2; model++){
+        AiNodeSetInt(node, "lensModel", model);
+        AiShimNodeUpdate(node);
+        check(!zoicShim().renderAborted.load(), "node update", models[model]);
+
+        int weighted = 0, finite = 0, reversed = 0, total = 0;
+        for (int y = 0; y < 16; y++){
+            for (int x = 0; x < 24; x++){
+                AtCameraInput input;
+                input.sx = (x + 0.5f) / 24.0f * 2.0f - 1.0f;
+                input.sy = ((y + 0.5f) / 16.0f * 2.0f - 1.0f) * (2.4f / 3.6f);
+                input.dsx = input.dsy = 2.0f / 1920.0f;
+                input.lensx = input.lensy = 0.5f;
+
+                AtCameraOutput output;
+                AiShimCreateRay(node, input, output, 0);
+                ++total;
+                weighted += output.weight.r > 0.0f ? 1 : 0;
+                finite += (std::isfinite(output.dir.x) && std::isfinite(output.dir.y) && std::isfinite(output.dir.z) &&
+                           std::abs(AiV3Length(output.dir) - 1.0f) < 1e-3f) ? 1 : 0;
+
+                // the lens center ray of a thin lens goes straight through, so it has to map back exactly
+                // a traced ray only meets its chief ray on the plane of focus, where it has to map back within a pixel
+                AtVector2 ps;
+                AtVector p = output.origin + output.dir * 1000.0f;
+                if (model == 1){
+                    if (output.weight.r <= 0.0f || output.dir.z >= 0.0f){ continue; }
+                    p = output.origin + output.dir * ((-200.0f - output.origin.z) / output.dir.z);
+                }
+                if (AiShimReverseRay(node, p, 0.0f, ps) && std::abs(ps.x - input.sx) < input.dsx && std::abs(ps.y - input.sy) < input.dsy){
+                    ++reversed;
+                }
+            }
+        }
+
+        check(finite == total, "normalized ray directions", models[model]);
+        check(weighted > total / 2, "rays with weight", models[model]);
+        check(model == 0 ? reversed == total : reversed == weighted, "reverse ray round trip", models[model]);
+    }
+
+    AiShimNodeDestroy(node);
+    check(zoicShim().memUsage.load() == 0, "memory usage back to zero", "node");
+}
+
+
+// depth at which two rays from the sensor center through opposite sides of the aperture meet, that's where the lens focuses
+static float focusDepth(AtNode *node, float relativeTime){
+    AtCameraOutput output[2];
+    for (int i = 0; i < 2; i++){
+        AtCameraInput input;
+        input.sx = input.sy = 0.0f;
+        input.dsx = input.dsy = 2.0f / 1920.0f;
+        input.lensx = i ? 0.75f : 0.25f;
+        input.lensy = 0.5f;
+        input.relative_time = relativeTime;
+        AiShimCreateRay(node, input, output[i], 0);
+        if (output[i].weight.r <= 0.0f){ return 0.0f; }
+    }
+
+    // closest approach of the two rays
+    AtVector d = output[0].origin - output[1].origin;
+    float b = AiV3Dot(output[0].dir, output[1].dir);
+    float e = AiV3Dot(output[0].dir, d), f = AiV3Dot(output[1].dir, d);
+    float t = (b * f - e) / (1.0f - b * b);
+    return (output[0].origin + output[0].dir * t).z;
+}
+
+
+// with the focus cache a focus pull isn't a lens change, the focus keys have to get to the rays all the same
+static void checkFocusKeys(const AtNodeMethods *methods){
+    AtNode *node = AiShimNodeCreate(methods, "zoicFocusCheck");
+    AiNodeSetFlt(node, "focalLength", 5.0f);
+    AiNodeSetFlt(node, "fStop", 2.8f);
+    AiNodeSetFlt(node, "focalDistance", 250.0f);
+    AiNodeSetInt(node, "builtinLens", builtinLensParameter("F_2.0_DOUBLE_GAUSS"));
+    AiNodeSetBool(node, "focusCache", true);
+    AiNodeSetFlt(node, "focusCacheNear", 50.0f);
+    AiNodeSetFlt(node, "focusCacheFar", 1000.0f);
+    AiNodeSetInt(node, "focusCacheSamples", 4);
+    AiShimNodeUpdate(node);
+    float fixed = focusDepth(node, 0.5f);
+
+    AtArray *keys = AiArrayAllocate(2, 1, AI_TYPE_FLOAT);
+    AiArraySetFlt(keys, 0, 100.0f);
+    AiArraySetFlt(keys, 1, 400.0f);
+    AiNodeSetArray(node, "focalDistanceKeys", keys);
+    AiShimNodeUpdate(node);
+    float near = focusDepth(node, 0.0f), middle = focusDepth(node, 0.5f), far = focusDepth(node, 1.0f);
+
+    check(fixed < 0.0f && std::abs(middle - fixed) <= 1e-3f * -fixed, "focus keys halfway match the focal distance", "focus cache");
+    check(near < 0.0f && far < middle && middle < near, "focus keys over the shutter interval", "focus cache");
+
+    AiShimNodeDestroy(node);
+}
+
+
+static std::string readFile(const char *path){
+    std::string text;
+    FILE *file = std::fopen(path, "r");
+    if (!file){ return text; }
+    char buffer[4096];
+    size_t size;
+    while ((size = std::fread(buffer, 1, sizeof(buffer), file)) > 0){
+        text.append(buffer, size);
+    }
+    std::fclose(file);
+    return text;
+}
+
+// a counter out of the telemetry json, -1 when it isn't there
+static long long telemetryCount(const char *path, const char *key){
+    std::string text = readFile(path);
+    std::string pattern = std::string("\"") + key + "\": ";
+    size_t found = text.find(pattern);
+    return found != std::string::npos ? std::atoll(text.c_str() + found + pattern.size()) : -1;
+}
+
+
+// the AA samples of a pixel share one LUT record, whichever way the host's screen derivatives point
+static void checkSensorCache(const AtNodeMethods *methods){
+    const char *path = "bin/core_check_telemetry.json";
+    AtNode *node = AiShimNodeCreate(methods, "zoicCacheCheck");
+    AiNodeSetFlt(node, "focalLength", 5.0f);
+    AiNodeSetFlt(node, "fStop", 2.8f);
+    AiNodeSetFlt(node, "focalDistance", 200.0f);
+    AiNodeSetInt(node, "builtinLens", builtinLensParameter("F_2.0_DOUBLE_GAUSS"));
+    AiNodeSetStr(node, "telemetryPath", path);
+    AiShimNodeUpdate(node);
+
+    for (int y = 0; y < 8; y++){
+        for (int x = 0; x < 8; x++){
+            for (int sample = 0; sample < 4; sample++){
+                AtCameraInput input;
+                input.sx = (x + 0.25f + 0.5f * (sample % 2)) / 960.0f;
+                input.sy = -(y + 0.25f + 0.5f * (sample / 2)) / 960.0f;
+                input.dsx = 1.0f / 960.0f;
+                input.dsy = -1.0f / 960.0f;
+                input.lensx = input.lensy = 0.5f;
+
+                AtCameraOutput output;
+                AiShimCreateRay(node, input, output, 0);
+            }
+        }
+    }
+    AiShimNodeDestroy(node);
+
+    check(telemetryCount(path, "lut_uncached_lookups") == 0, "negative dsy still uses the sensor cache", "node");
+    check(telemetryCount(path, "lut_cache_hits") == 8 * 8 * 3, "one LUT lookup per pixel", "node");
+    std::remove(path);
+}
+
+
+// an IPR session updates the node without end, the telemetry only keeps the profiles of the latest updates
+static void checkUpdateHistory(const AtNodeMethods *methods){
+    const char *path = "bin/core_check_updates.json";
+    AtNode *node = AiShimNodeCreate(methods, "zoicUpdateCheck");
+    AiNodeSetInt(node, "lensModel", 0);
+    AiNodeSetStr(node, "telemetryPath", path);
+    for (int i = 0; i < 100; i++){
+        AiNodeSetFlt(node, "focalDistance", 100.0f + i);
+        AiShimNodeUpdate(node);
+    }
+    AiShimNodeDestroy(node);
+
+    std::string text = readFile(path);
+    int profiles = 0;
+    for (size_t at = text.find("\n        ["); at != std::string::npos; at = text.find("\n        [", at + 1)){
+        ++profiles;
+    }
+    check(telemetryCount(path, "update_count") == 100, "update count", "node");
+    check(profiles > 0 && profiles < 100, "kept update profiles", "node");
+    std::remove(path);
+}
+
+
+// a zoom lens keeps its zoom positions when a reload fails, so the zoom still works on the lens that stays
+static void checkZoomReload(const AtNodeMethods *methods){
+    const char *path = "bin/core_check_zoom.dat";
+    FILE *file = std::fopen(path, "w");
+    if (!file){
+        check(false, "writing the zoom lens", "zoom");
+        return;
+    }
+    std::fprintf(file, "42.97 9.8 1.691 54.7 19.2\n-115.33 2.1 1.549 45.4 19.2\n306.84 4.16 0.0 0.0 19.2\n0.0 4.0 0.0 0.0 15.0\n"
+                       "-59.060 1.87 1.64 34.6 17.3\n40.93 10.64 0.0 0.0 17.3\n183.92 7.050 1.691 54.7 16.5\n-48.91 79.831 0.0 0.0 16.5\n"
+                       "#ZOOM 6 6.0 10.64 16.0\n");
+    std::fclose(file);
+
+    AtNode *node = AiShimNodeCreate(methods, "zoicZoomCheck");
+    AiNodeSetFlt(node, "focalLength", 5.0f);
+    AiNodeSetFlt(node, "fStop", 2.8f);
+    AiNodeSetFlt(node, "focalDistance", 200.0f);
+    AiNodeSetInt(node, "builtinLens", 0);
+    AiNodeSetStr(node, "lensDataPath", path);
+    AiShimNodeUpdate(node);
+    check(!zoicShim().renderAborted.load(), "zoom lens update", "zoom");
+
+    AtVector p(20.0f, 10.0f, -200.0f);
+    AtVector2 wide, failed, tele;
+    AiShimReverseRay(node, p, 0.0f, wide);
+
+    // the errors of the failed reload are expected, no need to see them
+    AiNodeSetStr(node, "lensDataPath", "bin/core_check_missing.dat");
+    zoicSetMessageSeverity(AI_SEVERITY_ERROR + 1);
+    AiShimNodeUpdate(node);
+    zoicSetMessageSeverity(AI_SEVERITY_WARNING);
+    check(zoicShim().renderAborted.load(), "missing lens file aborts", "zoom");
+    zoicShim().renderAborted.store(false);
+    AiShimReverseRay(node, p, 0.0f, failed);
+
+    AiNodeSetFlt(node, "zoom", 1.0f);
+    AiShimNodeUpdate(node);
+    AiShimReverseRay(node, p, 0.0f, tele);
+
+    check(failed.x == wide.x && failed.y == wide.y, "failed reload keeps the lens", "zoom");
+    check(std::abs(tele.x - wide.x) > 1e-3f, "zoom after a failed reload", "zoom");
+
+    AiShimNodeDestroy(node);
+    std::remove(path);
+}
+
+
+// bokeh image for the joint sampling check: a disc getting brighter to the right, so a bias shows up either way
+static const char *rampPath = "core_check_ramp";
+static const int rampSize = 64;
+
+static bool rampInfo(const char *path, unsigned int *width, unsigned int *height, unsigned int *channels){
+    if (std::strcmp(path, rampPath) != 0){ return false; }
+    *width = *height = rampSize;
+    *channels = 3;
+    return true;
+}
+
+static bool rampLoad(const char *path, float *pixels){
+    if (std::strcmp(path, rampPath) != 0){ return false; }
+    for (int y = 0; y < rampSize; y++){
+        for (int x = 0; x < rampSize; x++){
+            float u = (x + 0.5f) / rampSize * 2.0f - 1.0f;
+            float v = (y + 0.5f) / rampSize * 2.0f - 1.0f;
+            float *pixel = pixels + (y * rampSize + x) * 3;
+            pixel[0] = pixel[1] = pixel[2] = (u * u + v * v < 1.0f) ? 0.2f + 0.8f * (u + 1.0f) * 0.5f : 0.0f;
+        }
+    }
+    return true;
+}
+
+
+// the samples the joint bokeh and exit pupil sampling gets through the lens have to follow the same distribution
+// as plain rejection sampling of the bokeh image, checked near the edge of the image circle where the pupil is cut the most
+static void checkBokehPupil(){
+    const char *name = "bokeh pupil";
+    zoicHost host = zoicHost();
+    host.textureInfo = rampInfo;
+    host.textureLoad = rampLoad;
+    zoicSetHost(host);
+
+    Lensdata ld;
+    loadBuiltinLens(builtinLensParameter("F_2.0_DOUBLE_GAUSS") - 1, &ld);
+    ld.filmDiagonal = std::sqrt(3.6f * 3.6f + 2.4f * 2.4f);
+    ld.focalLengthRatio = 5.0f / traceThroughLensElementsForFocalLength(&ld, false);
+    adjustFocalLength(&ld);
+    prepareLens(&ld, 2.0f, 200.0f);
+    exitPupilLUT(&ld, 32, 10000, 1024, false);
+
+    imageData image;
+    check(image.read(rampPath), "reading the bokeh image", name);
+    buildBokehPupilSampling(&ld, image);
+
+    float edge = 0.0f;
+    for (std::map<float, apertureLUTEntry>::iterator it = ld.apertureMap.begin(); it != ld.apertureMap.end(); ++it){
+        if (it->second.acceptance > 0.0f){ edge = it->first; }
+    }
+    check(edge > 0.0f, "image circle", name);
+
+    AtVector origin(edge * 0.9f, 0.0f, ld.originShift);
+    sensorPositionRecord rec;
+    sensorPositionLookup(&ld, origin.x, origin.y, &rec);
+
+    // 8x8 histograms over the bokehSample domain of what gets through, the bins lined up with the cells of the distribution
+    // so the pixels rejection sampling gives don't land on a bin edge
+    const int bins = 8;
+    std::vector<double> joint(bins * bins, 0.0), rejection(bins * bins, 0.0);
+    double jointCount = 0.0, rejectionCount = 0.0;
+    for (int i = 0; i < 400000; i++){
+        for (int method = 0; method < 2; method++){
+            AtVector2 lens;
+            if (method == 0){
+                sampleBokehPupil(&ld, rec.bokehBin, xor128() / 4294967296.0f, xor128() / 4294967296.0f, &lens);
+            }
+            else {
+                image.bokehSample(xor128() / 4294967296.0f, xor128() / 4294967296.0f, &lens.x, &lens.y);
+            }
+
+            AtVector o = origin;
+            AtVector d = lutDirection(&ld, lens.x, lens.y, &rec, o);
+            if (!traceCameraRay(&o, &d, &ld, NULL, NULL)){ continue; }
+
+            int bx = std::min(std::max(static_cast<int>((lens.x - ld.bokehPupilOffsetX + 1.0f) * 0.5f * bins), 0), bins - 1);
+            int by = std::min(std::max(static_cast<int>((lens.y - ld.bokehPupilOffsetY + 1.0f) * 0.5f * bins), 0), bins - 1);
+            if (method == 0){ joint[by * bins + bx] += 1.0; jointCount += 1.0; }
+            else { rejection[by * bins + bx] += 1.0; rejectionCount += 1.0; }
+        }
+    }
+
+    double distance = 0.0;
+    for (int b = 0; b < bins * bins; b++){
+        distance += 0.5 * std::abs(joint[b] / std::max(jointCount, 1.0) - rejection[b] / std::max(rejectionCount, 1.0));
+    }
+    check(jointCount > 0.0 && rejectionCount > 0.0, "samples through the lens", name);
+    check(distance < 0.02, "joint sampling matches rejection sampling", name);
+
+    zoicSetHost(zoicHost());
+}
+
+
+int main(){
+    zoicSetMessageSeverity(AI_SEVERITY_WARNING);
+
+    for (int i = 0; i < builtinLensCount; i++){
+        checkBuiltinLens(i);
+    }
+    checkLensData();
+    checkBokehPupil();
+
+    AtNodeLib lib;
+    check(NodeLoader(0, &lib) && lib.methods != NULL, "node loader", "node");
+    checkNode(lib.methods);
+    checkFocusKeys(lib.methods);
+    checkSensorCache(lib.methods);
+    checkZoomReload(lib.methods);
+    checkUpdateHistory(lib.methods);
+
+    std::printf("%d built-in lenses, %d failures\n", builtinLensCount, failures);
+    return failures ? 1 : 0;
+}
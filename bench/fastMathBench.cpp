@@ -0,0 +1,181 @@
+// ZOIC - accuracy and throughput of the fast math routines against libm
+// Pins the error bounds documented in src/fastMath.h, exits with 1 if any of them is exceeded.
+
+#include "../src/fastMath.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+using namespace fastmath;
+
+static const int N = 1 << 16;
+static const int REPEATS = 200;
+
+// documented bounds in src/fastMath.h
+static const double SINCOS_MAX_ERROR = 1.2e-7;
+static const double ATAN2_MAX_ERROR  = 1.5e-5;
+#ifdef ZOIC_FASTMATH_SSE
+static const double RSQRT_MAX_ERROR  = 2.5e-7;
+#else
+static const double RSQRT_MAX_ERROR  = 5.0e-6;
+#endif
+
+static volatile float sink;
+
+
+// xorshift, same generator as the camera shader
+static uint32_t xor128(void){
+    static uint32_t x = 123456789, y = 362436069, z = 521288629, w = 88675123;
+    uint32_t t = x ^ (x << 11);
+    x = y; y = z; z = w;
+    return w = (w ^ (w >> 19) ^ t ^ (t >> 8));
+}
+
+
+static float uniform(float lo, float hi){
+    return lo + (hi - lo) * (xor128() / 4294967296.0f);
+}
+
+
+template <typename F>
+static double nsPerOp(F f){
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    for (int r = 0; r < REPEATS; ++r){
+        f();
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::high_resolution_clock::now() - start;
+    return elapsed.count() / (static_cast<double>(REPEATS) * N);
+}
+
+
+static bool report(const char *name, double maxError, double bound, double nsFast, double nsBatched, double nsLibm){
+    bool ok = maxError <= bound;
+    printf("%-12s %12.3e %12.3e %10.3f %10.3f %10.3f %8.2fx  %s\n",
+           name, maxError, bound, nsFast, nsBatched, nsLibm, nsLibm / nsBatched, ok ? "ok" : "FAIL");
+    return ok;
+}
+
+
+int main(){
+    std::vector<float> a(N), b(N), out1(N), out2(N);
+    bool ok = true;
+
+    printf("%-12s %12s %12s %10s %10s %10s %9s\n", "routine", "max error", "bound", "ns scalar", "ns batch", "ns libm", "speedup");
+
+    // sincos, angles as they show up in the disk sampling plus a wide range for the reduction
+    {
+        double maxError = 0.0;
+        for (int i = 0; i < N; ++i){
+            a[i] = (i & 1) ? uniform(-PI, PI) : uniform(-1e4f, 1e4f);
+        }
+        for (int i = 0; i < N; ++i){
+            float s, c;
+            fastSinCos(a[i], &s, &c);
+            maxError = std::max(maxError, std::abs(s - std::sin(static_cast<double>(a[i]))));
+            maxError = std::max(maxError, std::abs(c - std::cos(static_cast<double>(a[i]))));
+        }
+
+        double nsFast = nsPerOp([&](){
+            float acc = 0.0f;
+            for (int i = 0; i < N; ++i){ float s, c; fastSinCos(a[i], &s, &c); acc += s + c; }
+            sink = acc;
+        });
+        double nsBatched = nsPerOp([&](){ fastSinCosN(a.data(), out1.data(), out2.data(), N); sink = out1[N - 1] + out2[N - 1]; });
+        double nsLibm = nsPerOp([&](){
+            for (int i = 0; i < N; ++i){ out1[i] = std::sin(a[i]); out2[i] = std::cos(a[i]); }
+            sink = out1[N - 1] + out2[N - 1];
+        });
+
+        ok &= report("sincos", maxError, SINCOS_MAX_ERROR, nsFast, nsBatched, nsLibm);
+    }
+
+    // atan2, all quadrants including the axes
+    {
+        double maxError = 0.0;
+        for (int i = 0; i < N; ++i){
+            a[i] = uniform(-10.0f, 10.0f);
+            b[i] = (i % 97 == 0) ? 0.0f : uniform(-10.0f, 10.0f);
+        }
+        for (int i = 0; i < N; ++i){
+            double e = std::abs(fastAtan2(a[i], b[i]) - std::atan2(static_cast<double>(a[i]), static_cast<double>(b[i])));
+            // +pi and -pi are the same angle
+            maxError = std::max(maxError, std::min(e, std::abs(e - 2.0 * 3.14159265358979323846)));
+        }
+
+        double nsFast = nsPerOp([&](){
+            float acc = 0.0f;
+            for (int i = 0; i < N; ++i){ acc += fastAtan2(a[i], b[i]); }
+            sink = acc;
+        });
+        double nsBatched = nsPerOp([&](){ fastAtan2N(a.data(), b.data(), out1.data(), N); sink = out1[N - 1]; });
+        double nsLibm = nsPerOp([&](){
+            for (int i = 0; i < N; ++i){ out1[i] = std::atan2(a[i], b[i]); }
+            sink = out1[N - 1];
+        });
+
+        ok &= report("atan2", maxError, ATAN2_MAX_ERROR, nsFast, nsBatched, nsLibm);
+    }
+
+    // rsqrt, relative error over the whole normal float range
+    {
+        double maxError = 0.0;
+        for (int i = 0; i < N; ++i){
+            a[i] = std::pow(10.0f, uniform(-30.0f, 30.0f));
+        }
+        for (int i = 0; i < N; ++i){
+            double exact = 1.0 / std::sqrt(static_cast<double>(a[i]));
+            maxError = std::max(maxError, std::abs(fastRsqrt(a[i]) - exact) / exact);
+        }
+        fastRsqrtN(a.data(), out1.data(), N);
+        for (int i = 0; i < N; ++i){
+            double exact = 1.0 / std::sqrt(static_cast<double>(a[i]));
+            maxError = std::max(maxError, std::abs(out1[i] - exact) / exact);
+        }
+
+        double nsFast = nsPerOp([&](){
+            float acc = 0.0f;
+            for (int i = 0; i < N; ++i){ acc += fastRsqrt(a[i]); }
+            sink = acc;
+        });
+        double nsBatched = nsPerOp([&](){ fastRsqrtN(a.data(), out1.data(), N); sink = out1[N - 1]; });
+        double nsLibm = nsPerOp([&](){
+            for (int i = 0; i < N; ++i){ out1[i] = 1.0f / std::sqrt(a[i]); }
+            sink = out1[N - 1];
+        });
+
+        ok &= report("rsqrt", maxError, RSQRT_MAX_ERROR, nsFast, nsBatched, nsLibm);
+    }
+
+    // rotation straight from a sensor position, against atan2 + sin/cos of the angle
+    {
+        double maxError = 0.0;
+        for (int i = 0; i < N; ++i){
+            a[i] = uniform(-1.8f, 1.8f);
+            b[i] = uniform(-1.8f, 1.8f);
+        }
+        for (int i = 0; i < N; ++i){
+            float c, s;
+            rotationFromPoint(a[i], b[i], &c, &s);
+            double theta = std::atan2(static_cast<double>(b[i]), static_cast<double>(a[i]));
+            maxError = std::max(maxError, std::abs(c - std::cos(theta)));
+            maxError = std::max(maxError, std::abs(s - std::sin(theta)));
+        }
+
+        double nsFast = nsPerOp([&](){
+            float acc = 0.0f;
+            for (int i = 0; i < N; ++i){ float c, s; rotationFromPoint(a[i], b[i], &c, &s); acc += c + s; }
+            sink = acc;
+        });
+        double nsLibm = nsPerOp([&](){
+            for (int i = 0; i < N; ++i){ float theta = std::atan2(b[i], a[i]); out1[i] = std::cos(theta); out2[i] = std::sin(theta); }
+            sink = out1[N - 1] + out2[N - 1];
+        });
+
+        ok &= report("rotation", maxError, RSQRT_MAX_ERROR * 2.0, nsFast, nsFast, nsLibm);
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,260 @@
+// ZOIC - fuzzing the lens data parser
+// Every input goes through parseTabularLensData and through a slow, obvious reading of the same format, and the two
+// have to agree: on whether it is valid and on every value. Anything the parser accepts has to be a lens the rest
+// of the core can take, anything it rejects has to leave the lens data alone and point at a line that exists.
+//
+// As a libFuzzer target, seeded with the shipped lens files:
+//     clang++ -std=c++11 -g -O1 -fsanitize=fuzzer,address,undefined -DZOIC_NO_ARNOLD -DZOIC_LIBFUZZER
+//             bench/lensDataFuzz.cpp src/zoicCore.cpp -o bin/lens_fuzz
+//     bin/lens_fuzz lenses_tabular
+//
+// Without libFuzzer it mutates the lens files itself, make fuzz builds it that way with the sanitizers on:
+//     bin/lens_fuzz [LENS DIR] [ITERATIONS] [SEED]
+
+#include "../src/zoicCore.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+
+static bool isSeparator(char c){
+    return std::strchr("\t,;: \r\v\f", c) != NULL && c != '\0';
+}
+
+static std::vector<std::string> split(const std::string &line){
+    std::vector<std::string> tokens;
+    std::string token;
+    for (size_t i = 0; i <= line.size(); i++){
+        if (i == line.size() || isSeparator(line[i])){
+            if (!token.empty()){ tokens.push_back(token); }
+            token.clear();
+        }
+        else {
+            token += line[i];
+        }
+    }
+    return tokens;
+}
+
+static bool number(const std::string &token, float *value){
+    std::string digits = token[0] == '+' ? token.substr(1) : token;
+    if (digits.empty() || digits.size() > 63 || digits.find_first_not_of("0123456789.-+eE") != std::string::npos){ return false; }
+    char *end = NULL;
+    *value = std::strtof(digits.c_str(), &end);
+    return end == digits.c_str() + digits.size() && std::isfinite(*value);
+}
+
+
+// the lens table the slow way, front-most element first, directive lines are left to the parser
+static bool referenceParse(const std::string &text, std::vector<std::vector<float> > *rows, bool *directives){
+    size_t start = 0;
+    *directives = false;
+    while (start <= text.size()){
+        size_t newline = text.find('\n', start);
+        std::string line = text.substr(start, newline == std::string::npos ? std::string::npos : newline - start);
+        start = newline == std::string::npos ? text.size() + 1 : newline + 1;
+
+        std::vector<std::string> tokens = split(line);
+        if (tokens.empty()){ continue; }
+        if (tokens[0][0] == '#'){
+            *directives = *directives || tokens[0] == "#ZOOM" || tokens[0] == "#ASPHERE";
+            continue;
+        }
+
+        std::vector<float> row;
+        for (size_t i = 0; i < tokens.size(); i++){
+            float value;
+            if (!number(tokens[i], &value)){ return false; }
+            row.push_back(value);
+        }
+        if (row.size() < 4 || row.size() > 5 || (!rows->empty() && row.size() != (*rows)[0].size())){ return false; }
+        rows->push_back(row);
+    }
+
+    int apertures = 0;
+    for (size_t i = 0; i < rows->size(); i++){
+        apertures += (*rows)[i][0] == 0.0f ? 1 : 0;
+    }
+    return !rows->empty() && apertures <= 1;
+}
+
+
+static void fail(const char *what, const uint8_t *data, size_t size){
+    std::fprintf(stderr, "lens data fuzz: %s, input of %zu bytes:\n", what, size);
+    std::fwrite(data, 1, size, stderr);
+    std::fprintf(stderr, "\n");
+    std::abort();
+}
+
+
+static int statusCounts[LENSDATA_BAD_DIRECTIVE + 1];
+
+static void checkInput(const uint8_t *data, size_t size){
+    const char *text = reinterpret_cast<const char*>(data);
+    Lensdata ld;
+    lensDataResult result;
+    bool ok = parseTabularLensData(text, size, &ld, &result);
+    ++statusCounts[result.status];
+
+    int lines = 1;
+    for (size_t i = 0; i < size; i++){ lines += data[i] == '\n' ? 1 : 0; }
+
+    if (!ok){
+        if (result.status == LENSDATA_OK){ fail("rejected without a reason", data, size); }
+        if (result.line < 0 || result.line > lines || result.column < 0){ fail("error points outside the input", data, size); }
+        if (!ld.lenses.empty() || ld.lensCount != 0 || !ld.zoomElements.empty()){ fail("rejected input changed the lens", data, size); }
+    }
+    else {
+        if (result.status != LENSDATA_OK || (result.columns != 4 && result.columns != 5)){ fail("accepted with a bad result", data, size); }
+        if (ld.lensCount < 1 || ld.lensCount != static_cast<int>(ld.lenses.size())){ fail("lens count", data, size); }
+
+        int apertures = 0;
+        for (int i = 0; i < ld.lensCount; i++){
+            const LensElement &e = ld.lenses[i];
+            if (!std::isfinite(e.curvature) || !std::isfinite(e.thickness) || !std::isfinite(e.ior) ||
+                !std::isfinite(e.aperture) || !std::isfinite(e.abbe) || !std::isfinite(e.conic)){
+                fail("value that isn't finite", data, size);
+            }
+            apertures += e.curvature == 0.0f ? 1 : 0;
+            if (e.type == SURFACE_ASPHERE && e.curvature == 0.0f){ fail("aspheric aperture", data, size); }
+        }
+        if (apertures > 1){ fail("more than one aperture", data, size); }
+
+        if (ld.zoomElements.size() != ld.zoomThickness.size()){ fail("zoom elements and thicknesses differ", data, size); }
+        for (size_t z = 0; z < ld.zoomElements.size(); z++){
+            if (ld.zoomElements[z] < 0 || ld.zoomElements[z] >= ld.lensCount){ fail("zoom element out of range", data, size); }
+            if (ld.zoomThickness[z].size() < 2 || ld.zoomThickness[z].size() != ld.zoomThickness[0].size()){ fail("zoom positions", data, size); }
+        }
+    }
+
+    // the table itself against the reference, directives can only make a valid table invalid
+    std::vector<std::vector<float> > rows;
+    bool directives;
+    bool referenceOk = referenceParse(std::string(text, size), &rows, &directives);
+    if (ok && !referenceOk){ fail("parser accepted what the reference rejects", data, size); }
+    if (!ok && referenceOk && !directives){ fail("parser rejected what the reference accepts", data, size); }
+    if (ok){
+        for (size_t r = 0; r < rows.size(); r++){
+            const LensElement &e = ld.lenses[rows.size() - 1 - r];
+            const std::vector<float> &row = rows[r];
+            float abbe = row.size() == 5 ? row[3] : 0.0f;
+            if (e.curvature != row[0] || e.thickness != row[1] || e.ior != row[2] || e.abbe != abbe || e.aperture != row.back()){
+                fail("value differs from the reference", data, size);
+            }
+        }
+    }
+}
+
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size){
+    checkInput(data, size);
+    return 0;
+}
+
+
+#ifndef ZOIC_LIBFUZZER
+
+static uint64_t state = 88172645463325252ull;
+
+static uint32_t next(uint32_t range){
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return static_cast<uint32_t>(state >> 32) % range;
+}
+
+// what lens files are made of, so most mutations still look like one
+static const char alphabet[] = "0123456789.-+eE#\t\n\r ,;:";
+static const char *fragments[] = {
+    "0.0", "-0", "1e39", "1e-50", "nan", "inf", "0x1p3", "+12.5", "1.5.5", "--1", "\n#ZOOM 2 1.0 2.0 3.0\n",
+    "\n#ASPHERE 1 -1.0 1e-6 2e-9\n", "\n#ZOOM 1 4.0\n", "\n#ASPHERE 99 0\n", "\n#ZOOMX 1 2 3\n", "\n## comment\n",
+    "\n0.0 2.0 0.0 30.0\n", "\n50.0 5.0 1.5 64.2 40.0\n", "\r\n", "\t\t", "99999999999999999999999999999999999999999999999999999999999999999"
+};
+
+// a decimal number with a random amount of digits, point and exponent, for the rounding of the short number path
+static std::string randomNumber(){
+    std::string number = next(2) ? "-" : "";
+    int digits = 1 + next(10);
+    int point = next(digits + 1);
+    for (int d = 0; d < digits; d++){
+        if (d == point){ number += '.'; }
+        number += static_cast<char>('0' + next(10));
+    }
+    if (next(3) == 0){
+        char exponent[16];
+        std::snprintf(exponent, sizeof(exponent), "e%d", static_cast<int>(next(50)) - 25);
+        number += exponent;
+    }
+    return number;
+}
+
+static std::string mutate(const std::vector<std::string> &seeds){
+    std::string text = seeds[next(seeds.size())];
+    int steps = 1 + next(8);
+    for (int s = 0; s < steps; s++){
+        size_t at = text.empty() ? 0 : next(text.size() + 1);
+        switch (next(8)){
+            case 0: if (!text.empty() && at < text.size()){ text[at] = alphabet[next(sizeof(alphabet) - 1)]; } break;
+            case 1: if (!text.empty() && at < text.size()){ text[at] = static_cast<char>(next(256)); } break;
+            case 2: text.insert(at, 1, alphabet[next(sizeof(alphabet) - 1)]); break;
+            case 3: text.erase(at, next(16)); break;
+            case 4: text.insert(at, fragments[next(sizeof(fragments) / sizeof(fragments[0]))]); break;
+            case 5: {
+                // a line of this or another seed, somewhere else
+                const std::string &other = seeds[next(seeds.size())];
+                size_t from = next(other.size() + 1);
+                size_t to = other.find('\n', from);
+                text.insert(at, other.substr(from, to == std::string::npos ? std::string::npos : to - from + 1));
+            } break;
+            case 6: text.resize(at); break;
+            case 7: text.insert(at, randomNumber()); break;
+        }
+    }
+    return text;
+}
+
+int main(int argc, char **argv){
+    std::string directory = argc > 1 ? argv[1] : "lenses_tabular";
+    long iterations = argc > 2 ? std::atol(argv[2]) : 200000;
+    if (argc > 3){ state ^= std::strtoull(argv[3], NULL, 10) * 0x9E3779B97F4A7C15ull; }
+
+    std::vector<std::string> seeds;
+    if (DIR *dir = opendir(directory.c_str())){
+        while (dirent *entry = readdir(dir)){
+            std::string name = entry->d_name;
+            if (name.size() > 4 && name.compare(name.size() - 4, 4, ".dat") == 0){
+                std::ifstream file((directory + "/" + name).c_str(), std::ios::binary);
+                seeds.push_back(std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()));
+            }
+        }
+        closedir(dir);
+    }
+    if (seeds.empty()){
+        std::fprintf(stderr, "no lens files in %s\n", directory.c_str());
+        return 2;
+    }
+    seeds.push_back("50.0 5.0 1.5 40.0\n0.0 2.0 0.0 30.0\n-60.0 1.5 1.7 35.0\n#ZOOM 2 2.0 8.0\n#ASPHERE 3 -0.5 1e-6\n");
+
+    for (size_t i = 0; i < seeds.size(); i++){
+        checkInput(reinterpret_cast<const uint8_t*>(seeds[i].data()), seeds[i].size());
+    }
+    for (long i = 0; i < iterations; i++){
+        std::string text = mutate(seeds);
+        checkInput(reinterpret_cast<const uint8_t*>(text.data()), text.size());
+    }
+
+    std::printf("%ld inputs, no failures\n", iterations + static_cast<long>(seeds.size()));
+    for (int s = 0; s <= LENSDATA_BAD_DIRECTIVE; s++){
+        std::printf("%-60s %10d\n", lensDataStatusText(static_cast<lensDataStatus>(s)), statusCounts[s]);
+    }
+    return 0;
+}
+
+#endif
@@ -0,0 +1,1090 @@
+// ZOIC - camera ray cost per lens and sampling mode
+// Drives the camera node through src/arnoldShim.h the way a render would, for every lens file in a directory and
+// for THINLENS, RAYTRACED without and with the LUT, each with and without a bokeh image. Per run it measures
+// camera rays per second, mean traces per ray, the vignetted and skipped fractions, node_update time and the time
+// exitPupilLUT takes on its own. Results go out as JSON, one result per line.
+//
+// usage: zoic_bench [--lenses DIR] [--lens NAME] [--variant NAME] [--resolution WxH] [--samples N] [--repeats N]
+//                   [--out FILE] [--compare BASELINE.json] [--tolerance FRACTION]
+//                   [--scaling [--threads N] [--bucket SIZE]]
+//                   [--convergence [--max-samples N] [--reference-samples N]]
+//                   [--parse [--catalog-elements N]]
+//
+// With --compare every result is checked against the saved baseline and the program exits with 1 when any of them
+// got slower, needs more traces per ray or vignettes more than the tolerance allows.
+//
+// --scaling renders the same image from 1, 2, 4 .. N threads instead, each thread taking the next bucket the way
+// arnold hands them out, and reports throughput and scaling efficiency against the single thread run. On linux the
+// cycle, instruction, cache miss and L1D miss counters are read as well where perf_event_open is allowed. Misses per
+// ray that grow with the thread count are the sign of threads fighting over the same cache lines, the shared
+// counters and random number state in the node. Telling false sharing apart from real sharing takes perf c2c.
+//
+// --convergence looks at noise instead of speed. A wall of small bright lights far behind the focus plane is rendered
+// onto a film through the camera rays, at 1, 2, 4 .. N samples per pixel, and every step is compared against a
+// render of the same lens and variant at many more samples. RMSE against the render time shows what a sampling change
+// does to the time it takes to get to a clean image, efficiency is 1 / (RMSE^2 * seconds).
+//
+// --parse times reading lens data instead, the shipped files and two generated catalogs of --catalog-elements lens
+// elements, in MB and files per second and nanoseconds per element. The old getline and std::stof reader runs
+// alongside as a reference.
+
+#include "../src/zoicCore.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// same sensor, lens and focus for every run: 50mm on 35mm film focused at 2m
+static const float sensorWidth = 3.6f;
+static const float sensorHeight = 2.4f;
+static const float focalLength = 5.0f;
+static const float fStop = 4.0f;
+static const float focalDistance = 200.0f;
+
+static const char *bokehPath = "zoic_bench_hexagon";
+static const int bokehSize = 128;
+
+
+struct benchOptions{
+    std::string lensDirectory;
+    std::string lensFilter, variantFilter;
+    std::string outPath;
+    std::string baselinePath;
+    int width, height, samples, repeats;
+    double tolerance;
+    bool scaling;
+    int maxThreads, bucketSize;
+    bool convergence;
+    int maxSamples, referenceSamples;
+    bool parse;
+    int catalogElements;
+
+    benchOptions()
+        : lensDirectory("lenses_tabular"), width(240), height(160), samples(4), repeats(3), tolerance(0.1)
+        , scaling(false), maxThreads(static_cast<int>(std::thread::hardware_concurrency())), bucketSize(16)
+        , convergence(false), maxSamples(64), referenceSamples(256), parse(false), catalogElements(100000){
+    }
+};
+
+
+struct benchResult{
+    std::string lens, variant;
+    double raysPerSecond;
+    double triesPerRay;
+    double vignettedRate, skippedRate;
+    double nodeUpdateMs, lutBuildMs;
+    bool aborted;
+
+    benchResult()
+        : raysPerSecond(0.0), triesPerRay(0.0), vignettedRate(0.0), skippedRate(0.0)
+        , nodeUpdateMs(0.0), lutBuildMs(0.0), aborted(false){
+    }
+};
+
+
+struct scalingResult{
+    std::string lens, variant;
+    int threads;
+    double raysPerSecond, efficiency;
+    bool counted; // hardware counters were read
+    double cyclesPerRay, instructionsPerCycle, cacheMissesPerRay, l1dMissesPerRay;
+};
+
+
+struct convergenceResult{
+    std::string lens, variant;
+    int samples;
+    double seconds;
+    double rmse, relativeRmse;
+};
+
+
+struct benchVariant{
+    const char *name;
+    int lensModel; // THINLENS 0, RAYTRACED 1
+    bool lut;
+    bool bokeh;
+};
+
+static const benchVariant variants[] = {
+    { "thinlens",             0, false, false },
+    { "thinlens_bokeh",       0, false, true  },
+    { "raytraced_naive",      1, false, false },
+    { "raytraced_naive_bokeh",1, false, true  },
+    { "raytraced_lut",        1, true,  false },
+    { "raytraced_lut_bokeh",  1, true,  true  }
+};
+
+
+// node_finish reports its ray counts as messages, they're picked out of there
+struct finishCounts{
+    long long succes, vignetted, skipped, retries;
+};
+
+static finishCounts counts;
+
+static bool readCount(const char *text, const char *label, long long *value){
+    size_t length = std::strlen(label);
+    if (std::strncmp(text, label, length) != 0){ return false; }
+    *value = std::strtoll(text + length, NULL, 10);
+    return true;
+}
+
+static void benchMessage(int severity, const char *text){
+    if (readCount(text, "[ZOIC] Succesful rays", &counts.succes) ||
+        readCount(text, "[ZOIC] Vignetted rays", &counts.vignetted) ||
+        readCount(text, "[ZOIC] Skipped rays outside image circle", &counts.skipped) ||
+        readCount(text, "[ZOIC] Retried traces", &counts.retries)){
+        return;
+    }
+    if (severity >= AI_SEVERITY_WARNING){
+        std::fprintf(stderr, "  %s\n", text);
+    }
+}
+
+
+// bokeh image: a hexagonal aperture with a brighter rim, like a stopped down lens with six blades
+static bool hexagonInfo(const char *path, unsigned int *width, unsigned int *height, unsigned int *channels){
+    if (std::strcmp(path, bokehPath) != 0){ return false; }
+    *width = *height = bokehSize;
+    *channels = 3;
+    return true;
+}
+
+static bool hexagonLoad(const char *path, float *pixels){
+    if (std::strcmp(path, bokehPath) != 0){ return false; }
+
+    for (int y = 0; y < bokehSize; y++){
+        for (int x = 0; x < bokehSize; x++){
+            float u = (x + 0.5f) / bokehSize * 2.0f - 1.0f;
+            float v = (y + 0.5f) / bokehSize * 2.0f - 1.0f;
+
+            // distance to the center in the hexagon norm
+            float au = std::abs(u), av = std::abs(v);
+            float d = std::max(av, 0.866025f * au + 0.5f * av) / 0.95f;
+            float value = d < 1.0f ? 0.6f + 0.4f * d * d * d * d : 0.0f;
+
+            float *pixel = pixels + (y * bokehSize + x) * 3;
+            pixel[0] = pixel[1] = pixel[2] = value;
+        }
+    }
+    return true;
+}
+
+
+static double millisecondsSince(std::chrono::steady_clock::time_point start){
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+// exitPupilLUT by itself, on a lens set up the way node_update does it
+static double lutBuildMs(const std::string &path){
+    Lensdata ld;
+    ld.filmDiagonal = std::sqrt(sensorWidth * sensorWidth + sensorHeight * sensorHeight);
+    ld.focalDistance = focalDistance;
+    lensDataResult parsed;
+    if (!readTabularLensData(path, &ld, &parsed)){ return 0.0; }
+    cleanupLensData(&ld);
+
+    ld.focalLengthRatio = focalLength / traceThroughLensElementsForFocalLength(&ld, false);
+    adjustFocalLength(&ld);
+    prepareLens(&ld, fStop, focalDistance);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    exitPupilLUT(&ld, 32, 100000, 4096, false);
+    return millisecondsSince(start);
+}
+
+
+// low discrepancy lens samples, the R2 sequence
+static void lensSample(uint32_t index, float *u, float *v){
+    double a = 0.5 + index * 0.7548776662466927;
+    double b = 0.5 + index * 0.5698402909980532;
+    *u = static_cast<float>(a - std::floor(a));
+    *v = static_cast<float>(b - std::floor(b));
+}
+
+
+// the same sample for a pixel no matter which thread traces it
+static void cameraInput(int px, int py, int s, const benchOptions &options, AtCameraInput *input){
+    input->sx = (px + 0.5f) / options.width * 2.0f - 1.0f;
+    input->sy = ((py + 0.5f) / options.height * 2.0f - 1.0f) * (static_cast<float>(options.height) / options.width);
+    input->dsx = input->dsy = 2.0f / options.width;
+    lensSample(static_cast<uint32_t>((py * options.width + px) * options.samples + s), &input->lensx, &input->lensy);
+}
+
+
+static AtNode* createNode(const AtNodeMethods *methods, const std::string &lensPath, const benchVariant &variant){
+    AtNode *node = AiShimNodeCreate(methods, "zoicBench");
+    AiNodeSetFlt(node, "sensorWidth", sensorWidth);
+    AiNodeSetFlt(node, "sensorHeight", sensorHeight);
+    AiNodeSetFlt(node, "focalLength", focalLength);
+    AiNodeSetFlt(node, "fStop", fStop);
+    AiNodeSetFlt(node, "focalDistance", focalDistance);
+    AiNodeSetInt(node, "lensModel", variant.lensModel);
+    AiNodeSetStr(node, "lensDataPath", lensPath.c_str());
+    AiNodeSetBool(node, "kolbSamplingLUT", variant.lut);
+    AiNodeSetBool(node, "useImage", variant.bokeh);
+    AiNodeSetStr(node, "bokehPath", variant.bokeh ? bokehPath : "");
+    return node;
+}
+
+
+static benchResult runVariant(const AtNodeMethods *methods, const std::string &lensPath, const std::string &lensName,
+                              const benchVariant &variant, const benchOptions &options){
+    benchResult result;
+    result.lens = lensName;
+    result.variant = variant.name;
+
+    zoicShim().renderAborted.store(false);
+    counts = finishCounts();
+
+    AtNode *node = createNode(methods, lensPath, variant);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    AiShimNodeUpdate(node);
+    result.nodeUpdateMs = millisecondsSince(start);
+    result.aborted = zoicShim().renderAborted.load();
+
+    // buckets of pixels in scanline order, every pixel gets all of its samples in a row like arnold does
+    long long rays = 0;
+    double best = 0.0;
+    for (int repeat = 0; repeat < options.repeats && !result.aborted; repeat++){
+        start = std::chrono::steady_clock::now();
+
+        for (int py = 0; py < options.height; py++){
+            for (int px = 0; px < options.width; px++){
+                for (int s = 0; s < options.samples; s++){
+                    AtCameraInput input;
+                    cameraInput(px, py, s, options, &input);
+
+                    AtCameraOutput output;
+                    AiShimCreateRay(node, input, output, 0);
+                }
+            }
+        }
+
+        double seconds = millisecondsSince(start) * 1e-3;
+        long long passRays = static_cast<long long>(options.width) * options.height * options.samples;
+        best = std::max(best, passRays / seconds);
+        rays += passRays;
+    }
+
+    AiShimNodeDestroy(node);
+
+    result.raysPerSecond = best;
+    long long traced = counts.succes + counts.vignetted;
+    if (rays > 0){
+        result.triesPerRay = traced > 0 ? 1.0 + static_cast<double>(counts.retries) / traced : 0.0;
+        result.vignettedRate = static_cast<double>(counts.vignetted) / rays;
+        result.skippedRate = static_cast<double>(counts.skipped) / rays;
+    }
+    if (variant.lut){
+        result.lutBuildMs = lutBuildMs(lensPath);
+    }
+    return result;
+}
+
+
+// hardware counters for the whole process, threads started while they're open are counted as well
+struct perfCounters{
+    enum { cycles, instructions, cacheMisses, l1dMisses, count };
+    int fd[count];
+    bool available;
+
+    perfCounters() : available(false){
+        for (int i = 0; i < count; i++){ fd[i] = -1; }
+#ifdef __linux__
+        const uint64_t configs[count] = {
+            PERF_COUNT_HW_CPU_CYCLES,
+            PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_MISSES,
+            PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+        };
+        available = true;
+        for (int i = 0; i < count; i++){
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = i == l1dMisses ? PERF_TYPE_HW_CACHE : PERF_TYPE_HARDWARE;
+            attr.config = configs[i];
+            attr.disabled = 1;
+            attr.inherit = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fd[i] = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+            available = available && fd[i] >= 0;
+        }
+#endif
+    }
+
+    ~perfCounters(){
+#ifdef __linux__
+        for (int i = 0; i < count; i++){
+            if (fd[i] >= 0){ close(fd[i]); }
+        }
+#endif
+    }
+
+    void start(){
+#ifdef __linux__
+        for (int i = 0; available && i < count; i++){
+            ioctl(fd[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    // counts of threads that already exited are included, so read after joining them
+    bool stop(uint64_t values[count]){
+#ifdef __linux__
+        for (int i = 0; available && i < count; i++){
+            ioctl(fd[i], PERF_EVENT_IOC_DISABLE, 0);
+            if (read(fd[i], &values[i], sizeof(uint64_t)) != sizeof(uint64_t)){ return false; }
+        }
+#endif
+        return available;
+    }
+};
+
+
+// one pass over the image from the given amount of threads, buckets handed out in scanline order
+static double renderBuckets(const AtNode *node, int threads, const benchOptions &options){
+    int bucketsX = (options.width + options.bucketSize - 1) / options.bucketSize;
+    int bucketsY = (options.height + options.bucketSize - 1) / options.bucketSize;
+    std::atomic<int> nextBucket(0);
+    std::atomic<bool> go(false);
+
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++){
+        workers.push_back(std::thread([&, t](){
+            while (!go.load()){ std::this_thread::yield(); }
+
+            for (int bucket = nextBucket++; bucket < bucketsX * bucketsY; bucket = nextBucket++){
+                int x0 = (bucket % bucketsX) * options.bucketSize;
+                int y0 = (bucket / bucketsX) * options.bucketSize;
+                int x1 = std::min(x0 + options.bucketSize, options.width);
+                int y1 = std::min(y0 + options.bucketSize, options.height);
+
+                for (int py = y0; py < y1; py++){
+                    for (int px = x0; px < x1; px++){
+                        for (int s = 0; s < options.samples; s++){
+                            AtCameraInput input;
+                            cameraInput(px, py, s, options, &input);
+
+                            AtCameraOutput output;
+                            AiShimCreateRay(node, input, output, static_cast<uint16_t>(t));
+                        }
+                    }
+                }
+            }
+        }));
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    go.store(true);
+    for (size_t t = 0; t < workers.size(); t++){
+        workers[t].join();
+    }
+    return millisecondsSince(start) * 1e-3;
+}
+
+
+static std::vector<scalingResult> runScaling(const AtNodeMethods *methods, const std::string &lensPath, const std::string &lensName,
+                                             const benchVariant &variant, const benchOptions &options, perfCounters *perf){
+    std::vector<scalingResult> results;
+
+    zoicShim().renderAborted.store(false);
+    AtNode *node = createNode(methods, lensPath, variant);
+    AiShimNodeUpdate(node);
+    if (zoicShim().renderAborted.load()){
+        AiShimNodeDestroy(node);
+        return results;
+    }
+
+    // one pass up front so lazily built data is in place before anything gets timed
+    renderBuckets(node, 1, options);
+
+    std::vector<int> threadCounts;
+    for (int threads = 1; threads < options.maxThreads; threads *= 2){
+        threadCounts.push_back(threads);
+    }
+    threadCounts.push_back(options.maxThreads);
+
+    double rays = static_cast<double>(options.width) * options.height * options.samples;
+    for (size_t i = 0; i < threadCounts.size(); i++){
+        scalingResult r;
+        r.lens = lensName;
+        r.variant = variant.name;
+        r.threads = threadCounts[i];
+        r.counted = false;
+        r.cyclesPerRay = r.instructionsPerCycle = r.cacheMissesPerRay = r.l1dMissesPerRay = 0.0;
+
+        double best = 0.0;
+        for (int repeat = 0; repeat < options.repeats; repeat++){
+            uint64_t values[perfCounters::count];
+            perf->start();
+            double seconds = renderBuckets(node, r.threads, options);
+            bool counted = perf->stop(values);
+
+            // counters are taken from the fastest pass, same as the throughput
+            if (rays / seconds > best){
+                best = rays / seconds;
+                r.counted = counted;
+                if (counted){
+                    r.cyclesPerRay = values[perfCounters::cycles] / rays;
+                    r.instructionsPerCycle = values[perfCounters::cycles] ? static_cast<double>(values[perfCounters::instructions]) / values[perfCounters::cycles] : 0.0;
+                    r.cacheMissesPerRay = values[perfCounters::cacheMisses] / rays;
+                    r.l1dMissesPerRay = values[perfCounters::l1dMisses] / rays;
+                }
+            }
+        }
+
+        r.raysPerSecond = best;
+        r.efficiency = results.empty() ? 1.0 : best / (r.threads * results[0].raysPerSecond);
+        results.push_back(r);
+    }
+
+    AiShimNodeDestroy(node);
+    return results;
+}
+
+
+static std::string scalingJSON(const scalingResult &r){
+    char line[512];
+    if (r.counted){
+        std::snprintf(line, sizeof(line),
+                      "{\"lens\": \"%s\", \"variant\": \"%s\", \"threads\": %d, \"rays_per_sec\": %.1f, \"efficiency\": %.4f, "
+                      "\"cycles_per_ray\": %.1f, \"ipc\": %.3f, \"cache_misses_per_ray\": %.3f, \"l1d_misses_per_ray\": %.3f}",
+                      r.lens.c_str(), r.variant.c_str(), r.threads, r.raysPerSecond, r.efficiency,
+                      r.cyclesPerRay, r.instructionsPerCycle, r.cacheMissesPerRay, r.l1dMissesPerRay);
+    }
+    else {
+        std::snprintf(line, sizeof(line),
+                      "{\"lens\": \"%s\", \"variant\": \"%s\", \"threads\": %d, \"rays_per_sec\": %.1f, \"efficiency\": %.4f, "
+                      "\"cycles_per_ray\": null, \"ipc\": null, \"cache_misses_per_ray\": null, \"l1d_misses_per_ray\": null}",
+                      r.lens.c_str(), r.variant.c_str(), r.threads, r.raysPerSecond, r.efficiency);
+    }
+    return line;
+}
+
+
+// the convergence scene: lights on a grid on a wall well behind the focus plane, so every one of them turns into a
+// bokeh disc, over a faintly lit background
+static const float wallDistance = 800.0f;
+static const float lightSpacing = 80.0f;
+static const float lightRadius = 2.0f;
+static const float lightRadiance = 100.0f;
+static const float backgroundRadiance = 0.1f;
+
+static float sceneRadiance(const AtVector &origin, const AtVector &dir){
+    if (dir.z >= 0.0f){ return 0.0f; }
+
+    float t = (-wallDistance - origin.z) / dir.z;
+    float x = origin.x + t * dir.x;
+    float y = origin.y + t * dir.y;
+    float dx = x - lightSpacing * std::floor(x / lightSpacing + 0.5f);
+    float dy = y - lightSpacing * std::floor(y / lightSpacing + 0.5f);
+    return dx * dx + dy * dy < lightRadius * lightRadius ? lightRadiance : backgroundRadiance;
+}
+
+
+// 4d kronecker sequence for the pixel and lens position, shifted by a random offset per pixel and seed
+static float hashFloat(uint32_t x){
+    x ^= x >> 16; x *= 0x7feb352dU;
+    x ^= x >> 15; x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return (x >> 8) / 16777216.0f;
+}
+
+static void filmSample(int px, int py, int s, uint32_t seed, const benchOptions &options, AtCameraInput *input){
+    static const double alpha[4] = { 0.8566748838545029, 0.7338918566271259, 0.6287067210378086, 0.5385972572236101 };
+    uint32_t pixel = static_cast<uint32_t>(py * options.width + px) * 4u + seed * 0x9e3779b9U;
+
+    float u[4];
+    for (int d = 0; d < 4; d++){
+        double value = hashFloat(pixel + d) + s * alpha[d];
+        u[d] = static_cast<float>(value - std::floor(value));
+    }
+
+    input->sx = (px + u[0]) / options.width * 2.0f - 1.0f;
+    input->sy = ((py + u[1]) / options.height * 2.0f - 1.0f) * (static_cast<float>(options.height) / options.width);
+    input->dsx = input->dsy = 2.0f / options.width;
+    input->lensx = u[2];
+    input->lensy = u[3];
+}
+
+
+// adds samples [first, last) of every pixel to the film, rgb sums
+static void renderFilm(const AtNode *node, int first, int last, uint32_t seed, const benchOptions &options, std::vector<double> *film){
+    for (int py = 0; py < options.height; py++){
+        for (int px = 0; px < options.width; px++){
+            double *pixel = &(*film)[(py * options.width + px) * 3];
+            for (int s = first; s < last; s++){
+                AtCameraInput input;
+                filmSample(px, py, s, seed, options, &input);
+
+                AtCameraOutput output;
+                AiShimCreateRay(node, input, output, 0);
+
+                float radiance = sceneRadiance(output.origin, output.dir);
+                pixel[0] += output.weight.r * radiance;
+                pixel[1] += output.weight.g * radiance;
+                pixel[2] += output.weight.b * radiance;
+            }
+        }
+    }
+}
+
+
+static std::vector<convergenceResult> runConvergence(const AtNodeMethods *methods, const std::string &lensPath, const std::string &lensName,
+                                                     const benchVariant &variant, const benchOptions &options){
+    std::vector<convergenceResult> results;
+
+    zoicShim().renderAborted.store(false);
+    AtNode *node = createNode(methods, lensPath, variant);
+    AiShimNodeUpdate(node);
+    if (zoicShim().renderAborted.load()){
+        AiShimNodeDestroy(node);
+        return results;
+    }
+
+    size_t filmSize = static_cast<size_t>(options.width) * options.height * 3;
+    std::vector<double> reference(filmSize, 0.0);
+    renderFilm(node, 0, options.referenceSamples, 1, options, &reference);
+
+    double referenceMean = 0.0;
+    for (size_t i = 0; i < filmSize; i++){
+        reference[i] /= options.referenceSamples;
+        referenceMean += reference[i];
+    }
+    referenceMean /= filmSize;
+
+    std::vector<double> film(filmSize, 0.0);
+    double seconds = 0.0;
+    for (int samples = 1, done = 0; samples <= options.maxSamples; done = samples, samples *= 2){
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        renderFilm(node, done, samples, 0, options, &film);
+        seconds += millisecondsSince(start) * 1e-3;
+
+        double squared = 0.0;
+        for (size_t i = 0; i < filmSize; i++){
+            double difference = film[i] / samples - reference[i];
+            squared += difference * difference;
+        }
+
+        convergenceResult r;
+        r.lens = lensName;
+        r.variant = variant.name;
+        r.samples = samples;
+        r.seconds = seconds;
+        r.rmse = std::sqrt(squared / filmSize);
+        r.relativeRmse = referenceMean > 0.0 ? r.rmse / referenceMean : 0.0;
+        results.push_back(r);
+    }
+
+    AiShimNodeDestroy(node);
+    return results;
+}
+
+
+static double convergenceEfficiency(const convergenceResult &r){
+    return r.rmse > 0.0 && r.seconds > 0.0 ? 1.0 / (r.rmse * r.rmse * r.seconds) : 0.0;
+}
+
+static std::string convergenceJSON(const convergenceResult &r){
+    char line[512];
+    std::snprintf(line, sizeof(line),
+                  "{\"lens\": \"%s\", \"variant\": \"%s\", \"samples\": %d, \"seconds\": %.5f, \"rmse\": %.6g, "
+                  "\"relative_rmse\": %.6g, \"efficiency\": %.6g}",
+                  r.lens.c_str(), r.variant.c_str(), r.samples, r.seconds, r.rmse, r.relativeRmse, convergenceEfficiency(r));
+    return line;
+}
+
+
+// --parse: reading lens data files. The shipped lens files as a set and large generated catalogs with 4 and 5
+// columns, each through readTabularLensData, through parseTabularLensData on a buffer already in memory, which
+// leaves out opening and mapping the file, and through the way lens files were read before, as a reference.
+struct parseResult{
+    std::string corpus, method;
+    size_t bytes;
+    int files, elements;
+    double seconds; // per pass over the corpus
+};
+
+
+// a lens of many elements, values with the amount of digits lens files tend to have
+static std::string catalogText(int elements, int columns){
+    std::string text = "## LENS CATALOG, GENERATED BY zoic_bench\n## RADIUS OF CURVATURE // THICKNESS // IOR // V-NUMBER // APERTURE\n\n";
+    uint32_t seed = 1;
+    char line[128];
+    for (int i = 0; i < elements; i++){
+        float u[5];
+        for (int k = 0; k < 5; k++){
+            seed = seed * 1664525u + 1013904223u;
+            u[k] = (seed >> 8) / 16777216.0f;
+        }
+        float curvature = i == elements / 2 ? 0.0f : (u[0] - 0.5f) * 400.0f;
+        float ior = u[2] < 0.5f ? 0.0f : 1.45f + u[2] * 0.4f;
+        if (columns == 5){
+            std::snprintf(line, sizeof(line), "%.3f\t%.3f\t%.3f\t%.1f\t%.1f\n", curvature, u[1] * 20.0f, ior, ior > 0.0f ? 25.0f + u[3] * 40.0f : 0.0f, 10.0f + u[4] * 40.0f);
+        }
+        else {
+            std::snprintf(line, sizeof(line), "%.3f\t%.3f\t%.3f\t%.1f\n", curvature, u[1] * 20.0f, ior, 10.0f + u[4] * 40.0f);
+        }
+        text += line;
+        if (i % 50 == 49){ text += "## next group\n"; }
+    }
+    return text;
+}
+
+
+// two passes with getline, a stringstream and std::stof on every substring, like readTabularLensData used to
+static int legacyRead(const std::string &path){
+    std::ifstream lensDataFile(path.c_str());
+    std::string line;
+    std::stringstream iss;
+    int columns = 0, lines = 0;
+    while (getline(lensDataFile, line)){
+        if (line.empty() || line[0] == '#'){ continue; }
+        std::size_t prev = 0, pos;
+        iss << line;
+        while ((pos = line.find_first_of("\t,;: ", prev)) != std::string::npos){
+            if (pos > prev){ ++columns; }
+            prev = pos + 1;
+        }
+        if (prev < line.length()){ ++columns; }
+        iss.clear();
+        ++lines;
+    }
+
+    lensDataFile.clear();
+    lensDataFile.seekg(0, std::ios::beg);
+    int totalColumns = lines ? columns / lines : 0;
+
+    std::vector<LensElement> lenses;
+    while (getline(lensDataFile, line)){
+        if (line.empty() || line[0] == '#'){ continue; }
+        LensElement lens;
+        float *fields[5] = { &lens.curvature, &lens.thickness, &lens.ior, totalColumns == 5 ? &lens.abbe : &lens.aperture, &lens.aperture };
+        std::size_t prev = 0, pos;
+        int counter = 0;
+        iss << line;
+        while ((pos = line.find_first_of("\t,;: ", prev)) != std::string::npos){
+            if (pos > prev && counter < totalColumns){ *fields[counter++] = std::stof(line.substr(prev, pos - prev)); }
+            prev = pos + 1;
+        }
+        if (prev < line.length() && counter < totalColumns){ *fields[counter] = std::stof(line.substr(prev, std::string::npos)); }
+        lenses.push_back(lens);
+        iss.clear();
+    }
+    std::reverse(lenses.begin(), lenses.end());
+    return static_cast<int>(lenses.size());
+}
+
+
+static std::string fileText(const std::string &path){
+    std::ifstream file(path.c_str(), std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+
+// passes over the corpus until a quarter second is up, seconds per pass
+template <typename PASS>
+static double timePasses(PASS pass){
+    int passes = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    double ms;
+    do {
+        pass();
+        ++passes;
+    } while ((ms = millisecondsSince(start)) < 250.0 || passes < 3);
+    return ms / 1000.0 / passes;
+}
+
+
+static std::vector<parseResult> runParse(const std::vector<std::string> &lenses, const benchOptions &options){
+    struct corpus{ std::string name; std::vector<std::string> paths; bool generated; };
+    std::vector<corpus> corpora(3);
+    corpora[0].name = "lens_files";
+    corpora[0].generated = false;
+    for (size_t l = 0; l < lenses.size(); l++){
+        corpora[0].paths.push_back(options.lensDirectory + "/" + lenses[l] + ".dat");
+    }
+    for (int c = 0; c < 2; c++){
+        int columns = 4 + c;
+        corpora[1 + c].name = columns == 4 ? "catalog_4_columns" : "catalog_5_columns";
+        corpora[1 + c].generated = true;
+        corpora[1 + c].paths.push_back(std::string("zoic_bench_") + corpora[1 + c].name + ".dat");
+        std::ofstream out(corpora[1 + c].paths[0].c_str(), std::ios::binary);
+        out << catalogText(options.catalogElements, columns);
+    }
+
+    std::vector<parseResult> results;
+    for (size_t c = 0; c < corpora.size(); c++){
+        const std::vector<std::string> &paths = corpora[c].paths;
+        std::vector<std::string> texts;
+        parseResult r;
+        r.corpus = corpora[c].name;
+        r.files = static_cast<int>(paths.size());
+        r.bytes = 0;
+        r.elements = 0;
+
+        bool valid = true;
+        for (size_t p = 0; p < paths.size(); p++){
+            texts.push_back(fileText(paths[p]));
+            r.bytes += texts.back().size();
+            Lensdata ld;
+            lensDataResult parsed;
+            valid = valid && readTabularLensData(paths[p], &ld, &parsed) && legacyRead(paths[p]) == ld.lensCount;
+            r.elements += ld.lensCount;
+        }
+        if (!valid){
+            std::fprintf(stderr, "%s doesn't read the same both ways, left out\n", r.corpus.c_str());
+            continue;
+        }
+
+        r.method = "legacy";
+        r.seconds = timePasses([&](){ for (size_t p = 0; p < paths.size(); p++){ legacyRead(paths[p]); } });
+        results.push_back(r);
+
+        r.method = "file";
+        r.seconds = timePasses([&](){
+            for (size_t p = 0; p < paths.size(); p++){
+                Lensdata ld;
+                lensDataResult parsed;
+                readTabularLensData(paths[p], &ld, &parsed);
+            }
+        });
+        results.push_back(r);
+
+        r.method = "memory";
+        r.seconds = timePasses([&](){
+            for (size_t p = 0; p < texts.size(); p++){
+                Lensdata ld;
+                lensDataResult parsed;
+                parseTabularLensData(texts[p].data(), texts[p].size(), &ld, &parsed);
+            }
+        });
+        results.push_back(r);
+
+        if (corpora[c].generated){ std::remove(paths[0].c_str()); }
+    }
+    return results;
+}
+
+
+static std::string parseJSON(const parseResult &r){
+    char line[512];
+    std::snprintf(line, sizeof(line),
+                  "{\"corpus\": \"%s\", \"method\": \"%s\", \"files\": %d, \"bytes\": %zu, \"elements\": %d, "
+                  "\"mb_per_sec\": %.2f, \"files_per_sec\": %.1f, \"ns_per_element\": %.2f}",
+                  r.corpus.c_str(), r.method.c_str(), r.files, r.bytes, r.elements,
+                  r.bytes / r.seconds / 1e6, r.files / r.seconds, r.seconds * 1e9 / r.elements);
+    return line;
+}
+
+
+static std::string resultJSON(const benchResult &r){
+    char line[512];
+    std::snprintf(line, sizeof(line),
+                  "{\"lens\": \"%s\", \"variant\": \"%s\", \"rays_per_sec\": %.1f, \"tries_per_ray\": %.4f, "
+                  "\"vignetted_rate\": %.5f, \"skipped_rate\": %.5f, \"node_update_ms\": %.3f, \"lut_build_ms\": %.3f, \"aborted\": %s}",
+                  r.lens.c_str(), r.variant.c_str(), r.raysPerSecond, r.triesPerRay,
+                  r.vignettedRate, r.skippedRate, r.nodeUpdateMs, r.lutBuildMs, r.aborted ? "true" : "false");
+    return line;
+}
+
+
+// just enough JSON to read back what resultJSON writes
+static bool jsonString(const std::string &line, const char *key, std::string *value){
+    std::string pattern = std::string("\"") + key + "\": \"";
+    size_t begin = line.find(pattern);
+    if (begin == std::string::npos){ return false; }
+    begin += pattern.size();
+    size_t end = line.find('"', begin);
+    if (end == std::string::npos){ return false; }
+    *value = line.substr(begin, end - begin);
+    return true;
+}
+
+static bool jsonNumber(const std::string &line, const char *key, double *value){
+    std::string pattern = std::string("\"") + key + "\": ";
+    size_t begin = line.find(pattern);
+    if (begin == std::string::npos){ return false; }
+    *value = std::strtod(line.c_str() + begin + pattern.size(), NULL);
+    return true;
+}
+
+static std::vector<benchResult> readBaseline(const std::string &path){
+    std::vector<benchResult> results;
+    std::ifstream file(path.c_str());
+    std::string line;
+    while (std::getline(file, line)){
+        benchResult r;
+        if (!jsonString(line, "lens", &r.lens) || !jsonString(line, "variant", &r.variant)){ continue; }
+        jsonNumber(line, "rays_per_sec", &r.raysPerSecond);
+        jsonNumber(line, "tries_per_ray", &r.triesPerRay);
+        jsonNumber(line, "vignetted_rate", &r.vignettedRate);
+        jsonNumber(line, "skipped_rate", &r.skippedRate);
+        jsonNumber(line, "node_update_ms", &r.nodeUpdateMs);
+        jsonNumber(line, "lut_build_ms", &r.lutBuildMs);
+        results.push_back(r);
+    }
+    return results;
+}
+
+
+// timings below these are mostly noise, they're never flagged
+static const double minimumFlaggedMs = 2.0;
+static const double minimumFlaggedRate = 0.005;
+
+static int compareToBaseline(const std::vector<benchResult> &results, const std::vector<benchResult> &baseline, double tolerance){
+    int regressions = 0;
+    std::printf("\n%-26s %-22s %12s %12s %10s %10s %10s\n", "lens", "variant", "rays/s", "tries/ray", "vignetted", "update", "lut");
+
+    for (size_t i = 0; i < results.size(); i++){
+        const benchResult &r = results[i];
+        const benchResult *b = NULL;
+        for (size_t j = 0; j < baseline.size() && !b; j++){
+            if (baseline[j].lens == r.lens && baseline[j].variant == r.variant){ b = &baseline[j]; }
+        }
+        if (!b){
+            std::printf("%-26s %-22s  new\n", r.lens.c_str(), r.variant.c_str());
+            continue;
+        }
+
+        bool slower = r.raysPerSecond < b->raysPerSecond * (1.0 - tolerance);
+        bool moreTries = r.triesPerRay > b->triesPerRay * (1.0 + tolerance);
+        bool moreVignetting = r.vignettedRate + r.skippedRate > b->vignettedRate + b->skippedRate + minimumFlaggedRate;
+        bool slowerUpdate = r.nodeUpdateMs > b->nodeUpdateMs * (1.0 + tolerance) && r.nodeUpdateMs - b->nodeUpdateMs > minimumFlaggedMs;
+        bool slowerLUT = r.lutBuildMs > b->lutBuildMs * (1.0 + tolerance) && r.lutBuildMs - b->lutBuildMs > minimumFlaggedMs;
+        bool regressed = slower || moreTries || moreVignetting || slowerUpdate || slowerLUT;
+        regressions += regressed ? 1 : 0;
+
+        std::printf("%-26s %-22s %+11.1f%%%s %+11.1f%%%s %+9.2f%%%s %+9.1f%%%s %+9.1f%%%s %s\n",
+                    r.lens.c_str(), r.variant.c_str(),
+                    b->raysPerSecond > 0.0 ? (r.raysPerSecond / b->raysPerSecond - 1.0) * 100.0 : 0.0, slower ? "!" : " ",
+                    b->triesPerRay > 0.0 ? (r.triesPerRay / b->triesPerRay - 1.0) * 100.0 : 0.0, moreTries ? "!" : " ",
+                    (r.vignettedRate + r.skippedRate - b->vignettedRate - b->skippedRate) * 100.0, moreVignetting ? "!" : " ",
+                    b->nodeUpdateMs > 0.0 ? (r.nodeUpdateMs / b->nodeUpdateMs - 1.0) * 100.0 : 0.0, slowerUpdate ? "!" : " ",
+                    b->lutBuildMs > 0.0 ? (r.lutBuildMs / b->lutBuildMs - 1.0) * 100.0 : 0.0, slowerLUT ? "!" : " ",
+                    regressed ? "REGRESSION" : "ok");
+    }
+
+    std::printf("\n%d of %d results regressed beyond %.0f%%\n", regressions, static_cast<int>(results.size()), tolerance * 100.0);
+    return regressions;
+}
+
+
+static std::vector<std::string> lensFiles(const std::string &directory){
+    std::vector<std::string> names;
+    DIR *dir = opendir(directory.c_str());
+    if (!dir){ return names; }
+
+    while (dirent *entry = readdir(dir)){
+        std::string name = entry->d_name;
+        if (name.size() > 4 && name.compare(name.size() - 4, 4, ".dat") == 0){
+            names.push_back(name.substr(0, name.size() - 4));
+        }
+    }
+    closedir(dir);
+
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+
+static bool parseArguments(int argc, char **argv, benchOptions *options){
+    for (int i = 1; i < argc; i++){
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--lenses" && hasValue){ options->lensDirectory = argv[++i]; }
+        else if (arg == "--lens" && hasValue){ options->lensFilter = argv[++i]; }
+        else if (arg == "--variant" && hasValue){ options->variantFilter = argv[++i]; }
+        else if (arg == "--out" && hasValue){ options->outPath = argv[++i]; }
+        else if (arg == "--compare" && hasValue){ options->baselinePath = argv[++i]; }
+        else if (arg == "--tolerance" && hasValue){ options->tolerance = std::atof(argv[++i]); }
+        else if (arg == "--samples" && hasValue){ options->samples = std::max(std::atoi(argv[++i]), 1); }
+        else if (arg == "--repeats" && hasValue){ options->repeats = std::max(std::atoi(argv[++i]), 1); }
+        else if (arg == "--scaling"){ options->scaling = true; }
+        else if (arg == "--threads" && hasValue){ options->maxThreads = std::atoi(argv[++i]); }
+        else if (arg == "--bucket" && hasValue){ options->bucketSize = std::max(std::atoi(argv[++i]), 1); }
+        else if (arg == "--convergence"){ options->convergence = true; }
+        else if (arg == "--max-samples" && hasValue){ options->maxSamples = std::max(std::atoi(argv[++i]), 1); }
+        else if (arg == "--reference-samples" && hasValue){ options->referenceSamples = std::max(std::atoi(argv[++i]), 1); }
+        else if (arg == "--parse"){ options->parse = true; }
+        else if (arg == "--catalog-elements" && hasValue){ options->catalogElements = std::max(std::atoi(argv[++i]), 1); }
+        else if (arg == "--resolution" && hasValue){
+            if (std::sscanf(argv[++i], "%dx%d", &options->width, &options->height) != 2 || options->width < 1 || options->height < 1){ return false; }
+        }
+        else { return false; }
+    }
+
+    options->maxThreads = std::min(std::max(options->maxThreads, 1), static_cast<int>(AI_MAX_THREADS));
+    // only the plain results can be compared against a baseline
+    int modes = (options->scaling ? 1 : 0) + (options->convergence ? 1 : 0) + (options->parse ? 1 : 0);
+    return modes <= 1 && !(modes && !options->baselinePath.empty());
+}
+
+
+int main(int argc, char **argv){
+    benchOptions options;
+    if (!parseArguments(argc, argv, &options)){
+        std::fprintf(stderr, "usage: zoic_bench [--lenses DIR] [--lens NAME] [--variant NAME] [--resolution WxH] [--samples N] [--repeats N]\n"
+                             "                  [--out FILE] [--compare BASELINE.json] [--tolerance FRACTION]\n"
+                             "                  [--scaling [--threads N] [--bucket SIZE]]\n"
+                             "                  [--convergence [--max-samples N] [--reference-samples N]]\n"
+                             "                  [--parse [--catalog-elements N]]\n");
+        return 2;
+    }
+
+    zoicHost host = zoicHost();
+    host.message = benchMessage;
+    host.textureInfo = hexagonInfo;
+    host.textureLoad = hexagonLoad;
+    zoicSetHost(host);
+
+    AtNodeLib lib;
+    NodeLoader(0, &lib);
+
+    std::vector<std::string> lenses = lensFiles(options.lensDirectory);
+    if (lenses.empty()){
+        std::fprintf(stderr, "no lens files in %s\n", options.lensDirectory.c_str());
+        return 2;
+    }
+
+    // opened before any worker thread exists, so all of them inherit the counters
+    perfCounters perf;
+    if (options.scaling && !perf.available){
+        std::fprintf(stderr, "hardware counters not available, scaling results come without them\n");
+    }
+
+    std::vector<benchResult> results;
+    std::vector<scalingResult> scaling;
+    std::vector<convergenceResult> convergence;
+    std::vector<parseResult> parsing;
+    if (options.parse){
+        parsing = runParse(lenses, options);
+        double legacySeconds = 0.0;
+        for (size_t i = 0; i < parsing.size(); i++){
+            const parseResult &r = parsing[i];
+            if (r.method == "legacy"){ legacySeconds = r.seconds; }
+            std::fprintf(stderr, "%-20s %-8s %10.1f MB/s %12.0f files/s %9.2f ns/element %7.2fx\n",
+                         r.corpus.c_str(), r.method.c_str(), r.bytes / r.seconds / 1e6, r.files / r.seconds,
+                         r.seconds * 1e9 / r.elements, legacySeconds / r.seconds);
+        }
+    }
+
+    for (size_t v = 0; !options.parse && v < sizeof(variants) / sizeof(variants[0]); v++){
+        if (!options.variantFilter.empty() && options.variantFilter != variants[v].name){ continue; }
+
+        // the thin lens doesn't look at the lens data, once is enough
+        size_t lensRuns = variants[v].lensModel == 0 ? 1 : lenses.size();
+
+        for (size_t l = 0; l < lensRuns; l++){
+            std::string name = variants[v].lensModel == 0 ? "thinlens" : lenses[l];
+            std::string path = options.lensDirectory + "/" + lenses[l] + ".dat";
+            if (variants[v].lensModel != 0 && !options.lensFilter.empty() && options.lensFilter != name){ continue; }
+
+            if (options.scaling){
+                std::vector<scalingResult> rs = runScaling(lib.methods, path, name, variants[v], options, &perf);
+                for (size_t i = 0; i < rs.size(); i++){
+                    std::fprintf(stderr, "%-26s %-22s %4d threads %12.0f rays/s %7.1f%% efficiency",
+                                 rs[i].lens.c_str(), rs[i].variant.c_str(), rs[i].threads, rs[i].raysPerSecond, rs[i].efficiency * 100.0);
+                    if (rs[i].counted){
+                        std::fprintf(stderr, " %8.3f cache misses/ray %8.3f L1D misses/ray", rs[i].cacheMissesPerRay, rs[i].l1dMissesPerRay);
+                    }
+                    std::fprintf(stderr, "\n");
+                }
+                scaling.insert(scaling.end(), rs.begin(), rs.end());
+                continue;
+            }
+
+            if (options.convergence){
+                std::vector<convergenceResult> rs = runConvergence(lib.methods, path, name, variants[v], options);
+                for (size_t i = 0; i < rs.size(); i++){
+                    std::fprintf(stderr, "%-26s %-22s %5d spp %9.4f s %12.5f rmse %9.4f relative %12.4g efficiency\n",
+                                 rs[i].lens.c_str(), rs[i].variant.c_str(), rs[i].samples, rs[i].seconds,
+                                 rs[i].rmse, rs[i].relativeRmse, convergenceEfficiency(rs[i]));
+                }
+                convergence.insert(convergence.end(), rs.begin(), rs.end());
+                continue;
+            }
+
+            benchResult r = runVariant(lib.methods, path, name, variants[v], options);
+            std::fprintf(stderr, "%-26s %-22s %12.0f rays/s %8.3f tries/ray %7.2f%% vignetted %9.2f ms update\n",
+                         r.lens.c_str(), r.variant.c_str(), r.raysPerSecond, r.triesPerRay,
+                         (r.vignettedRate + r.skippedRate) * 100.0, r.nodeUpdateMs);
+            results.push_back(r);
+        }
+    }
+
+    std::string json = "{\"benchmark\": \"zoic_bench\", \"format\": 1, ";
+    char settings[256];
+    std::snprintf(settings, sizeof(settings), "\"resolution\": [%d, %d], \"samples\": %d, \"repeats\": %d,\n",
+                  options.width, options.height, options.samples, options.repeats);
+    json += settings;
+    if (options.scaling){
+        std::snprintf(settings, sizeof(settings), "\"bucket_size\": %d, \"hardware_threads\": %u, \"hardware_counters\": %s,\n\"scaling\": [\n",
+                      options.bucketSize, std::thread::hardware_concurrency(), perf.available ? "true" : "false");
+        json += settings;
+        for (size_t i = 0; i < scaling.size(); i++){
+            json += scalingJSON(scaling[i]) + (i + 1 < scaling.size() ? ",\n" : "\n");
+        }
+    }
+    else if (options.convergence){
+        std::snprintf(settings, sizeof(settings), "\"reference_samples\": %d,\n\"convergence\": [\n", options.referenceSamples);
+        json += settings;
+        for (size_t i = 0; i < convergence.size(); i++){
+            json += convergenceJSON(convergence[i]) + (i + 1 < convergence.size() ? ",\n" : "\n");
+        }
+    }
+    else if (options.parse){
+        std::snprintf(settings, sizeof(settings), "\"catalog_elements\": %d,\n\"parse\": [\n", options.catalogElements);
+        json += settings;
+        for (size_t i = 0; i < parsing.size(); i++){
+            json += parseJSON(parsing[i]) + (i + 1 < parsing.size() ? ",\n" : "\n");
+        }
+    }
+    else {
+        json += "\"results\": [\n";
+        for (size_t i = 0; i < results.size(); i++){
+            json += resultJSON(results[i]) + (i + 1 < results.size() ? ",\n" : "\n");
+        }
+    }
+    json += "]}\n";
+
+    if (options.outPath.empty()){
+        std::fputs(json.c_str(), stdout);
+    }
+    else {
+        std::ofstream out(options.outPath.c_str());
+        out << json;
+    }
+
+    if (!options.baselinePath.empty()){
+        std::vector<benchResult> baseline = readBaseline(options.baselinePath);
+        if (baseline.empty()){
+            std::fprintf(stderr, "no results in baseline %s\n", options.baselinePath.c_str());
+            return 2;
+        }
+        return compareToBaseline(results, baseline, options.tolerance) > 0 ? 1 : 0;
+    }
+    return 0;
+}
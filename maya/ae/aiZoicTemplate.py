@@ -77,7 +77,23 @@ class aiZoicTemplate(templates.AttributeTemplate):
 
         self.beginLayout("Raytraced model", collapse=False)
         self.addCustom("aiLensDataPath", self.filenameNewLensData, self.filenameReplaceLensData)
+        self.addControl("aiBuiltinLens", label="Built-in Lens")
+        self.addControl("aiZoom", label="Zoom")
         self.addControl("aiKolbSamplingLUT", label="Precalculate LUT")
+        self.addControl("aiProgressiveLUT", label="Progressive LUT")
+        self.addControl("aiWideAngleLUT", label="Wide Angle LUT")
+        self.addControl("aiFocusCache", label="Focus Cache")
+        self.addControl("aiFocusCacheNear", label="Focus Cache Near (cm)")
+        self.addControl("aiFocusCacheFar", label="Focus Cache Far (cm)")
+        self.addControl("aiFocusCacheSamples", label="Focus Cache Samples")
+        self.addControl("aiDispersion", label="Dispersion")
+        self.addControl("aiPreviewMode", label="Preview Mode")
+        self.addControl("aiLutAccuracyReport", label="LUT Accuracy Report")
+        self.addControl("aiTelemetryPath", label="Telemetry Path")
+        self.addControl("aiHeatmapPath", label="Heatmap Path")
+        self.addControl("aiHeatmapResolution", label="Heatmap Resolution")
+        self.addControl("aiRayRecordPath", label="Ray Record Path")
+        self.addControl("aiRayRecordInterval", label="Ray Record Interval")
         self.endLayout()
 
         self.addSeparator()
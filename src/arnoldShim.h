@@ -0,0 +1,451 @@
+// ZOIC - header only stand-in for the parts of the arnold api zoic uses
+// Lets the lens model core, and the camera node itself, build and run on machines without an arnold license.
+// Vectors and colors are plain structs with the arnold spellings, messages, allocations, render aborts and texture
+// reads go through a zoicHost that a benchmark or test can replace. Nodes are just parameter maps: create one with
+// AiShimNodeCreate from the methods NodeLoader hands out, set parameters with the AiNodeSet* calls and drive it with
+// AiShimNodeUpdate and AiShimCreateRay.
+// Only used with ZOIC_NO_ARNOLD defined, the plugin always builds against the real ai.h.
+
+// (C) Zeno Pelgrims, www.zenopelgrims.com/zoic
+
+#ifndef ZOIC_ARNOLDSHIM_H
+#define ZOIC_ARNOLDSHIM_H
+
+#include <atomic>
+#include <cmath>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#define AI_VERSION "5.0.2.0-shim"
+#define AI_PI 3.14159265358979323846f
+#define AI_PIOVER2 1.57079632679489661923f
+#define AI_MAX_THREADS 256
+
+#define AI_NODE_CAMERA 0x0002
+
+#define AI_TYPE_INT 0x01
+#define AI_TYPE_BOOLEAN 0x03
+#define AI_TYPE_FLOAT 0x04
+#define AI_TYPE_STRING 0x0A
+#define AI_TYPE_ARRAY 0x0F
+#define AI_TYPE_ENUM 0x11
+#define AI_TYPE_NONE 0xFF
+
+#define AI_SEVERITY_INFO 0x00
+#define AI_SEVERITY_WARNING 0x01
+#define AI_SEVERITY_ERROR 0x02
+
+
+struct AtVector{
+    float x, y, z;
+
+    AtVector() : x(0.0f), y(0.0f), z(0.0f){}
+    AtVector(float _x, float _y, float _z) : x(_x), y(_y), z(_z){}
+
+    AtVector operator+(const AtVector &rhs) const { return AtVector(x + rhs.x, y + rhs.y, z + rhs.z); }
+    AtVector operator-(const AtVector &rhs) const { return AtVector(x - rhs.x, y - rhs.y, z - rhs.z); }
+    AtVector operator-() const { return AtVector(-x, -y, -z); }
+    AtVector operator*(float s) const { return AtVector(x * s, y * s, z * s); }
+    AtVector operator/(float s) const { return AtVector(x / s, y / s, z / s); }
+    AtVector& operator+=(const AtVector &rhs){ x += rhs.x; y += rhs.y; z += rhs.z; return *this; }
+    AtVector& operator-=(const AtVector &rhs){ x -= rhs.x; y -= rhs.y; z -= rhs.z; return *this; }
+    AtVector& operator*=(float s){ x *= s; y *= s; z *= s; return *this; }
+    AtVector& operator/=(float s){ x /= s; y /= s; z /= s; return *this; }
+    bool operator==(const AtVector &rhs) const { return x == rhs.x && y == rhs.y && z == rhs.z; }
+    bool operator!=(const AtVector &rhs) const { return !(*this == rhs); }
+};
+
+inline AtVector operator*(float s, const AtVector &v){ return v * s; }
+
+
+struct AtVector2{
+    float x, y;
+
+    AtVector2() : x(0.0f), y(0.0f){}
+    AtVector2(float _x, float _y) : x(_x), y(_y){}
+
+    AtVector2 operator+(const AtVector2 &rhs) const { return AtVector2(x + rhs.x, y + rhs.y); }
+    AtVector2 operator-(const AtVector2 &rhs) const { return AtVector2(x - rhs.x, y - rhs.y); }
+    AtVector2 operator*(float s) const { return AtVector2(x * s, y * s); }
+    AtVector2 operator/(float s) const { return AtVector2(x / s, y / s); }
+    AtVector2& operator+=(const AtVector2 &rhs){ x += rhs.x; y += rhs.y; return *this; }
+    AtVector2& operator+=(float s){ x += s; y += s; return *this; }
+    AtVector2& operator*=(float s){ x *= s; y *= s; return *this; }
+};
+
+
+struct AtRGB{
+    float r, g, b;
+
+    AtRGB() : r(0.0f), g(0.0f), b(0.0f){}
+    AtRGB(float _r, float _g, float _b) : r(_r), g(_g), b(_b){}
+
+    AtRGB& operator=(float f){ r = g = b = f; return *this; }
+    AtRGB operator*(float s) const { return AtRGB(r * s, g * s, b * s); }
+    AtRGB operator*(const AtRGB &rhs) const { return AtRGB(r * rhs.r, g * rhs.g, b * rhs.b); }
+    AtRGB operator+(const AtRGB &rhs) const { return AtRGB(r + rhs.r, g + rhs.g, b + rhs.b); }
+    AtRGB& operator*=(float s){ r *= s; g *= s; b *= s; return *this; }
+    AtRGB& operator*=(const AtRGB &rhs){ r *= rhs.r; g *= rhs.g; b *= rhs.b; return *this; }
+    AtRGB& operator+=(const AtRGB &rhs){ r += rhs.r; g += rhs.g; b += rhs.b; return *this; }
+};
+
+static const AtRGB AI_RGB_BLACK(0.0f, 0.0f, 0.0f);
+static const AtRGB AI_RGB_WHITE(1.0f, 1.0f, 1.0f);
+static const AtVector2 AI_P2_ZERO(0.0f, 0.0f);
+
+
+inline float AiV3Dot(const AtVector &a, const AtVector &b){ return a.x * b.x + a.y * b.y + a.z * b.z; }
+inline float AiV3Length(const AtVector &a){ return std::sqrt(AiV3Dot(a, a)); }
+inline AtVector AiV3Cross(const AtVector &a, const AtVector &b){ return AtVector(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x); }
+
+inline AtVector AiV3Normalize(const AtVector &a){
+    float length = AiV3Length(a);
+    return length > 0.0f ? a / length : a;
+}
+
+
+// arnold interns its strings, the shim just keeps a copy
+class AtString{
+public:
+    AtString(){}
+    explicit AtString(const char *s) : str(s ? s : ""){}
+
+    const char* c_str() const { return str.c_str(); }
+    operator const char*() const { return str.c_str(); }
+    bool empty() const { return str.empty(); }
+    bool operator==(const AtString &rhs) const { return str == rhs.str; }
+    bool operator!=(const AtString &rhs) const { return str != rhs.str; }
+
+private:
+    std::string str;
+};
+
+
+// everything that leaves the shim, replace it with zoicSetHost before creating any nodes
+struct zoicHost{
+    void (*message)(int severity, const char *text);
+    void* (*allocate)(size_t bytes);
+    void (*deallocate)(void *memory);
+    void (*abortRender)();
+
+    // texture reads for the bokeh image, by default there are no textures
+    bool (*textureInfo)(const char *path, unsigned int *width, unsigned int *height, unsigned int *channels);
+    bool (*textureLoad)(const char *path, float *pixels);
+};
+
+// state shared by everything built against the shim, inline functions keep a single copy of their statics
+struct zoicShimState{
+    zoicHost host;
+    std::atomic<int64_t> memUsage;
+    std::atomic<bool> renderAborted;
+    std::atomic<int> severityLevel; // messages below this severity are dropped
+    std::atomic<bool> debugMessages; // AiMsgDebug goes out as info when set, like a render at debug verbosity
+
+    zoicShimState();
+};
+
+inline void zoicShimDefaultMessage(int severity, const char *text){
+    static const char *prefixes[] = { "", "WARNING | ", "ERROR   | " };
+    std::fprintf(severity == AI_SEVERITY_INFO ? stdout : stderr, "%s%s\n", prefixes[severity < 3 ? severity : 2], text);
+}
+
+inline void* zoicShimDefaultAllocate(size_t bytes){ return std::malloc(bytes); }
+inline void zoicShimDefaultDeallocate(void *memory){ std::free(memory); }
+inline void zoicShimDefaultAbort(){}
+inline bool zoicShimNoTextureInfo(const char*, unsigned int*, unsigned int*, unsigned int*){ return false; }
+inline bool zoicShimNoTextureLoad(const char*, float*){ return false; }
+
+inline zoicShimState::zoicShimState()
+    : memUsage(0), renderAborted(false), severityLevel(AI_SEVERITY_INFO), debugMessages(false){
+    host.message = zoicShimDefaultMessage;
+    host.allocate = zoicShimDefaultAllocate;
+    host.deallocate = zoicShimDefaultDeallocate;
+    host.abortRender = zoicShimDefaultAbort;
+    host.textureInfo = zoicShimNoTextureInfo;
+    host.textureLoad = zoicShimNoTextureLoad;
+}
+
+inline zoicShimState& zoicShim(){
+    static zoicShimState state;
+    return state;
+}
+
+// swap in a new host, callbacks left NULL keep their default
+inline void zoicSetHost(const zoicHost &host){
+    zoicHost &current = zoicShim().host;
+    zoicShimState defaults;
+    current.message = host.message ? host.message : defaults.host.message;
+    current.allocate = host.allocate ? host.allocate : defaults.host.allocate;
+    current.deallocate = host.deallocate ? host.deallocate : defaults.host.deallocate;
+    current.abortRender = host.abortRender ? host.abortRender : defaults.host.abortRender;
+    current.textureInfo = host.textureInfo ? host.textureInfo : defaults.host.textureInfo;
+    current.textureLoad = host.textureLoad ? host.textureLoad : defaults.host.textureLoad;
+}
+
+// drop messages below the given severity, AI_SEVERITY_WARNING silences the info banners
+inline void zoicSetMessageSeverity(int severity){
+    zoicShim().severityLevel.store(severity);
+}
+
+// pass AiMsgDebug messages on, for the lens tables and the nested setup phases
+inline void zoicSetDebugMessages(bool debug){
+    zoicShim().debugMessages.store(debug);
+}
+
+
+inline void zoicShimMessage(int severity, const char *format, va_list args){
+    if (severity < zoicShim().severityLevel.load()){ return; }
+
+    char text[1024];
+    std::vsnprintf(text, sizeof(text), format, args);
+    zoicShim().host.message(severity, text);
+}
+
+inline void AiMsgInfo(const char *format, ...){
+    va_list args;
+    va_start(args, format);
+    zoicShimMessage(AI_SEVERITY_INFO, format, args);
+    va_end(args);
+}
+
+inline void AiMsgWarning(const char *format, ...){
+    va_list args;
+    va_start(args, format);
+    zoicShimMessage(AI_SEVERITY_WARNING, format, args);
+    va_end(args);
+}
+
+inline void AiMsgError(const char *format, ...){
+    va_list args;
+    va_start(args, format);
+    zoicShimMessage(AI_SEVERITY_ERROR, format, args);
+    va_end(args);
+}
+
+inline void AiMsgDebug(const char *format, ...){
+    if (!zoicShim().debugMessages.load()){ return; }
+
+    va_list args;
+    va_start(args, format);
+    zoicShimMessage(AI_SEVERITY_INFO, format, args);
+    va_end(args);
+}
+
+
+inline void AiRenderAbort(){
+    zoicShim().renderAborted.store(true);
+    zoicShim().host.abortRender();
+}
+
+inline void* AiMalloc(size_t bytes){ return zoicShim().host.allocate(bytes); }
+inline void AiFree(void *memory){ zoicShim().host.deallocate(memory); }
+inline void AiAddMemUsage(int64_t bytes, const AtString&){ zoicShim().memUsage.fetch_add(bytes); }
+
+inline bool AiTextureGetResolution(const AtString path, unsigned int *width, unsigned int *height){
+    unsigned int channels;
+    return zoicShim().host.textureInfo(path.c_str(), width, height, &channels);
+}
+
+inline bool AiTextureGetNumChannels(const AtString path, unsigned int *channels){
+    unsigned int width, height;
+    return zoicShim().host.textureInfo(path.c_str(), &width, &height, channels);
+}
+
+inline bool AiTextureLoad(const AtString path, bool, unsigned int, void *pixelData){
+    return zoicShim().host.textureLoad(path.c_str(), static_cast<float*>(pixelData));
+}
+
+
+// arrays only ever hold floats in zoic
+struct AtArray{
+    std::vector<float> data;
+    uint8_t nkeys;
+    uint8_t type;
+};
+
+inline AtArray* AiArrayAllocate(uint32_t nelements, uint8_t nkeys, uint8_t type){
+    AtArray *array = new AtArray();
+    array->data.resize(nelements * nkeys);
+    array->nkeys = nkeys;
+    array->type = type;
+    return array;
+}
+
+inline void AiArrayDestroy(AtArray *array){ delete array; }
+inline uint32_t AiArrayGetNumElements(const AtArray *array){ return array->nkeys ? static_cast<uint32_t>(array->data.size()) / array->nkeys : 0; }
+inline uint8_t AiArrayGetNumKeys(const AtArray *array){ return array->nkeys; }
+inline float AiArrayGetFlt(const AtArray *array, uint32_t i){ return array->data[i]; }
+inline bool AiArraySetFlt(AtArray *array, uint32_t i, float value){ array->data[i] = value; return true; }
+
+
+struct AtParamValue{
+    int type;
+    float f;
+    int i;
+    bool b;
+    std::string s;
+    AtArray array;
+
+    AtParamValue() : type(AI_TYPE_NONE), f(0.0f), i(0), b(false){}
+};
+
+struct AtList;
+
+// parameter declarations with their defaults, filled in by node_parameters
+struct AtNodeEntry{
+    std::map<std::string, AtParamValue> parameters;
+};
+
+struct AtCameraInput{
+    float sx, sy;        // screen space, -1 to 1 over the width
+    float dsx, dsy;      // screen space size of a pixel
+    float lensx, lensy;  // lens sample in [0, 1)
+    float relative_time; // position in the shutter interval, 0 - 1
+
+    AtCameraInput() : sx(0.0f), sy(0.0f), dsx(0.0f), dsy(0.0f), lensx(0.5f), lensy(0.5f), relative_time(0.0f){}
+};
+
+struct AtCameraOutput{
+    AtVector origin, dir;
+    AtVector dOdx, dOdy, dDdx, dDdy;
+    AtRGB weight;
+
+    AtCameraOutput() : weight(1.0f, 1.0f, 1.0f){}
+};
+
+struct AtNode;
+
+struct AtNodeMethods{
+    void (*Parameters)(AtList *params, AtNodeEntry *nentry);
+    void (*Initialize)(AtNode *node);
+    void (*Update)(AtNode *node);
+    void (*Finish)(AtNode *node);
+    void (*CameraCreateRay)(const AtNode *node, const AtCameraInput &input, AtCameraOutput &output, uint16_t tid);
+    bool (*CameraReverseRay)(const AtNode *node, const AtVector &po, float dz, AtVector2 &Ps);
+};
+
+struct AtNode{
+    const AtNodeMethods *methods;
+    std::string name;
+    AtNodeEntry entry;
+    void *localData;
+};
+
+struct AtNodeLib{
+    int node_type;
+    uint8_t output_type;
+    const char *name;
+    const AtNodeMethods *methods;
+    char version[32];
+};
+
+
+inline AtParamValue& AiShimParameter(AtNodeEntry *nentry, const char *name, int type){
+    AtParamValue &value = nentry->parameters[name];
+    value.type = type;
+    return value;
+}
+
+#define AiParameterFlt(n, v) (AiShimParameter(nentry, n, AI_TYPE_FLOAT).f = static_cast<float>(v))
+#define AiParameterInt(n, v) (AiShimParameter(nentry, n, AI_TYPE_INT).i = (v))
+#define AiParameterBool(n, v) (AiShimParameter(nentry, n, AI_TYPE_BOOLEAN).b = (v))
+#define AiParameterStr(n, v) (AiShimParameter(nentry, n, AI_TYPE_STRING).s = (v))
+#define AiParameterEnum(n, v, e) ((void)(e), AiShimParameter(nentry, n, AI_TYPE_ENUM).i = (v))
+#define AiParameterArray(n, v) do { AtArray *shimArray = (v); AiShimParameter(nentry, n, AI_TYPE_ARRAY).array = *shimArray; AiArrayDestroy(shimArray); } while (0)
+
+// unknown parameter names are a bug in the caller, not something to recover from
+inline const AtParamValue& AiShimGet(const AtNode *node, const char *name){
+    std::map<std::string, AtParamValue>::const_iterator it = node->entry.parameters.find(name);
+    if (it == node->entry.parameters.end()){
+        std::fprintf(stderr, "[arnoldShim] unknown parameter %s\n", name);
+        std::abort();
+    }
+    return it->second;
+}
+
+inline AtParamValue& AiShimSet(AtNode *node, const char *name){
+    return const_cast<AtParamValue&>(AiShimGet(node, name));
+}
+
+inline float AiNodeGetFlt(const AtNode *node, const char *name){ return AiShimGet(node, name).f; }
+inline int AiNodeGetInt(const AtNode *node, const char *name){ return AiShimGet(node, name).i; }
+inline bool AiNodeGetBool(const AtNode *node, const char *name){ return AiShimGet(node, name).b; }
+inline AtString AiNodeGetStr(const AtNode *node, const char *name){ return AtString(AiShimGet(node, name).s.c_str()); }
+inline AtArray* AiNodeGetArray(const AtNode *node, const char *name){ return const_cast<AtArray*>(&AiShimGet(node, name).array); }
+
+inline void AiNodeSetFlt(AtNode *node, const char *name, float value){ AiShimSet(node, name).f = value; }
+inline void AiNodeSetInt(AtNode *node, const char *name, int value){ AiShimSet(node, name).i = value; }
+inline void AiNodeSetBool(AtNode *node, const char *name, bool value){ AiShimSet(node, name).b = value; }
+inline void AiNodeSetStr(AtNode *node, const char *name, const char *value){ AiShimSet(node, name).s = value; }
+
+// takes ownership of the array, like arnold does
+inline void AiNodeSetArray(AtNode *node, const char *name, AtArray *array){
+    AiShimSet(node, name).array = *array;
+    AiArrayDestroy(array);
+}
+
+inline const char* AiNodeGetName(const AtNode *node){ return node->name.c_str(); }
+inline void AiNodeSetLocalData(AtNode *node, void *data){ node->localData = data; }
+inline void* AiNodeGetLocalData(const AtNode *node){ return node->localData; }
+
+inline void AiCameraInitialize(AtNode*){}
+inline void AiCameraUpdate(AtNode*, bool){}
+inline void AiCameraDestroy(AtNode*){}
+
+
+// node life cycle, what the arnold universe does around a render
+inline AtNode* AiShimNodeCreate(const AtNodeMethods *methods, const char *name){
+    AtNode *node = new AtNode();
+    node->methods = methods;
+    node->name = name;
+    node->localData = NULL;
+    methods->Parameters(NULL, &node->entry);
+    methods->Initialize(node);
+    return node;
+}
+
+inline void AiShimNodeUpdate(AtNode *node){ node->methods->Update(node); }
+
+inline void AiShimCreateRay(const AtNode *node, const AtCameraInput &input, AtCameraOutput &output, uint16_t tid){
+    node->methods->CameraCreateRay(node, input, output, tid);
+}
+
+inline bool AiShimReverseRay(const AtNode *node, const AtVector &po, float dz, AtVector2 &Ps){
+    return node->methods->CameraReverseRay(node, po, dz, Ps);
+}
+
+inline void AiShimNodeDestroy(AtNode *node){
+    node->methods->Finish(node);
+    delete node;
+}
+
+
+// the node method signatures, same names as the arnold macros
+#define AI_CAMERA_NODE_EXPORT_METHODS(tag)                                                                         \
+    static void Parameters(AtList *params, AtNodeEntry *nentry);                                                   \
+    static void Initialize(AtNode *node);                                                                          \
+    static void Update(AtNode *node);                                                                              \
+    static void Finish(AtNode *node);                                                                              \
+    static void CameraCreateRay(const AtNode *node, const AtCameraInput &input, AtCameraOutput &output, uint16_t tid); \
+    static bool CameraReverseRay(const AtNode *node, const AtVector &po, float dz, AtVector2 &Ps);                  \
+    static const AtNodeMethods tag##Table = { Parameters, Initialize, Update, Finish, CameraCreateRay, CameraReverseRay }; \
+    static const AtNodeMethods *tag = &tag##Table;
+
+#define node_parameters static void Parameters(AtList *params, AtNodeEntry *nentry)
+#define node_initialize static void Initialize(AtNode *node)
+#define node_update static void Update(AtNode *node)
+#define node_finish static void Finish(AtNode *node)
+#define camera_create_ray static void CameraCreateRay(const AtNode *node, const AtCameraInput &input, AtCameraOutput &output, uint16_t tid)
+#define camera_reverse_ray static bool CameraReverseRay(const AtNode *node, const AtVector &po, float dz, AtVector2 &Ps)
+#define node_loader bool NodeLoader(int i, AtNodeLib *node)
+
+// declared here so programs linking the node built against the shim can load it
+bool NodeLoader(int i, AtNodeLib *node);
+
+#endif
@@ -1,232 +1,152 @@
-from PIL import Image, ImageDraw, ImageFont
+# Draws the camera rays recorded by the zoic node (the rayRecordPath parameter) through the lens, seen from the side
+# usage: python src/draw.py rays.zoicrays lensDrawing.png
+#
+# Every lens set up during the render is drawn with the rays that went through it, one image per lens,
+# lensDrawing.png becomes lensDrawing_<lens id>.png when there's more than one. The lens sits on the y = 0 plane,
+# rays from off that plane are projected onto it.
+
+from __future__ import print_function
+
 import math
-import re
- 
-print "####### INITIALIZING PYTHON IMAGE DRAWING #######"
-# GLOBAL VARS
+import os
+import struct
+import sys
+
+from PIL import Image, ImageDraw
+
+
 SIZE = (4500, 750)
 AAS = 4
 LINEWIDTH = 10
-TRANSLATEX = 2800 * AAS
-TRANSLATEY = (SIZE[1] * AAS) / 2
-PADDING = 10 * AAS
-SCALE = 85
-# font = ImageFont.truetype('C:\Windows\Fonts\Consola.ttf', 16 * AAS)
-font = ImageFont.truetype('/Users/zpelgrims/Library/Fonts/Inconsolata.otf', 16 * AAS)
+PADDING = 200
 WHITE = (255, 255, 255)
 RED = (int(0.9 * 255), int(0.4 * 255), int(0.5 * 255))
 BLUE = (36, 71, 91)
-GREEN = (int(0.5 * 255), int(0.7 * 255), int(0.25 * 255))
 ORANGE = (int(0.8 * 255), int(0.4 * 255), int(0.15 * 255))
 GREY = (150, 150, 150)
 DARKGREY = (120, 120, 120)
- 
- 
-# DATA VARS
-print "PYTHON: Reading data file"
-dataFile = open('/Volumes/ZENO_2016/projects/zoic/src/draw.zoic', 'r')
-# dataFile = open('C:\ilionData\Users\zeno.pelgrims\Documents\zoic_compile/draw.zoic', 'r')
- 
-LENSMODEL = dataFile.readline()
-LENSMODELSTRING = LENSMODEL[10:-2]
-print "PYTHON: Lens model: ", LENSMODELSTRING
- 
- 
-if LENSMODELSTRING == "KOLB":
- 
-                LENSES = dataFile.readline()
-                LENSESSTRING = re.sub('[LENSES{}]', '', LENSES)
-                LENSESSTRING = LENSESSTRING.rstrip()
-                LENSESLIST = [float(n) for n in LENSESSTRING.split()]
- 
-                IORSTRING = dataFile.readline()
-                IORSTRING = re.sub('[IOR{}]', '', IORSTRING)
-                IORLIST = [float(n) for n in IORSTRING.split()]
- 
-                APERTUREELEMENTSTRING = dataFile.readline()
-                APERTUREELEMENTSTRING = re.sub('[APERTUREELEMENT{}]', '', APERTUREELEMENTSTRING)
-                APERTUREELEMENTLIST = [int(n) for n in APERTUREELEMENTSTRING.split()]
- 
-                APERTUREDISTANCESTRING = dataFile.readline()
-                APERTUREDISTANCESTRING = re.sub('[APERTUREDISTANCE{}]', '', APERTUREDISTANCESTRING)
-                APERTUREDISTANCELIST = [float(n) for n in APERTUREDISTANCESTRING.split()]
- 
-                APERTURESTRING = dataFile.readline()
-                APERTURESTRING = re.sub('[APERTURE{}]', '', APERTURESTRING)
-                APERTURELIST = [float(n) for n in APERTURESTRING.split()]
- 
-                APERTUREMAXSTRING = dataFile.readline()
-                APERTUREMAXSTRING = re.sub('[APERTUREMAX{}]', '', APERTUREMAXSTRING)
-                APERTUREMAXLIST = [float(n) for n in APERTUREMAXSTRING.split()]
-                FOCUSDISTANCESTRING = dataFile.readline()
-                FOCUSDISTANCESTRING = re.sub('[FOCUSDISTANCE{}]', '', FOCUSDISTANCESTRING)
-                FOCUSDISTANCELIST = [float(n) for n in FOCUSDISTANCESTRING.split()]
-                IMAGEDISTANCESTRING = dataFile.readline()
-                IMAGEDISTANCESTRING = re.sub('[IMAGEDISTANCE{}]', '', IMAGEDISTANCESTRING)
-                IMAGEDISTANCELIST = [float(n) for n in IMAGEDISTANCESTRING.split()]
- 
-                SENSORHEIGHTSTRING = dataFile.readline()
-                SENSORHEIGHTSTRING = re.sub('[SENSORHEIGHT{}]', '', SENSORHEIGHTSTRING)
-                SENSORHEIGHTLIST = [float(n) for n in SENSORHEIGHTSTRING.split()]
- 
-RAYSSTRING = dataFile.readline()
-RAYSSTRING = re.sub('[RAYS{}]', '', RAYSSTRING)
-RAYSLIST = [float(n) for n in RAYSSTRING.split()]
- 
-dataFile.close()
- 
- 
- 
- 
-list1 = []
-list2 = []
-lenscounter = 0
- 
-def arc(draw, bbox, start, end, fill, width = LINEWIDTH, segments = 200):
-    global list1
-    global list2
-    global lenscounter
-    global IORLIST
-    global APERTUREELEMENTLIST
- 
-    firstLastList = []
- 
-    # radians
-    start *= math.pi / 180
-    end *= math.pi / 180
- 
-    # angle step
-    da = (end - start) / segments
- 
-    # shift end points with half a segment angle
-    start -= da / 2
-    end -= da / 2
- 
-    # ellips radii
-    rx = (bbox[2] - bbox[0]) / 2
-    ry = (bbox[3] - bbox[1]) / 2
- 
-    # box centre
-    cx = bbox[0] + rx
-    cy = bbox[1] + ry
- 
-    # segment length
-    l = (rx + ry) * da / 2.0
- 
-    for i in range(segments):
- 
-        # angle centre
-        a = start + (i + 0.5) * da
- 
-        # x,y centre
-        x = cx + math.cos(a) * rx
-        y = cy + math.sin(a) * ry
- 
-        # derivatives
-        dx = -math.sin(a) * rx / (rx + ry)
-        dy = math.cos(a) * ry / (rx + ry)
- 
-        if lenscounter != APERTUREELEMENTLIST[0]:
-            draw.line([(x - dx * l, y - dy * l), (x + dx * l, y + dy * l)], fill=fill, width=width)
- 
- 
-        if lenscounter == 0:
-            if i == 0:
-                list1.append((x - dx * l, y - dy * l))
- 
-            if i == segments - 1:
-                list1.append((x - dx * l, y - dy * l))
- 
- 
-        if lenscounter % 2 == 0:
-            if i == 0:
-                list2.append((x - dx * l, y - dy * l))
- 
-            if i == segments - 1:
-                list2.append((x - dx * l, y - dy * l))
- 
-                if IORLIST[lenscounter] != 1.0 or lenscounter == 0:
-                    draw.line([list1[0], list2[0]], fill = fill, width = width)
-                    draw.line([list1[1], list2[1]], fill = fill, width = width)
- 
-                list1 = []
- 
- 
-        elif lenscounter % 2 != 0:
-            if i == 0:
-                list1.append((x - dx * l, y - dy * l))
- 
-            if i == segments - 1:
-                list1.append((x - dx * l, y - dy * l))
- 
- 
-                if IORLIST[lenscounter] != 1.0:
-                    draw.line([list1[0], list2[0]], fill = fill, width = width)
-                    draw.line([list1[1], list2[1]], fill = fill, width = width)
- 
-                list2 = []
- 
-    lenscounter = lenscounter + 1
- 
- 
- 
- 
- 
- 
-# IMAGE WITH ACTUAL RAYS
-print "PYTHON: Creating actual rays image"
-img = Image.new('RGB', (SIZE[0] * AAS, SIZE[1] * AAS), BLUE)
-d = ImageDraw.Draw(img)
- 
-# ORIGIN LINES
-print "PYTHON: ---- Drawing origin lines"
-d.line([-5000 + TRANSLATEX, 0 + TRANSLATEY, 15000 + TRANSLATEX, 0 + TRANSLATEY],  DARKGREY, 5)
-d.line([0 + TRANSLATEX, 9999 + TRANSLATEY, 0 + TRANSLATEX, -9999 + TRANSLATEY],  DARKGREY, 5)
-d.text([0 + TRANSLATEX + PADDING, 0 + TRANSLATEY + PADDING + 1000], "(0, 0)", DARKGREY, font)
-d.text([0 + TRANSLATEX + PADDING, 0 + TRANSLATEY + PADDING + 1100], "ORIGIN", DARKGREY, font)
- 
-# TEMPORARY FOCUS LINE, REMOVE!
-d.line([(100 * AAS * SCALE + TRANSLATEX, 9999 * AAS * SCALE + TRANSLATEY), (100 * AAS * SCALE + TRANSLATEX, - 9999 * AAS * SCALE + TRANSLATEY)], ORANGE, 1)
- 
-
-# RAYS
-print "PYTHON: ---- Drawing rays"
-for count in range (0, len(RAYSLIST) / 4):
-    d.line([RAYSLIST[(count * 4)] * AAS * SCALE + TRANSLATEX, RAYSLIST[(count * 4) + 1] * AAS * SCALE + TRANSLATEY, RAYSLIST[(count * 4) + 2] * AAS * SCALE + TRANSLATEX,  (RAYSLIST[(count * 4) + 3] * AAS * SCALE) + TRANSLATEY], WHITE, 1)
- 
-
-if LENSMODELSTRING == "KOLB":
- 
-                # FOCUS DISTANCE
-                print "PYTHON: ---- Drawing focus line"
-                d.line([(FOCUSDISTANCELIST[0] * AAS) * SCALE + TRANSLATEX, 9999 + TRANSLATEY, (FOCUSDISTANCELIST[0] * AAS) * SCALE + TRANSLATEX, -9999 + TRANSLATEY],  ORANGE, LINEWIDTH)
-                d.text([(FOCUSDISTANCELIST[0] * AAS) * SCALE + TRANSLATEX + PADDING, 0 + TRANSLATEY + PADDING + 1000], "(" + str(FOCUSDISTANCELIST[0]) + ", 0)", ORANGE, font)
-                d.text([(FOCUSDISTANCELIST[0] * AAS) * SCALE + TRANSLATEX + PADDING, 0 + TRANSLATEY + PADDING + 1100], "FOCUSDISTANCE", ORANGE, font)
-               
-                # IMAGE DISTANCE
-                print "PYTHON: ---- Drawing image line"
-                d.line([(IMAGEDISTANCELIST[0] * AAS) * SCALE + TRANSLATEX, 9999 + TRANSLATEY, (IMAGEDISTANCELIST[0] * AAS) * SCALE + TRANSLATEX, -9999 + TRANSLATEY],  ORANGE, LINEWIDTH)
-                d.text([(IMAGEDISTANCELIST[0] * AAS) * SCALE + TRANSLATEX + PADDING, 0 + TRANSLATEY + PADDING + 1000], "(" + str(IMAGEDISTANCELIST[0]) + ", 0)", ORANGE, font)
-                d.text([(IMAGEDISTANCELIST[0] * AAS) * SCALE + TRANSLATEX + PADDING, 0 + TRANSLATEY + PADDING + 1100], "IMAGEDISTANCE", ORANGE, font)
- 
-                # LENS ELEMENTS
-                print "PYTHON: ---- Drawing lens elements"
-                for count in range (0, len(LENSESLIST) / 3):
-                    arc(d, [((LENSESLIST[count * 3] * AAS) - (LENSESLIST[(count * 3) + 1]) * AAS) * SCALE + TRANSLATEX, (- LENSESLIST[(count * 3) + 1]) * AAS * SCALE + TRANSLATEY, ((LENSESLIST[count*3] * AAS) + (LENSESLIST[(count * 3) + 1] * AAS)) * SCALE + TRANSLATEX, (LENSESLIST[(count * 3) + 1] * AAS) * SCALE + TRANSLATEY], - LENSESLIST[(count * 3) + 2], LENSESLIST[(count * 3) + 2], RED)
- 
-                # APERTURE
-                print "PYTHON: ---- Drawing aperture"
-                d.line([(APERTUREDISTANCELIST[0] * AAS * SCALE + TRANSLATEX, (APERTUREMAXLIST[0] / 2.0) * AAS * SCALE + TRANSLATEY), (APERTUREDISTANCELIST[0] * AAS * SCALE + TRANSLATEX, APERTURELIST[0] * AAS * SCALE + TRANSLATEY)], GREY, LINEWIDTH)
-                d.line([(APERTUREDISTANCELIST[0] * AAS * SCALE + TRANSLATEX, - (APERTUREMAXLIST[0] / 2.0) * AAS * SCALE + TRANSLATEY), (APERTUREDISTANCELIST[0] * AAS * SCALE + TRANSLATEX, - APERTURELIST[0] * AAS * SCALE + TRANSLATEY)], GREY, LINEWIDTH)
- 
-                # SENSOR
-                print "PYTHON: ---- Drawing sensor"
-                d.line([(IMAGEDISTANCELIST[0] * AAS * SCALE + TRANSLATEX, SENSORHEIGHTLIST[0] * AAS * SCALE + TRANSLATEY), (IMAGEDISTANCELIST[0] * AAS * SCALE + TRANSLATEX, - SENSORHEIGHTLIST[0] * AAS * SCALE + TRANSLATEY)], ORANGE, LINEWIDTH * 3)
- 
-
-print "PYTHON: ---- Anti-aliasing image"
-img.thumbnail(SIZE, Image.ANTIALIAS)
- 
-print "PYTHON: Saving image"
-# img.save('C:\ilionData\Users\zeno.pelgrims\Documents\zoic_compile\lensDrawing.png','png')
-img.save('/Volumes/ZENO_2016/projects/zoic/tests/images/lensDrawing.png','png')
+
+TRACED = 1
+THINLENS = 2
+SKIPPED = 4
+
+
+def readRecording(path):
+    with open(path, 'rb') as recording:
+        data = recording.read()
+
+    if data[:8] != b'ZOICRAYS':
+        raise ValueError('%s: not a zoic ray recording' % path)
+    version, = struct.unpack_from('<I', data, 8)
+    if version != 1:
+        raise ValueError('%s: unknown version %d' % (path, version))
+
+    lenses = {}
+    rays = []
+    done = None
+    offset = 12
+    while offset + 8 <= len(data):
+        tag, count = struct.unpack_from('<4sI', data, offset)
+        offset += 8
+        words = data[offset:offset + count * 4]
+        offset += count * 4
+
+        if tag == b'LENS':
+            lensId, model, surfaces, apertureElement = struct.unpack_from('<4I', words, 0)
+            apertureRadius, focalDistance, originShift, fov = struct.unpack_from('<4f', words, 16)
+            elements = [struct.unpack_from('<5f', words, 32 + i * 20) for i in range(surfaces)]
+            lenses[lensId] = {'model': model, 'apertureElement': apertureElement, 'apertureRadius': apertureRadius,
+                              'focalDistance': focalDistance, 'originShift': originShift, 'fov': fov,
+                              'elements': elements}
+        elif tag == b'RAYS':
+            w = 0
+            while w < count:
+                packed, index, lensId = struct.unpack_from('<3I', words, w * 4)
+                points = packed & 0xff
+                values = struct.unpack_from('<%df' % (5 + points * 3), words, w * 4 + 12)
+                rays.append({'flags': (packed >> 8) & 0xff, 'thread': packed >> 16, 'index': index, 'lens': lensId,
+                             'screen': values[0:2], 'dir': values[2:5],
+                             'points': [values[5 + i * 3:8 + i * 3] for i in range(points)]})
+                w += 8 + points * 3
+        elif tag == b'DONE':
+            done = struct.unpack_from('<2I', words, 0)
+
+    if done is None:
+        print('[ZOIC] %s ends before the render did, drawing what is there' % path)
+    elif done[1]:
+        print('[ZOIC] %d ray paths were dropped while rendering' % done[1])
+    return lenses, rays
+
+
+def drawLens(lens, rays, path):
+    elements = lens['elements']
+    img = Image.new('RGB', (SIZE[0] * AAS, SIZE[1] * AAS), BLUE)
+    d = ImageDraw.Draw(img)
+
+    # fit the lens and the sensor in the image, z goes to the right and y up
+    extent = [lens['originShift']] + [e[0] + e[1] for e in elements]
+    radius = max([e[3] * 0.5 for e in elements] + [lens['apertureRadius'], 1.0])
+    scale = min((SIZE[0] * AAS - 2 * PADDING) / max(max(extent) - min(extent), 1.0) * 0.5, (SIZE[1] * AAS - 2 * PADDING) / (2.2 * radius))
+    left = SIZE[0] * AAS * 0.5 - 0.5 * (max(extent) + min(extent)) * scale
+
+    def screen(z, y):
+        return (left + z * scale, SIZE[1] * AAS * 0.5 - y * scale)
+
+    d.line([screen(-1e4, 0.0), screen(1e4, 0.0)], DARKGREY, 5)
+
+    # rays, from the sensor through every surface hit and out of the lens
+    far = max(extent) - min(extent)
+    for ray in rays:
+        points = [screen(p[2], p[1]) for p in ray['points']]
+        if not points:
+            continue
+        if ray['flags'] & TRACED:
+            last = ray['points'][-1]
+            points.append(screen(last[2] + ray['dir'][2] * far, last[1] + ray['dir'][1] * far))
+        d.line(points, WHITE if ray['flags'] & TRACED else GREY, 1)
+
+    # lens surfaces, a flat aperture stop and spherical caps around the center of curvature
+    for i, (center, curvature, thickness, aperture, ior) in enumerate(elements):
+        half = aperture * 0.5
+        if i == lens['apertureElement']:
+            vertex = center + curvature
+            d.line([screen(vertex, half), screen(vertex, lens['apertureRadius'])], GREY, LINEWIDTH)
+            d.line([screen(vertex, -half), screen(vertex, -lens['apertureRadius'])], GREY, LINEWIDTH)
+            continue
+
+        angle = math.asin(max(min(half / abs(curvature), 1.0), -1.0))
+        arc = []
+        for s in range(101):
+            a = -angle + 2.0 * angle * s / 100.0
+            arc.append(screen(center + curvature * math.cos(a), curvature * math.sin(a)))
+        d.line(arc, RED, LINEWIDTH)
+
+    # sensor, at the origin shift of the lens
+    sensor = lens['originShift']
+    d.line([screen(sensor, radius), screen(sensor, -radius)], ORANGE, LINEWIDTH * 3)
+
+    img.thumbnail(SIZE, Image.LANCZOS)
+    img.save(path, 'png')
+    print('[ZOIC] Drew %d rays to %s' % (len(rays), path))
+
+
+def main():
+    if len(sys.argv) != 3:
+        print('usage: python draw.py <ray recording> <output png>')
+        return 1
+
+    lenses, rays = readRecording(sys.argv[1])
+    drawn = [i for i in sorted(lenses) if lenses[i]['elements']]
+    if not drawn:
+        print('[ZOIC] No raytraced lens in %s, nothing to draw' % sys.argv[1])
+        return 1
+
+    base, ext = os.path.splitext(sys.argv[2])
+    for i in drawn:
+        path = sys.argv[2] if len(drawn) == 1 else '%s_%d%s' % (base, i, ext)
+        drawLens(lenses[i], [r for r in rays if r['lens'] == i and not r['flags'] & THINLENS], path)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,159 @@
+// ZOIC - fast math routines for camera ray generation
+// Small, branch free approximations of the few transcendental functions used per camera ray.
+// The batched versions work on plain float arrays and are written so the compiler can vectorize them,
+// the rsqrt kernel uses SSE directly when it is available.
+
+// Error bounds below are measured over the stated domain by bench/fastMathBench.cpp, keep them in sync.
+//
+//   fastSinCos    |x| <= 1e4        max abs error  1.2e-7 (sin and cos)
+//   fastAtan2     |x|, |y| >= 1e-20  max abs error  1.5e-5 rad
+//   fastRsqrt     x in [1e-30, 1e30] max rel error 2.5e-7 (SSE) / 5.0e-6 (generic)
+//   rotationFromPoint               follows fastRsqrt, the result is normalized to within its error
+
+// (C) Zeno Pelgrims, www.zenopelgrims.com/zoic
+
+#ifndef ZOIC_FASTMATH_H
+#define ZOIC_FASTMATH_H
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#  include <xmmintrin.h>
+#  define ZOIC_FASTMATH_SSE 1
+#endif
+
+
+namespace fastmath{
+
+static const float PI       = 3.14159265358979323846f;
+static const float PIOVER2  = 1.57079632679489661923f;
+static const float TWOOVERPI = 0.63661977236758134308f;
+
+// pi/2 split in three parts for exact range reduction (Cody & Waite)
+static const float PIOVER2_A = 1.5703125f;
+static const float PIOVER2_B = 4.837512969970703125e-4f;
+static const float PIOVER2_C = 7.54978995489188216e-8f;
+
+
+// sin and cos of the same angle, sharing the range reduction
+inline void fastSinCos(float x, float *sinx, float *cosx){
+    // reduce x to r in [-pi/4, pi/4] and the quadrant q
+    // rounding through a truncating int conversion keeps the loop vectorizable, std::floor doesn't on plain SSE2
+    float t = x * TWOOVERPI;
+    int q = static_cast<int>(t + (t >= 0.0f ? 0.5f : -0.5f));
+    float qf = static_cast<float>(q);
+    float r = ((x - qf * PIOVER2_A) - qf * PIOVER2_B) - qf * PIOVER2_C;
+    float r2 = r * r;
+
+    // minimax polynomials on [-pi/4, pi/4]
+    float s = r + r * r2 * (-1.6666654611e-1f + r2 * (8.3321608736e-3f + r2 * -1.9515295891e-4f));
+    float c = 1.0f - 0.5f * r2 + r2 * r2 * (4.166664568298827e-2f + r2 * (-1.388731625493765e-3f + r2 * 2.443315711809948e-5f));
+
+    // swap and flip depending on the quadrant
+    float sq = (q & 1) ? c : s;
+    float cq = (q & 1) ? s : c;
+    *sinx = (q & 2) ? -sq : sq;
+    *cosx = ((q + 1) & 2) ? -cq : cq;
+}
+
+
+// with the default -ftrapping-math gcc won't if-convert float compares or conditional float math,
+// so the octant is picked with integer compares and selects on the bit patterns instead
+inline float fastAtan2(float y, float x){
+    float ax = std::abs(x);
+    float ay = std::abs(y);
+    uint32_t bx, by, sx;
+    std::memcpy(&bx, &ax, sizeof(float));
+    std::memcpy(&by, &ay, sizeof(float));
+    std::memcpy(&sx, &x, sizeof(float));
+
+    // non negative floats order the same way as their bit patterns
+    uint32_t steep = by > bx ? 1u : 0u;
+    uint32_t bmx = steep ? by : bx;
+    uint32_t bmn = steep ? bx : by;
+    float mx, mn;
+    std::memcpy(&mx, &bmx, sizeof(float));
+    std::memcpy(&mn, &bmn, sizeof(float));
+
+    // atan on [0, 1], 9th order polynomial (Abramowitz & Stegun 4.4.49)
+    float a = mn / (mx + 1e-30f);
+    float s = a * a;
+    float r = a * (0.9998660f + s * (-0.3302995f + s * (0.1801410f + s * (-0.0851330f + s * 0.0208351f))));
+
+    // multiplying by exactly 0 or 1 keeps these branch free
+    r += static_cast<float>(steep) * (PIOVER2 - 2.0f * r);
+    r += static_cast<float>(sx >> 31) * (PI - 2.0f * r);
+    return std::copysign(r, y);
+}
+
+
+inline float fastRsqrt(float x){
+#ifdef ZOIC_FASTMATH_SSE
+    float y = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(x)));
+    return y * (1.5f - 0.5f * x * y * y);
+#else
+    uint32_t i;
+    std::memcpy(&i, &x, sizeof(float));
+    i = 0x5f375a86 - (i >> 1);
+    float y;
+    std::memcpy(&y, &i, sizeof(float));
+    y = y * (1.5f - 0.5f * x * y * y);
+    return y * (1.5f - 0.5f * x * y * y);
+#endif
+}
+
+
+// cos and sin of the polar angle of (x, y), without going through the angle itself
+// the origin has no angle, there the identity rotation is returned
+inline void rotationFromPoint(float x, float y, float *cosx, float *sinx){
+    float r2 = x * x + y * y;
+    if (r2 > 0.0f){
+        float invr = fastRsqrt(r2);
+        *cosx = x * invr;
+        *sinx = y * invr;
+    }
+    else {
+        *cosx = 1.0f;
+        *sinx = 0.0f;
+    }
+}
+
+
+// batched versions, same error bounds as the scalar ones
+
+inline void fastSinCosN(const float *x, float *sinx, float *cosx, int n){
+    for (int i = 0; i < n; ++i){
+        fastSinCos(x[i], &sinx[i], &cosx[i]);
+    }
+}
+
+
+inline void fastAtan2N(const float *y, const float *x, float *out, int n){
+    for (int i = 0; i < n; ++i){
+        out[i] = fastAtan2(y[i], x[i]);
+    }
+}
+
+
+inline void fastRsqrtN(const float *x, float *out, int n){
+    int i = 0;
+#ifdef ZOIC_FASTMATH_SSE
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 threehalfs = _mm_set1_ps(1.5f);
+    for (; i + 4 <= n; i += 4){
+        __m128 v = _mm_loadu_ps(x + i);
+        __m128 y = _mm_rsqrt_ps(v);
+        y = _mm_mul_ps(y, _mm_sub_ps(threehalfs, _mm_mul_ps(_mm_mul_ps(half, v), _mm_mul_ps(y, y))));
+        _mm_storeu_ps(out + i, y);
+    }
+#endif
+    for (; i < n; ++i){
+        out[i] = fastRsqrt(x[i]);
+    }
+}
+
+} // namespace fastmath
+
+#endif
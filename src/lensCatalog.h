@@ -0,0 +1,155 @@
+// ZOIC - built-in lens catalog
+// GENERATED by src/lensCatalog.py from lenses_tabular/, do not edit by hand.
+// Elements are stored as cleanupLensData leaves them: rear-most first, in cm, aperture stop flattened.
+
+#ifndef ZOIC_LENSCATALOG_H
+#define ZOIC_LENSCATALOG_H
+
+struct builtinLensElement{
+    float curvature, thickness, ior, aperture, abbe;
+};
+
+struct builtinLens{
+    const char *name;
+    int lensCount;
+    int apertureElement;
+    bool apertureStop;  // false when the file has no aperture, element 0 then clips without being flattened
+    const builtinLensElement *elements;
+};
+
+static constexpr builtinLensElement lens_F_1_25_PETZVAL[] = {
+    { 28.8100014f, -14.6639996f, 1.0f, 2.5999999f, 0.0f },
+    { -4.06599998f, 0.173000008f, 1.64999998f, 2.5999999f, 33.7000008f },
+    { -33.2229996f, 2.82999992f, 1.0f, 2.5999999f, 0.0f },
+    { -6.05600023f, 0.55400002f, 1.62600005f, 2.5999999f, 35.7000008f },
+    { 4.93100023f, 1.47000003f, 1.51699996f, 2.5999999f, 64.1999969f },
+    { 9999.90039f, 3.0999999f, 1.0f, 2.69000006f, 0.0f },
+    { 13.8429995f, 3.21500015f, 1.0f, 4.14000034f, 0.0f },
+    { -13.8429995f, 0.207999989f, 1.62600005f, 4.14000034f, 35.7000008f },
+    { 8.13199997f, 1.99000001f, 1.51699996f, 4.14000034f, 64.1999969f },
+    { 160.0f, 0.0860000029f, 1.0f, 4.32000017f, 0.0f },
+    { 12.1110001f, 1.03799999f, 1.51699996f, 4.32000017f, 64.1999969f },
+};
+
+static constexpr builtinLensElement lens_F_1_6_PETZVAL[] = {
+    { 213.060013f, -12.2607985f, 1.0f, 1.53999996f, 0.0f },
+    { -4.48909998f, 0.265000015f, 1.72000003f, 1.53999996f, 29.2999992f },
+    { -22.8328991f, 1.97689986f, 1.0f, 2.30999994f, 0.0f },
+    { 5.51730013f, 1.58999991f, 1.61099994f, 2.30999994f, 58.7999992f },
+    { 66.0830994f, 5.96729994f, 1.0f, 3.16000009f, 0.0f },
+    { -9.91629982f, 0.530000031f, 1.72000003f, 3.16000009f, 29.2999992f },
+    { -11.4427004f, 0.0766000003f, 1.0f, 3.16000009f, 0.0f },
+    { 7.40619946f, 1.8549999f, 1.61099994f, 3.16000009f, 58.7999992f },
+};
+
+static constexpr builtinLensElement lens_F_2_0_DOUBLE_GAUSS[] = {
+    { -7.9460001f, -6.40799952f, 1.0f, 4.0f, 0.0f },
+    { 87.413002f, 0.643999994f, 1.71700001f, 4.0f, 0.0f },
+    { -4.07700014f, 0.0379999988f, 1.0f, 4.0f, 0.0f },
+    { 8.15400028f, 1.21300006f, 1.65799999f, 4.0f, 0.0f },
+    { -2.89899993f, 0.235999987f, 1.60300004f, 3.4000001f, 0.0f },
+    { 9999.90039f, 0.899999976f, 1.0f, 3.42000008f, 0.0f },
+    { 2.54999995f, 1.14100003f, 1.0f, 3.5999999f, 0.0f },
+    { 8.15400028f, 0.655000031f, 1.699f, 4.5999999f, 0.0f },
+    { 3.85500002f, 0.805000007f, 1.66999996f, 4.5999999f, 0.0f },
+    { 16.9659996f, 0.0240000002f, 1.0f, 5.03999996f, 0.0f },
+    { 5.89499998f, 0.751999974f, 1.66999996f, 5.03999996f, 0.0f },
+};
+
+static constexpr builtinLensElement lens_F_2_5_HFOV_TRIPLET[] = {
+    { -8.49300003f, -3.49099922f, 1.0f, 1.39999998f, 0.0f },
+    { 8.49300003f, 0.600000024f, 1.69400001f, 1.39999998f, 53.2999992f },
+    { 9999.90039f, 0.699999988f, 1.0f, 1.36000001f, 0.0f },
+    { 3.32299995f, 0.76700002f, 1.0f, 1.35000002f, 0.0f },
+    { -8.49300003f, 0.916999996f, 1.67299998f, 1.56000006f, 32.2000008f },
+    { -28.3530006f, 0.300000012f, 1.0f, 2.0f, 0.0f },
+    { 4.22000027f, 0.206999987f, 1.64900005f, 2.0f, 53.2999992f },
+};
+
+static constexpr builtinLensElement lens_F_2_8_MORI_USP[] = {
+    { 9999.90039f, -26.2979984f, 1.0f, 8.0f, 0.0f },
+    { -8.3501997f, 12.9306002f, 1.0f, 2.70000005f, 0.0f },
+    { -174.009903f, 0.86590004f, 1.72899997f, 2.54999995f, 54.7000008f },
+    { -6.43820047f, 0.0397999994f, 1.0f, 2.37999988f, 0.0f },
+    { -20.8841991f, 0.726599991f, 1.80400002f, 2.29999995f, 46.5f },
+    { 22.6238995f, 0.2588f, 1.0f, 2.29999995f, 0.0f },
+    { -5.60379982f, 1.11479998f, 1.78499997f, 2.13999987f, 26.1000004f },
+    { -16.8815994f, 2.99599981f, 1.0f, 3.00999999f, 0.0f },
+    { 8.21169949f, 0.935599983f, 1.60300004f, 3.00999999f, 42.5f },
+    { 5.22539997f, 5.73320007f, 1.0f, 4.19999981f, 0.0f },
+    { 12.6009998f, 0.696699977f, 1.66999996f, 5.24000025f, 51.5999985f },
+};
+
+static constexpr builtinLensElement lens_F_2_8_TESSAR[] = {
+    { -4.89099979f, -3.96200085f, 1.0f, 1.64999998f, 0.0f },
+    { 18.3920002f, 0.705000043f, 1.69099998f, 1.64999998f, 54.7000008f },
+    { 4.09299994f, 1.06400001f, 1.0f, 1.7299999f, 0.0f },
+    { -5.90600014f, 0.187000006f, 1.63999999f, 1.7299999f, 34.5999985f },
+    { 9999.90039f, 0.400000006f, 1.0f, 1.5f, 0.0f },
+    { 30.684f, 0.415999979f, 1.0f, 1.92000008f, 0.0f },
+    { -11.533f, 0.209999993f, 1.54900002f, 1.92000008f, 45.4000015f },
+    { 4.29699993f, 0.980000019f, 1.69099998f, 1.92000008f, 54.7000008f },
+};
+
+static constexpr builtinLensElement lens_F_4_0_FISHEYE_MULLER[] = {
+    { -1.50404f, -3.34460998f, 1.0f, 0.65200001f, 0.0f },
+    { -2.2372601f, 0.0939999968f, 1.67299998f, 0.596000016f, 0.0f },
+    { -1.42883992f, 0.00627000025f, 1.0f, 0.596000016f, 0.0f },
+    { -0.522650003f, 0.0971399993f, 1.80499995f, 0.583999991f, 0.0f },
+    { 2.94541001f, 0.219339997f, 1.51699996f, 0.596000016f, 0.0f },
+    { 9999.90039f, 0.141630009f, 1.0f, 0.60799998f, 0.0f },
+    { 4.38676977f, 0.538950026f, 1.0f, 0.81400001f, 0.0f },
+    { 0.958819985f, 0.200539991f, 1.65400004f, 0.90200007f, 0.0f },
+    { 0.833490014f, 1.11548996f, 1.0f, 1.34200001f, 0.0f },
+    { 7.52018976f, 0.106540002f, 1.63900006f, 1.77999997f, 0.0f },
+    { 1.13931f, 0.741360009f, 1.0f, 2.06800008f, 0.0f },
+    { 3.02249002f, 0.0833500028f, 1.62f, 3.03399992f, 0.0f },
+};
+
+static constexpr builtinLensElement lens_F_5_0_TELEPHOTO[] = {
+    { -3.69109988f, -3.71099997f, 1.0f, 0.75999999f, 0.0f },
+    { 8.28339958f, 0.25f, 1.60300004f, 0.75999999f, 38.0f },
+    { 2.29890013f, 0.104999997f, 1.0f, 0.75999999f, 0.0f },
+    { -2.86049986f, 0.200000003f, 1.61300004f, 0.75999999f, 58.5999985f },
+    { 13.2322006f, 2.4059999f, 1.0f, 1.04999995f, 0.0f },
+    { 2.65219998f, 0.25f, 1.61300004f, 1.04999995f, 58.5999985f },
+    { -47.792099f, 0.0500000007f, 1.0f, 1.04999995f, 0.0f },
+    { -4.60029984f, 0.200000003f, 1.76199996f, 1.04999995f, 26.5f },
+    { 14.9035006f, 0.25f, 1.61300004f, 1.04999995f, 58.5999985f },
+};
+
+static const int builtinLensCount = 8;
+
+static const builtinLens builtinLenses[] = {
+    { "F_1.25_PETZVAL", 11, 5, true, lens_F_1_25_PETZVAL },
+    { "F_1.6_PETZVAL", 8, 0, false, lens_F_1_6_PETZVAL },
+    { "F_2.0_DOUBLE_GAUSS", 11, 5, true, lens_F_2_0_DOUBLE_GAUSS },
+    { "F_2.5_HFOV_TRIPLET", 7, 2, true, lens_F_2_5_HFOV_TRIPLET },
+    { "F_2.8_MORI_USP", 11, 0, true, lens_F_2_8_MORI_USP },
+    { "F_2.8_TESSAR", 8, 4, true, lens_F_2_8_TESSAR },
+    { "F_4.0_FISHEYE_MULLER", 12, 5, true, lens_F_4_0_FISHEYE_MULLER },
+    { "F_5.0_TELEPHOTO", 9, 0, false, lens_F_5_0_TELEPHOTO },
+};
+
+// names for the builtinLens enum parameter, index 0 means a lens data file is used instead.
+// Only the node uses them, it defines ZOIC_BUILTIN_LENS_NAMES before including this header.
+#ifdef ZOIC_BUILTIN_LENS_NAMES
+static const char* builtinLensNames[] =
+{
+    "NONE",
+    "F_1.25_PETZVAL",
+    "F_1.6_PETZVAL",
+    "F_2.0_DOUBLE_GAUSS",
+    "F_2.5_HFOV_TRIPLET",
+    "F_2.8_MORI_USP",
+    "F_2.8_TESSAR",
+    "F_4.0_FISHEYE_MULLER",
+    "F_5.0_TELEPHOTO",
+    NULL
+};
+#endif
+
+// every distinct surface count in the catalog, an unrolled tracer gets instantiated for each
+#define ZOIC_BUILTIN_LENS_SURFACE_COUNTS(X) X(7) X(8) X(9) X(11) X(12)
+
+#endif
@@ -0,0 +1,174 @@
+# Generates src/lensCatalog.h from the lens description files in lenses_tabular/
+# usage: python src/lensCatalog.py lenses_tabular src/lensCatalog.h
+#
+# The tables come out exactly as readTabularLensData + cleanupLensData would leave them in memory:
+# rear-most element first, aperture stop (if any) flattened to a radius of 99999, air at ior 1.0, mm scaled to cm
+# and the rear element moved so the last lens sits at the origin. All arithmetic is rounded to float
+# along the way, so the tables match the parsed data bit for bit.
+
+from __future__ import print_function
+
+import glob
+import os
+import re
+import struct
+import sys
+
+
+def f32(value):
+    return struct.unpack('f', struct.pack('f', value))[0]
+
+
+def parseLensFile(path):
+    rows = []
+    with open(path) as lensFile:
+        for line in lensFile:
+            line = line.rstrip('\r\n')
+            if not line or line.startswith('#'):
+                continue
+            tokens = [t for t in re.split(r'[\t,;: ]', line) if t]
+            rows.append([f32(float(t)) for t in tokens])
+
+    columns = len(rows[0])
+    if columns not in (4, 5) or any(len(row) != columns for row in rows):
+        raise ValueError('%s: expected 4 or 5 columns on every line' % path)
+
+    lenses = []
+    for row in rows:
+        if columns == 4:
+            curvature, thickness, ior, aperture = row
+            abbe = 0.0
+        else:
+            curvature, thickness, ior, abbe, aperture = row
+        lenses.append([curvature, thickness, ior, aperture, abbe])
+
+    # rear-most element first
+    lenses.reverse()
+    return lenses
+
+
+def cleanupLensData(lenses, path):
+    apertureElement = -1
+    for i, lens in enumerate(lenses):
+        if lens[0] == 0.0:
+            if apertureElement != -1:
+                raise ValueError('%s: multiple apertures found' % path)
+            apertureElement = i
+            lens[0] = 99999.0
+        if lens[2] == 0.0:
+            lens[2] = 1.0
+
+    # without a stop the camera keeps aperture element 0, the rear-most surface, and clips there as a sphere
+    apertureStop = apertureElement != -1
+    if not apertureStop:
+        apertureElement = 0
+
+    # scale from mm to cm
+    for lens in lenses:
+        lens[0] = f32(lens[0] * 0.1)
+        lens[1] = f32(lens[1] * 0.1)
+        lens[3] = f32(lens[3] * 0.1)
+
+    # move lenses so last lens is at origin
+    summedThickness = 0.0
+    for lens in lenses:
+        summedThickness = f32(summedThickness + lens[1])
+    lenses[0][1] = f32(lenses[0][1] - summedThickness)
+
+    return apertureElement, apertureStop
+
+
+def identifier(name):
+    return 'lens_' + re.sub(r'[^0-9A-Za-z_]', '_', name)
+
+
+def floatLiteral(value):
+    return '%.9gf' % value if ('.' in '%.9g' % value or 'e' in '%.9g' % value) else '%.1ff' % value
+
+
+def main():
+    if len(sys.argv) != 3:
+        print('usage: python lensCatalog.py <lens directory> <output header>')
+        return 1
+
+    paths = sorted(glob.glob(os.path.join(sys.argv[1], '*.dat')))
+    catalog = []
+    for path in paths:
+        name = os.path.splitext(os.path.basename(path))[0]
+        with open(path) as lensFile:
+            if any(line.startswith('#ZOOM') or line.startswith('#ASPHERE') for line in lensFile):
+                # zoom lenses are compiled per zoom position at render time, aspheres have no place in the tables
+                print('[ZOIC] Skipping %s: zoom or aspheric lens' % path)
+                continue
+        lenses = parseLensFile(path)
+        try:
+            apertureElement, apertureStop = cleanupLensData(lenses, path)
+        except ValueError as error:
+            # the camera can't handle more than one aperture stop, leave such lenses to the file based path
+            print('[ZOIC] Skipping %s' % error)
+            continue
+        catalog.append((name, lenses, apertureElement, apertureStop))
+
+    out = []
+    out.append('// ZOIC - built-in lens catalog')
+    out.append('// GENERATED by src/lensCatalog.py from lenses_tabular/, do not edit by hand.')
+    out.append('// Elements are stored as cleanupLensData leaves them: rear-most first, in cm, aperture stop flattened.')
+    out.append('')
+    out.append('#ifndef ZOIC_LENSCATALOG_H')
+    out.append('#define ZOIC_LENSCATALOG_H')
+    out.append('')
+    out.append('struct builtinLensElement{')
+    out.append('    float curvature, thickness, ior, aperture, abbe;')
+    out.append('};')
+    out.append('')
+    out.append('struct builtinLens{')
+    out.append('    const char *name;')
+    out.append('    int lensCount;')
+    out.append('    int apertureElement;')
+    out.append('    bool apertureStop;  // false when the file has no aperture, element 0 then clips without being flattened')
+    out.append('    const builtinLensElement *elements;')
+    out.append('};')
+    out.append('')
+
+    for name, lenses, apertureElement, apertureStop in catalog:
+        out.append('static constexpr builtinLensElement %s[] = {' % identifier(name))
+        for lens in lenses:
+            out.append('    { %s, %s, %s, %s, %s },' % tuple(floatLiteral(v) for v in lens))
+        out.append('};')
+        out.append('')
+
+    out.append('static const int builtinLensCount = %d;' % len(catalog))
+    out.append('')
+    out.append('static const builtinLens builtinLenses[] = {')
+    for name, lenses, apertureElement, apertureStop in catalog:
+        out.append('    { "%s", %d, %d, %s, %s },' % (name, len(lenses), apertureElement, 'true' if apertureStop else 'false', identifier(name)))
+    out.append('};')
+    out.append('')
+    out.append('// names for the builtinLens enum parameter, index 0 means a lens data file is used instead.')
+    out.append('// Only the node uses them, it defines ZOIC_BUILTIN_LENS_NAMES before including this header.')
+    out.append('#ifdef ZOIC_BUILTIN_LENS_NAMES')
+    out.append('static const char* builtinLensNames[] =')
+    out.append('{')
+    out.append('    "NONE",')
+    for name, lenses, apertureElement, apertureStop in catalog:
+        out.append('    "%s",' % name)
+    out.append('    NULL')
+    out.append('};')
+    out.append('#endif')
+    out.append('')
+    out.append('// every distinct surface count in the catalog, an unrolled tracer gets instantiated for each')
+    counts = sorted(set(len(lenses) for name, lenses, apertureElement, apertureStop in catalog))
+    out.append('#define ZOIC_BUILTIN_LENS_SURFACE_COUNTS(X) %s' % ' '.join('X(%d)' % c for c in counts))
+    out.append('')
+    out.append('#endif')
+    out.append('')
+
+    with open(sys.argv[2], 'w') as header:
+        header.write('\n'.join(out))
+
+    print('[ZOIC] Wrote %d lenses to %s' % (len(catalog), sys.argv[2]))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
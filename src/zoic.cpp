@@ -12,48 +12,21 @@
 // TODO
 // Calculate proper ray derivatives for optimal texture i/o
 
-#include <ai.h>
-#include <iostream>
-#include <cstdint>
-#include <string>
-#include <cstring>
-#include <fstream>
-#include <sstream>
-#include <iomanip>
-#include <vector>
-#include <map>
-#include <iterator>
-#include <algorithm>
-
-static std::string DRAW_OUT_DIR     = "./";
-static std::string DRAW_SCRIPTS_DIR = "./";
-
-#ifdef _MACBOOK
-#  define MACBOOK_ONLY(block) block
-DRAW_OUT_DIR     = "/Volumes/ZENO_2016/projects/zoic/src/";
-DRAW_SCRIPTS_DIR = "/Volumes/ZENO_2016/projects/zoic/src/";
-#else
-#  define MACBOOK_ONLY(block)
-#endif
-
-#ifdef _WORK
-#  define WORK_ONLY(block) block
-DRAW_OUT_DIR     = "C:/ilionData/Users/zeno.pelgrims/Documents/zoic_compile/";
-DRAW_SCRIPTS_DIR = "C:/ilionData/Users/zeno.pelgrims/Documents/zoic_compile/";
-#else
-#  define WORK_ONLY(block)
-#endif
-
-#ifdef _DEBUGIMAGESAMPLING
-#  define DEBUG_ONLY(block) block
-#else
-#  define DEBUG_ONLY(block)
-#endif
-
-#ifdef _DRAW
-#  define DRAW_ONLY(block) block
-#else
-#  define DRAW_ONLY(block)
+#include "zoicCore.h"
+#define ZOIC_BUILTIN_LENS_NAMES
+#include "lensCatalog.h"
+
+#include <chrono>
+#include <cstdio>
+#include <new>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#if defined(__x86_64__) || defined(__i386__)
+#  include <x86intrin.h>
+#elif defined(_M_X64) || defined(_M_IX86)
+#  include <intrin.h>
 #endif
 
 
@@ -68,11 +41,28 @@ enum zoicParams{
     p_focalLength,
     p_fStop,
     p_focalDistance,
+    p_focalDistanceKeys,
+    p_zoom,
     p_useImage,
     p_bokehPath,
     p_lensModel,
     p_lensDataPath,
+    p_builtinLens,
     p_kolbSamplingLUT,
+    p_progressiveLUT,
+    p_wideAngleLUT,
+    p_focusCache,
+    p_focusCacheNear,
+    p_focusCacheFar,
+    p_focusCacheSamples,
+    p_dispersion,
+    p_previewMode,
+    p_lutAccuracyReport,
+    p_telemetryPath,
+    p_heatmapPath,
+    p_heatmapResolution,
+    p_rayRecordPath,
+    p_rayRecordInterval,
     p_useDof,
     p_opticalVignettingDistance,
     p_opticalVignettingRadius,
@@ -97,461 +87,34 @@ static const char* LensModelNames[] =
 };
 
 
-// arnold texture loading function
-inline bool LoadTexture(const AtString path, void *pixelData){
-    return AiTextureLoad(path, true, 0, pixelData);
-}
-
-
-struct arrayCompare{
-    const float *values;
-    inline arrayCompare(const float *_values) :values(_values) {}
-    inline bool operator()(int _lhs, int _rhs) const{
-        return values[_lhs] > values[_rhs];
-    }
-};
-
-
-class imageData{
-private:
-    int x, y, nchannels;
-    float *pixelData;
-    float *cdfRow;
-    float *cdfColumn;
-    int *rowIndices;
-    int *columnIndices;
-
-public:
-    imageData()
-        : x(0), y(0), nchannels(0)
-        , pixelData(0), cdfRow(0), cdfColumn(0)
-        , rowIndices(0), columnIndices(0) {
-    }
-
-    ~imageData(){
-        invalidate();
-    }
-
-    bool isValid() const{
-        return (x * y * nchannels > 0 && nchannels >= 3);
-    }
-
-    void invalidate(){
-        if (pixelData){
-            AiAddMemUsage(-x * y * nchannels * sizeof(float), AtString("zoic"));
-            AiFree(pixelData);
-            pixelData = 0;
-        }
-        if (cdfRow){
-            AiAddMemUsage(-y * sizeof(float), AtString("zoic"));
-            AiFree(cdfRow);
-            cdfRow = 0;
-        }
-        if (cdfColumn){
-            AiAddMemUsage(-x * y * sizeof(float), AtString("zoic"));
-            AiFree(cdfColumn);
-            cdfColumn = 0;
-        }
-        if (rowIndices){
-            AiAddMemUsage(-y * sizeof(int), AtString("zoic"));
-            AiFree(rowIndices);
-            rowIndices = 0;
-        }
-        if (columnIndices){
-            AiAddMemUsage(-x * y * sizeof(int), AtString("zoic"));
-            AiFree(columnIndices);
-            columnIndices = 0;
-        }
-        x = y = nchannels = 0;
-    }
-
-    bool read(const char *bokeh_kernel_filename){
-        invalidate();
-        int64_t nbytes = 0;
-
-        AiMsgInfo("[ZOIC] Reading image using Arnold API: %s", bokeh_kernel_filename);
-        AtString path(bokeh_kernel_filename);
-
-        unsigned int iw, ih, nc;
-        if (!AiTextureGetResolution(path, &iw, &ih) || !AiTextureGetNumChannels(path, &nc)){ return false; }
-
-        x = static_cast<int>(iw);
-        y = static_cast<int>(ih);
-        nchannels = static_cast<int>(nc);
-
-        nbytes = x * y * nchannels * sizeof(float);
-        AiAddMemUsage(nbytes, AtString("zoic"));
-        pixelData = (float*)AiMalloc(nbytes);
-
-        if (!LoadTexture(path, pixelData)){
-            invalidate();
-            return false;
-        }
-
-        AiMsgInfo("[ZOIC] Bokeh Image Width: %d", x);
-        AiMsgInfo("[ZOIC] Bokeh Image Height: %d", y);
-        AiMsgInfo("[ZOIC] Bokeh Image Channels: %d", nchannels);
-        AiMsgInfo("[ZOIC] Total amount of bokeh pixels to process: %d", x * y);
-
-        DEBUG_ONLY({
-            // print out raw pixel data
-            int npixels = x * y;
-            for (int i = 0, j = 0; i < npixels; i++){
-                std::cout << "[";
-                for (int k = 0; k < nchannels; k++, j++){
-                    std::cout << pixelData[j];
-                    if (k + 1 < nchannels){
-                        std::cout << ", ";
-                    }
-                }
-                std::cout << "]";
-                if (i + 1 < npixels){
-                    std::cout << ", ";
-                }
-            }
-            std::cout << "----------------------------------------------" << std::endl;
-            std::cout << "----------------------------------------------" << std::endl;
-        })
-
-            bokehProbability();
-
-        return true;
-    }
-
-    // Importance sampling
-    void bokehProbability(){
-        if (!isValid()){ return; }
-
-        // initialize arrays
-        int64_t nbytes = x * y * sizeof(float);
-        int64_t totalTempBytes = 0;
-
-        AiAddMemUsage(nbytes, AtString("zoic"));
-        float *pixelValues = (float*)AiMalloc(nbytes);
-        totalTempBytes += nbytes;
-
-        AiAddMemUsage(nbytes, AtString("zoic"));
-        float *normalizedPixelValues = (float*)AiMalloc(nbytes);
-        totalTempBytes += nbytes;
-
-        int npixels = x * y;
-        int o1 = (nchannels >= 2 ? 1 : 0);
-        int o2 = (nchannels >= 3 ? 2 : o1);
-        float totalValue = 0.0f;
-
-        // for every pixel, stuff going wrong here
-        for (int i = 0, j = 0; i < npixels; ++i, j += nchannels){
-            // store pixel value in array
-            pixelValues[i] = pixelData[j] * 0.3f + pixelData[j + o1] * 0.59f + pixelData[j + o2] * 0.11f;
-            totalValue += pixelValues[i];
-
-            DEBUG_ONLY(std::cout << "Pixel Luminance: " << i << " -> " << pixelValues[i] << std::endl);
-        }
-
-        DEBUG_ONLY({
-            std::cout << "----------------------------------------------" << std::endl;
-            std::cout << "DEBUG: Total Pixel Value: " << totalValue << std::endl;
-            std::cout << "----------------------------------------------" << std::endl;
-            std::cout << "----------------------------------------------" << std::endl;
-        })
-
-            // normalize pixel values so sum = 1
-            float invTotalValue = 1.0f / totalValue;
-        float totalNormalizedValue = 0.0f;
-
-        for (int i = 0; i < npixels; ++i){
-            normalizedPixelValues[i] = pixelValues[i] * invTotalValue;
-
-            totalNormalizedValue += normalizedPixelValues[i];
-
-            DEBUG_ONLY(std::cout << "Normalized Pixel Value: " << i << ": " << normalizedPixelValues[i] << std::endl);
-        }
-
-        DEBUG_ONLY({
-            std::cout << "----------------------------------------------" << std::endl;
-            std::cout << "DEBUG: Total Normalized Pixel Value: " << totalNormalizedValue << std::endl;
-            std::cout << "----------------------------------------------" << std::endl;
-            std::cout << "----------------------------------------------" << std::endl;
-        })
-
-            // calculate sum for each row
-            nbytes = y * sizeof(float);
-        AiAddMemUsage(nbytes, AtString("zoic"));
-        float *summedRowValues = (float*)AiMalloc(nbytes);
-        totalTempBytes += nbytes;
-
-        for (int i = 0, k = 0; i < y; ++i){
-
-            summedRowValues[i] = 0.0f;
-
-            for (int j = 0; j < x; ++j, ++k){
-
-                summedRowValues[i] += normalizedPixelValues[k];
-            }
-
-            DEBUG_ONLY(std::cout << "Summed Values row [" << i << "]: " << summedRowValues[i] << std::endl);
-        }
-
-
-        DEBUG_ONLY({
-            // calculate sum of all row values, just to debug
-            float totalNormalizedRowValue = 0.0f;
-            for (int i = 0; i < y; ++i){
-                totalNormalizedRowValue += summedRowValues[i];
-            }
-            std::cout << "----------------------------------------------" << std::endl;
-            std::cout << "Debug: Summed Row Value: " << totalNormalizedRowValue << std::endl;
-            std::cout << "----------------------------------------------" << std::endl;
-        })
-
-
-            // make array of indices
-            nbytes = y * sizeof(int);
-        AiAddMemUsage(nbytes, AtString("zoic"));
-        rowIndices = (int*)AiMalloc(nbytes);
-
-        for (int i = 0; i < y; ++i){
-            rowIndices[i] = i;
-        }
-
-        std::sort(rowIndices, rowIndices + y, arrayCompare(summedRowValues));
-
-        DEBUG_ONLY({
-            // print values
-            for (int i = 0; i < y; ++i){
-                std::cout << "PDF row [" << rowIndices[i] << "]: " << summedRowValues[rowIndices[i]] << std::endl;
-            }
-            std::cout << "----------------------------------------------" << std::endl;
-            std::cout << "----------------------------------------------" << std::endl;
-        })
-
-            // For every row, add the sum of all previous row (cumulative distribution function)
-            nbytes = y * sizeof(float);
-        AiAddMemUsage(nbytes, AtString("zoic"));
-        cdfRow = (float*)AiMalloc(nbytes);
-
-        float prevVal = 0.0f;
-        for (int i = 0; i < y; ++i){
-            cdfRow[i] = prevVal + summedRowValues[rowIndices[i]];
-            prevVal = cdfRow[i];
-
-            DEBUG_ONLY(std::cout << "CDF row [" << rowIndices[i] << "]: " << cdfRow[i] << std::endl);
-        }
-
-        DEBUG_ONLY({
-            std::cout << "----------------------------------------------" << std::endl;
-            std::cout << "----------------------------------------------" << std::endl;
-        })
-
-            nbytes = npixels * sizeof(float);
-        AiAddMemUsage(nbytes, AtString("zoic"));
-        float *normalizedValuesPerRow = (float*)AiMalloc(nbytes);
-        totalTempBytes += nbytes;
-
-        // divide pixel values of each pixel by the sum of the pixel values of that row (Normalize)
-        for (int r = 0, i = 0; r < y; ++r){
-            for (int c = 0; c < x; ++c, ++i){
-                // avoid division by 0
-                if ((normalizedPixelValues[i] != 0) && (summedRowValues[r] != 0)){
-                    normalizedValuesPerRow[i] = normalizedPixelValues[i] / summedRowValues[r];
-                }
-                else {
-                    normalizedValuesPerRow[i] = 0;
-                }
-
-                DEBUG_ONLY(std::cout << "Normalized Pixel value per row: " << i << ": " << normalizedValuesPerRow[i] << std::endl);
-            }
-        }
-
-        DEBUG_ONLY({
-            std::cout << "----------------------------------------------" << std::endl;
-            std::cout << "----------------------------------------------" << std::endl;
-        })
-
-            // sort column values from highest to lowest per row (probability density function)
-            nbytes = npixels * sizeof(int);
-        AiAddMemUsage(nbytes, AtString("zoic"));
-        columnIndices = (int*)AiMalloc(nbytes);
-
-        for (int i = 0; i < npixels; i++){
-            columnIndices[i] = i;
-        }
-
-        for (int i = 0; i < npixels; i += x){
-            std::sort(columnIndices + i, columnIndices + i + x, arrayCompare(normalizedValuesPerRow));
-        }
-
-        DEBUG_ONLY({
-            for (int i = 0; i < npixels; ++i){
-                std::cout << "PDF column [" << columnIndices[i] << "]: " << normalizedValuesPerRow[columnIndices[i]] << std::endl;
-            }
-
-            std::cout << "----------------------------------------------" << std::endl;
-            std::cout << "----------------------------------------------" << std::endl;
-        })
-
-            // For every column per row, add the sum of all previous columns (cumulative distribution function)
-            nbytes = npixels * sizeof(float);
-        AiAddMemUsage(nbytes, AtString("zoic"));
-        cdfColumn = (float*)AiMalloc(nbytes);
-
-        for (int r = 0, i = 0; r < y; ++r){
-            prevVal = 0.0f;
-
-            for (int c = 0; c < x; ++c, ++i){
-                cdfColumn[i] = prevVal + normalizedValuesPerRow[columnIndices[i]];
-                prevVal = cdfColumn[i];
-
-                DEBUG_ONLY(std::cout << "CDF column [" << columnIndices[i] << "]: " << cdfColumn[i] << std::endl);
-            }
-        }
-
-        DEBUG_ONLY(std::cout << "----------------------------------------------" << std::endl);
-
-        // Release and untrack memory
-        AiAddMemUsage(-totalTempBytes, AtString("zoic"));
-        AiFree(pixelValues);
-        AiFree(normalizedPixelValues);
-        AiFree(summedRowValues);
-        AiFree(normalizedValuesPerRow);
-    }
-
-    // Sample image
-    void bokehSample(float randomNumberRow, float randomNumberColumn, float *dx, float *dy){
-        if (!isValid()){
-            AiMsgWarning("Invalid bokeh image data.");
-            *dx = 0.0f;
-            *dy = 0.0f;
-            return;
-        }
-
-        // print random number between 0 and 1
-        DEBUG_ONLY(std::cout << "RANDOM NUMBER ROW: " << randomNumberRow << std::endl);
-
-        // find upper bound of random number in the array
-        float *pUpperBound = std::upper_bound(cdfRow, cdfRow + y, randomNumberRow);
-
-        int r = 0;
-        pUpperBound >= (cdfRow + y) ? r = y - 1 : r = static_cast<int>(pUpperBound - cdfRow);
-
-        // find actual pixel row
-        int actualPixelRow = rowIndices[r];
-
-        // recalculate pixel row so that the center pixel is (0,0) - might run into problems with images of dimensions like 2x2, 4x4, 6x6, etc
-        int recalulatedPixelRow = actualPixelRow - ((x - 1) / 2);
-
-        DEBUG_ONLY({
-            // print values
-            std::cout << "INDEX IN CDF ROW: " << r << std::endl;
-            std::cout << "ACTUAL PIXEL ROW: " << actualPixelRow << std::endl;
-            std::cout << "RECALCULATED PIXEL ROW: " << recalulatedPixelRow << std::endl;
-            std::cout << "----------------------------------------------" << std::endl;
-            std::cout << "----------------------------------------------" << std::endl;
-            std::cout << "RANDOM NUMBER COLUMN: " << randomNumberColumn << std::endl;
-        })
-
-            int startPixel = actualPixelRow * x;
-        DEBUG_ONLY(std::cout << "START PIXEL: " << startPixel << std::endl);
-
-
-        // find upper bound of random number in the array
-        float *pUpperBoundColumn = std::upper_bound(cdfColumn + startPixel, cdfColumn + startPixel + x, randomNumberColumn);
-
-        int c = 0;
-        pUpperBoundColumn >= cdfColumn + startPixel + x ? c = startPixel + x - 1 : c = static_cast<int>(pUpperBoundColumn - cdfColumn);
-
-        // find actual pixel column
-        int actualPixelColumn = columnIndices[c];
-        int relativePixelColumn = actualPixelColumn - startPixel;
-        int recalulatedPixelColumn = relativePixelColumn - ((y - 1) / 2);
-
-        DEBUG_ONLY({
-            // print values
-            std::cout << "INDEX IN CDF COLUMN: " << c << std::endl;
-            std::cout << "ACTUAL PIXEL COLUMN: " << actualPixelColumn << std::endl;
-            std::cout << "RELATIVE PIXEL COLUMN (starting from 0): " << relativePixelColumn << std::endl;
-            std::cout << "RECALCULATED PIXEL COLUMN: " << recalulatedPixelColumn << std::endl;
-            std::cout << "----------------------------------------------" << std::endl;
-            std::cout << "----------------------------------------------" << std::endl;
-        })
-
-            // to get the right image orientation, flip the x and y coordinates and then multiply the y values by -1 to flip the pixels vertically
-            float flippedRow = static_cast<float>(recalulatedPixelColumn);
-        float flippedColumn = recalulatedPixelRow * -1.0f;
-
-        // send values back
-        *dx = static_cast<float>(flippedRow) / static_cast<float>(x)* 2.0;
-        *dy = static_cast<float>(flippedColumn) / static_cast<float>(y)* 2.0;
-    }
-};
-
-
-// small 2d bounding box class for aperture LUT data
-class boundingBox2d{
-public:
-    AtVector2 max, min;
-
-    // get center of bounding box
-    AtVector2 getCentroid(){
-        AtVector2 rv((min.x + max.x) * 0.5f, (min.y + max.y) * 0.5f);
-        return rv;
-    }
-
-    // return either Xscale or Yscale depending on which one is largest
-    // needed since I scale the area over which I will shoot rays uniformly
-    // and it needs to cover all of the aperture
-    float getMaxScale(){
-        AtVector2 centroid = getCentroid();
-
-        float x1 = max.x - centroid.x;
-        float y2 = max.y - centroid.y;
-        float scaleX = std::sqrt(x1 * x1);
-        float scaleY = std::sqrt(y2 * y2);
-
-        if (scaleX >= scaleY){
-            return scaleX;
-        }
-        else {
-            return scaleY;
-        }
-    }
-};
-
-
-// lens element data structure
-struct LensElement{
-public:
-    float curvature, thickness, ior, aperture, abbe, center;
-};
-
-// lens data structure, to store variables I don´t want to compute every time
-struct Lensdata{
-    std::vector<LensElement> lenses;
-    int lensCount;
-    float userApertureRadius;
-    int apertureElement;
-    int vignettedRays, succesRays, drawRays;
-    int totalInternalReflection;
-    float apertureDistance;
-    float focalLengthRatio;
-    float filmDiagonal;
-    float originShift;
-    float focalDistance;
-    std::map<float, boundingBox2d> apertureMap;
-};
-
-
 struct cameraParams{
     float sensorWidth;
     float sensorHeight;
     float focalLength;
     float fStop;
     float focalDistance;
+    std::vector<float> focalDistanceKeys; // focus distance over the shutter interval, needs the focus cache
+    float zoom;
     bool useImage;
     std::string bokehPath;
     LensModel lensModel;
     std::string lensDataPath;
+    int builtinLens;
     bool kolbSamplingLUT;
+    bool progressiveLUT;
+    bool wideAngleLUT;
+    bool focusCache;
+    float focusCacheNear;
+    float focusCacheFar;
+    int focusCacheSamples;
+    bool dispersion;
+    bool previewMode;
+    bool lutAccuracyReport;
+    std::string telemetryPath;
+    std::string heatmapPath;
+    int heatmapResolution;
+    std::string rayRecordPath;
+    int rayRecordInterval;
     bool useDof;
     float opticalVignettingDistance;
     float opticalVignettingRadius;
@@ -563,8 +126,22 @@ struct cameraParams{
         , focalLength(0.0f)
         , fStop(0.0f)
         , focalDistance(0.0)
+        , zoom(0.0f)
         , useImage(false)
         , lensModel(NONE)
+        , builtinLens(0)
+        , kolbSamplingLUT(false)
+        , progressiveLUT(false)
+        , wideAngleLUT(false)
+        , focusCache(false)
+        , focusCacheNear(0.0f)
+        , focusCacheFar(0.0f)
+        , focusCacheSamples(0)
+        , dispersion(false)
+        , previewMode(false)
+        , lutAccuracyReport(false)
+        , heatmapResolution(0)
+        , rayRecordInterval(0)
         , useDof(false)
         , opticalVignettingDistance(0.0f)
         , opticalVignettingRadius(0.0f)
@@ -581,28 +158,79 @@ struct cameraParams{
         focalLength = AiNodeGetFlt(node, "focalLength");
         fStop = AiNodeGetFlt(node, "fStop");
         focalDistance = AiNodeGetFlt(node, "focalDistance");
+
+        zoom = AiNodeGetFlt(node, "zoom");
+
+        focalDistanceKeys.clear();
+        AtArray *keys = AiNodeGetArray(node, "focalDistanceKeys");
+        for (uint32_t i = 0; keys && i < AiArrayGetNumElements(keys); i++){
+            focalDistanceKeys.push_back(AiArrayGetFlt(keys, i));
+        }
+
         useImage = AiNodeGetBool(node, "useImage");
         bokehPath = AiNodeGetStr(node, "bokehPath");
         lensModel = (LensModel) AiNodeGetInt(node, "lensModel");
         lensDataPath = AiNodeGetStr(node, "lensDataPath");
+        builtinLens = AiNodeGetInt(node, "builtinLens");
         kolbSamplingLUT = AiNodeGetBool(node, "kolbSamplingLUT");
+        progressiveLUT = AiNodeGetBool(node, "progressiveLUT");
+        wideAngleLUT = AiNodeGetBool(node, "wideAngleLUT");
+        focusCache = AiNodeGetBool(node, "focusCache");
+        focusCacheNear = AiNodeGetFlt(node, "focusCacheNear");
+        focusCacheFar = AiNodeGetFlt(node, "focusCacheFar");
+        focusCacheSamples = AiNodeGetInt(node, "focusCacheSamples");
+        dispersion = AiNodeGetBool(node, "dispersion");
+        previewMode = AiNodeGetBool(node, "previewMode");
+        lutAccuracyReport = AiNodeGetBool(node, "lutAccuracyReport");
+        telemetryPath = AiNodeGetStr(node, "telemetryPath");
+        heatmapPath = AiNodeGetStr(node, "heatmapPath");
+        heatmapResolution = AiNodeGetInt(node, "heatmapResolution");
+        rayRecordPath = AiNodeGetStr(node, "rayRecordPath");
+        rayRecordInterval = AiNodeGetInt(node, "rayRecordInterval");
         useDof = AiNodeGetBool(node, "useDof");
         opticalVignettingDistance = AiNodeGetFlt(node, "opticalVignettingDistance");
         opticalVignettingRadius = AiNodeGetFlt(node, "opticalVignettingRadius");
         exposureControl = AiNodeGetFlt(node, "exposureControl");
     }
 
+    // with the focus cache a focus change is an interpolation, no rebuild
+    bool focusCached() const {
+        return lensModel == RAYTRACED && focusCache;
+    }
+
+    // focus distance at a point in the shutter interval [0, 1], keys are spread evenly over it
+    float shutterFocalDistance(float relativeTime) const {
+        if (!focusCached() || focalDistanceKeys.empty()){ return focalDistance; }
+        if (focalDistanceKeys.size() == 1){ return focalDistanceKeys[0]; }
+
+        float key = std::min(std::max(relativeTime, 0.0f), 1.0f) * static_cast<float>(focalDistanceKeys.size() - 1);
+        int i = std::min(static_cast<int>(key), static_cast<int>(focalDistanceKeys.size()) - 2);
+        return linearInterpolate(key - static_cast<float>(i), focalDistanceKeys[i], focalDistanceKeys[i + 1]);
+    }
+
     bool lensChanged(const cameraParams &rhs){
         return (sensorWidth != rhs.sensorWidth ||
                 sensorHeight != rhs.sensorHeight ||
                 focalLength != rhs.focalLength ||
                 fStop != rhs.fStop ||
-                focalDistance != rhs.focalDistance ||
+                (!focusCached() && focalDistance != rhs.focalDistance) ||
+                focusCached() != rhs.focusCached() ||
+                (focusCached() && (focusCacheNear != rhs.focusCacheNear ||
+                                   focusCacheFar != rhs.focusCacheFar ||
+                                   focusCacheSamples != rhs.focusCacheSamples)) ||
                 useImage != rhs.useImage ||
                 (useImage && bokehPath != rhs.bokehPath) ||
                 lensModel != rhs.lensModel ||
                 (lensModel == RAYTRACED && (lensDataPath != rhs.lensDataPath ||
-                                            kolbSamplingLUT != rhs.kolbSamplingLUT)));
+                                            builtinLens != rhs.builtinLens ||
+                                            kolbSamplingLUT != rhs.kolbSamplingLUT ||
+                                            (kolbSamplingLUT && (progressiveLUT != rhs.progressiveLUT ||
+                                                                 wideAngleLUT != rhs.wideAngleLUT)))));
+    }
+
+    // zoom lenses are compiled at all zoom positions up front, a zoom change only interpolates
+    bool zoomChanged(const cameraParams &rhs){
+        return lensModel == RAYTRACED && zoom != rhs.zoom;
     }
 
     bool bokehChanged(const cameraParams &rhs){
@@ -612,935 +240,1029 @@ struct cameraParams{
 };
 
 
-struct drawData{
-    std::ofstream myfile;
-    std::ofstream testAperturesFile;
-    bool draw;
-    int counter;
-
-    drawData()
-        : draw(false), counter(0){
-    }
-};
+// epoch of a render thread that isn't using any lens data
+static const uint64_t idleEpoch = UINT64_MAX;
 
+// per thread data with every element starting on a cache line. std::allocator only aligns to alignof(max_align_t)
+// before C++17, so the elements are placed in an over-allocated buffer instead.
+static const uintptr_t cacheLineSize = 64;
 
-struct cameraData{
-    float fov;
-    float tan_fov;
-    float apertureRadius;
-    imageData image;
-    cameraParams params;
-    Lensdata lens;
-    drawData draw;
-
-    cameraData()
-        : fov(0.0f), tan_fov(0.0f), apertureRadius(0.0f){
+template <typename T>
+class cacheLineArray{
+public:
+    explicit cacheLineArray(size_t n)
+        : storage(n * sizeof(T) + cacheLineSize), count(n){
+        uintptr_t base = reinterpret_cast<uintptr_t>(&storage[0]);
+        items = reinterpret_cast<T*>((base + cacheLineSize - 1) & ~(cacheLineSize - 1));
+        for (size_t i = 0; i < count; i++){ new (&items[i]) T(); }
     }
 
-    ~cameraData(){
-        image.invalidate();
+    ~cacheLineArray(){
+        for (size_t i = 0; i < count; i++){ items[i].~T(); }
     }
-};
-
 
-// xorshift fast random number generator
-uint32_t xor128(void){
-    static uint32_t x = 123456789, y = 362436069, z = 521288629, w = 88675123;
-    uint32_t t = x ^ (x << 11);
-    x = y; y = z; z = w;
-    return w = (w ^ (w >> 19) ^ t ^ (t >> 8));
-}
+    T& operator[](size_t i){ return items[i]; }
+    const T& operator[](size_t i) const { return items[i]; }
+    size_t size() const { return count; }
+    size_t memory() const { return storage.capacity(); }
 
+private:
+    cacheLineArray(const cacheLineArray&);
+    cacheLineArray& operator=(const cacheLineArray&);
 
-inline float linearInterpolate(float perc, float a, float b){
-    return a + perc * (b - a);
-}
+    std::vector<char> storage;
+    size_t count;
+    T *items;
+};
 
 
-// sin approximation, not completely accurate but faster than std::sin
-inline float fastSin(float x){
-    x = fmod(x + AI_PI, AI_PI * 2) - AI_PI; // restrict x so that -AI_PI < x < AI_PI
-    const float B = 4.0f / AI_PI;
-    const float C = -4.0f / (AI_PI*AI_PI);
-    float y = B * x + C * x * std::abs(x);
-    const float P = 0.225f;
-    return P * (y * std::abs(y) - y) + y;
-}
+// epoch a render thread announced while it uses a camera state
+struct threadEpoch{
+    std::atomic<uint64_t> epoch;
+    char padding[56]; // keep the epochs of different threads on different cache lines
 
+    threadEpoch()
+        : epoch(idleEpoch){
+    }
+};
 
-inline float fastCos(float x){
-    // conversion from sin to cos
-    x += AI_PI * 0.5;
 
-    x = fmod(x + AI_PI, AI_PI * 2) - AI_PI; // restrict x so that -AI_PI < x < AI_PI
-    const float B = 4.0f / AI_PI;
-    const float C = -4.0f / (AI_PI*AI_PI);
-    float y = B * x + C * x * std::abs(x);
-    const float P = 0.225f;
-    return P * (y * std::abs(y) - y) + y;
+// time stamp counter where there is one, nanoseconds otherwise, only differences of it mean anything
+inline uint64_t cycleCounter(){
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
 }
 
-
-// Improved concentric mapping code by Dave Cline [peter shirley´s blog]
-// maps points on the unit square onto the unit disk uniformly
-inline void concentricDiskSample(float ox, float oy, AtVector2 *lens) {
-    float phi, r;
-
-    // switch coordinate space from [0, 1] to [-1, 1]
-    float a = 2.0 * ox - 1.0;
-    float b = 2.0 * oy - 1.0;
-
-    if ((a * a) > (b * b)){
-        r = a;
-        phi = (0.78539816339f) * (b / a);
-    }
-    else {
-        r = b;
-        phi = (AI_PIOVER2)-(0.78539816339f) * (a / b);
-    }
-
-    lens->x = r * fastCos(phi);
-    lens->y = r * fastSin(phi);
+inline uint64_t steadyNanoseconds(){
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
+// one in this many camera rays of a thread gets timed, reading the counter costs as much as a short trace
+static const uint64_t timedRayInterval = 64;
 
-// parse the tabular lens data files
-void readTabularLensData(std::string lensDataFileName, Lensdata *ld){
-    std::ifstream lensDataFile(lensDataFileName);
-    std::string line, token;
-    std::stringstream iss;
-    int lensDataCounter = 0, commentCounter = 0;
-    LensElement lens;
-
-    AiMsgInfo("[ZOIC] ##############################################");
-    AiMsgInfo("[ZOIC] ############# READING LENS DATA ##############");
-    AiMsgInfo("[ZOIC] ##############################################");
-    AiMsgInfo("[ZOIC] Welcome to the lens nerd club :-D");
+// stage profiles of this many of the latest node updates are kept, an IPR session updates without end
+static const size_t keptUpdates = 32;
 
-    // read file without storing data, but count instead
-    int columns = 0, lines = 0;
+// camera ray statistics of one render thread, only ever written by that thread and added up in node_finish
+struct threadTelemetry{
+    uint64_t rays, succesRays, vignettedRays, skippedRays;
+    uint64_t lutLookups, lutCacheHits, lutUncached, bokehSamples; // uncached: lookups of samples without screen derivatives
+    uint64_t tries[maxtries + 2]; // camera rays by the amount of retries they took
+    uint64_t timedRays, timedTicks;
+    char padding[64]; // keep the counters of different threads on different cache lines
 
-    while (getline(lensDataFile, line)){
-        if (line.empty() || line.front() == '#'){ continue; }
-        std::size_t prev = 0, pos;
-        iss << line;
+    threadTelemetry()
+        : rays(0), succesRays(0), vignettedRays(0), skippedRays(0)
+        , lutLookups(0), lutCacheHits(0), lutUncached(0), bokehSamples(0), timedRays(0), timedTicks(0){
+        std::fill(tries, tries + maxtries + 2, 0);
+    }
 
-        while ((pos = line.find_first_of("\t,;: ", prev)) != std::string::npos){
-            if (pos > prev){ ++columns; }
-            prev = pos + 1;
+    void add(const threadTelemetry &rhs){
+        rays += rhs.rays;
+        succesRays += rhs.succesRays;
+        vignettedRays += rhs.vignettedRays;
+        skippedRays += rhs.skippedRays;
+        lutLookups += rhs.lutLookups;
+        lutCacheHits += rhs.lutCacheHits;
+        lutUncached += rhs.lutUncached;
+        bokehSamples += rhs.bokehSamples;
+        for (int i = 0; i < maxtries + 2; i++){
+            tries[i] += rhs.tries[i];
         }
-
-        if (prev < line.length()){ ++columns; }
-
-        iss.clear();
-        ++lines;
+        timedRays += rhs.timedRays;
+        timedTicks += rhs.timedTicks;
     }
 
-    lensDataFile.clear();
-    lensDataFile.seekg(0, std::ios::beg);
-    int totalColumns = static_cast<int>(static_cast<float>(columns) / static_cast<float>(lines));
-    AiMsgInfo("%-40s %12d", "[ZOIC] Data file columns", totalColumns);
-
-    // bail out if not legal amount of columns
-    if (totalColumns < 4){
-        AiMsgError("[ZOIC] Failed to read lens data file.");
-        AiMsgError("[ZOIC] Less than 4 columns of data are found. Please double check.");
-		AiRenderAbort();
-    }
-    else if (totalColumns > 5){
-        AiMsgError("[ZOIC] Failed to read lens data file.");
-        AiMsgError("[ZOIC] More than 5 columns of data are found. Please double check.");
-		AiRenderAbort();
+    uint64_t retries() const{
+        uint64_t total = 0;
+        for (int i = 1; i < maxtries + 2; i++){
+            total += tries[i] * i;
+        }
+        return total;
     }
+};
 
 
-    // read in data fo real
-    switch (totalColumns)
-    {
-    case 4:
-    {
-        while (getline(lensDataFile, line)){
-            if (line.empty() || line.front() == '#'){
-                ++commentCounter;
-                continue;
-            }
-
-            std::size_t prev = 0, pos;
-            iss << line;
-
-            while ((pos = line.find_first_of("\t,;: ", prev)) != std::string::npos){
-                if (pos > prev){
-                    if (lensDataCounter == 0){
-                        lens.curvature = std::stof(line.substr(prev, pos - prev));
-                    }
-                    else if (lensDataCounter == 1){
-                        lens.thickness = std::stof(line.substr(prev, pos - prev));
-                    }
-                    else if (lensDataCounter == 2){
-                        lens.ior = std::stof(line.substr(prev, pos - prev));
-                    }
-                    else if (lensDataCounter == 3){
-                        lens.aperture = std::stof(line.substr(prev, pos - prev));
-                        lensDataCounter = -1;
-                    }
-                }
-
-                prev = pos + 1;
-                ++lensDataCounter;
-            }
-
-            if (prev < line.length()){
-                if (lensDataCounter == 0){
-                    lens.curvature = std::stof(line.substr(prev, std::string::npos));
-                }
-                else if (lensDataCounter == 1){
-                    lens.thickness = std::stof(line.substr(prev, std::string::npos));
-                }
-                else if (lensDataCounter == 2){
-                    lens.ior = std::stof(line.substr(prev, std::string::npos));
-                }
-                else if (lensDataCounter == 3){
-                    lens.aperture = std::stof(line.substr(prev, std::string::npos));
-                    lensDataCounter = -1;
-                }
-
-                ++lensDataCounter;
-            }
+// camera ray cost over the film, in cells of equal size across the sensor
+// cells are shared by the threads rendering around them, so they're counted atomically
+struct heatmapCell{
+    std::atomic<uint32_t> rays, succesRays, traces;
+    std::atomic<uint64_t> ticks;
 
-            ld->lenses.push_back(lens);
-            iss.clear();
-        }
+    heatmapCell()
+        : rays(0), succesRays(0), traces(0), ticks(0){
+    }
+};
 
+class costHeatmap{
+private:
+    int width, height;
+    float aspect; // sensor width over height, sy * aspect spans the film height like sx spans its width
+    std::vector<heatmapCell> cells;
 
-        ld->lensCount = static_cast<int>(ld->lenses.size());
+public:
+    costHeatmap(int _width, float sensorWidth, float sensorHeight)
+        : width(std::max(_width, 1))
+        , height(std::max(static_cast<int>(std::floor(width * sensorHeight / sensorWidth + 0.5f)), 1))
+        , aspect(sensorWidth / sensorHeight)
+        , cells(static_cast<size_t>(width) * static_cast<size_t>(height)){
+    }
 
-        AiMsgInfo("%-40s %12d", "[ZOIC] Comment lines ignored", commentCounter);
+    bool matches(int _width, float sensorWidth, float sensorHeight) const{
+        return width == std::max(_width, 1) && aspect == sensorWidth / sensorHeight;
+    }
 
-        AiMsgInfo("[ZOIC] ##############################################");
-        AiMsgInfo("[ZOIC] #   ROC       Thickness     IOR     Aperture #");
-        AiMsgInfo("[ZOIC] ##############################################");
+    void record(float sx, float sy, int traces, bool succes, uint64_t ticks){
+        int x = static_cast<int>(std::floor((sx + 1.0f) * 0.5f * width));
+        int y = static_cast<int>(std::floor((sy * aspect + 1.0f) * 0.5f * height));
+        if (x < 0 || y < 0 || x >= width || y >= height){ return; }
+
+        // image rows go from the top down, screen space y goes up
+        heatmapCell &cell = cells[static_cast<size_t>(height - 1 - y) * width + x];
+        cell.rays.fetch_add(1, std::memory_order_relaxed);
+        cell.succesRays.fetch_add(succes ? 1 : 0, std::memory_order_relaxed);
+        cell.traces.fetch_add(traces, std::memory_order_relaxed);
+        cell.ticks.fetch_add(ticks, std::memory_order_relaxed);
+    }
 
-        for (int i = 0; i < ld->lensCount; i++){
-            AiMsgInfo("[ZOIC] %10.4f  %10.4f  %10.4f  %10.4f", ld->lenses[i].curvature, ld->lenses[i].thickness, ld->lenses[i].ior, ld->lenses[i].aperture);
+    // mean traces per ray, the fraction of rays that made it through, mean ns per ray and the ray count
+    bool write(const std::string &path, double ticksPerNs) const{
+        std::vector<std::string> names;
+        names.push_back("traces");
+        names.push_back("success");
+        names.push_back("time");
+        names.push_back("rays");
+        std::vector<std::vector<float> > channels(names.size(), std::vector<float>(cells.size(), 0.0f));
+
+        for (size_t i = 0; i < cells.size(); i++){
+            float rays = static_cast<float>(cells[i].rays.load());
+            if (rays == 0.0f){ continue; }
+            channels[0][i] = cells[i].traces.load() / rays;
+            channels[1][i] = cells[i].succesRays.load() / rays;
+            channels[2][i] = ticksPerNs > 0.0 ? static_cast<float>(cells[i].ticks.load() / ticksPerNs / rays) : 0.0f;
+            channels[3][i] = rays;
         }
+        return writeEXR(path, width, height, names, channels);
+    }
+};
 
-        AiMsgInfo("[ZOIC] ##############################################");
-        AiMsgInfo("[ZOIC] ########### END READING LENS DATA ############");
-        AiMsgInfo("[ZOIC] ##############################################");
-
-    } break;
-
-    case 5:
-    {
-        while (getline(lensDataFile, line)){
-            if (line.empty() || line.front() == '#'){
-                ++commentCounter;
-                continue;
-            }
 
-            std::size_t prev = 0, pos;
-            iss << line;
+// sampled camera ray paths, written to a binary file while rendering so they can be drawn afterwards
+// every render thread has its own ring buffer it alone writes to, a writer thread drains them to disk
+// a record that doesn't fit because the writer fell behind is dropped, render threads never wait on it
+//
+// file layout, little endian 32 bit words: "ZOICRAYS" and a version, then chunks of a tag, a word count and the words
+//   LENS  lens id, lens model, surface count, aperture element, aperture radius, focal distance, origin shift,
+//         field of view of a thin lens, then center, curvature, thickness, aperture and ior of every surface
+//   RAYS  records: point count | flags << 8 | thread << 16, ray index, lens id, sx, sy, ray direction, points
+//   DONE  records written, records dropped
+// positions are in lens space, the sensor sits behind the lens at negative z, camera space is lens space turned around
+static const int rayRingWords = 1 << 15;
+
+enum rayRecordFlags{
+    RAYRECORD_TRACED = 1,
+    RAYRECORD_THINLENS = 2,
+    RAYRECORD_SKIPPED = 4
+};
 
-            while ((pos = line.find_first_of("\t,;: ", prev)) != std::string::npos){
-                if (pos > prev){
-                    if (lensDataCounter == 0){
-                        lens.curvature = std::stof(line.substr(prev, pos - prev));
-                    }
-                    else if (lensDataCounter == 1){
-                        lens.thickness = std::stof(line.substr(prev, pos - prev));
-                    }
-                    else if (lensDataCounter == 2){
-                        lens.ior = std::stof(line.substr(prev, pos - prev));
-                    }
-                    else if (lensDataCounter == 3){
-                        lens.abbe = std::stof(line.substr(prev, pos - prev));
-                    }
-                    else if (lensDataCounter == 4){
-                        lens.aperture = std::stof(line.substr(prev, pos - prev));
-                        lensDataCounter = -1;
-                    }
-                }
+struct rayRing{
+    std::atomic<uint32_t*> buffer; // allocated by its render thread on its first record
+    std::atomic<uint64_t> head;    // words written, only moved by the render thread
+    std::atomic<uint64_t> tail;    // words drained, only moved by the writer thread
+    uint64_t dropped;
+    rayPath path;   // scratch for the ray being recorded
+    char padding[64];
 
-                prev = pos + 1;
-                ++lensDataCounter;
-            }
+    rayRing()
+        : buffer(NULL), head(0), tail(0), dropped(0){
+    }
+};
 
-            if (prev < line.length()){
-                if (lensDataCounter == 0){
-                    lens.curvature = std::stof(line.substr(prev, std::string::npos));
-                }
-                else if (lensDataCounter == 1){
-                    lens.thickness = std::stof(line.substr(prev, std::string::npos));
-                }
-                else if (lensDataCounter == 2){
-                    lens.ior = std::stof(line.substr(prev, std::string::npos));
-                }
-                else if (lensDataCounter == 3){
-                    lens.abbe = std::stof(line.substr(prev, pos - prev));
-                }
-                else if (lensDataCounter == 4){
-                    lens.aperture = std::stof(line.substr(prev, std::string::npos));
-                    lensDataCounter = -1;
-                }
+class rayRecorder{
+public:
+    rayRecorder(const std::string &path, int interval)
+        : interval(std::max(interval, 1)), rings(AI_MAX_THREADS), file(std::fopen(path.c_str(), "wb")), stopping(false), recorded(0){
+        if (!file){ return; }
+        const char magic[8] = { 'Z', 'O', 'I', 'C', 'R', 'A', 'Y', 'S' };
+        uint32_t version = 1;
+        std::fwrite(magic, 1, sizeof(magic), file);
+        std::fwrite(&version, sizeof(version), 1, file);
+        writer = std::thread(&rayRecorder::run, this);
+    }
 
-                ++lensDataCounter;
+    ~rayRecorder(){
+        finish();
+        for (size_t t = 0; t < rings.size(); t++){
+            if (rings[t].buffer.load()){
+                delete[] rings[t].buffer.load();
+                AiAddMemUsage(-static_cast<int64_t>(rayRingWords * sizeof(uint32_t)), AtString("zoic"));
             }
-
-            ld->lenses.push_back(lens);
-            iss.clear();
         }
+    }
 
-
-        ld->lensCount = static_cast<int>(ld->lenses.size());
-
-        AiMsgInfo("%-40s %12d", "[ZOIC] Comment lines ignored", commentCounter);
-        AiMsgInfo("[ZOIC] ##############################################");
-        AiMsgInfo("[ZOIC] #  ROC   Thickness   IOR    ABBE    Aperture #");
-        AiMsgInfo("[ZOIC] ##############################################");
-
-        for (int i = 0; i < ld->lensCount; i++){
-            AiMsgInfo("[ZOIC] %7.3f  %7.3f %7.3f   %7.3f   %7.3f", ld->lenses[i].curvature, ld->lenses[i].thickness, ld->lenses[i].ior, ld->lenses[i].abbe, ld->lenses[i].aperture);
+    bool isOpen() const{ return file != NULL; }
+
+    // every interval-th camera ray of a thread is recorded
+    bool sampled(uint64_t ray) const{ return ray % interval == 0; }
+
+    // set up of the lens the following rays go through, the lens id ties the rays to it
+    void lens(uint64_t id, int model, const Lensdata *ld, float apertureRadius, float focalDistance, float fov){
+        std::vector<uint32_t> words;
+        words.push_back(static_cast<uint32_t>(id));
+        words.push_back(static_cast<uint32_t>(model));
+        words.push_back(ld ? static_cast<uint32_t>(ld->lensCount) : 0);
+        words.push_back(ld ? static_cast<uint32_t>(ld->apertureElement) : 0);
+        pushFloat(&words, ld ? ld->userApertureRadius : apertureRadius);
+        pushFloat(&words, focalDistance);
+        pushFloat(&words, ld ? ld->originShift : 0.0f);
+        pushFloat(&words, fov);
+        for (int i = 0; ld && i < ld->lensCount; i++){
+            pushFloat(&words, ld->lenses[i].center);
+            pushFloat(&words, ld->lenses[i].curvature);
+            pushFloat(&words, ld->lenses[i].thickness);
+            pushFloat(&words, ld->lenses[i].aperture);
+            pushFloat(&words, ld->lenses[i].ior);
         }
 
-        AiMsgInfo("[ZOIC] ##############################################");
-        AiMsgInfo("[ZOIC] ########### END READING LENS DATA ############");
-        AiMsgInfo("[ZOIC] ##############################################");
-
-    } break;
+        std::lock_guard<std::mutex> lock(mutex);
+        pendingLenses.push_back(words);
     }
 
-    // reverse the lens order, since we will start with the rear-most lens element
-    std::reverse(ld->lenses.begin(), ld->lenses.end());
-}
-
-
-void cleanupLensData(Lensdata *ld){
-    int apertureCount = 0;
-    for (int i = 0; i < ld->lensCount; i++){
-        // check if there is a 0.0 lensRadiusCurvature, which is the aperture
-        if (ld->lenses[i].curvature == 0.0){
-            ld->apertureElement = i;
-            ++apertureCount;
+    // where render thread tid traces a sampled ray into, reset for every ray
+    rayPath& path(int tid){
+        rings[tid].path.count = 0;
+        return rings[tid].path;
+    }
 
-            // can´t handle > 1 apertures!
-            if (apertureCount > 1){
-                AiMsgError("[ZOIC] Multiple apertures found. Provide lens description with 1 aperture.");
-				AiRenderAbort();
-            }
+    // called by render thread tid only
+    void record(int tid, uint64_t ray, uint64_t lensId, int flags, float sx, float sy, const AtVector &dir, const rayPath &path){
+        rayRing &ring = rings[tid];
+        uint32_t *buffer = ring.buffer.load(std::memory_order_relaxed);
+        if (!buffer){
+            buffer = new uint32_t[rayRingWords];
+            AiAddMemUsage(static_cast<int64_t>(rayRingWords * sizeof(uint32_t)), AtString("zoic"));
+            ring.buffer.store(buffer, std::memory_order_release);
+        }
 
-            // ray sphere intersection even for aperture, so I make it as flat as possible with a very large radius of curvature
-            AiMsgInfo("[ZOIC] Adjusted ROC[%d] [%.4f] to [99999.0]", i, ld->lenses[i].curvature);
-            ld->lenses[i].curvature = 99999.0;
+        uint64_t head = ring.head.load(std::memory_order_relaxed);
+        uint64_t words = 8 + 3 * static_cast<uint64_t>(path.count);
+        if (head + words - ring.tail.load(std::memory_order_acquire) > static_cast<uint64_t>(rayRingWords)){
+            ++ring.dropped;
+            return;
         }
 
-        // air shouldn´t be ior 0.0 but 1.0
-        if (ld->lenses[i].ior == 0.0){
-            AiMsgInfo("[ZOIC] Changed IOR[%d] [%.4f] to [1.0000]", i, ld->lenses[i].ior);
-            ld->lenses[i].ior = 1.0;
+        uint64_t w = head;
+        put(buffer, w++, static_cast<uint32_t>(path.count) | (static_cast<uint32_t>(flags) << 8) | (static_cast<uint32_t>(tid) << 16));
+        put(buffer, w++, static_cast<uint32_t>(ray));
+        put(buffer, w++, static_cast<uint32_t>(lensId));
+        putFloat(buffer, w++, sx);
+        putFloat(buffer, w++, sy);
+        putFloat(buffer, w++, dir.x);
+        putFloat(buffer, w++, dir.y);
+        putFloat(buffer, w++, dir.z);
+        for (int i = 0; i < path.count; i++){
+            putFloat(buffer, w++, path.points[i].x);
+            putFloat(buffer, w++, path.points[i].y);
+            putFloat(buffer, w++, path.points[i].z);
         }
+        ring.head.store(w, std::memory_order_release);
     }
 
-    AiMsgInfo("%-40s %12d", "[ZOIC] Aperture is lens element number", ld->apertureElement);
-
-    // scale from mm to cm
-    for (int i = 0; i < ld->lensCount; i++){
-        ld->lenses[i].curvature *= 0.1;
-        ld->lenses[i].thickness *= 0.1;
-        ld->lenses[i].aperture *= 0.1;
-    }
+    // drains what is left and closes the file, once the render threads are done
+    void finish(){
+        if (!writer.joinable()){ return; }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        writer.join();
 
-    // move lenses so last lens is at origin
-    float summedThickness = 0.0;
-    for (int i = 0; i < ld->lensCount; i++){
-        summedThickness += ld->lenses[i].thickness;
+        uint32_t done[4] = { chunkTag("DONE"), 2, static_cast<uint32_t>(recorded), static_cast<uint32_t>(dropped()) };
+        std::fwrite(done, sizeof(uint32_t), 4, file);
+        std::fclose(file);
+        file = NULL;
     }
 
-    ld->lenses[0].thickness -= summedThickness;
-}
-
+    uint64_t recordCount() const{ return recorded; }
 
-// precomputes the lens centers so they can just be called at every ray creation
-void computeLensCenters(Lensdata *ld){
-    float summedThickness;
-    for (int i = 0; i < ld->lensCount; i++){
-        i == 0 ? summedThickness = ld->lenses[0].thickness : summedThickness += ld->lenses[i].thickness;
-        ld->lenses[i].center = summedThickness - ld->lenses[i].curvature;
+    uint64_t dropped() const{
+        uint64_t total = 0;
+        for (size_t t = 0; t < rings.size(); t++){
+            total += rings[t].dropped;
+        }
+        return total;
     }
-}
-
-
-// ray sphere intersection for lens element intersections
-inline bool raySphereIntersection(AtVector *hit_point, AtVector ray_direction, AtVector ray_origin, AtVector sphere_center, float sphere_radius, bool reverse, bool tracingRealRays){
-    ray_direction = AiV3Normalize(ray_direction);
-    AtVector L = sphere_center - ray_origin;
-
-    float tca = AiV3Dot(L, ray_direction);
-    float radius2 = sphere_radius * sphere_radius;
-    float d2 = AiV3Dot(L, L) - (tca * tca);
-
-    // if the distance from the ray to the spherecenter is larger than its radius, don't worry about it
-    if (tracingRealRays && (d2 > radius2)){ return false; }
-
-    float thc = std::sqrt(std::abs(radius2 - d2));
 
-    float sign = (sphere_radius < 0.0f ? -1.0f : 1.0f);
-
-    if (reverse){
-        *hit_point = ray_origin + ray_direction * (tca - thc * sign);
-    } else {
-        *hit_point = ray_origin + ray_direction * (tca + thc * sign);
+private:
+    uint64_t interval;
+    std::vector<rayRing> rings;
+    std::FILE *file;
+    std::thread writer;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping;
+    std::vector<std::vector<uint32_t> > pendingLenses;
+    std::vector<uint32_t> drained;
+    uint64_t recorded;
+
+    static uint32_t chunkTag(const char *tag){
+        return static_cast<uint32_t>(tag[0]) | (static_cast<uint32_t>(tag[1]) << 8) | (static_cast<uint32_t>(tag[2]) << 16) | (static_cast<uint32_t>(tag[3]) << 24);
     }
 
-    return true;
-}
-
-
-// compute normal at intersection point between ray and lens element
-inline bool intersectionNormal(AtVector hit_point, AtVector sphere_center, float sphere_radius, AtVector *hit_point_normal){
-    float sign = (sphere_radius < 0.0f ? -1.0f : 1.0f);
-
-    *hit_point_normal = AiV3Normalize(sphere_center - hit_point) * sign;
-    return true;
-}
-
-
-// snell's law
-inline bool calculateTransmissionVector(AtVector *ray_direction, float ior1, float ior2, AtVector incidentVector, AtVector normalVector, bool tracingRealRays){
-    incidentVector = AiV3Normalize(incidentVector);
-    normalVector = AiV3Normalize(normalVector);
-
-    float eta;
-    ior2 == 1.0 ? eta = ior1 : eta = ior1 / ior2;
-
-    float c1 = -AiV3Dot(incidentVector, normalVector);
-    float cs2 = (eta * eta) * (1.0 - (c1 * c1));
-
-    // total internal reflection, can only occur when ior1 > ior2
-    if ((tracingRealRays) && (ior1 > ior2) && (cs2 > 1.0)){
-        return false;
+    static uint32_t floatBits(float value){
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return bits;
     }
 
-    *ray_direction = (incidentVector * eta) + (normalVector * ((eta * c1) - std::sqrt(std::abs(1.0 - cs2))));
-    return true;
-}
+    static void pushFloat(std::vector<uint32_t> *words, float value){ words->push_back(floatBits(value)); }
+    static void put(uint32_t *buffer, uint64_t w, uint32_t value){ buffer[w & (rayRingWords - 1)] = value; }
+    static void putFloat(uint32_t *buffer, uint64_t w, float value){ put(buffer, w, floatBits(value)); }
 
-
-// line line intersection for finding the principle plane
-AtVector2 lineLineIntersection(AtVector line1_origin, AtVector line1_direction, AtVector line2_origin, AtVector line2_direction){
-    float A1 = line1_direction.y - line1_origin.y;
-    float B1 = line1_origin.z - line1_direction.z;
-    float C1 = A1 * line1_origin.z + B1 * line1_origin.y;
-    float A2 = line2_direction.y - line2_origin.y;
-    float B2 = line2_origin.z - line2_direction.z;
-    float C2 = A2 * line2_origin.z + B2 * line2_origin.y;
-    float delta = A1 * B2 - A2 * B1;
-    AtVector2 rv = { (B2 * C1 - B1 * C2) / delta, (A1 * C2 - A2 * C1) / delta };
-    return rv;
-}
-
-
-// line plane intersection with fixed intersection at y = 0, for finding the focal length and sensor shift
-AtVector linePlaneIntersection(AtVector rayOrigin, AtVector rayDirection) {
-    AtVector coord(100.0, 0.0, 100.0);
-    AtVector planeNormal(0.0, 1.0, 0.0);
-    rayDirection = AiV3Normalize(rayDirection);
-    coord = AiV3Normalize(coord);
-    return rayOrigin + (rayDirection * (AiV3Dot(coord, planeNormal) - AiV3Dot(planeNormal, rayOrigin)) / AiV3Dot(planeNormal, rayDirection));
-}
-
-
-// calculate distance at which the lens forms fully focused images
-// done by tracing a ray from the focus point backwards through the lens elements and finding the intersection point with y = 0
-float calculateImageDistance(float objectDistance, Lensdata *ld){
-    AtVector ray_origin(0.0f, 0.0f, objectDistance);
-    AtVector ray_direction(0.0f, (ld->lenses[ld->lensCount - 1].aperture / 2.0f) * 0.05f, -objectDistance);
-
-    float summedThickness = 0.0, imageDistance = 0.0;
-    AtVector hit_point_normal, hit_point;
-
-    for (int k = 0; k < ld->lensCount; k++){
-        summedThickness += ld->lenses[k].thickness;
+    void writeChunk(const char *tag, const std::vector<uint32_t> &words){
+        uint32_t header[2] = { chunkTag(tag), static_cast<uint32_t>(words.size()) };
+        std::fwrite(header, sizeof(uint32_t), 2, file);
+        std::fwrite(words.data(), sizeof(uint32_t), words.size(), file);
     }
 
-    for (int i = 0; i < ld->lensCount; i++){
-        if (i != 0){ summedThickness -= ld->lenses[ld->lensCount - i].thickness; }
-
-        AtVector sphere_center(0.0f, 0.0f, summedThickness - ld->lenses[ld->lensCount - 1 - i].curvature);
-
-        raySphereIntersection(&hit_point, ray_direction, ray_origin, sphere_center, ld->lenses[ld->lensCount - 1 - i].curvature, true, false);
-        intersectionNormal(hit_point, sphere_center, -ld->lenses[ld->lensCount - 1 - i].curvature, &hit_point_normal);
-
-        if (i == 0){
-            if (!calculateTransmissionVector(&ray_direction, 1.0, ld->lenses[ld->lensCount - i - 1].ior, ray_direction, hit_point_normal, false)){
-                ld->totalInternalReflection++;
-            }
+    // moves everything the render threads wrote so far to the file
+    void drain(){
+        std::vector<std::vector<uint32_t> > lenses;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            lenses.swap(pendingLenses);
         }
-        else {
-            if (!calculateTransmissionVector(&ray_direction, ld->lenses[ld->lensCount - i].ior, ld->lenses[ld->lensCount - i - 1].ior, ray_direction, hit_point_normal, false)){
-                ld->totalInternalReflection++;
-            }
+        for (size_t i = 0; i < lenses.size(); i++){
+            writeChunk("LENS", lenses[i]);
         }
 
-        if (i == ld->lensCount - 1){
-            imageDistance = linePlaneIntersection(hit_point, ray_direction).z;
+        drained.clear();
+        for (size_t t = 0; t < rings.size(); t++){
+            uint32_t *buffer = rings[t].buffer.load(std::memory_order_acquire);
+            if (!buffer){ continue; }
+
+            uint64_t head = rings[t].head.load(std::memory_order_acquire);
+            uint64_t tail = rings[t].tail.load(std::memory_order_relaxed);
+            while (tail < head){
+                // records are whole between tail and head, count them by their headers
+                uint32_t count = buffer[tail & (rayRingWords - 1)] & 0xff;
+                for (uint64_t w = 0; w < 8 + 3 * static_cast<uint64_t>(count); w++){
+                    drained.push_back(buffer[(tail + w) & (rayRingWords - 1)]);
+                }
+                tail += 8 + 3 * static_cast<uint64_t>(count);
+                ++recorded;
+            }
+            rings[t].tail.store(tail, std::memory_order_release);
         }
-
-        ray_origin = hit_point;
-    }
-
-    AiMsgInfo("%-40s %12.8f", "[ZOIC] Object distance [cm]", objectDistance);
-    AiMsgInfo("%-40s %12.8f", "[ZOIC] Image distance [cm]", imageDistance);
-
-    return imageDistance;
-}
-
-
-// main tracing function which will be called many, many times
-inline bool traceThroughLensElements(AtVector *ray_origin, AtVector *ray_direction, Lensdata *ld, drawData *dd){
-    AtVector hit_point, hit_point_normal, sphere_center;
-
-    for (int i = 0; i < ld->lensCount; i++){
-        sphere_center.x = 0.0f;
-        sphere_center.y = 0.0f;
-        sphere_center.z = ld->lenses[i].center;
-
-        if (!raySphereIntersection(&hit_point, *ray_direction, *ray_origin, sphere_center, ld->lenses[i].curvature, false, true)){
-            return false;
+        if (!drained.empty()){
+            writeChunk("RAYS", drained);
         }
+    }
 
-        float hitPoint2 = hit_point.x * hit_point.x + hit_point.y * hit_point.y;
-
-        // check if ray hits lens boundary or aperture
-        if ((hitPoint2 >(ld->lenses[i].aperture * 0.5) * (ld->lenses[i].aperture * 0.5))
-            || ((i == ld->apertureElement) && (hitPoint2 > (ld->userApertureRadius * ld->userApertureRadius)))){
-            return false;
+    void run(){
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stopping){
+            wake.wait_for(lock, std::chrono::milliseconds(100));
+            lock.unlock();
+            drain();
+            lock.lock();
         }
+        lock.unlock();
+        drain();
+    }
+};
 
-        intersectionNormal(hit_point, sphere_center, ld->lenses[i].curvature, &hit_point_normal);
-
-        DRAW_ONLY({
-            if (dd && dd->draw){
-                dd->myfile << std::fixed << std::setprecision(10) << -ray_origin->z << " ";
-                dd->myfile << std::fixed << std::setprecision(10) << -ray_origin->y << " ";
-                dd->myfile << std::fixed << std::setprecision(10) << -hit_point.z << " ";
-                dd->myfile << std::fixed << std::setprecision(10) << -hit_point.y << " ";
-            }
-        })
-
-            *ray_origin = hit_point;
 
-        // if not last lens element
-        if (i != ld->lensCount - 1){
-            if (!calculateTransmissionVector(ray_direction, ld->lenses[i].ior, ld->lenses[i + 1].ior, *ray_direction, hit_point_normal, true)){
-                ld->totalInternalReflection++;
-                return false;
-            }
-        }
-        else { // last lens element
-            // assuming the material outside the lens is air [ior 1.0]
-            if (!calculateTransmissionVector(ray_direction, ld->lenses[i].ior, 1.0, *ray_direction, hit_point_normal, true)){
-                ld->totalInternalReflection++;
-                return false;
-            }
+// thin lens setup, for THINLENS or as the preview stand in for RAYTRACED
+struct thinLens{
+    float fov;
+    float tan_fov;
+    float apertureRadius;
+    float vignettingDistance, vignettingRadius;
+    float distortion[2]; // radial, on tan of the ray angle: 1 + k1 s^2 + k2 s^4 with s the screen space radius
 
-            DRAW_ONLY({
-                if (dd && dd->draw){
-                    dd->myfile << std::fixed << std::setprecision(10) << -hit_point.z << " ";
-                    dd->myfile << std::fixed << std::setprecision(10) << -hit_point.y << " ";
-                    dd->myfile << std::fixed << std::setprecision(10) << hit_point.z + ray_direction->z * -10000.0 << " ";
-                    dd->myfile << std::fixed << std::setprecision(10) << hit_point.y + ray_direction->y * -10000.0 << " ";
-                }
-            })
-        }
+    thinLens()
+        : fov(0.0f), tan_fov(0.0f), apertureRadius(0.0f)
+        , vignettingDistance(0.0f), vignettingRadius(1.0f){
+        distortion[0] = distortion[1] = 0.0f;
     }
+};
 
-    return true;
-}
-
-
-float traceThroughLensElementsForFocalLength(Lensdata *ld, bool originShift){
-    float tracedFocalLength = 0.0, focalPointDistance = 0.0, principlePlaneDistance = 0.0, summedThickness = 0.0;
-    float rayOriginHeight = ld->lenses[0].aperture * 0.1;
-    AtVector hit_point, hit_point_normal;
-    AtVector ray_origin(0.0, rayOriginHeight, 0.0);
-    AtVector ray_direction(0.0, 0.0, 99999.0);
 
-    for (int i = 0; i < ld->lensCount; i++){
-        // need to keep the summedthickness method since the sphere centers get computed only later on
-        i == 0 ? summedThickness = ld->lenses[0].thickness : summedThickness += ld->lenses[i].thickness;
+// everything the render threads read, set up by node_update and never changed once it is published
+// the lens and bokeh image are handed on from state to state as long as they don't change
+struct cameraState{
+    cameraParams params; // focus distance and focus keys included, with the focus cache they change without the lens
+    Lensdata *lens;
+    imageData *image; // probability functions of the bokeh image
+    bool preview;
+    thinLens thin;
 
-        AtVector sphere_center(0.0, 0.0, summedThickness - ld->lenses[i].curvature);
-        raySphereIntersection(&hit_point, ray_direction, ray_origin, sphere_center, ld->lenses[i].curvature, false, false);
-        intersectionNormal(hit_point, sphere_center, ld->lenses[i].curvature, &hit_point_normal);
+    cameraState(Lensdata *_lens, imageData *_image)
+        : lens(_lens), image(_image), preview(false){
+    }
+};
 
-        if (i != ld->lensCount - 1){
-            if (!calculateTransmissionVector(&ray_direction, ld->lenses[i].ior, ld->lenses[i + 1].ior, ray_direction, hit_point_normal, true)){
-                ld->totalInternalReflection++;
-            }
-        }
-        else { // last element in vector
-            if (!calculateTransmissionVector(&ray_direction, ld->lenses[i].ior, 1.0, ray_direction, hit_point_normal, true)){
-                ld->totalInternalReflection++;
-            }
 
-            // original parallel ray start and end
-            AtVector pp_line1start(0.0, rayOriginHeight, 0.0);
-            AtVector pp_line1end(0.0, rayOriginHeight, 999999.0);
+// a replaced state, with the lens and bokeh image that went out with it, NULL when the next state still uses them
+struct retiredState{
+    cameraState *state;
+    Lensdata *lens;
+    imageData *image;
+    uint64_t epoch;
+};
 
-            // direction ray end
-            AtVector pp_line2end(0.0, 
-                                static_cast<float>(ray_origin.y + (ray_direction.y * 100000.0)), 
-                                static_cast<float>(ray_origin.z + (ray_direction.z * 100000.0)));
 
-            principlePlaneDistance = lineLineIntersection(pp_line1start, pp_line1end, ray_origin, pp_line2end).x;
+struct cameraData{
+    cacheLineArray<sensorPositionRecord> sensorCache;
+    std::atomic<uint32_t> sensorCacheGeneration;
+
+    // nothing the render threads read is changed in place: node_update sets up a new state off to the side and
+    // swaps the pointer, render threads never wait on it. A replaced state is kept around until every
+    // thread that might still be reading it has moved past the epoch it was retired in.
+    std::atomic<cameraState*> state;
+    std::atomic<uint64_t> stateEpoch;
+    std::vector<threadEpoch> threadEpochs;
+    std::vector<retiredState> retiredStates; // only touched by node_update
+    std::atomic<int> anyThreadReaders;
+
+    // zoom lens compiled at every zoom position of its description, only touched by node_update
+    std::vector<Lensdata*> zoomKeys;
+
+    // preview thin lens last fitted, to the lens with this id at this sensor width and focus distance, only touched by node_update
+    // lens ids start at 1, a new lens only gets its id when it is published
+    thinLens previewLens;
+    uint64_t previewLensId;
+    float previewSensorWidth;
+    float previewFocalDistance;
+
+    // render telemetry, counted per thread while rendering and written out in node_finish
+    std::vector<threadTelemetry> telemetry;
+    int64_t retiredInternalReflection; // counted in lenses that got replaced since
+    std::vector<std::vector<setupStage> > updates; // ring of the latest keptUpdates, update n is at n % keptUpdates
+    uint64_t updateCount;
+    uint64_t clockTicks, clockNs; // counter and steady clock at initialization, to turn ticks into time
+
+    // camera ray cost over the film, NULL unless a heatmap path is set
+    // a replaced heatmap is kept until the node goes away, a render thread might still be counting into it
+    std::atomic<costHeatmap*> heatmap;
+    std::vector<costHeatmap*> retiredHeatmaps;
+
+    // sampled ray paths, NULL unless a ray record path is set, replaced recorders are kept like heatmaps
+    std::atomic<rayRecorder*> recorder;
+    std::vector<rayRecorder*> retiredRecorders;
 
-            if (!originShift){
-                AiMsgInfo("%-40s %12.8f", "[ZOIC] Principle Plane distance [cm]", principlePlaneDistance);
-            }
-            else {
-                AiMsgInfo("%-40s %12.8f", "[ZOIC] Adj. PP distance [cm]", principlePlaneDistance);
-            }
+    cameraData()
+        : sensorCache(AI_MAX_THREADS), sensorCacheGeneration(0)
+        , state(new cameraState(new Lensdata(), new imageData())), stateEpoch(1), threadEpochs(AI_MAX_THREADS), anyThreadReaders(0)
+        , previewLensId(0), previewSensorWidth(0.0f), previewFocalDistance(0.0f)
+        , telemetry(AI_MAX_THREADS), retiredInternalReflection(0), updateCount(0)
+        , clockTicks(cycleCounter()), clockNs(steadyNanoseconds()), heatmap(NULL), recorder(NULL){
+    }
 
-            focalPointDistance = linePlaneIntersection(ray_origin, ray_direction).z;
+    // rate of cycleCounter, measured over the life of the node so far
+    double ticksPerNs() const{
+        uint64_t elapsedNs = steadyNanoseconds() - clockNs;
+        return elapsedNs > 0 ? static_cast<double>(cycleCounter() - clockTicks) / elapsedNs : 0.0;
+    }
 
-            if (!originShift){
-                AiMsgInfo("%-40s %12.8f", "[ZOIC] Focal point distance [cm]", focalPointDistance);
-            }
-            else {
-                AiMsgInfo("%-40s %12.8f", "[ZOIC] Adj. Focal point distance [cm]", focalPointDistance);
-            }
+    // heap memory the node holds, plus the lens and bokeh image of a next state that node_update is setting up
+    int64_t memory(const cameraState *next) const{
+        const cameraState *current = state.load();
+        size_t bytes = current->image->memory() + lensMemory(current->lens);
+        if (next && next->image != current->image){ bytes += next->image->memory(); }
+        if (next && next->lens != current->lens){ bytes += lensMemory(next->lens); }
+        for (size_t i = 0; i < zoomKeys.size(); i++){
+            bytes += lensMemory(zoomKeys[i]);
         }
-
-        ray_origin = hit_point;
+        bytes += sensorCache.memory() + telemetry.capacity() * sizeof(threadTelemetry);
+        return static_cast<int64_t>(bytes);
     }
 
-    tracedFocalLength = focalPointDistance - principlePlaneDistance;
-
-    if (!originShift){
-        AiMsgInfo("%-40s %12.8f", "[ZOIC] Raytraced Focal Length [cm]", tracedFocalLength);
+    // forget all cached sensor positions, needed whenever the LUT or the resolution changes
+    // records carry the generation they were made in, so the render threads' records are never written here
+    void invalidateSensorCache(){
+        sensorCacheGeneration.fetch_add(1);
     }
-    else {
-        AiMsgInfo("%-40s %12.8f", "[ZOIC] Adj. Raytraced Focal Length [cm]", tracedFocalLength);
 
+    // pin the current epoch before loading the state, so it can't be deleted while this thread uses it
+    const cameraState* acquireState(int tid){
+        threadEpochs[tid].epoch.store(stateEpoch.load());
+        return state.load();
     }
 
-    return tracedFocalLength;
-}
+    void releaseState(int tid){
+        threadEpochs[tid].epoch.store(idleEpoch, std::memory_order_release);
+    }
 
+    // for callers without a thread id, like camera_reverse_ray
+    // while any of them holds a state nothing retired gets deleted, they're rare and short
+    const cameraState* acquireStateAnyThread(){
+        anyThreadReaders.fetch_add(1);
+        return state.load();
+    }
 
-void adjustFocalLength(Lensdata *ld){
-    for (int i = 0; i < ld->lensCount; i++){
-        ld->lenses[i].curvature *= ld->focalLengthRatio;
-        ld->lenses[i].thickness *= ld->focalLengthRatio;
-        ld->lenses[i].aperture *= ld->focalLengthRatio;
+    void releaseStateAnyThread(){
+        anyThreadReaders.fetch_sub(1, std::memory_order_release);
     }
-}
 
+    // swap in the next state, the previous one is retired in the epoch that ends here
+    // together with its lens and bokeh image, unless the next state took them over
+    void publishState(cameraState *next){
+        const cameraState *current = state.load();
+        if (next->lens != current->lens){
+            next->lens->snapshotId = stateEpoch.load();
+            next->lens->totalInternalReflection.store(0); // only count the render, not the setup
+        }
 
-void writeToFile(Lensdata *ld, std::ofstream &myfile){
-    myfile << "LENSES{";
-    for (int i = 0; i < ld->lensCount; i++){
-        // lenscenter, radius, angle
-        myfile << std::fixed << std::setprecision(10) << -ld->lenses[i].center;
-        myfile << " ";
-        myfile << std::fixed << std::setprecision(10) << -ld->lenses[i].curvature;
-        myfile << " ";
-        myfile << std::fixed << std::setprecision(10) << (std::asin((ld->lenses[i].aperture * 0.5) / ld->lenses[i].curvature)) * (180 / AI_PI);
-        myfile << " ";
+        cameraState *previous = state.exchange(next);
+        retiredState retired;
+        retired.state = previous;
+        retired.lens = (previous->lens != next->lens) ? previous->lens : NULL;
+        retired.image = (previous->image != next->image) ? previous->image : NULL;
+        retired.epoch = stateEpoch.fetch_add(1);
+        if (retired.lens){
+            retiredInternalReflection += retired.lens->totalInternalReflection.load();
+        }
+        retiredStates.push_back(retired);
+        reclaimStates();
     }
-    myfile << "}\n";
 
-    myfile << "IOR{";
-    for (int i = 0; i < ld->lensCount; i++){
-        myfile << std::fixed << std::setprecision(10) << ld->lenses[i].ior;
-        myfile << " ";
-    }
-    myfile << "}\n";
+    // delete the retired states no thread can reach anymore
+    // a thread that pinned epoch e loaded the pointer after e started, so it can only hold states retired in e or later
+    void reclaimStates(){
+        if (anyThreadReaders.load() > 0){ return; }
 
-    myfile << "APERTUREELEMENT{";
-    myfile << std::fixed << std::setprecision(10) << ld->apertureElement;
-    myfile << "}\n";
+        uint64_t oldest = idleEpoch;
+        for (size_t t = 0; t < threadEpochs.size(); t++){
+            oldest = std::min(oldest, threadEpochs[t].epoch.load());
+        }
 
-    myfile << "APERTUREDISTANCE{";
-    myfile << std::fixed << std::setprecision(10) << -ld->apertureDistance;
-    myfile << "}\n";
+        size_t kept = 0;
+        for (size_t i = 0; i < retiredStates.size(); i++){
+            if (retiredStates[i].epoch < oldest){
+                deleteRetired(retiredStates[i]);
+            }
+            else {
+                retiredStates[kept++] = retiredStates[i];
+            }
+        }
+        retiredStates.resize(kept);
+    }
 
-    myfile << "APERTURE{";
-    myfile << std::fixed << std::setprecision(10) << ld->userApertureRadius;
-    myfile << "}\n";
+    static void deleteRetired(const retiredState &retired){
+        delete retired.lens;
+        delete retired.image;
+        delete retired.state;
+    }
 
-    myfile << "APERTUREMAX{";
-    float maxAperture = 0.0;
-    for (int i = 0; i < ld->lensCount; i++){
-        if (ld->lenses[i].aperture > maxAperture){
-            maxAperture = ld->lenses[i].aperture;
+    void clearZoomKeys(){
+        for (size_t i = 0; i < zoomKeys.size(); i++){
+            delete zoomKeys[i];
         }
+        zoomKeys.clear();
     }
-    myfile << std::fixed << std::setprecision(10) << maxAperture;
-    myfile << "}\n";
 
-    myfile << "FOCUSDISTANCE{";
-    myfile << std::fixed << std::setprecision(10) << -ld->focalDistance;
-    myfile << "}\n";
+    ~cameraData(){
+        clearZoomKeys();
 
-    myfile << "IMAGEDISTANCE{";
-    myfile << std::fixed << std::setprecision(10) << -ld->originShift;
-    myfile << "}\n";
+        delete heatmap.load();
+        for (size_t i = 0; i < retiredHeatmaps.size(); i++){
+            delete retiredHeatmaps[i];
+        }
 
-    myfile << "SENSORHEIGHT{";
-    myfile << std::fixed << std::setprecision(10) << 1.7;
-    myfile << "}\n";
-}
+        delete recorder.load();
+        for (size_t i = 0; i < retiredRecorders.size(); i++){
+            delete retiredRecorders[i];
+        }
 
+        // rendering is done, nothing can be holding a state anymore
+        for (size_t i = 0; i < retiredStates.size(); i++){
+            deleteRetired(retiredStates[i]);
+        }
+        cameraState *current = state.load();
+        delete current->lens;
+        delete current->image;
+        delete current;
+    }
+};
 
-// creates a secondary, virtual aperture resembling the exit pupil on a real lens
-bool empericalOpticalVignetting(AtVector origin, AtVector direction, float apertureRadius, float opticalVignettingRadius, float opticalVignettingDistance){
-    // because the first intersection point of the aperture is already known, I can just linearly scale it by the distance to the second aperture
-    AtVector opticalVignetPoint;
-    opticalVignetPoint = (direction * opticalVignettingDistance) - origin;
-    float pointHypotenuse = std::sqrt((opticalVignetPoint.x * opticalVignetPoint.x) + (opticalVignetPoint.y * opticalVignetPoint.y));
-    float virtualApertureTrueRadius = apertureRadius * opticalVignettingRadius;
 
-    return std::abs(pointHypotenuse) < virtualApertureTrueRadius;
-}
+// input and output of the batched camera ray generation
+struct cameraSample{
+    float sx, sy;
+    float lensx, lensy;
+};
 
 
+struct cameraRay{
+    AtVector origin, dir;
+    float weight;
+    int tries;
+};
 
-bool traceThroughLensElementsForApertureSize(AtVector ray_origin, AtVector ray_direction, Lensdata *ld){
-    AtVector hit_point, hit_point_normal, sphere_center;
 
-    for (int i = 0; i < ld->lensCount; i++){
-        sphere_center.x = 0.0;
-        sphere_center.y = 0.0;
-        sphere_center.z = ld->lenses[i].center;
+// generates the RAYTRACED camera rays for many screen samples in one pass, e.g. a whole bucket or scanline
+// samples are sorted by distance from the sensor center so neighbouring rays share LUT entries, then traced in packets
+// a lane whose ray got blocked is refilled with the next retry from the queue, so packets stay full until the very end
+// rays come back in the order of the samples, in the same space camera_create_ray produces them in (without exposure)
+// Arnold hands out camera rays one at a time, so the render itself keeps using camera_create_ray
+bool generateRayBatch(cameraData *camera, const cameraSample *samples, cameraRay *rays, int n, int tid){
+    const cameraState &state = *camera->acquireState(tid);
+    const cameraParams &params = state.params;
 
-        if (!raySphereIntersection(&hit_point, ray_direction, ray_origin, sphere_center, ld->lenses[i].curvature, false, true)){
-            return false;
-        }
+    if (params.lensModel != RAYTRACED || n <= 0){
+        camera->releaseState(tid);
+        return false;
+    }
 
-        float hitPoint2 = (hit_point.x * hit_point.x) + (hit_point.y * hit_point.y);
+    Lensdata &ld = *state.lens;
+    threadTelemetry &stats = camera->telemetry[tid];
+    focusPosition focus = locateFocus(&ld, params.focalDistance);
 
-        // check if ray hits lens boundary or aperture
-        if ((hitPoint2 >(ld->lenses[i].aperture * 0.5) * (ld->lenses[i].aperture * 0.5))
-            || ((i == ld->apertureElement) && (hitPoint2 > (ld->userApertureRadius * ld->userApertureRadius)))){
-            return false;
-        }
+    float halfWidth = params.sensorWidth * 0.5f;
 
-        intersectionNormal(hit_point, sphere_center, ld->lenses[i].curvature, &hit_point_normal);
+    // sampling data per screen sample
+    cacheLineArray<sensorPositionRecord> records(n);
+    std::vector<float> radius(n);
+    std::vector<int> order(n);
 
-        ray_origin = hit_point;
+    for (int i = 0; i < n; i++){
+        float x = samples[i].sx * halfWidth;
+        float y = samples[i].sy * halfWidth;
+        radius[i] = x * x + y * y;
+        order[i] = i;
 
-        // if not last lens element
-        if (i != ld->lensCount - 1){
-            if (!calculateTransmissionVector(&ray_direction, ld->lenses[i].ior, ld->lenses[i + 1].ior, ray_direction, hit_point_normal, true)){
-                ld->totalInternalReflection++;
-                return false;
-            }
+        if (params.kolbSamplingLUT){
+            focusedSensorPositionLookup(&ld, focus, x, y, &records[i]);
+            ++stats.lutLookups;
         }
-        else { // last lens element
-            // assuming the material outside the lens is air [ior 1.0]
-            if (!calculateTransmissionVector(&ray_direction, ld->lenses[i].ior, 1.0, ray_direction, hit_point_normal, true)){
-                ld->totalInternalReflection++;
-                return false;
-            }
+        else { // naive sampling over the whole first lens element
+            records[i].maxScale = ld.lenses[0].aperture;
+            records[i].scaleY = ld.lenses[0].aperture;
+            records[i].maxTries = maxtries + 1;
         }
-    }
 
-    return true;
-}
+        rays[i].origin = AtVector(x, y, focus.originShift);
+        rays[i].dir = AtVector(0.0f, 0.0f, 0.0f);
+        rays[i].weight = 0.0f;
+        rays[i].tries = 0;
+    }
 
+    std::sort(order.begin(), order.end(), arrayCompare(&radius[0]));
+
+    // samples still to be traced, retries are pushed back on top so they get traced while their LUT data is hot
+    std::vector<int> queue;
+    queue.reserve(n);
+    for (int i = 0; i < n; i++){
+        int s = order[i];
+        if (records[s].skipped){
+            ++stats.skippedRays;
+            ++stats.tries[0];
+            continue;
+        }
+        queue.push_back(s);
+    }
 
-// test ground truth aperture shape, only executed if drawing constant is enabled
-void testAperturesTruth(Lensdata *ld, std::ofstream &testAperturesFile){
-    testAperturesFile.open(DRAW_OUT_DIR + "testApertures.zoic", std::ofstream::out | std::ofstream::trunc);
+    rayPacket packet;
+    int laneSample[rayPacketSize];
+    AtVector2 lens(0.0, 0.0);
 
-    AtVector origin, direction;
+    while (!queue.empty()){
+        int lanes = 0;
 
-    int filmSamples = 3;
-    int apertureSamples = 10000;
+        for (; lanes < rayPacketSize && !queue.empty(); lanes++){
+            int s = queue.back();
+            queue.pop_back();
+            laneSample[lanes] = s;
 
-    for (int i = -filmSamples; i < filmSamples + 1; i++){
-        for (int j = -filmSamples; j < filmSamples + 1; j++){
-            AtVector2 lens(0.0, 0.0);
-            testAperturesFile << "GT: ";
+            // first try uses the sample handed in, retries draw new random numbers
+            float u = samples[s].lensx, v = samples[s].lensy;
+            if (rays[s].tries > 0){
+                u = xor128() / 4294967296.0f;
+                v = xor128() / 4294967296.0f;
+            }
+            !params.useImage ? concentricDiskSample(u, v, &lens) : state.image->bokehSample(u, v, &lens.x, &lens.y);
+            stats.bokehSamples += params.useImage ? 1 : 0;
+
+            AtVector dir = lutDirection(&ld, lens.x, lens.y, &records[s], rays[s].origin);
+            packet.ox[lanes] = rays[s].origin.x;
+            packet.oy[lanes] = rays[s].origin.y;
+            packet.oz[lanes] = rays[s].origin.z;
+            packet.dx[lanes] = dir.x;
+            packet.dy[lanes] = dir.y;
+            packet.dz[lanes] = dir.z;
+            packet.alive[lanes] = 1;
+        }
 
-            for (int k = 0; k < apertureSamples; k++){
-                concentricDiskSample(xor128() / 4294967296.0f, xor128() / 4294967296.0f, &lens);
+        // pad a partially filled last packet with dead lanes
+        for (int j = lanes; j < rayPacketSize; j++){
+            packet.ox[j] = packet.oy[j] = packet.dx[j] = packet.dy[j] = 0.0f;
+            packet.oz[j] = focus.originShift;
+            packet.dz[j] = -ld.lenses[0].thickness;
+            packet.alive[j] = 0;
+        }
 
-                origin.x = (static_cast<float>(i) / static_cast<float>(filmSamples)) * (3.6 * 0.5);
-                origin.y = (static_cast<float>(j) / static_cast<float>(filmSamples)) * (3.6 * 0.5);
-                origin.z = ld->originShift;
+        traceRayPacket(&packet, &ld);
 
-                direction.x = (lens.x * ld->lenses[0].aperture) - origin.x;
-                direction.y = (lens.y * ld->lenses[0].aperture) - origin.y;
-                direction.z = -ld->lenses[0].thickness;
+        for (int j = 0; j < lanes; j++){
+            int s = laneSample[j];
 
-                if (traceThroughLensElements(&origin, &direction, ld, NULL)){
-                    testAperturesFile << lens.x * ld->lenses[0].aperture << " " << lens.y * ld->lenses[0].aperture << " ";
-                }
+            if (packet.alive[j]){
+                // flip ray direction and origin
+                rays[s].origin = AtVector(-packet.ox[j], -packet.oy[j], -packet.oz[j]);
+                rays[s].dir = AtVector(-packet.dx[j], -packet.dy[j], -packet.dz[j]);
+                rays[s].weight = 1.0f;
+                ++stats.succesRays;
+                ++stats.tries[rays[s].tries];
+            }
+            else if (rays[s].tries < records[s].maxTries){
+                ++rays[s].tries;
+                queue.push_back(s);
+            }
+            else {
+                ++stats.vignettedRays;
+                ++stats.tries[rays[s].tries];
             }
+        }
+    }
+
+    stats.rays += n;
 
-            testAperturesFile << std::endl;
+    // blocked and skipped rays still start on the (flipped) sensor
+    for (int i = 0; i < n; i++){
+        if (rays[i].weight == 0.0f){
+            rays[i].origin *= -1.0f;
         }
     }
 
-    AiMsgInfo("%-40s", "[ZOIC] Tested Ground Truth");
+    camera->releaseState(tid);
+    return true;
 }
 
 
-void exitPupilLUT(Lensdata *ld, int filmSamplesX, int boundsSamples){
+// stages of one node_update, every mark closes the stage that ran since the previous mark
+// the setupPhase scopes the core runs in the meantime end up nested below that stage
+class updateProfile{
+private:
+    std::vector<setupStage> &stages;
+    std::vector<setupStage> *previous;
+    std::chrono::steady_clock::time_point start, last;
+    int64_t startBytes, lastBytes;
+    size_t first; // where the stage that is running goes, in front of its nested phases
 
-    float filmWidth = 4.0;
-    float filmSpacingX = filmWidth / static_cast<float>(filmSamplesX);
+public:
+    updateProfile(std::vector<setupStage> &_stages, int64_t bytes)
+        : stages(_stages), previous(collectSetupStages(&_stages)), start(std::chrono::steady_clock::now()), last(start)
+        , startBytes(bytes), lastBytes(bytes), first(_stages.size()){
+    }
 
-    AiMsgInfo("%-40s %12d", "[ZOIC] Calculating LUT of size", filmSamplesX);
+    ~updateProfile(){
+        collectSetupStages(previous);
+    }
 
-    for (int i = 0; i < filmSamplesX; i++){
-        AtVector sampleOrigin(static_cast<float>(filmSpacingX * static_cast<float>(i)), 0.0, ld->originShift);
+    void mark(const char *name, int64_t bytes){
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        setupStage stage;
+        stage.name = name;
+        stage.depth = 0;
+        stage.ms = std::chrono::duration<double, std::milli>(now - last).count();
+        stage.bytes = bytes - lastBytes;
+        stages.insert(stages.begin() + first, stage);
+        first = stages.size();
+        last = now;
+        lastBytes = bytes;
+    }
 
-        // calculate bounds of aperture, to eventually find centroid and max scale
-        boundingBox2d apertureBounds;
-        apertureBounds.min = AI_P2_ZERO;
-        apertureBounds.max = AI_P2_ZERO;
+    // one line per update with the time of every stage, the nested phases only at debug verbosity
+    void report(int update, int64_t bytes){
+        double total = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        double marked = 0.0;
+        std::string line;
+        char text[128];
+        for (size_t i = 0; i < stages.size(); i++){
+            if (stages[i].depth > 0){ continue; }
+            std::snprintf(text, sizeof(text), "%s %s %.1f", line.empty() ? "" : ",", stages[i].name.c_str(), stages[i].ms);
+            line += text;
+            marked += stages[i].ms;
+        }
+        if (total - marked >= 0.1){
+            std::snprintf(text, sizeof(text), "%s other %.1f", line.empty() ? "" : ",", total - marked);
+            line += text;
+        }
+        AiMsgInfo("[ZOIC] Update %d: %.1f ms, %+.2f MB |%s [ms]", update, total, static_cast<double>(bytes - startBytes) / (1024.0 * 1024.0), line.c_str());
 
-        AtVector boundsDirection;
-        float lensU = 0.0, lensV = 0.0;
+        for (size_t i = 0; i < stages.size(); i++){
+            AiMsgDebug("[ZOIC] %*s%-*s %10.3f ms %10.1f KB", 2 * stages[i].depth, "", 40 - 2 * stages[i].depth, stages[i].name.c_str(),
+                       stages[i].ms, static_cast<double>(stages[i].bytes) / 1024.0);
+        }
+    }
+};
 
-        for (int b = 0; b < boundsSamples; b++){
-            // random number in domain [-1, 1]
-            lensU = ((xor128() / 4294967296.0f) * 2.0f) - 1.0f;
-            lensV = ((xor128() / 4294967296.0f) * 2.0f) - 1.0f;
 
-            // maybe sample it uniformly instead of randomly? Would probably be more predicatable that way
+// field positions and pupil samples the preview vignetting is fitted with
+static const int previewFieldSamples = 16;
+static const int previewPupilSamples = 4096;
+static const int previewLensSamples = 256;
 
-            // calculate direction vectors over whole first lens element
-            boundsDirection.x = (lensU * ld->lenses[0].aperture) - sampleOrigin.x;
-            boundsDirection.y = (lensV * ld->lenses[0].aperture) - sampleOrigin.y;
-            boundsDirection.z = -ld->lenses[0].thickness;
+// a thin lens can't look sideways, chief rays beyond this angle are left out of the distortion fit
+static const float previewMaxAngle = 1.4f;
 
-            if (traceThroughLensElementsForApertureSize(sampleOrigin, boundsDirection, ld)){
-                // not sure if I need this check..
-                if ((apertureBounds.min.x + apertureBounds.min.y) == 0.0){
-                    apertureBounds.min.x = lensU * ld->lenses[0].aperture;
-                    apertureBounds.min.y = lensV * ld->lenses[0].aperture;
-                    apertureBounds.max.x = lensU * ld->lenses[0].aperture;
-                    apertureBounds.max.y = lensV * ld->lenses[0].aperture;
-                }
 
-                // if any of the bounds exceed previous bounds, replace to grow bbox
-                if ((lensU * ld->lenses[0].aperture) > apertureBounds.max.x){
-                    apertureBounds.max.x = lensU * ld->lenses[0].aperture;
-                }
+// screen space radius at which the distorted thin lens images a ray with the given tan of its angle, by newton from a guess
+float previewFieldRadius(const thinLens &thin, float tanAngle, float s){
+    float target = tanAngle / thin.tan_fov;
+    for (int i = 0; i < 6; i++){
+        float s2 = s * s;
+        float f = s * (1.0f + s2 * (thin.distortion[0] + s2 * thin.distortion[1])) - target;
+        float df = 1.0f + s2 * (3.0f * thin.distortion[0] + 5.0f * s2 * thin.distortion[1]);
+        s -= f / df;
+    }
+    return s;
+}
 
-                if ((lensV * ld->lenses[0].aperture) > apertureBounds.max.y){
-                    apertureBounds.max.y = lensV * ld->lenses[0].aperture;
-                }
 
-                if ((lensU * ld->lenses[0].aperture) < apertureBounds.min.x){
-                    apertureBounds.min.x = lensU * ld->lenses[0].aperture;
-                }
+// equivalent thin lens of a traced lens for look-dev and layout, for the THINLENS code path:
+// the traced focal length and aperture, a radial distortion polynomial fitted to the chief rays for framing and the
+// empericalOpticalVignetting virtual aperture fitted to how much of the exit pupil gets through over the field
+void derivePreviewLens(Lensdata *ld, const cameraParams &params, thinLens *thin){
+    float focalLength = traceThroughLensElementsForFocalLength(ld, true);
+    float halfWidth = params.sensorWidth * 0.5f;
+    float maxField = ld->filmDiagonal / params.sensorWidth; // film corner, in screen space
+
+    thin->fov = 2.0f * std::atan(halfWidth / focalLength);
+    thin->tan_fov = halfWidth / focalLength;
+    thin->apertureRadius = ld->userApertureRadius;
+    thin->distortion[0] = thin->distortion[1] = 0.0f;
+
+    AiMsgInfo("%-40s %12.8f", "[ZOIC] Preview focal length [cm]", focalLength);
+
+    // field of view and distortion, least squares fit of tan(angle) = c0 s + c1 s^3 + c2 s^5 over the inverse chief ray table
+    // the field of view is left free since the traced lens breathes with focus, which the focal length alone doesn't show
+    double m[3][4] = {{0.0}};
+    bool clipped = false;
+    for (int i = 1; i <= static_cast<int>(ld->reverseRadius.size()) - 1; i++){
+        float angle = ld->reverseMaxAngle * static_cast<float>(i) / static_cast<float>(reverseTableSize);
+        double s = ld->reverseRadius[i] / halfWidth;
+        if (s > maxField){ break; }
+        if (angle > previewMaxAngle){
+            clipped = true;
+            break;
+        }
 
-                if ((lensV * ld->lenses[0].aperture) < apertureBounds.min.y){
-                    apertureBounds.min.y = lensV * ld->lenses[0].aperture;
-                }
+        double basis[3] = {s, s * s * s, s * s * s * s * s};
+        for (int r = 0; r < 3; r++){
+            for (int c = 0; c < 3; c++){
+                m[r][c] += basis[r] * basis[c];
             }
+            m[r][3] += basis[r] * std::tan(angle);
         }
-
-        // store bounds of this particular point on aperture in a map for easy lookup
-        ld->apertureMap.insert(std::pair<float, boundingBox2d>(sampleOrigin.x, apertureBounds));
     }
-}
-
-
-
-// test lut, only executed if drawing constant is enabled
-// see camera_create_ray for code documentation on this
-void testAperturesLUT(Lensdata *ld, std::ofstream &testAperturesFile){
 
-    AtVector origin, direction;
-    int filmSamples = 3;
-    int apertureSamples = 5000;
-    float samplingErrorCorrection = 1.05;
-    AtVector2 lens(0.0, 0.0);
+    // gaussian elimination, the normal equations are symmetric positive definite so no pivoting
+    bool solved = m[0][0] > 0.0;
+    for (int r = 0; r < 3 && solved; r++){
+        if (std::abs(m[r][r]) < 1e-12 * m[0][0]){
+            solved = false;
+            break;
+        }
+        for (int below = r + 1; below < 3; below++){
+            double factor = m[below][r] / m[r][r];
+            for (int c = r; c < 4; c++){
+                m[below][c] -= factor * m[r][c];
+            }
+        }
+    }
+    if (solved){
+        double coefficients[3];
+        for (int r = 2; r >= 0; r--){
+            double sum = m[r][3];
+            for (int c = r + 1; c < 3; c++){
+                sum -= m[r][c] * coefficients[c];
+            }
+            coefficients[r] = sum / m[r][r];
+        }
 
-    for (int i = -filmSamples; i < filmSamples + 1; i++){
-        for (int j = -filmSamples; j < filmSamples + 1; j++){
+        if (coefficients[0] > 0.0){
+            thin->tan_fov = static_cast<float>(coefficients[0]);
+            thin->fov = 2.0f * std::atan(thin->tan_fov);
+            thin->distortion[0] = static_cast<float>(coefficients[1] / coefficients[0]);
+            thin->distortion[1] = static_cast<float>(coefficients[2] / coefficients[0]);
+        }
+    }
 
-            origin.x = (static_cast<float>(i) / static_cast<float>(filmSamples)) * (3.6 * 0.5);
-            origin.y = (static_cast<float>(j) / static_cast<float>(filmSamples)) * (3.6 * 0.5);
-            origin.z = ld->originShift;
+    // framing error, where the thin lens puts each chief ray against where the traced lens does
+    float framingError = 0.0f;
+    for (int i = 1; i <= static_cast<int>(ld->reverseRadius.size()) - 1; i++){
+        float angle = ld->reverseMaxAngle * static_cast<float>(i) / static_cast<float>(reverseTableSize);
+        float s = ld->reverseRadius[i] / halfWidth;
+        if (s > maxField || angle > previewMaxAngle){ break; }
+        framingError = std::max(framingError, std::abs(previewFieldRadius(*thin, std::tan(angle), s) - s));
+    }
 
-            testAperturesFile << "SS: ";
+    if (clipped){
+        AiMsgWarning("[ZOIC] The lens sees wider than a thin lens can, the preview frame edges are off");
+    }
 
-            for (int k = 0; k < apertureSamples; k++){
+    // fraction of the rear element that passes light, along the x axis of the sensor relative to its center
+    float traced[previewFieldSamples];
+    for (int f = 0; f < previewFieldSamples; f++){
+        float x = maxField * halfWidth * static_cast<float>(f) / static_cast<float>(previewFieldSamples - 1);
+        int passed = 0;
 
+        rayPacket packet;
+        for (int k = 0; k < previewPupilSamples; k += rayPacketSize){
+            for (int j = 0; j < rayPacketSize; j++){
+                AtVector2 lens(0.0f, 0.0f);
                 concentricDiskSample(xor128() / 4294967296.0f, xor128() / 4294967296.0f, &lens);
+                packet.ox[j] = x;
+                packet.oy[j] = 0.0f;
+                packet.oz[j] = ld->originShift;
+                packet.dx[j] = lens.x * ld->lenses[0].aperture - x;
+                packet.dy[j] = lens.y * ld->lenses[0].aperture;
+                packet.dz[j] = -ld->lenses[0].thickness;
+                packet.alive[j] = 1;
+            }
+            passed += traceRayPacket(&packet, ld);
+        }
 
-                // lowest bound x value
-                float distanceFromOrigin = std::abs(std::sqrt(origin.x * origin.x + origin.y * origin.y));
-
-                std::map<float, boundingBox2d>::iterator low;
-                low = ld->apertureMap.lower_bound(distanceFromOrigin);
-                float lowerBound = low->first;
-
-                // find angle between point and x axis (atan2)
-                float theta = atan2(origin.y, origin.x);
-
-                // precalc sin, cos
-                float sin = fastSin(theta);
-                float cos = fastCos(theta);
-
-                // avoid 0 distance error at origin
-                if (distanceFromOrigin != 0.0){
-                    --low;
-                    float prev = low->first;
-                    float percentage = (distanceFromOrigin - lowerBound) / (prev - lowerBound);
-
-                    // scale point
-                    lens *= linearInterpolate(percentage, ld->apertureMap[lowerBound].getMaxScale(), ld->apertureMap[prev].getMaxScale()) * samplingErrorCorrection;
-
-                    // translate points
-                    lens.x += linearInterpolate(percentage, ld->apertureMap[lowerBound].getCentroid().x, ld->apertureMap[prev].getCentroid().x);
-
-                    // rotate point
-                    float lensx_rotated = lens.x * cos - lens.y * sin;
-                    float lensy_rotated = lens.x * sin + lens.y * cos;
-                    lens.x = lensx_rotated;
-                    lens.y = lensy_rotated;
+        traced[f] = static_cast<float>(passed) / static_cast<float>(previewPupilSamples);
+    }
 
-                }
-                else {
-                    // scale point
-                    lens *= ld->apertureMap[lowerBound].getMaxScale() * samplingErrorCorrection;
+    for (int f = previewFieldSamples - 1; f >= 0; f--){
+        traced[f] = (traced[0] > 0.0f) ? traced[f] / traced[0] : 1.0f;
+    }
 
-                    // translate point
-                    lens.x += ld->apertureMap[lowerBound].getCentroid().x;
+    // thin lens rays towards the plane of focus from stratified lens positions, set up exactly like camera_create_ray does
+    std::vector<AtVector> lensOrigins(previewFieldSamples * previewLensSamples), lensDirections(previewFieldSamples * previewLensSamples);
+    int strata = static_cast<int>(std::sqrt(static_cast<float>(previewLensSamples)));
+    for (int f = 0; f < previewFieldSamples; f++){
+        float s = maxField * static_cast<float>(f) / static_cast<float>(previewFieldSamples - 1);
+        float s2 = s * s;
+        AtVector p(s * thin->tan_fov * (1.0f + s2 * (thin->distortion[0] + s2 * thin->distortion[1])), 0.0f, 1.0f);
+        AtVector dir = AiV3Normalize(p);
+        AtVector focusPoint = dir * std::abs(params.focalDistance / dir.z);
+
+        for (int k = 0; k < previewLensSamples; k++){
+            AtVector2 lens(0.0f, 0.0f);
+            concentricDiskSample((static_cast<float>(k % strata) + 0.5f) / strata, (static_cast<float>(k / strata) + 0.5f) / strata, &lens);
+            lens *= thin->apertureRadius;
+
+            AtVector origin(lens.x, lens.y, 0.0f);
+            lensOrigins[f * previewLensSamples + k] = origin;
+            lensDirections[f * previewLensSamples + k] = AiV3Normalize(focusPoint - origin);
+        }
+    }
 
-                    // rotate point
-                    float lensx_rotated = lens.x * cos - lens.y * sin;
-                    float lensy_rotated = lens.x * sin + lens.y * cos;
-                    lens.x = lensx_rotated;
-                    lens.y = lensy_rotated;
+    // grid search over the virtual aperture, a distance of 0 turns it off
+    float bestError = -1.0f;
+    for (int d = 0; d <= 32; d++){
+        float distance = 4.0f * focalLength * static_cast<float>(d) / 32.0f;
+
+        for (int r = 0; r <= 20; r++){
+            float radius = 1.0f + 2.0f * static_cast<float>(r) / 20.0f;
+            float error = 0.0f;
+
+            for (int f = 0; f < previewFieldSamples; f++){
+                int passed = previewLensSamples;
+                if (distance > 0.0f){
+                    passed = 0;
+                    for (int k = 0; k < previewLensSamples; k++){
+                        passed += empericalOpticalVignetting(lensOrigins[f * previewLensSamples + k], lensDirections[f * previewLensSamples + k],
+                                                             thin->apertureRadius, radius, distance);
+                    }
                 }
 
-                direction.x = lens.x - origin.x;
-                direction.y = lens.y - origin.y;
-                direction.z = -ld->lenses[0].thickness;
+                float difference = static_cast<float>(passed) / static_cast<float>(previewLensSamples) - traced[f];
+                error += difference * difference;
+            }
 
-                testAperturesFile << lens.x << " " << lens.y << " ";
+            if (bestError < 0.0f || error < bestError){
+                bestError = error;
+                thin->vignettingDistance = distance;
+                thin->vignettingRadius = radius;
             }
 
-            testAperturesFile << std::endl;
+            if (distance == 0.0f){ break; }
         }
     }
 
-    testAperturesFile.close();
-
-    // execute python drawing
-    std::string command = "python " + DRAW_SCRIPTS_DIR + "triangleSamplingDraw.py";
-    system(command.c_str());
-
-    AiMsgInfo("%-40s", "[ZOIC] Tested LUT");
+    AiMsgInfo("%-40s %12.8f", "[ZOIC] Preview field of view [deg]", thin->fov * (180.0f / AI_PI));
+    AiMsgInfo("%-40s %12.8f", "[ZOIC] Preview distortion k1", thin->distortion[0]);
+    AiMsgInfo("%-40s %12.8f", "[ZOIC] Preview distortion k2", thin->distortion[1]);
+    if (ld->reverseRadius.empty()){
+        AiMsgWarning("[ZOIC] No field angles traced for this lens, the preview frames with the focal length alone");
+    }
+    else {
+        AiMsgInfo("%-40s %12.8f", "[ZOIC] Preview framing error [% width]", framingError * 50.0f);
+    }
+    AiMsgInfo("%-40s %12.8f", "[ZOIC] Preview vignetting distance [cm]", thin->vignettingDistance);
+    AiMsgInfo("%-40s %12.8f", "[ZOIC] Preview vignetting radius", thin->vignettingRadius);
+    AiMsgInfo("%-40s %12.8f", "[ZOIC] Preview vignetting error [rms]", std::sqrt(bestError / static_cast<float>(previewFieldSamples)));
 }
 
 
@@ -1550,11 +1272,28 @@ node_parameters{
     AiParameterFlt("focalLength", 2.0); // in cm
     AiParameterFlt("fStop", 4.0);
     AiParameterFlt("focalDistance", 100.0);
+    AiParameterArray("focalDistanceKeys", AiArrayAllocate(0, 1, AI_TYPE_FLOAT)); // focus over the shutter interval
+    AiParameterFlt("zoom", 0.0); // 0 - 1 range, only used by zoom lens descriptions
     AiParameterBool("useImage", false);
     AiParameterStr("bokehPath", "");
     AiParameterEnum("lensModel", RAYTRACED, LensModelNames);
     AiParameterStr("lensDataPath", "");
+    AiParameterEnum("builtinLens", 0, builtinLensNames);
     AiParameterBool("kolbSamplingLUT", true);
+    AiParameterBool("progressiveLUT", false);
+    AiParameterBool("wideAngleLUT", false);
+    AiParameterBool("focusCache", false);
+    AiParameterFlt("focusCacheNear", 10.0); // in cm
+    AiParameterFlt("focusCacheFar", 100000.0); // in cm
+    AiParameterInt("focusCacheSamples", 8);
+    AiParameterBool("dispersion", false); // chromatic aberration from the abbe numbers in the lens data
+    AiParameterBool("previewMode", false); // renders RAYTRACED through an equivalent thin lens
+    AiParameterBool("lutAccuracyReport", false); // prints how well the LUT covers the exit pupil whenever it's built
+    AiParameterStr("telemetryPath", ""); // render statistics as json, written when the node is done, <node> becomes the node name
+    AiParameterStr("heatmapPath", ""); // exr of the camera ray cost over the film, written when the node is done
+    AiParameterInt("heatmapResolution", 256); // heatmap width in cells, the height follows the sensor
+    AiParameterStr("rayRecordPath", ""); // binary file of sampled camera ray paths through the lens, see rayRecorder
+    AiParameterInt("rayRecordInterval", 100000); // every how many camera rays of a thread one gets recorded
     AiParameterBool("useDof", true);
     AiParameterFlt("opticalVignettingDistance", 0.0); // distance of the opticalVignetting virtual aperture
     AiParameterFlt("opticalVignettingRadius", 1.0); // 1.0 - .. range float, to multiply with the actual aperture radius
@@ -1562,34 +1301,150 @@ node_parameters{
 }
 
 
+static std::string jsonEscape(const std::string &text){
+    std::string escaped;
+    for (size_t i = 0; i < text.size(); i++){
+        if (text[i] == '"' || text[i] == '\\'){ escaped += '\\'; }
+        escaped += text[i];
+    }
+    return escaped;
+}
+
+
+// everything the node counted while rendering, as json for tracking camera cost across renders
+// ns per ray comes from the timed rays, their counter ticks converted with the ticks per ns since node_initialize
+static void writeTelemetry(const AtNode *node, const cameraData *camera, const threadTelemetry &total, int64_t internalReflection){
+    const cameraState &current = *camera->state.load();
+    const cameraParams &params = current.params;
+
+    std::string path = params.telemetryPath;
+    size_t token = path.find("<node>");
+    if (token != std::string::npos){
+        path.replace(token, 6, AiNodeGetName(node));
+    }
+
+    FILE *file = std::fopen(path.c_str(), "w");
+    if (!file){
+        AiMsgWarning("[ZOIC] Couldn't write telemetry to [%s]", path.c_str());
+        return;
+    }
+
+    double ticksPerNs = camera->ticksPerNs();
+    double nsPerRay = (total.timedRays > 0 && ticksPerNs > 0.0) ? total.timedTicks / ticksPerNs / total.timedRays : 0.0;
+
+    const char *lensModels[] = { "THINLENS", "RAYTRACED", "NONE" };
+    std::string lens = (params.builtinLens > 0 && params.builtinLens <= builtinLensCount) ? builtinLensNames[params.builtinLens] : params.lensDataPath;
+
+    std::fprintf(file, "{\n");
+    std::fprintf(file, "    \"node\": \"%s\",\n", jsonEscape(AiNodeGetName(node)).c_str());
+    std::fprintf(file, "    \"lens_model\": \"%s\",\n", lensModels[std::min(static_cast<int>(params.lensModel), 2)]);
+    std::fprintf(file, "    \"lens\": \"%s\",\n", params.lensModel == RAYTRACED ? jsonEscape(lens).c_str() : "");
+    std::fprintf(file, "    \"lut\": %s,\n", params.kolbSamplingLUT ? "true" : "false");
+    std::fprintf(file, "    \"preview\": %s,\n", current.preview ? "true" : "false");
+    std::fprintf(file, "    \"rays\": %llu,\n", static_cast<unsigned long long>(total.rays));
+    std::fprintf(file, "    \"succesful_rays\": %llu,\n", static_cast<unsigned long long>(total.succesRays));
+    std::fprintf(file, "    \"vignetted_rays\": %llu,\n", static_cast<unsigned long long>(total.vignettedRays));
+    std::fprintf(file, "    \"skipped_rays\": %llu,\n", static_cast<unsigned long long>(total.skippedRays));
+    std::fprintf(file, "    \"total_internal_reflection\": %lld,\n", static_cast<long long>(internalReflection));
+    std::fprintf(file, "    \"retries_histogram\": [");
+    for (int i = 0; i < maxtries + 2; i++){
+        std::fprintf(file, "%s%llu", i ? ", " : "", static_cast<unsigned long long>(total.tries[i]));
+    }
+    std::fprintf(file, "],\n");
+    std::fprintf(file, "    \"traces_per_ray\": %.4f,\n", total.rays ? 1.0 + static_cast<double>(total.retries()) / total.rays : 0.0);
+    std::fprintf(file, "    \"lut_lookups\": %llu,\n", static_cast<unsigned long long>(total.lutLookups));
+    std::fprintf(file, "    \"lut_cache_hits\": %llu,\n", static_cast<unsigned long long>(total.lutCacheHits));
+    std::fprintf(file, "    \"lut_uncached_lookups\": %llu,\n", static_cast<unsigned long long>(total.lutUncached));
+    std::fprintf(file, "    \"bokeh_samples\": %llu,\n", static_cast<unsigned long long>(total.bokehSamples));
+    std::fprintf(file, "    \"timed_rays\": %llu,\n", static_cast<unsigned long long>(total.timedRays));
+    std::fprintf(file, "    \"ns_per_ray\": %.1f,\n", nsPerRay);
+    std::fprintf(file, "    \"memory_bytes\": %lld,\n", static_cast<long long>(camera->memory(NULL)));
+
+    // the kept updates, oldest first
+    size_t kept = camera->updates.size();
+    std::fprintf(file, "    \"update_count\": %llu,\n", static_cast<unsigned long long>(camera->updateCount));
+    std::fprintf(file, "    \"updates\": [");
+    for (size_t u = 0; u < kept; u++){
+        const std::vector<setupStage> &stages = camera->updates[(camera->updateCount - kept + u) % keptUpdates];
+        std::fprintf(file, "%s\n        [", u ? "," : "");
+        for (size_t i = 0; i < stages.size(); i++){
+            std::fprintf(file, "%s{\"stage\": \"%s\", \"depth\": %d, \"ms\": %.3f, \"bytes\": %lld}", i ? ", " : "",
+                         stages[i].name.c_str(), stages[i].depth, stages[i].ms, static_cast<long long>(stages[i].bytes));
+        }
+        std::fprintf(file, "]");
+    }
+    std::fprintf(file, "\n    ]\n}\n");
+    std::fclose(file);
+
+    AiMsgInfo("[ZOIC] Telemetry written to [%s]", path.c_str());
+}
+
+
 node_initialize{
     AiCameraInitialize(node);
     AiNodeSetLocalData(node, new cameraData());
     //cameraData *camera = new cameraData();
     //AiCameraInitialize(node, (void*)camera);
-
-    DRAW_ONLY(AiMsgInfo("[ZOIC] ---- IMAGE DRAWING ENABLED @ COMPILE TIME ----");)
 }
 
 
 node_update{
     AiCameraUpdate(node, false);
     cameraData *camera = (cameraData*)AiNodeGetLocalData(node);
-    drawData &dd = camera->draw;
     cameraParams parms(node);
 
-    DRAW_ONLY({
-        // create file to transfer data to python drawing module
-        dd.myfile.open(DRAW_OUT_DIR + "draw.zoic", std::ofstream::out | std::ofstream::trunc);
-    })
+    // the render threads keep using the current state, everything changes in the next one
+    const cameraState *previous = camera->state.load();
+    cameraState *next = new cameraState(*previous);
+
+    // cached sensor positions depend on the LUT as well as on the resolution
+    camera->invalidateSensorCache();
+
+    // the profile of this update takes the place of the oldest one kept
+    if (camera->updates.size() < keptUpdates){
+        camera->updates.push_back(std::vector<setupStage>());
+    }
+    std::vector<setupStage> &stages = camera->updates[camera->updateCount++ % keptUpdates];
+    stages.clear();
+    updateProfile profile(stages, camera->memory(NULL));
 
     // make probability functions of the bokeh image
-    if (parms.bokehChanged(camera->params)) {
-        camera->image.invalidate();
-        if (parms.useImage && !camera->image.read(parms.bokehPath.c_str())){
+    if (parms.bokehChanged(previous->params)) {
+        next->image = new imageData();
+        if (parms.useImage && !next->image->read(parms.bokehPath.c_str())){
             AiMsgError("[ZOIC] Couldn't open bokeh image!");
             AiRenderAbort();
         }
+        profile.mark("bokeh image", camera->memory(next));
+    }
+
+    // counts over everything rendered from here on, until the layout of the heatmap changes
+    costHeatmap *heatmap = camera->heatmap.load();
+    if (!parms.heatmapPath.empty() && (!heatmap || !heatmap->matches(parms.heatmapResolution, parms.sensorWidth, parms.sensorHeight))){
+        if (heatmap){ camera->retiredHeatmaps.push_back(heatmap); }
+        camera->heatmap.store(new costHeatmap(parms.heatmapResolution, parms.sensorWidth, parms.sensorHeight));
+    }
+    else if (parms.heatmapPath.empty() && heatmap){
+        camera->retiredHeatmaps.push_back(heatmap);
+        camera->heatmap.store(NULL);
+    }
+
+    // a new file for every change of where and how often rays get recorded
+    if (parms.rayRecordPath != previous->params.rayRecordPath || parms.rayRecordInterval != previous->params.rayRecordInterval){
+        rayRecorder *recorder = camera->recorder.load();
+        if (recorder){ camera->retiredRecorders.push_back(recorder); }
+        camera->recorder.store(NULL);
+
+        if (!parms.rayRecordPath.empty()){
+            recorder = new rayRecorder(parms.rayRecordPath, parms.rayRecordInterval);
+            if (recorder->isOpen()){
+                camera->recorder.store(recorder);
+            }
+            else {
+                AiMsgWarning("[ZOIC] Couldn't open [%s] to record ray paths", parms.rayRecordPath.c_str());
+                delete recorder;
+            }
+        }
     }
 
 
@@ -1597,117 +1452,198 @@ node_update{
     {
         case THINLENS:
         {
-            DRAW_ONLY({
-                dd.myfile << "LENSMODEL{THINLENS}";
-                dd.myfile << "\n";
-                dd.myfile << "RAYS{";
-            })
-
-            camera->fov = 2.0f * atan((parms.sensorWidth / (2.0f * parms.focalLength))); // in radians
-            camera->tan_fov = tanf(camera->fov / 2.0f);
-            camera->apertureRadius = (parms.focalLength) / (2.0f * parms.fStop);
+            thinLens &thin = next->thin;
+            thin.fov = 2.0f * atan((parms.sensorWidth / (2.0f * parms.focalLength))); // in radians
+            thin.tan_fov = tanf(thin.fov / 2.0f);
+            thin.apertureRadius = (parms.focalLength) / (2.0f * parms.fStop);
+            thin.vignettingDistance = parms.opticalVignettingDistance;
+            thin.vignettingRadius = parms.opticalVignettingRadius;
+            thin.distortion[0] = thin.distortion[1] = 0.0f;
+            next->preview = false;
+            profile.mark("thin lens", camera->memory(next));
         }
         break;
 
         case RAYTRACED:
         {
-            // check if i actually need to recalculate everything, or parameters didn't change on update
-            if (parms.lensChanged(camera->params)){
-
-                DRAW_ONLY({
-                    dd.myfile << "LENSMODEL{KOLB}";
-                    dd.myfile << "\n";
-                })
+            // zoom lenses don't support the focus cache, a focus change recompiles them
+            bool zoomLens = !camera->zoomKeys.empty();
+            bool zoomFocusChanged = zoomLens && parms.focalDistance != previous->params.focalDistance;
 
-                Lensdata &ld = camera->lens;
+            // check if i actually need to recalculate everything, or parameters didn't change on update
+            if (parms.lensChanged(previous->params) || zoomFocusChanged){
 
-                // reset variables
-                ld.lenses.clear();
-                ld.vignettedRays = 0;
-                ld.succesRays = 0;
-                ld.totalInternalReflection = 0;
-                ld.originShift = 0.0;
-                ld.apertureMap.clear();
+                // compile into a fresh lens for the next state, the render threads keep using the current one
+                Lensdata *compiled = new Lensdata();
+                Lensdata &ld = *compiled;
+                next->lens = compiled;
 
                 // not sure if this is the right way to do it.. probably more to it than this!
                 ld.filmDiagonal = std::sqrt((parms.sensorWidth * parms.sensorWidth) + (parms.sensorHeight * parms.sensorHeight));
 
                 ld.focalDistance = parms.focalDistance;
 
-                // check if file is supplied
+                // angular LUT for wide angle lenses
+                ld.angularLUT = parms.kolbSamplingLUT && parms.wideAngleLUT;
+
+                // check if a built-in lens is picked or a file is supplied
                 // string is const char* so have to do it the oldskool way
-                if (parms.lensDataPath.empty()){
+                bool builtin = parms.builtinLens > 0 && parms.builtinLens <= builtinLensCount;
+                lensDataResult parsed;
+
+                if (!builtin && parms.lensDataPath.empty()){
                     AiMsgError("[ZOIC] Lens Data Path is invalid");
                     AiRenderAbort();
+                    next->lens = previous->lens;
+                    delete compiled;
+
+                } else if (!builtin && !readTabularLensData(parms.lensDataPath, &ld, &parsed)){
+                    // nothing half read gets compiled
+                    AiMsgError("[ZOIC] Failed to read lens data file [%s]", parms.lensDataPath.c_str());
+                    if (parsed.column > 0){
+                        AiMsgError("[ZOIC] Line %d, column %d: %s", parsed.line, parsed.column, lensDataStatusText(parsed.status));
+                    }
+                    else if (parsed.line > 0){
+                        AiMsgError("[ZOIC] Line %d: %s", parsed.line, lensDataStatusText(parsed.status));
+                    }
+                    else {
+                        AiMsgError("[ZOIC] %s", lensDataStatusText(parsed.status));
+                    }
+                    AiRenderAbort();
+                    next->lens = previous->lens;
+                    delete compiled;
 
                 } else {
-                    AiMsgInfo("[ZOIC] Lens Data Path = [%s]", parms.lensDataPath.c_str());
-                    readTabularLensData(parms.lensDataPath, &ld);
-
-                    // look for invalid numbers that would mess it all up bro
-                    cleanupLensData(&ld);
-
-                    // calculate focal length by tracing a parallel ray through the lens system
-                    float kolbFocalLength = traceThroughLensElementsForFocalLength(&ld, false);
-
-                    // find by how much all lens elements should be scaled
-                    ld.focalLengthRatio = parms.focalLength / kolbFocalLength;
-                    AiMsgInfo("%-40s %12.8f", "[ZOIC] Focal length ratio", ld.focalLengthRatio);
+                    if (builtin){
+                        // built-in lenses are compiled in already cleaned up, nothing to parse
+                        AiMsgInfo("[ZOIC] Built-in lens = [%s]", builtinLensNames[parms.builtinLens]);
+                        loadBuiltinLens(parms.builtinLens - 1, &ld);
+                        ld.tracer = builtinLensTracer(ld.lensCount);
+                    }
+                    else {
+                        AiMsgInfo("[ZOIC] Lens Data Path = [%s]", parms.lensDataPath.c_str());
+                        // zoom lenses get cleaned up per zoom position
+                        if (ld.zoomElements.empty()){
+                            cleanupLensData(&ld);
+                        }
+                    }
+                    profile.mark("lens data", camera->memory(next));
 
-                    // scale lens elements
-                    adjustFocalLength(&ld);
+                    // the new lens made it this far, the zoom keys of the one it replaces can go
+                    // when it doesn't, the current lens stays and keeps its zoom keys
+                    camera->clearZoomKeys();
 
-                    // calculate focal length by tracing a parallel ray through the lens system (2nd time for new focallength)
-                    kolbFocalLength = traceThroughLensElementsForFocalLength(&ld, true);
+                    if (!ld.zoomElements.empty()){
+                        if (parms.focusCache){
+                            AiMsgWarning("[ZOIC] Focus cache isn't supported for zoom lenses, ignoring it.");
+                        }
 
-                    // user specified aperture radius from fstop
-                    ld.userApertureRadius = kolbFocalLength / (2.0 * parms.fStop);
-                    AiMsgInfo("%-40s %12.8f", "[ZOIC] User aperture radius [cm]", ld.userApertureRadius);
+                        // every zoom position up front, so an animated zoom only interpolates
+                        buildZoomKeys(&ld, parms.focalLength, parms.fStop, parms.focalDistance, parms.kolbSamplingLUT, &camera->zoomKeys);
+                        interpolateZoom(camera->zoomKeys, parms.zoom, parms.fStop, parms.focalDistance, &ld);
+                        profile.mark("zoom keys", camera->memory(next));
 
-                    // clamp aperture if fstop is wider than max aperture given by lens description
-                    if (ld.userApertureRadius > ld.lenses[ld.apertureElement].aperture){
-                        AiMsgWarning("[ZOIC] Given FSTOP wider than maximum aperture radius provided by lens data.");
-                        AiMsgWarning("[ZOIC] Clamping aperture radius from [%.9f] to [%.9f]", ld.userApertureRadius, ld.lenses[ld.apertureElement].aperture);
-                        ld.userApertureRadius = ld.lenses[ld.apertureElement].aperture;
+                        if (parms.kolbSamplingLUT && parms.useImage && next->image->isValid()){
+                            buildBokehPupilSampling(&ld, *next->image);
+                            profile.mark("bokeh pupil sampling", camera->memory(next));
+                        }
                     }
+                    else {
+                        // calculate focal length by tracing a parallel ray through the lens system
+                        float kolbFocalLength = traceThroughLensElementsForFocalLength(&ld, false);
 
-                    // calculate how much origin should be shifted so that the image distance at a certain object distance falls on the film plane
-                    ld.originShift = calculateImageDistance(parms.focalDistance, &ld);
+                        // find by how much all lens elements should be scaled
+                        ld.focalLengthRatio = parms.focalLength / kolbFocalLength;
+                        AiMsgInfo("%-40s %12.8f", "[ZOIC] Focal length ratio", ld.focalLengthRatio);
 
-                    // calculate distance between film plane and aperture
-                    ld.apertureDistance = 0.0;
-                    for (int i = 0; i < ld.lensCount; i++){
-                        ld.apertureDistance += ld.lenses[i].thickness;
-                        if (i == ld.apertureElement){
-                            AiMsgInfo("%-40s %12.8f", "[ZOIC] Aperture distance [cm]", ld.apertureDistance);
-                            break;
-                        }
-                    }
+                        // scale lens elements
+                        adjustFocalLength(&ld);
 
-                    // precompute lens centers
-                    computeLensCenters(&ld);
+                        prepareLens(&ld, parms.fStop, parms.focalDistance);
+                        profile.mark("focal length and focus", camera->memory(next));
 
-                    // precompute aperture lookup table
-                    if (parms.kolbSamplingLUT){
-                        exitPupilLUT(&ld, 32, 100000);
+                        bool progressive = parms.progressiveLUT;
+                        bool focusCache = parms.focusCache;
 
-                        DRAW_ONLY({
-                            testAperturesTruth(&ld, dd.testAperturesFile);
-                            testAperturesLUT(&ld, dd.testAperturesFile);
-                        })
+                        if (focusCache){
+                            // all focus distances in range at once, so a focus pull doesn't rebuild anything
+                            float nearDistance = std::max(std::min(parms.focusCacheNear, parms.focusCacheFar), 0.001f);
+                            float farDistance = std::max(parms.focusCacheNear, parms.focusCacheFar);
+                            buildFocusCache(&ld, nearDistance, farDistance, std::max(parms.focusCacheSamples, 2), parms.kolbSamplingLUT, progressive);
+                            profile.mark("focus cache", camera->memory(next));
+                        }
+                        // precompute aperture lookup table
+                        else if (parms.kolbSamplingLUT){
+                            exitPupilLUT(&ld, 32, 100000, 4096, progressive);
+                            profile.mark("exit pupil LUT", camera->memory(next));
+
+                            // the joint distribution follows the LUT bounds, which a progressive LUT still changes while rendering
+                            if (parms.useImage && next->image->isValid()){
+                                if (progressive){
+                                    AiMsgWarning("[ZOIC] Joint bokeh image sampling needs the full LUT, not used with the progressive LUT.");
+                                }
+                                else {
+                                    buildBokehPupilSampling(&ld, *next->image);
+                                    profile.mark("bokeh pupil sampling", camera->memory(next));
+                                }
+                            }
+
+                            if (parms.lutAccuracyReport){
+                                std::vector<lutAccuracyRecord> accuracy;
+                                lutAccuracy(&ld, 9, 40000, &accuracy);
+                                printLUTAccuracy(accuracy);
+                                profile.mark("LUT accuracy", camera->memory(next));
+                            }
+                        }
                     }
-
-                    DRAW_ONLY({
-                        // write to file for lens drawing
-                        writeToFile(&ld, dd.myfile);
-                        dd.myfile << "RAYS{";
-                    })
                 }
 
             }
+            else if (zoomLens && parms.zoomChanged(previous->params)){
+                // only the zoom changed, set up a new lens in between the compiled zoom positions
+                Lensdata *compiled = new Lensdata();
+                next->lens = compiled;
+                interpolateZoom(camera->zoomKeys, parms.zoom, parms.fStop, parms.focalDistance, compiled);
+                if (parms.kolbSamplingLUT && parms.useImage && next->image->isValid()){
+                    buildBokehPupilSampling(compiled, *next->image);
+                }
+                profile.mark("zoom interpolation", camera->memory(next));
+            }
+            else if (parms.focusCached() && (parms.focalDistance != previous->params.focalDistance ||
+                                             parms.focalDistanceKeys != previous->params.focalDistanceKeys)){
+                // the focus cache covers every focus distance in range, the new focus only goes out with the next state
+                AiMsgDebug("[ZOIC] Focus changed, taken from the focus cache");
+            }
             else {
                 AiMsgWarning("[ZOIC] Skipping raytraced node update, parameters didn't change.");
             }
+
+            // look-dev and layout render through an equivalent thin lens, derived from the lens of the next state
+            // the fit takes a while, it's only done again for another lens, sensor width or focus distance
+            // the vignetting is fitted on the plane of focus, which moves without a new lens under the focus cache
+            next->preview = false;
+            if (parms.previewMode && next->lens->lensCount > 0){
+                if (next->lens != previous->lens || next->lens->snapshotId != camera->previewLensId ||
+                    parms.sensorWidth != camera->previewSensorWidth || parms.focalDistance != camera->previewFocalDistance){
+                    derivePreviewLens(next->lens, parms, &camera->previewLens);
+                    camera->previewLensId = 0;
+                    camera->previewSensorWidth = parms.sensorWidth;
+                    camera->previewFocalDistance = parms.focalDistance;
+                    profile.mark("preview lens", camera->memory(next));
+                }
+                next->thin = camera->previewLens;
+                next->preview = true;
+            }
+
+            if (parms.focusCached()){
+                if (parms.focalDistance < std::min(parms.focusCacheNear, parms.focusCacheFar) ||
+                    parms.focalDistance > std::max(parms.focusCacheNear, parms.focusCacheFar)){
+                    AiMsgWarning("[ZOIC] Focal distance [%.4f] outside of the focus cache range, clamping", parms.focalDistance);
+                }
+            }
+            else if (!parms.focalDistanceKeys.empty()){
+                AiMsgWarning("[ZOIC] Focal distance keys need the focus cache, using the focal distance instead.");
+            }
         }
 
         case NONE:
@@ -1716,33 +1652,70 @@ node_update{
         break;
     }
     
-    camera->params = parms;
+    next->params = parms;
+    camera->publishState(next);
+    if (next->preview){
+        camera->previewLensId = next->lens->snapshotId;
+    }
+
+    // the lens the recorded rays go through, thin lens rays are tied to lens id 0
+    rayRecorder *recorder = camera->recorder.load();
+    if (recorder){
+        if (next->preview || parms.lensModel == THINLENS){
+            recorder->lens(0, THINLENS, NULL, next->thin.apertureRadius, parms.focalDistance, next->thin.fov);
+        }
+        else if (next->lens->lensCount > 0){
+            recorder->lens(next->lens->snapshotId, RAYTRACED, next->lens, 0.0f, parms.focalDistance, 0.0f);
+        }
+    }
+
+    profile.report(static_cast<int>(camera->updateCount), camera->memory(NULL));
 }
 
 
 node_finish{
     cameraData *camera = (cameraData*)AiNodeGetLocalData(node);
 
-    Lensdata &ld = camera->lens;
-    drawData &dd = camera->draw;
+    const cameraState &current = *camera->state.load();
+    Lensdata &ld = *current.lens;
 
-    AiMsgInfo("%-40s %12d", "[ZOIC] Succesful rays", ld.succesRays);
-    AiMsgInfo("%-40s %12d", "[ZOIC] Vignetted rays", ld.vignettedRays);
-    AiMsgInfo("%-40s %12.8f", "[ZOIC] Vignetted Percentage", (static_cast<float>(ld.vignettedRays) / (static_cast<float>(ld.succesRays) + static_cast<float>(ld.vignettedRays))) * 100.0);
-    AiMsgInfo("%-40s %12d", "[ZOIC] Total internal reflection cases", ld.totalInternalReflection);
+    threadTelemetry total;
+    for (size_t t = 0; t < camera->telemetry.size(); t++){
+        total.add(camera->telemetry[t]);
+    }
+    int64_t internalReflection = camera->retiredInternalReflection + ld.totalInternalReflection.load();
 
-    DRAW_ONLY({
-        AiMsgInfo("%-40s %12d", "[ZOIC] Rays to be drawn", ld.drawRays);
+    AiMsgInfo("%-40s %12llu", "[ZOIC] Succesful rays", static_cast<unsigned long long>(total.succesRays));
+    AiMsgInfo("%-40s %12llu", "[ZOIC] Vignetted rays", static_cast<unsigned long long>(total.vignettedRays));
+    AiMsgInfo("%-40s %12llu", "[ZOIC] Skipped rays outside image circle", static_cast<unsigned long long>(total.skippedRays));
+    AiMsgInfo("%-40s %12llu", "[ZOIC] Retried traces", static_cast<unsigned long long>(total.retries()));
+    AiMsgInfo("%-40s %12.8f", "[ZOIC] Vignetted Percentage", (static_cast<float>(total.vignettedRays) / (static_cast<float>(total.succesRays) + static_cast<float>(total.vignettedRays))) * 100.0);
+    AiMsgInfo("%-40s %12lld", "[ZOIC] Total internal reflection cases", static_cast<long long>(internalReflection));
 
-        dd.myfile << "}";
-        dd.myfile.close();
+    if (!current.params.telemetryPath.empty()){
+        writeTelemetry(node, camera, total, internalReflection);
+    }
 
-        // execute python drawing
-        std::string command = "python " + DRAW_SCRIPTS_DIR + "draw.py";
-        system(command.c_str());
+    costHeatmap *heatmap = camera->heatmap.load();
+    if (heatmap && !current.params.heatmapPath.empty()){
+        if (heatmap->write(current.params.heatmapPath, camera->ticksPerNs())){
+            AiMsgInfo("[ZOIC] Camera ray heatmap written to [%s]", current.params.heatmapPath.c_str());
+        }
+        else {
+            AiMsgWarning("[ZOIC] Couldn't write the camera ray heatmap to [%s]", current.params.heatmapPath.c_str());
+        }
+    }
 
-        AiMsgInfo("[ZOIC] Drawing finished");
-    })
+    // render threads are done, write out what the writer thread hasn't gotten to yet
+    rayRecorder *recorder = camera->recorder.load();
+    if (recorder){
+        recorder->finish();
+        AiMsgInfo("%-40s %12llu", "[ZOIC] Recorded ray paths", static_cast<unsigned long long>(recorder->recordCount()));
+        if (recorder->dropped() > 0){
+            AiMsgWarning("[ZOIC] %llu ray paths dropped, the ray record interval is too small to keep up with", static_cast<unsigned long long>(recorder->dropped()));
+        }
+        AiMsgInfo("[ZOIC] Ray paths written to [%s]", current.params.rayRecordPath.c_str());
+    }
 
     delete camera;
     //AiCameraDestroy(node); arnold 5 change?
@@ -1751,27 +1724,32 @@ node_finish{
 
 camera_create_ray{
     cameraData *camera = (cameraData*)AiNodeGetLocalData(node);
-    cameraParams &params = camera->params;
-    Lensdata &ld = camera->lens;
-    drawData &dd = camera->draw;
+    const cameraState &state = *camera->acquireState(tid);
+    const cameraParams &params = state.params;
+    const thinLens &thin = state.thin;
+    Lensdata &ld = *state.lens;
 
-    DRAW_ONLY({
-        // draw counters
-        if (dd.counter == 100000){
-            dd.draw = true;
-            dd.counter = 0;
-        }
-    })
+    threadTelemetry &stats = camera->telemetry[tid];
+    uint64_t ray = stats.rays++;
+    bool timed = (ray % timedRayInterval) == 0;
+    costHeatmap *heatmap = camera->heatmap.load(std::memory_order_relaxed);
+    uint64_t startTicks = (timed || heatmap) ? cycleCounter() : 0;
+
+    // only the sampled rays keep their path through the lens
+    rayRecorder *recorder = camera->recorder.load(std::memory_order_relaxed);
+    rayPath *path = (recorder && recorder->sampled(ray)) ? &recorder->path(tid) : NULL;
 
     int tries = 0;
-    const int maxtries = 25;
+    int traces = 1; // no trace at all for sensor positions the LUT knows get no light
 
-    switch (params.lensModel)
+    switch (state.preview ? THINLENS : params.lensModel)
     {
         case THINLENS:
         {
-           // create point on lens
-           AtVector p(input.sx * camera->tan_fov, input.sy * camera->tan_fov, 1.0);
+           // create point on lens, radial distortion is only set for the RAYTRACED preview
+           float s2 = input.sx * input.sx + input.sy * input.sy;
+           float distortion = 1.0f + s2 * (thin.distortion[0] + s2 * thin.distortion[1]);
+           AtVector p(input.sx * thin.tan_fov * distortion, input.sy * thin.tan_fov * distortion, 1.0);
 
            // calculate direction vector from origin to point on lens
            output.dir = AiV3Normalize(p - output.origin);
@@ -1784,10 +1762,10 @@ camera_create_ray{
 
               // either get uniformly distributed points on the unit disk or bokeh image
               AtVector2 lens(0.0, 0.0);
-              !params.useImage ? concentricDiskSample(input.lensx, input.lensy, &lens) : camera->image.bokehSample(input.lensx, input.lensy, &lens.x, &lens.y);
+              !params.useImage ? concentricDiskSample(input.lensx, input.lensy, &lens) : state.image->bokehSample(input.lensx, input.lensy, &lens.x, &lens.y);
 
               // scale points in [-1, 1] domain to actual aperture radius
-              lens *= camera->apertureRadius;
+              lens *= thin.apertureRadius;
 
               // new origin is these points on the lens
               output.origin.x = lens.x;
@@ -1799,14 +1777,14 @@ camera_create_ray{
               AtVector focusPoint = output.dir * intersection;
               output.dir = AiV3Normalize(focusPoint - output.origin);
 
-              if (params.opticalVignettingDistance > 0.0f){
+              if (thin.vignettingDistance > 0.0f){
                  // while ray doesn´t succeed through secondary virtual aperture, sample new point on lens and repeat function
-                 while (!empericalOpticalVignetting(output.origin, output.dir, camera->apertureRadius, params.opticalVignettingRadius, params.opticalVignettingDistance) && tries <= maxtries){
+                 while (!empericalOpticalVignetting(output.origin, output.dir, thin.apertureRadius, thin.vignettingRadius, thin.vignettingDistance) && tries <= maxtries){
                         // sample new point on lens
-                        !params.useImage ? concentricDiskSample(xor128() / 4294967296.0f, xor128() / 4294967296.0f, &lens) : camera->image.bokehSample(xor128() / 4294967296.0f, xor128() / 4294967296.0f, &lens.x, &lens.y);
+                        !params.useImage ? concentricDiskSample(xor128() / 4294967296.0f, xor128() / 4294967296.0f, &lens) : state.image->bokehSample(xor128() / 4294967296.0f, xor128() / 4294967296.0f, &lens.x, &lens.y);
 
                         // all thin lens calculations need to be repeated with new lens values
-                        lens *= camera->apertureRadius;
+                        lens *= thin.apertureRadius;
                         output.dir = AiV3Normalize(p - originOriginal);
                         output.origin.x = lens.x;
                         output.origin.y = lens.y;
@@ -1823,26 +1801,22 @@ camera_create_ray{
               // otherwise it would repeat forever if no light can get through
               if (tries > maxtries){
                  output.weight = 0.0f;
-                 ++ld.vignettedRays;
+                 ++stats.vignettedRays;
               }
               else {
-                 ++ld.succesRays;
+                 ++stats.succesRays;
               }
+              stats.bokehSamples += params.useImage ? tries + 1 : 0;
+              traces = tries + 1;
            }
 
-           DRAW_ONLY({
-              if (dd.draw){
-                 dd.myfile << std::fixed << std::setprecision(10) << output.origin.z << " ";
-                 dd.myfile << std::fixed << std::setprecision(10) << output.origin.y << " ";
-                 dd.myfile << std::fixed << std::setprecision(10) << output.dir.z * -10000.0 << " ";
-                 dd.myfile << std::fixed << std::setprecision(10) << output.dir.y * 10000.0 << " ";
-              }
-
-              dd.draw = false;
-           })
+           if (path){
+              path->add(output.origin);
+              recorder->record(tid, ray, 0, RAYRECORD_THINLENS | (tries > maxtries ? 0 : RAYRECORD_TRACED), input.sx, input.sy, output.dir, *path);
+           }
 
-              // now looking down -Z
-              output.dir.z *= -1.0;
+           // now looking down -Z
+           output.dir.z *= -1.0;
         }
 
         break;
@@ -1852,115 +1826,137 @@ camera_create_ray{
         // not sure if this is correct, i´d like to use the diagonal since that seems to be the standard
         output.origin.x = input.sx * (params.sensorWidth * 0.5);
         output.origin.y = input.sy * (params.sensorWidth * 0.5);
-        output.origin.z = ld.originShift;
-
-        DRAW_ONLY({
-            // looks cleaner in 2d when rays are aligned on axis
-            output.origin.x = 0.0;
 
-            // rays start from 0, 0 origin
-            //output.origin.y = 0.0;
-        })
+        // focus may change over the shutter interval, the focus cache has the sensor position and LUT for it
+        float focalDistance = params.shutterFocalDistance(input.relative_time);
+        focusPosition focus = locateFocus(&ld, focalDistance);
+        output.origin.z = focus.originShift;
 
         // store original origin for reset later on
         AtVector kolb_origin_original = output.origin;
+        bool traced = false, skipped = false;
+
+        // dispersion traces every ray at the hero wavelengths
+        AtRGB dispersionWeight = AI_RGB_WHITE;
+        AtRGB *spectralWeight = params.dispersion ? &dispersionWeight : NULL;
 
         // either get uniformly distributed points on the unit disk or bokeh image
         AtVector2 lens(0.0, 0.0);
-        !params.useImage ? concentricDiskSample(input.lensx, input.lensy, &lens) : camera->image.bokehSample(input.lensx, input.lensy, &lens.x, &lens.y);
+        !params.useImage ? concentricDiskSample(input.lensx, input.lensy, &lens) : state.image->bokehSample(input.lensx, input.lensy, &lens.x, &lens.y);
 
         // if not using the LUT - NAIVE OVER WHOLE FIRST LENS ELEMENT, VERY SLOW FOR SMALL APERTURES
         if (!params.kolbSamplingLUT){
             output.dir.x = (lens.x * ld.lenses[0].aperture) - output.origin.x;
             output.dir.y = (lens.y * ld.lenses[0].aperture) - output.origin.y;
             output.dir.z = -ld.lenses[0].thickness;
-            DRAW_ONLY(output.dir.x = 0.0;)
 
-            while (!traceThroughLensElements(&output.origin, &output.dir, &ld, &dd) && tries <= maxtries){
+            traced = traceCameraRay(&output.origin, &output.dir, &ld, path, spectralWeight);
+
+            while (!traced && tries <= maxtries){
                 output.origin = kolb_origin_original;
-                !params.useImage ? concentricDiskSample(xor128() / 4294967296.0, xor128() / 4294967296.0, &lens) : camera->image.bokehSample(xor128() / 4294967296.0, xor128() / 4294967296.0, &lens.x, &lens.y);
+                !params.useImage ? concentricDiskSample(xor128() / 4294967296.0, xor128() / 4294967296.0, &lens) : state.image->bokehSample(xor128() / 4294967296.0, xor128() / 4294967296.0, &lens.x, &lens.y);
                 output.dir.x = (lens.x * ld.lenses[0].aperture) - output.origin.x;
                 output.dir.y = (lens.y * ld.lenses[0].aperture) - output.origin.y;
                 output.dir.z = -ld.lenses[0].thickness;
-                DRAW_ONLY(output.dir.x = 0.0;)
-                    ++tries;
+                ++tries;
+                traced = traceCameraRay(&output.origin, &output.dir, &ld, path, spectralWeight);
             }
         }
         else { // USING LOOKUP TABLE FOR APERTURE SIZE
 
-            float samplingErrorCorrection = 1.05;
-            float distanceFromOrigin = std::abs(std::sqrt(output.origin.x * output.origin.x + output.origin.y * output.origin.y));
-
-            std::map<float, boundingBox2d>::iterator low;
-            low = ld.apertureMap.lower_bound(distanceFromOrigin);
-            float lowerBound = low->first;
-
-            // find angle between point and x axis (atan2)
-            float theta = atan2(output.origin.y, output.origin.x);
-
-            // precalc sin, cos
-            float sin = fastSin(theta);
-            float cos = fastCos(theta);
-
-            --low;
-            float prev = low->first;
-
-            float percentage = (distanceFromOrigin - lowerBound) / (prev - lowerBound);
-
-            float maxScale = linearInterpolate(percentage, ld.apertureMap[lowerBound].getMaxScale(), ld.apertureMap[prev].getMaxScale()) * samplingErrorCorrection;
-            float translation = linearInterpolate(percentage, ld.apertureMap[lowerBound].getCentroid().x, ld.apertureMap[prev].getCentroid().x);
+            // the LUT data barely changes over the area of a pixel, so all AA samples landing in
+            // the same pixel sized cell on the sensor reuse the record of the cell center
+            sensorPositionRecord exact;
+            sensorPositionRecord *rec = &exact;
+            // the derivatives only give the size of a pixel, hosts with a flipped screen y hand in a negative dsy
+            float cellWidth = std::abs(input.dsx), cellHeight = std::abs(input.dsy);
+            bool useCache = (cellWidth > 0.0f && cellHeight > 0.0f);
+
+            if (useCache){
+                rec = &camera->sensorCache[tid];
+                int cellX = static_cast<int>(std::floor(input.sx / cellWidth));
+                int cellY = static_cast<int>(std::floor(input.sy / cellHeight));
+                uint32_t generation = camera->sensorCacheGeneration.load(std::memory_order_relaxed);
+
+                if (cellX != rec->cellX || cellY != rec->cellY || rec->lensId != ld.snapshotId || rec->generation != generation || rec->focalDistance != focalDistance){
+                    rec->lensId = ld.snapshotId;
+                    rec->generation = generation;
+                    rec->focalDistance = focalDistance;
+                    rec->cellX = cellX;
+                    rec->cellY = cellY;
+                    focusedSensorPositionLookup(&ld, focus,
+                                         (cellX + 0.5f) * cellWidth * (params.sensorWidth * 0.5f),
+                                         (cellY + 0.5f) * cellHeight * (params.sensorWidth * 0.5f),
+                                         rec);
+                    ++stats.lutLookups;
+                }
+                else {
+                    ++stats.lutCacheHits;
+                }
+            }
+            else {
+                focusedSensorPositionLookup(&ld, focus, output.origin.x, output.origin.y, rec);
+                ++stats.lutLookups;
+                ++stats.lutUncached;
+            }
 
-            lens *= maxScale;
-            lens.x += translation;
+            skipped = rec->skipped;
 
-            // rotate point
-            float lensx_rotated = lens.x * cos - lens.y * sin;
-            float lensy_rotated = lens.x * sin + lens.y * cos;
-            lens.x = lensx_rotated;
-            lens.y = lensy_rotated;
+            // bokeh image and exit pupil sampled jointly, so most samples make it through
+            // the cells only leave out what can't pass, the ray weight stays as it is for plain rejection sampling
+            bool jointBokeh = params.useImage && !ld.bokehPupilCdf.empty();
 
-            output.dir.x = lens.x - output.origin.x;
-            output.dir.y = lens.y - output.origin.y;
-            output.dir.z = -ld.lenses[0].thickness;
-            DRAW_ONLY(output.dir.x = 0.0;)
+            if (!skipped){
+                if (jointBokeh){
+                    sampleBokehPupil(&ld, rec->bokehBin, input.lensx, input.lensy, &lens);
+                }
 
-            while (!traceThroughLensElements(&output.origin, &output.dir, &ld, &dd) && tries <= maxtries){
-                output.origin = kolb_origin_original;
+                output.dir = lutDirection(&ld, lens.x, lens.y, rec, output.origin);
 
-                !params.useImage ? concentricDiskSample(xor128() / 4294967296.0, xor128() / 4294967296.0, &lens) : camera->image.bokehSample(xor128() / 4294967296.0, xor128() / 4294967296.0, &lens.x, &lens.y);
+                traced = traceCameraRay(&output.origin, &output.dir, &ld, path, spectralWeight);
 
-                lens *= maxScale;
-                lens += translation;
+                while (!traced && tries < rec->maxTries){
+                    output.origin = kolb_origin_original;
 
-                // rotate point
-                lensx_rotated = lens.x * cos - lens.y * sin;
-                lensy_rotated = lens.x * sin + lens.y * cos;
-                lens.x = lensx_rotated;
-                lens.y = lensy_rotated;
+                    if (jointBokeh){
+                        sampleBokehPupil(&ld, rec->bokehBin, xor128() / 4294967296.0f, xor128() / 4294967296.0f, &lens);
+                    }
+                    else {
+                        !params.useImage ? concentricDiskSample(xor128() / 4294967296.0, xor128() / 4294967296.0, &lens) : state.image->bokehSample(xor128() / 4294967296.0, xor128() / 4294967296.0, &lens.x, &lens.y);
+                    }
 
-                output.dir.x = lens.x - output.origin.x;
-                output.dir.y = lens.y - output.origin.y;
-                output.dir.z = -ld.lenses[0].thickness;
-                DRAW_ONLY(output.dir.x = 0.0;)
+                    output.dir = lutDirection(&ld, lens.x, lens.y, rec, output.origin);
 
                     ++tries;
+                    traced = traceCameraRay(&output.origin, &output.dir, &ld, path, spectralWeight);
+                }
             }
         }
 
+        // no light gets to this point on the sensor, known in advance from the LUT
+        if (skipped){
+            output.weight = 0.0f;
+            ++stats.skippedRays;
+        }
         // abort loop if really no light gets to this point on the sensor
-        if (tries > maxtries){
+        else if (!traced){
             output.weight = 0.0f;
-            ++ld.vignettedRays;
+            ++stats.vignettedRays;
         }
         else {
-            ++ld.succesRays;
+            output.weight *= dispersionWeight;
+            ++stats.succesRays;
+        }
+        stats.bokehSamples += params.useImage ? tries + 1 : 0;
+        traces = skipped ? 0 : tries + 1;
+
+        if (path){
+            recorder->record(tid, ray, ld.snapshotId, (traced ? RAYRECORD_TRACED : 0) | (skipped ? RAYRECORD_SKIPPED : 0), input.sx, input.sy, output.dir, *path);
         }
 
         // flip ray direction and origin
         output.dir *= -1.0;
         output.origin *= -1.0;
-
-        DRAW_ONLY(dd.draw = false;)
         }
 
     case NONE:
@@ -1968,6 +1964,8 @@ camera_create_ray{
         break;
     }
     
+    ++stats.tries[std::min(tries, maxtries + 1)];
+
     // EXPERIMENTAL, I KNOW IT IS INCORRECT BUT AT LEAST THE VISUAL PROBLEM IS RESOLVED
     // NOT CALCULATING THE DERIVATIVES PROBS AFFECTS TEXTURE I/O
 
@@ -1986,14 +1984,88 @@ camera_create_ray{
         output.weight *= 1.0f / (1.0f + e2);
     }
 
-    DRAW_ONLY(++dd.counter;)  
+    if (timed || heatmap){
+        uint64_t ticks = cycleCounter() - startTicks;
+        if (timed){
+            stats.timedTicks += ticks;
+            ++stats.timedRays;
+        }
+        if (heatmap){
+            heatmap->record(input.sx, input.sy, traces, output.weight.r > 0.0f || output.weight.g > 0.0f || output.weight.b > 0.0f, ticks);
+        }
+    }
+
+    camera->releaseState(tid);
 }
 
+// screen position a camera space point projects to, for AOVs and tools that need to go from world to screen
 camera_reverse_ray
 {
-    return false;
-}
+    cameraData *camera = (cameraData*)AiNodeGetLocalData(node);
+    const cameraState &state = *camera->acquireStateAnyThread();
+    const cameraParams &params = state.params;
+    const thinLens &thin = state.thin;
+    bool projected = false;
+
+    // the preview is projected like it's rendered, through its thin lens
+    switch (state.preview ? THINLENS : params.lensModel)
+    {
+        case THINLENS:
+        {
+            // straight through the center of the lens, points on the plane of focus land exactly where their rays start
+            if (po.z >= 0.0f){ break; }
+
+            float coeff = 1.0f / (-po.z * thin.tan_fov);
+            Ps.x = po.x * coeff;
+            Ps.y = po.y * coeff;
+            projected = true;
+
+            float rho = std::sqrt(po.x * po.x + po.y * po.y);
+            if (state.preview && rho > 0.0f){
+                float s = rho * coeff;
+                float distorted = previewFieldRadius(thin, rho / -po.z, s);
+                Ps.x *= distorted / s;
+                Ps.y *= distorted / s;
+            }
+        }
+
+        break;
+
+    case RAYTRACED:
+    {
+        Lensdata &ld = *state.lens;
+        float radius = 0.0f;
+
+        if (ld.focusKeys.empty()){
+            projected = reverseProjectRadius(&ld, po, &radius);
+        }
+        else {
+            // blended between the two surrounding focus keys, like the LUT
+            focusPosition focus = locateFocus(&ld, params.focalDistance);
+            float a = 0.0f, b = 0.0f;
+            projected = reverseProjectRadius(ld.focusKeys[focus.key], po, &a) && reverseProjectRadius(ld.focusKeys[focus.key + 1], po, &b);
+            radius = linearInterpolate(focus.t, a, b);
+        }
+
+        if (projected){
+            // same azimuth as the point, in the screen space camera_create_ray takes its sensor positions from
+            float rho = std::sqrt(po.x * po.x + po.y * po.y);
+            float coeff = (rho > 0.0f) ? radius / (rho * params.sensorWidth * 0.5f) : 0.0f;
+            Ps.x = po.x * coeff;
+            Ps.y = po.y * coeff;
+        }
+    }
 
+    break;
+
+    case NONE:
+    default:
+        break;
+    }
+
+    camera->releaseStateAnyThread();
+    return projected;
+}
 
 
 node_loader{
@@ -2004,4 +2076,4 @@ node_loader{
     node->node_type = AI_NODE_CAMERA;
     strcpy(node->version, AI_VERSION);
     return true;
-}
\ No newline at end of file
+}
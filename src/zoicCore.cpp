@@ -0,0 +1,2190 @@
+// ZOIC - lens model core, see zoicCore.h
+
+// (C) Zeno Pelgrims, www.zenopelgrims.com/zoic
+
+#include "zoicCore.h"
+#include "lensCatalog.h"
+
+#include <cstdlib>
+#if __cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+#include <charconv>
+#endif
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+static thread_local std::vector<setupStage> *activeSetupStages = NULL;
+static thread_local int setupPhaseDepth = 0;
+
+std::vector<setupStage>* collectSetupStages(std::vector<setupStage> *stages){
+    std::vector<setupStage> *previous = activeSetupStages;
+    activeSetupStages = stages;
+    setupPhaseDepth = 0;
+    return previous;
+}
+
+setupPhase::setupPhase(const char *_name, const Lensdata *_ld)
+    : name(_name), ld(_ld), stages(activeSetupStages), index(0), startBytes(0){
+    if (!stages){ return; }
+    ++setupPhaseDepth;
+    index = stages->size();
+    startBytes = ld ? lensMemory(ld) : 0;
+    start = std::chrono::steady_clock::now();
+}
+
+setupPhase::~setupPhase(){
+    if (!stages){ return; }
+    setupStage stage;
+    stage.name = name;
+    stage.depth = setupPhaseDepth--;
+    stage.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    stage.bytes = ld ? static_cast<int64_t>(lensMemory(ld)) - static_cast<int64_t>(startBytes) : 0;
+    stages->insert(stages->begin() + index, stage);
+}
+
+
+// xorshift fast random number generator
+uint32_t xor128(void){
+    static uint32_t x = 123456789, y = 362436069, z = 521288629, w = 88675123;
+    uint32_t t = x ^ (x << 11);
+    x = y; y = z; z = w;
+    return w = (w ^ (w >> 19) ^ t ^ (t >> 8));
+}
+
+
+// batched concentric mapping, for when many lens samples are needed at once
+void concentricDiskSampleN(const float *ox, const float *oy, float *lensx, float *lensy, int n){
+    std::vector<float> phi(n), sin(n), cos(n);
+
+    for (int i = 0; i < n; ++i){
+        float a = 2.0f * ox[i] - 1.0f;
+        float b = 2.0f * oy[i] - 1.0f;
+
+        if ((a * a) > (b * b)){
+            lensx[i] = a;
+            phi[i] = (0.78539816339f) * (b / a);
+        }
+        else if (b != 0.0f){
+            lensx[i] = b;
+            phi[i] = (AI_PIOVER2)-(0.78539816339f) * (a / b);
+        }
+        else {
+            lensx[i] = 0.0f;
+            phi[i] = 0.0f;
+        }
+    }
+
+    fastmath::fastSinCosN(&phi[0], &sin[0], &cos[0], n);
+
+    for (int i = 0; i < n; ++i){
+        float r = lensx[i];
+        lensx[i] = r * cos[i];
+        lensy[i] = r * sin[i];
+    }
+}
+
+
+// below this, reading a file is cheaper than setting up and tearing down a mapping
+static const size_t lensDataMapSize = 256 * 1024;
+
+
+// read-only view of a whole lens data file, large ones are mapped so parsing never copies them
+class lensDataFile{
+public:
+    explicit lensDataFile(const std::string &path);
+    ~lensDataFile();
+
+    bool isOpen() const { return opened; }
+    const char* data() const { return mapped ? mapped : (buffer.empty() ? "" : &buffer[0]); }
+    size_t size() const { return mapped ? mappedSize : buffer.size(); }
+
+private:
+    lensDataFile(const lensDataFile&);
+    lensDataFile& operator=(const lensDataFile&);
+
+    bool opened;
+    const char *mapped;
+    size_t mappedSize;
+    std::vector<char> buffer; // when mapping isn't possible
+};
+
+
+#ifdef _WIN32
+lensDataFile::lensDataFile(const std::string &path)
+    : opened(false), mapped(NULL), mappedSize(0){
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE){ return; }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize)){
+        CloseHandle(file);
+        return;
+    }
+
+    if (fileSize.QuadPart >= static_cast<LONGLONG>(lensDataMapSize)){
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping){
+            mapped = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+            mappedSize = mapped ? static_cast<size_t>(fileSize.QuadPart) : 0;
+            CloseHandle(mapping);
+        }
+        opened = mapped != NULL;
+    }
+    else {
+        DWORD count = 0;
+        buffer.resize(static_cast<size_t>(fileSize.QuadPart));
+        opened = buffer.empty() || (ReadFile(file, &buffer[0], static_cast<DWORD>(buffer.size()), &count, NULL) && count == buffer.size());
+    }
+    CloseHandle(file);
+}
+
+lensDataFile::~lensDataFile(){
+    if (mapped){ UnmapViewOfFile(mapped); }
+}
+#else
+lensDataFile::lensDataFile(const std::string &path)
+    : opened(false), mapped(NULL), mappedSize(0){
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0){ return; }
+
+    struct stat info;
+    size_t fileSize = fstat(fd, &info) == 0 && S_ISREG(info.st_mode) ? static_cast<size_t>(info.st_size) : 0;
+    if (fileSize >= lensDataMapSize){
+        void *view = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (view != MAP_FAILED){
+            mapped = static_cast<const char*>(view);
+            mappedSize = fileSize;
+            opened = true;
+        }
+    }
+
+    // small files, pipes and whatever else can't be mapped are read in
+    if (!opened){
+        buffer.resize(fileSize ? fileSize + 1 : 4096);
+        size_t filled = 0;
+        ssize_t count;
+        while ((count = read(fd, &buffer[filled], buffer.size() - filled)) > 0){
+            filled += count;
+            if (filled == buffer.size()){ buffer.resize(filled * 2); }
+        }
+        buffer.resize(filled);
+        opened = count == 0;
+    }
+    close(fd);
+}
+
+lensDataFile::~lensDataFile(){
+    if (mapped){ munmap(const_cast<char*>(mapped), mappedSize); }
+}
+#endif
+
+
+static inline bool isLensDataSeparator(char c){
+    return c == '\t' || c == ',' || c == ';' || c == ':' || c == ' ' || c == '\r' || c == '\v' || c == '\f';
+}
+
+
+// start of the next value on a line, or the line end when there is none left
+static inline const char* nextLensDataToken(const char *p, const char *lineEnd, const char **tokenEnd){
+    while (p < lineEnd && isLensDataSeparator(*p)){ ++p; }
+    const char *q = p;
+    while (q < lineEnd && !isLensDataSeparator(*q)){ ++q; }
+    *tokenEnd = q;
+    return p;
+}
+
+
+// numbers as lens files write them, up to 7 digits and a small exponent. The digits and the power of ten are
+// both exact floats then, so a single multiplication or division rounds exactly like strtof does (Clinger).
+// Anything else is left to the slow path.
+static const float exactPowersOfTen[] = { 1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f };
+
+static inline bool parseShortLensDataNumber(const char *c, const char *end, float *value){
+    bool negative = c < end && *c == '-';
+    if (negative){ ++c; }
+
+    uint32_t mantissa = 0;
+    int digits = 0, exponent = 0;
+    bool seen = false, point = false;
+    for (; c < end; ++c){
+        if (*c >= '0' && *c <= '9'){
+            seen = true;
+            exponent -= point ? 1 : 0;
+            if (mantissa == 0 && *c == '0'){ continue; }
+            if (++digits > 7){ return false; }
+            mantissa = mantissa * 10 + (*c - '0');
+        }
+        else if (*c == '.' && !point){ point = true; }
+        else { break; }
+    }
+    if (!seen){ return false; }
+
+    if (c < end){
+        if (*c != 'e' && *c != 'E'){ return false; }
+        bool negativeExponent = ++c < end && *c == '-';
+        if (c < end && (*c == '-' || *c == '+')){ ++c; }
+        if (c == end){ return false; }
+        int e = 0;
+        for (; c < end; ++c){
+            if (*c < '0' || *c > '9' || e > 100){ return false; }
+            e = e * 10 + (*c - '0');
+        }
+        exponent += negativeExponent ? -e : e;
+    }
+
+    if (mantissa == 0){ exponent = 0; }
+    if (exponent < -10 || exponent > 10){ return false; }
+    float v = static_cast<float>(mantissa);
+    v = exponent < 0 ? v / exactPowersOfTen[-exponent] : v * exactPowersOfTen[exponent];
+    *value = negative ? -v : v;
+    return true;
+}
+
+
+// a plain decimal number, std::from_chars where the library has it for floats, strtof on a copy otherwise.
+// All of them round correctly, so a file reads the same either way and the same as lensCatalog.py reads it.
+static bool parseLensDataNumber(const char *begin, const char *end, float *value){
+    if (begin < end && *begin == '+'){ ++begin; }
+    if (parseShortLensDataNumber(begin, end, value)){ return true; }
+    if (begin == end || end - begin > 63){ return false; }
+
+    // keeps out what only one of the two would take: hex floats, inf, nan, leading whitespace
+    for (const char *c = begin; c < end; ++c){
+        if (!((*c >= '0' && *c <= '9') || *c == '.' || *c == '-' || *c == '+' || *c == 'e' || *c == 'E')){ return false; }
+    }
+
+#if defined(__cpp_lib_to_chars)
+    std::from_chars_result parsed = std::from_chars(begin, end, *value);
+    if (parsed.ec == std::errc()){ return parsed.ptr == end; }
+    if (parsed.ec != std::errc::result_out_of_range){ return false; }
+    // out of range, strtof gives the same overflow and flushes underflow to denormals or 0
+#endif
+
+    char token[64];
+    std::memcpy(token, begin, end - begin);
+    token[end - begin] = '\0';
+    char *parsedEnd = NULL;
+    *value = std::strtof(token, &parsedEnd);
+    return parsedEnd == token + (end - begin) && std::isfinite(*value);
+}
+
+
+static inline bool parseLensDataSurface(const char *begin, const char *end, int *surface){
+    if (begin == end || end - begin > 6){ return false; }
+    int value = 0;
+    for (const char *c = begin; c < end; ++c){
+        if (*c < '0' || *c > '9'){ return false; }
+        value = value * 10 + (*c - '0');
+    }
+    *surface = value;
+    return true;
+}
+
+
+static bool lensDataError(lensDataResult *result, lensDataStatus status, int line, int column){
+    result->status = status;
+    result->line = line;
+    result->column = column;
+    return false;
+}
+
+
+// one line of lens data at a time, with its first token
+struct lensDataLine{
+    const char *next, *end;
+    const char *lineEnd, *token, *tokenEnd;
+    int number;
+
+    lensDataLine(const char *data, size_t size)
+        : next(data), end(data + size), lineEnd(data), token(data), tokenEnd(data), number(0){
+    }
+
+    bool advance(){
+        if (next >= end){ return false; }
+        lineEnd = static_cast<const char*>(std::memchr(next, '\n', end - next));
+        if (!lineEnd){ lineEnd = end; }
+        token = nextLensDataToken(next, lineEnd, &tokenEnd);
+        next = lineEnd < end ? lineEnd + 1 : end;
+        ++number;
+        return true;
+    }
+
+    bool blank() const{ return token == lineEnd; }
+    bool comment() const{ return !blank() && *token == '#' && !zoom() && !asphere(); }
+    bool zoom() const{ return tokenEnd - token == 5 && std::memcmp(token, "#ZOOM", 5) == 0; }
+    bool asphere() const{ return tokenEnd - token == 8 && std::memcmp(token, "#ASPHERE", 8) == 0; }
+    bool element() const{ return !blank() && *token != '#'; }
+};
+
+
+// surface and values of a #ZOOM or #ASPHERE line, values only counted when there is no room given for them
+static bool parseLensDirective(const lensDataLine &line, int *surface, float *values, size_t capacity, size_t *count, lensDataResult *result){
+    const char *tokenEnd;
+    const char *token = nextLensDataToken(line.tokenEnd, line.lineEnd, &tokenEnd);
+    if (!parseLensDataSurface(token, tokenEnd, surface)){
+        return lensDataError(result, LENSDATA_BAD_DIRECTIVE, line.number, 2);
+    }
+
+    *count = 0;
+    while ((token = nextLensDataToken(tokenEnd, line.lineEnd, &tokenEnd)) != line.lineEnd){
+        float value;
+        if (!parseLensDataNumber(token, tokenEnd, &value)){
+            return lensDataError(result, LENSDATA_BAD_NUMBER, line.number, static_cast<int>(*count) + 3);
+        }
+        if (*count < capacity){ values[*count] = value; }
+        ++*count;
+    }
+    return true;
+}
+
+
+// lens data description, one lens element per line going from the front of the lens to the back:
+//     <radius of curvature> <thickness> <ior> [abbe number] <aperture>
+// in mm, separated by any of tab , ; : or space. 0 as the radius of curvature marks the aperture stop, 0 as the ior air.
+// Lines starting with # are comments, which is where the extra lens data goes so the files still read as plain
+// spherical primes elsewhere. Surfaces are numbered from 1 in file order, values are in mm like the rest of the file.
+//
+// zoom lens, every #ZOOM line needs the same amount (>= 2) of thickness values:
+//     #ZOOM <surface> <thickness at zoom 0> ... <thickness at zoom 1>
+// even asphere, sag = c r^2 / (1 + sqrt(1 - (1 + conic) c^2 r^2)) + A4 r^4 + A6 r^6 + ... + A14 r^14, missing terms are 0:
+//     #ASPHERE <surface> <conic> <A4> <A6> ... <A14>
+//
+// Every value is parsed once, straight out of the buffer. A quick count of the lines up front lets the lens elements go
+// into their final vector directly, the only allocations are the ones that end up in ld. The few #ZOOM and #ASPHERE
+// lines are applied in a last sweep, once all lens elements are known. Nothing in ld changes unless the whole
+// description is valid, otherwise result says what is wrong and where.
+bool parseTabularLensData(const char *data, size_t size, Lensdata *ld, lensDataResult *result){
+    *result = lensDataResult();
+
+    int elementLines = 0, zoomLines = 0, directiveLines = 0;
+    for (lensDataLine line(data, size); line.advance(); ){
+        elementLines += line.element() ? 1 : 0;
+        zoomLines += line.zoom() ? 1 : 0;
+        directiveLines += (line.zoom() || line.asphere()) ? 1 : 0;
+    }
+
+    // lens elements are stored rear-most first, so the rows fill the vector from the back
+    std::vector<LensElement> lenses(elementLines);
+    int row = 0, apertureCount = 0;
+
+    for (lensDataLine line(data, size); line.advance(); ){
+        if (line.blank() || line.comment()){
+            ++result->commentLines;
+            continue;
+        }
+
+        // directives are only checked for their syntax here, so errors come in the order of the lines
+        if (!line.element()){
+            int surface;
+            size_t count;
+            if (!parseLensDirective(line, &surface, NULL, 0, &count, result)){ return false; }
+            continue;
+        }
+
+        // lens element, the abbe number is the optional fourth column
+        float values[5];
+        int count = 0;
+        const char *tokenEnd = line.tokenEnd;
+        for (const char *token = line.token; token != line.lineEnd; token = nextLensDataToken(tokenEnd, line.lineEnd, &tokenEnd)){
+            if (count == 5){
+                return lensDataError(result, result->columns ? LENSDATA_INCONSISTENT_COLUMNS : LENSDATA_COLUMN_COUNT, line.number, count + 1);
+            }
+            if (!parseLensDataNumber(token, tokenEnd, &values[count])){
+                return lensDataError(result, LENSDATA_BAD_NUMBER, line.number, count + 1);
+            }
+            ++count;
+        }
+
+        if (result->columns == 0){
+            if (count < 4){ return lensDataError(result, LENSDATA_COLUMN_COUNT, line.number, 0); }
+            result->columns = count;
+        }
+        else if (count != result->columns){
+            return lensDataError(result, LENSDATA_INCONSISTENT_COLUMNS, line.number, 0);
+        }
+
+        if (values[0] == 0.0f && ++apertureCount > 1){
+            return lensDataError(result, LENSDATA_MULTIPLE_APERTURES, line.number, 1);
+        }
+
+        LensElement &lens = lenses[elementLines - 1 - row++];
+        lens.curvature = values[0];
+        lens.thickness = values[1];
+        lens.ior = values[2];
+        lens.abbe = count == 5 ? values[3] : 0.0f;
+        lens.aperture = values[count - 1];
+    }
+
+    if (elementLines == 0){
+        return lensDataError(result, LENSDATA_NO_ELEMENTS, 0, 0);
+    }
+
+    int lensCount = elementLines;
+    std::vector<int> zoomElements;
+    std::vector<std::vector<float> > zoomThickness;
+    zoomElements.reserve(zoomLines);
+    zoomThickness.reserve(zoomLines);
+
+    for (lensDataLine line(data, size); directiveLines > 0 && line.advance(); ){
+        if (!line.zoom() && !line.asphere()){ continue; }
+        --directiveLines;
+
+        int surface;
+        size_t count;
+        float values[asphereTerms + 1];
+        parseLensDirective(line, &surface, values, asphereTerms + 1, &count, result);
+        int element = lensCount - surface;
+
+        if (surface < 1 || surface > lensCount ||
+            (line.zoom() && (count < 2 || (!zoomThickness.empty() && count != zoomThickness[0].size()))) ||
+            (line.asphere() && (count == 0 || count > asphereTerms + 1 || lenses[element].curvature == 0.0f))){
+            return lensDataError(result, LENSDATA_BAD_DIRECTIVE, line.number, 0);
+        }
+
+        if (line.zoom()){
+            // the thicknesses of all zoom positions, read again now that there is room for them
+            zoomElements.push_back(element);
+            zoomThickness.push_back(std::vector<float>(count));
+            parseLensDirective(line, &surface, &zoomThickness.back()[0], count, &count, result);
+        }
+        else {
+            LensElement &lens = lenses[element];
+            lens.type = SURFACE_ASPHERE;
+            lens.conic = values[0];
+            for (size_t k = 1; k < count; k++){
+                lens.asphere[k - 1] = values[k];
+            }
+        }
+    }
+
+    ld->lenses.swap(lenses);
+    ld->lensCount = lensCount;
+    ld->zoomElements.swap(zoomElements);
+    ld->zoomThickness.swap(zoomThickness);
+    return true;
+}
+
+
+const char* lensDataStatusText(lensDataStatus status){
+    switch (status){
+        case LENSDATA_OK: return "ok";
+        case LENSDATA_UNREADABLE: return "file can't be read";
+        case LENSDATA_NO_ELEMENTS: return "no lens elements";
+        case LENSDATA_BAD_NUMBER: return "not a number";
+        case LENSDATA_COLUMN_COUNT: return "lens elements need 4 or 5 columns";
+        case LENSDATA_INCONSISTENT_COLUMNS: return "different amount of columns than the first lens element";
+        case LENSDATA_MULTIPLE_APERTURES: return "more than one aperture, only 1 is supported";
+        case LENSDATA_BAD_DIRECTIVE: return "invalid #ZOOM or #ASPHERE line";
+    }
+    return "unknown error";
+}
+
+
+// parse the tabular lens data files
+bool readTabularLensData(const std::string &lensDataFileName, Lensdata *ld, lensDataResult *result){
+    setupPhase phase("parse lens data", ld);
+    lensDataFile file(lensDataFileName);
+    if (!file.isOpen()){
+        *result = lensDataResult();
+        return lensDataError(result, LENSDATA_UNREADABLE, 0, 0);
+    }
+
+    if (!parseTabularLensData(file.data(), file.size(), ld, result)){
+        return false;
+    }
+
+    AiMsgDebug("[ZOIC] ##############################################");
+    AiMsgDebug("[ZOIC] ############# READING LENS DATA ##############");
+    AiMsgDebug("[ZOIC] ##############################################");
+    AiMsgDebug("[ZOIC] Welcome to the lens nerd club :-D");
+    AiMsgDebug("%-40s %12d", "[ZOIC] Data file columns", result->columns);
+    AiMsgDebug("%-40s %12d", "[ZOIC] Comment lines ignored", result->commentLines);
+    AiMsgDebug("[ZOIC] ##############################################");
+    AiMsgDebug("[ZOIC] #  ROC   Thickness   IOR    ABBE    Aperture #");
+    AiMsgDebug("[ZOIC] ##############################################");
+
+    for (int i = ld->lensCount - 1; i >= 0; i--){
+        AiMsgDebug("[ZOIC] %7.3f  %7.3f %7.3f   %7.3f   %7.3f", ld->lenses[i].curvature, ld->lenses[i].thickness, ld->lenses[i].ior, ld->lenses[i].abbe, ld->lenses[i].aperture);
+    }
+
+    AiMsgDebug("[ZOIC] ##############################################");
+    AiMsgDebug("[ZOIC] ########### END READING LENS DATA ############");
+    AiMsgDebug("[ZOIC] ##############################################");
+
+    if (!ld->zoomElements.empty()){
+        AiMsgInfo("%-40s %12d", "[ZOIC] Zoom lens, moving elements", static_cast<int>(ld->zoomElements.size()));
+        AiMsgInfo("%-40s %12d", "[ZOIC] Zoom positions", static_cast<int>(ld->zoomThickness[0].size()));
+    }
+
+    int asphereCount = 0;
+    for (int i = 0; i < ld->lensCount; i++){
+        asphereCount += ld->lenses[i].type == SURFACE_ASPHERE ? 1 : 0;
+    }
+    if (asphereCount > 0){
+        AiMsgInfo("%-40s %12d", "[ZOIC] Aspheric surfaces", asphereCount);
+    }
+
+    return true;
+}
+
+
+void cleanupLensData(Lensdata *ld){
+    setupPhase phase("clean up lens data", ld);
+    int apertureCount = 0;
+    for (int i = 0; i < ld->lensCount; i++){
+        // check if there is a 0.0 lensRadiusCurvature, which is the aperture
+        if (ld->lenses[i].curvature == 0.0){
+            ld->apertureElement = i;
+            ++apertureCount;
+
+            // can´t handle > 1 apertures!
+            if (apertureCount > 1){
+                AiMsgError("[ZOIC] Multiple apertures found. Provide lens description with 1 aperture.");
+				AiRenderAbort();
+            }
+
+            // the aperture is traced as a plane, the very large radius of curvature is only left for lens drawing
+            AiMsgDebug("[ZOIC] Adjusted ROC[%d] [%.4f] to [99999.0]", i, ld->lenses[i].curvature);
+            ld->lenses[i].curvature = 99999.0;
+            ld->lenses[i].type = SURFACE_PLANE;
+        }
+
+        // air shouldn´t be ior 0.0 but 1.0
+        if (ld->lenses[i].ior == 0.0){
+            AiMsgDebug("[ZOIC] Changed IOR[%d] [%.4f] to [1.0000]", i, ld->lenses[i].ior);
+            ld->lenses[i].ior = 1.0;
+        }
+    }
+
+    AiMsgInfo("%-40s %12d", "[ZOIC] Aperture is lens element number", ld->apertureElement);
+
+    // scale from mm to cm
+    for (int i = 0; i < ld->lensCount; i++){
+        ld->lenses[i].scale(0.1f);
+    }
+
+    // move lenses so last lens is at origin
+    float summedThickness = 0.0;
+    for (int i = 0; i < ld->lensCount; i++){
+        summedThickness += ld->lenses[i].thickness;
+    }
+
+    ld->lenses[0].thickness -= summedThickness;
+}
+
+
+// fills the lens data straight from the compiled in catalog, the tables are already cleaned up
+// so this replaces both readTabularLensData and cleanupLensData
+void loadBuiltinLens(int index, Lensdata *ld){
+    const builtinLens &builtin = builtinLenses[index];
+
+    for (int i = 0; i < builtin.lensCount; i++){
+        LensElement lens;
+        lens.curvature = builtin.elements[i].curvature;
+        lens.thickness = builtin.elements[i].thickness;
+        lens.ior = builtin.elements[i].ior;
+        lens.aperture = builtin.elements[i].aperture;
+        lens.abbe = builtin.elements[i].abbe;
+        lens.type = (builtin.apertureStop && i == builtin.apertureElement) ? SURFACE_PLANE : SURFACE_SPHERE;
+        ld->lenses.push_back(lens);
+    }
+
+    ld->lensCount = builtin.lensCount;
+    ld->apertureElement = builtin.apertureElement;
+
+    AiMsgInfo("%-40s %12d", "[ZOIC] Built-in lens elements", ld->lensCount);
+    AiMsgInfo("%-40s %12d", "[ZOIC] Aperture is lens element number", ld->apertureElement);
+}
+
+
+// precomputes the lens centers so they can just be called at every ray creation
+void computeLensCenters(Lensdata *ld){
+    float summedThickness;
+    for (int i = 0; i < ld->lensCount; i++){
+        i == 0 ? summedThickness = ld->lenses[0].thickness : summedThickness += ld->lenses[i].thickness;
+        ld->lenses[i].vertex = summedThickness;
+        ld->lenses[i].center = summedThickness - ld->lenses[i].curvature;
+    }
+}
+
+
+// line line intersection for finding the principle plane
+AtVector2 lineLineIntersection(AtVector line1_origin, AtVector line1_direction, AtVector line2_origin, AtVector line2_direction){
+    float A1 = line1_direction.y - line1_origin.y;
+    float B1 = line1_origin.z - line1_direction.z;
+    float C1 = A1 * line1_origin.z + B1 * line1_origin.y;
+    float A2 = line2_direction.y - line2_origin.y;
+    float B2 = line2_origin.z - line2_direction.z;
+    float C2 = A2 * line2_origin.z + B2 * line2_origin.y;
+    float delta = A1 * B2 - A2 * B1;
+    AtVector2 rv = { (B2 * C1 - B1 * C2) / delta, (A1 * C2 - A2 * C1) / delta };
+    return rv;
+}
+
+
+// line plane intersection with fixed intersection at y = 0, for finding the focal length and sensor shift
+AtVector linePlaneIntersection(AtVector rayOrigin, AtVector rayDirection) {
+    AtVector coord(100.0, 0.0, 100.0);
+    AtVector planeNormal(0.0, 1.0, 0.0);
+    rayDirection = AiV3Normalize(rayDirection);
+    coord = AiV3Normalize(coord);
+    return rayOrigin + (rayDirection * (AiV3Dot(coord, planeNormal) - AiV3Dot(planeNormal, rayOrigin)) / AiV3Dot(planeNormal, rayDirection));
+}
+
+
+// calculate distance at which the lens forms fully focused images
+// done by tracing a ray from the focus point backwards through the lens elements and finding the intersection point with y = 0
+float calculateImageDistance(float objectDistance, Lensdata *ld){
+    setupPhase phase("image distance");
+    AtVector ray_origin(0.0f, 0.0f, objectDistance);
+    AtVector ray_direction(0.0f, (ld->lenses[ld->lensCount - 1].aperture / 2.0f) * 0.05f, -objectDistance);
+
+    float summedThickness = 0.0, imageDistance = 0.0;
+    AtVector hit_point_normal, hit_point;
+
+    for (int k = 0; k < ld->lensCount; k++){
+        summedThickness += ld->lenses[k].thickness;
+    }
+
+    for (int i = 0; i < ld->lensCount; i++){
+        if (i != 0){ summedThickness -= ld->lenses[ld->lensCount - i].thickness; }
+
+        intersectSurface(&hit_point, &hit_point_normal, ray_direction, ray_origin, ld->lenses[ld->lensCount - 1 - i], summedThickness, true, false);
+
+        if (i == 0){
+            if (!calculateTransmissionVector(&ray_direction, 1.0, ld->lenses[ld->lensCount - i - 1].ior, ray_direction, hit_point_normal, false)){
+                ld->totalInternalReflection++;
+            }
+        }
+        else {
+            if (!calculateTransmissionVector(&ray_direction, ld->lenses[ld->lensCount - i].ior, ld->lenses[ld->lensCount - i - 1].ior, ray_direction, hit_point_normal, false)){
+                ld->totalInternalReflection++;
+            }
+        }
+
+        if (i == ld->lensCount - 1){
+            imageDistance = linePlaneIntersection(hit_point, ray_direction).z;
+        }
+
+        ray_origin = hit_point;
+    }
+
+    AiMsgInfo("%-40s %12.8f", "[ZOIC] Object distance [cm]", objectDistance);
+    AiMsgInfo("%-40s %12.8f", "[ZOIC] Image distance [cm]", imageDistance);
+
+    return imageDistance;
+}
+
+
+// traceThroughLensElements with the surface index as a template parameter, so for the built-in lenses
+// the whole loop unrolls and the last element / aperture checks are resolved per surface
+// draw output is left to the generic tracer
+template <int I, int N>
+struct unrolledLensTracer{
+    static inline bool trace(AtVector *ray_origin, AtVector *ray_direction, Lensdata *ld){
+        const LensElement &lens = ld->lenses[I];
+        AtVector hit_point, hit_point_normal;
+
+        if (!intersectSurface(&hit_point, &hit_point_normal, *ray_direction, *ray_origin, lens, lens.vertex, false, true)){
+            return false;
+        }
+
+        float hitPoint2 = hit_point.x * hit_point.x + hit_point.y * hit_point.y;
+
+        // check if ray hits lens boundary or aperture
+        if ((hitPoint2 > (lens.aperture * 0.5) * (lens.aperture * 0.5))
+            || ((I == ld->apertureElement) && (hitPoint2 > (ld->userApertureRadius * ld->userApertureRadius)))){
+            return false;
+        }
+
+        *ray_origin = hit_point;
+
+        // assuming the material outside the lens is air [ior 1.0]
+        float nextIor = (I + 1 < N) ? ld->lenses[I + 1].ior : 1.0f;
+        if (!calculateTransmissionVector(ray_direction, lens.ior, nextIor, *ray_direction, hit_point_normal, true)){
+            ld->totalInternalReflection++;
+            return false;
+        }
+
+        return unrolledLensTracer<I + 1, N>::trace(ray_origin, ray_direction, ld);
+    }
+};
+
+
+template <int N>
+struct unrolledLensTracer<N, N>{
+    static inline bool trace(AtVector *, AtVector *, Lensdata *){
+        return true;
+    }
+};
+
+
+template <int N>
+bool traceThroughBuiltinLens(AtVector *ray_origin, AtVector *ray_direction, Lensdata *ld){
+    return unrolledLensTracer<0, N>::trace(ray_origin, ray_direction, ld);
+}
+
+
+// one unrolled tracer per surface count found in the built-in catalog
+lensTracer builtinLensTracer(int lensCount){
+    switch (lensCount){
+#define ZOIC_BUILTIN_TRACER_CASE(N) case N: return traceThroughBuiltinLens<N>;
+        ZOIC_BUILTIN_LENS_SURFACE_COUNTS(ZOIC_BUILTIN_TRACER_CASE)
+#undef ZOIC_BUILTIN_TRACER_CASE
+        default: return NULL;
+    }
+}
+
+
+float traceThroughLensElementsForFocalLength(Lensdata *ld, bool originShift){
+    setupPhase phase(originShift ? "focal length trace, scaled" : "focal length trace");
+    float tracedFocalLength = 0.0, focalPointDistance = 0.0, principlePlaneDistance = 0.0, summedThickness = 0.0;
+    float rayOriginHeight = ld->lenses[0].aperture * 0.1;
+    AtVector hit_point, hit_point_normal;
+    AtVector ray_origin(0.0, rayOriginHeight, 0.0);
+    AtVector ray_direction(0.0, 0.0, 99999.0);
+
+    for (int i = 0; i < ld->lensCount; i++){
+        // need to keep the summedthickness method since the sphere centers get computed only later on
+        i == 0 ? summedThickness = ld->lenses[0].thickness : summedThickness += ld->lenses[i].thickness;
+
+        intersectSurface(&hit_point, &hit_point_normal, ray_direction, ray_origin, ld->lenses[i], summedThickness, false, false);
+
+        if (i != ld->lensCount - 1){
+            if (!calculateTransmissionVector(&ray_direction, ld->lenses[i].ior, ld->lenses[i + 1].ior, ray_direction, hit_point_normal, true)){
+                ld->totalInternalReflection++;
+            }
+        }
+        else { // last element in vector
+            if (!calculateTransmissionVector(&ray_direction, ld->lenses[i].ior, 1.0, ray_direction, hit_point_normal, true)){
+                ld->totalInternalReflection++;
+            }
+
+            // original parallel ray start and end
+            AtVector pp_line1start(0.0, rayOriginHeight, 0.0);
+            AtVector pp_line1end(0.0, rayOriginHeight, 999999.0);
+
+            // direction ray end
+            AtVector pp_line2end(0.0, 
+                                static_cast<float>(ray_origin.y + (ray_direction.y * 100000.0)), 
+                                static_cast<float>(ray_origin.z + (ray_direction.z * 100000.0)));
+
+            principlePlaneDistance = lineLineIntersection(pp_line1start, pp_line1end, ray_origin, pp_line2end).x;
+
+            if (!originShift){
+                AiMsgDebug("%-40s %12.8f", "[ZOIC] Principle Plane distance [cm]", principlePlaneDistance);
+            }
+            else {
+                AiMsgDebug("%-40s %12.8f", "[ZOIC] Adj. PP distance [cm]", principlePlaneDistance);
+            }
+
+            focalPointDistance = linePlaneIntersection(ray_origin, ray_direction).z;
+
+            if (!originShift){
+                AiMsgDebug("%-40s %12.8f", "[ZOIC] Focal point distance [cm]", focalPointDistance);
+            }
+            else {
+                AiMsgDebug("%-40s %12.8f", "[ZOIC] Adj. Focal point distance [cm]", focalPointDistance);
+            }
+        }
+
+        ray_origin = hit_point;
+    }
+
+    tracedFocalLength = focalPointDistance - principlePlaneDistance;
+
+    if (!originShift){
+        AiMsgInfo("%-40s %12.8f", "[ZOIC] Raytraced Focal Length [cm]", tracedFocalLength);
+    }
+    else {
+        AiMsgInfo("%-40s %12.8f", "[ZOIC] Adj. Raytraced Focal Length [cm]", tracedFocalLength);
+
+    }
+
+    return tracedFocalLength;
+}
+
+
+void adjustFocalLength(Lensdata *ld){
+    for (int i = 0; i < ld->lensCount; i++){
+        ld->lenses[i].scale(ld->focalLengthRatio);
+    }
+}
+
+
+// hero wavelengths [um] and how much of each RGB channel they stand for, every channel sums to 1
+static const float spectralWavelengths[spectralLanes] = { 0.450f, 0.510f, 0.570f, 0.630f };
+
+
+static const float spectralResponse[spectralLanes][3] = {
+    { 0.00f, 0.00f, 0.75f },
+    { 0.00f, 0.50f, 0.25f },
+    { 0.35f, 0.50f, 0.00f },
+    { 0.65f, 0.00f, 0.00f }
+};
+
+
+// ior of every element at the hero wavelengths, from a cauchy fit through the d line ior and the abbe number
+// (nd - 1) / V = nF - nC, elements without an abbe number (air, 4 column lens files) don't disperse
+void computeSpectralIor(Lensdata *ld){
+    const float lambdaD = 0.5876f, lambdaF = 0.4861f, lambdaC = 0.6563f;
+
+    for (int i = 0; i < ld->lensCount; i++){
+        LensElement &lens = ld->lenses[i];
+        float b = 0.0f;
+        if (lens.abbe > 0.0f && lens.ior > 1.0f){
+            b = ((lens.ior - 1.0f) / lens.abbe) / ((1.0f / (lambdaF * lambdaF)) - (1.0f / (lambdaC * lambdaC)));
+        }
+
+        float a = lens.ior - b / (lambdaD * lambdaD);
+        for (int w = 0; w < spectralLanes; w++){
+            lens.spectralIor[w] = (b == 0.0f) ? lens.ior : a + b / (spectralWavelengths[w] * spectralWavelengths[w]);
+        }
+    }
+}
+
+
+// traces a ray from the sensor through surfaces 0 to last, without clipping it at element rims or the aperture
+// so a chief ray can be followed through the whole lens, also where the rims vignette it
+bool traceUnclipped(AtVector *ray_origin, AtVector *ray_direction, Lensdata *ld, int last){
+    AtVector hit_point, hit_point_normal;
+
+    for (int i = 0; i <= last; i++){
+        if (!intersectSurface(&hit_point, &hit_point_normal, *ray_direction, *ray_origin, ld->lenses[i], ld->lenses[i].vertex, false, true)){
+            return false;
+        }
+
+        *ray_origin = hit_point;
+
+        float ior2 = (i != ld->lensCount - 1) ? ld->lenses[i + 1].ior : 1.0f;
+        if (!calculateTransmissionVector(ray_direction, ld->lenses[i].ior, ior2, *ray_direction, hit_point_normal, true)){
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+// where to aim at the rear element for the middle of the light that gets through along the meridian of a sensor radius
+// stands in for the chief ray of lenses whose aperture stop can't be aimed through the center, like a stop right at the sensor
+bool bundleCenterAim(Lensdata *ld, float radius, float *aim){
+    const int steps = 64;
+    float extent = ld->lenses[0].aperture;
+    float step = 2.0f * extent / static_cast<float>(steps);
+    float dz = -ld->lenses[0].thickness;
+    int first = -1, last = -1;
+
+    for (int k = 0; k <= steps; k++){
+        AtVector o(radius, 0.0f, ld->originShift), d(-extent + step * static_cast<float>(k) - radius, 0.0f, dz);
+        if (traceThroughLensElements(&o, &d, ld, NULL)){
+            if (first < 0){ first = k; }
+            last = k;
+        }
+    }
+    if (first < 0){ return false; }
+
+    // bisect both edges of the bundle between the last blocked and the first passing aim
+    float edges[2];
+    for (int e = 0; e < 2; e++){
+        float passing = -extent + step * static_cast<float>(e == 0 ? first : last);
+        float blocked = passing + (e == 0 ? -step : step);
+        if ((e == 0 && first == 0) || (e == 1 && last == steps)){
+            edges[e] = passing;
+            continue;
+        }
+
+        for (int i = 0; i < 20; i++){
+            float middle = 0.5f * (passing + blocked);
+            AtVector o(radius, 0.0f, ld->originShift), d(middle - radius, 0.0f, dz);
+            (traceThroughLensElements(&o, &d, ld, NULL) ? passing : blocked) = middle;
+        }
+        edges[e] = passing;
+    }
+
+    *aim = 0.5f * (edges[0] + edges[1]);
+    return true;
+}
+
+
+// field angle, sensor radius and entrance pupil position of the rays from every sensor radius up to the film corner
+// the chief ray is found by aiming at the rear element until it crosses the center of the aperture stop,
+// with bundleCenters the middle of the transmitted bundle is used instead
+void traceFieldAngles(Lensdata *ld, bool bundleCenters, std::vector<float> &angles, std::vector<float> &radii, std::vector<float> &pupils){
+    float maxRadius = ld->filmDiagonal * 0.5f * samplingErrorCorrection;
+    float dz = -ld->lenses[0].thickness;
+
+    // the axis itself maps to the center of the sensor, its pupil position gets filled in by the first ray
+    angles.assign(1, 0.0f);
+    radii.assign(1, 0.0f);
+    pupils.assign(1, 0.0f);
+    float aim = 0.0f;
+
+    for (int j = 1; j <= reverseTraceSamples; j++){
+        float radius = maxRadius * static_cast<float>(j) / static_cast<float>(reverseTraceSamples);
+        float a1 = aim;
+        bool found = false;
+
+        if (bundleCenters){
+            found = bundleCenterAim(ld, radius, &a1);
+        }
+        else {
+            // secant search on where to aim at the rear element, starting from the previous chief ray
+            float a0 = aim;
+            float h0 = 0.0f, h1 = 0.0f;
+            a1 = aim - 0.01f * ld->lenses[0].aperture;
+            for (int iteration = 0; iteration < 20; iteration++){
+                AtVector o(radius, 0.0f, ld->originShift), d(a1 - radius, 0.0f, dz);
+                if (!traceUnclipped(&o, &d, ld, ld->apertureElement)){ break; }
+                h1 = o.x;
+
+                if (iteration == 0){
+                    AtVector o0(radius, 0.0f, ld->originShift), d0(a0 - radius, 0.0f, dz);
+                    if (!traceUnclipped(&o0, &d0, ld, ld->apertureElement)){ break; }
+                    h0 = o0.x;
+                }
+
+                if (std::abs(h1) < 1e-4f * ld->userApertureRadius){
+                    found = true;
+                    break;
+                }
+                if (h1 == h0){ break; }
+
+                float next = a1 - h1 * (a1 - a0) / (h1 - h0);
+                a0 = a1; h0 = h1;
+                a1 = next;
+            }
+        }
+        if (!found){ break; }
+
+        AtVector o(radius, 0.0f, ld->originShift), d(a1 - radius, 0.0f, dz);
+        if (!traceUnclipped(&o, &d, ld, ld->lensCount - 1)){ break; }
+
+        // camera space flips lens space, which also undoes the image inversion: the ray leaves towards +x
+        AtVector origin = -o, dir = -d;
+        float angle = std::atan2(dir.x, -dir.z);
+
+        // past the widest angle the table can't be inverted anymore
+        if (angle <= angles.back()){ break; }
+
+        angles.push_back(angle);
+        radii.push_back(radius);
+        pupils.push_back(origin.z - origin.x * (dir.z / dir.x));
+        aim = a1;
+    }
+}
+
+
+// inverse of traceFieldAngles, resampled to evenly spaced field angles for constant time lookups
+// the chief ray stands in for the whole bundle, at the focus distance that is exact, out of focus it is the blur center
+// lenses without a usable chief ray, like one with the stop right at the sensor, get the traced bundle centers instead
+void buildReverseProjection(Lensdata *ld){
+    setupPhase phase("reverse projection", ld);
+    ld->reverseRadius.clear();
+    ld->reversePupil.clear();
+    ld->reverseMaxAngle = 0.0f;
+    if (ld->filmDiagonal <= 0.0f){ return; }
+
+    std::vector<float> angles, radii, pupils;
+    traceFieldAngles(ld, false, angles, radii, pupils);
+    if (angles.size() < 3){
+        AiMsgInfo("[ZOIC] No usable chief ray through the aperture stop, reverse projection follows the bundle centers");
+        traceFieldAngles(ld, true, angles, radii, pupils);
+    }
+
+    if (angles.size() < 3){
+        AiMsgWarning("[ZOIC] Couldn't trace the chief rays, camera_reverse_ray is not available for this lens");
+        return;
+    }
+
+    pupils[0] = pupils[1];
+
+    // resample to evenly spaced angles
+    ld->reverseMaxAngle = angles.back();
+    ld->reverseRadius.resize(reverseTableSize + 1);
+    ld->reversePupil.resize(reverseTableSize + 1);
+
+    size_t k = 0;
+    for (int i = 0; i <= reverseTableSize; i++){
+        float angle = ld->reverseMaxAngle * static_cast<float>(i) / static_cast<float>(reverseTableSize);
+        while (k + 2 < angles.size() && angles[k + 1] < angle){ ++k; }
+
+        float t = std::min(std::max((angle - angles[k]) / (angles[k + 1] - angles[k]), 0.0f), 1.0f);
+        ld->reverseRadius[i] = linearInterpolate(t, radii[k], radii[k + 1]);
+        ld->reversePupil[i] = linearInterpolate(t, pupils[k], pupils[k + 1]);
+    }
+
+    AiMsgInfo("%-40s %12.8f", "[ZOIC] Reverse projection field [deg]", ld->reverseMaxAngle * 2.0f * (180.0f / AI_PI));
+}
+
+
+// sensor radius a camera space point is imaged at, from the inverse chief ray table
+// the entrance pupil moves with field angle, so the angle is refined twice with the pupil position of the previous guess
+bool reverseProjectRadius(const Lensdata *ld, const AtVector &p, float *radius){
+    if (ld->reverseRadius.empty()){ return false; }
+
+    float rho = std::sqrt(p.x * p.x + p.y * p.y);
+    float scale = static_cast<float>(reverseTableSize) / ld->reverseMaxAngle;
+
+    float pupil = ld->reversePupil[0];
+    float angle = 0.0f;
+    for (int pass = 0; pass < 3; pass++){
+        angle = fastmath::fastAtan2(rho, pupil - p.z);
+        if (angle > ld->reverseMaxAngle){ return false; }
+
+        float position = angle * scale;
+        int i = std::min(static_cast<int>(position), reverseTableSize - 1);
+        float t = position - static_cast<float>(i);
+        pupil = linearInterpolate(t, ld->reversePupil[i], ld->reversePupil[i + 1]);
+        *radius = linearInterpolate(t, ld->reverseRadius[i], ld->reverseRadius[i + 1]);
+    }
+
+    return true;
+}
+
+
+// sets up a cleaned up and scaled lens for rendering: aperture from the fstop, sensor position for the focus distance,
+// aperture distance and lens centers. Everything but the LUT.
+void prepareLens(Lensdata *ld, float fStop, float focalDistance){
+    // calculate focal length by tracing a parallel ray through the lens system (2nd time for new focallength)
+    float kolbFocalLength = traceThroughLensElementsForFocalLength(ld, true);
+
+    // user specified aperture radius from fstop
+    ld->userApertureRadius = kolbFocalLength / (2.0 * fStop);
+    AiMsgInfo("%-40s %12.8f", "[ZOIC] User aperture radius [cm]", ld->userApertureRadius);
+
+    // clamp aperture if fstop is wider than max aperture given by lens description
+    if (ld->userApertureRadius > ld->lenses[ld->apertureElement].aperture){
+        AiMsgWarning("[ZOIC] Given FSTOP wider than maximum aperture radius provided by lens data.");
+        AiMsgWarning("[ZOIC] Clamping aperture radius from [%.9f] to [%.9f]", ld->userApertureRadius, ld->lenses[ld->apertureElement].aperture);
+        ld->userApertureRadius = ld->lenses[ld->apertureElement].aperture;
+    }
+
+    // calculate how much origin should be shifted so that the image distance at a certain object distance falls on the film plane
+    ld->focalDistance = focalDistance;
+    ld->originShift = calculateImageDistance(focalDistance, ld);
+
+    // calculate distance between film plane and aperture
+    ld->apertureDistance = 0.0;
+    for (int i = 0; i < ld->lensCount; i++){
+        ld->apertureDistance += ld->lenses[i].thickness;
+        if (i == ld->apertureElement){
+            AiMsgInfo("%-40s %12.8f", "[ZOIC] Aperture distance [cm]", ld->apertureDistance);
+            break;
+        }
+    }
+
+    // precompute lens centers
+    computeLensCenters(ld);
+
+    computeSpectralIor(ld);
+
+    buildReverseProjection(ld);
+}
+
+
+// creates a secondary, virtual aperture resembling the exit pupil on a real lens
+bool empericalOpticalVignetting(AtVector origin, AtVector direction, float apertureRadius, float opticalVignettingRadius, float opticalVignettingDistance){
+    // because the first intersection point of the aperture is already known, I can just linearly scale it by the distance to the second aperture
+    AtVector opticalVignetPoint;
+    opticalVignetPoint = (direction * opticalVignettingDistance) - origin;
+    float pointHypotenuse = std::sqrt((opticalVignetPoint.x * opticalVignetPoint.x) + (opticalVignetPoint.y * opticalVignetPoint.y));
+    float virtualApertureTrueRadius = apertureRadius * opticalVignettingRadius;
+
+    return std::abs(pointHypotenuse) < virtualApertureTrueRadius;
+}
+
+
+bool traceThroughLensElementsForApertureSize(AtVector ray_origin, AtVector ray_direction, Lensdata *ld){
+    AtVector hit_point, hit_point_normal;
+
+    for (int i = 0; i < ld->lensCount; i++){
+        if (!intersectSurface(&hit_point, &hit_point_normal, ray_direction, ray_origin, ld->lenses[i], ld->lenses[i].vertex, false, true)){
+            return false;
+        }
+
+        float hitPoint2 = (hit_point.x * hit_point.x) + (hit_point.y * hit_point.y);
+
+        // check if ray hits lens boundary or aperture
+        if ((hitPoint2 >(ld->lenses[i].aperture * 0.5) * (ld->lenses[i].aperture * 0.5))
+            || ((i == ld->apertureElement) && (hitPoint2 > (ld->userApertureRadius * ld->userApertureRadius)))){
+            return false;
+        }
+
+        ray_origin = hit_point;
+
+        // if not last lens element
+        if (i != ld->lensCount - 1){
+            if (!calculateTransmissionVector(&ray_direction, ld->lenses[i].ior, ld->lenses[i + 1].ior, ray_direction, hit_point_normal, true)){
+                ld->totalInternalReflection++;
+                return false;
+            }
+        }
+        else { // last lens element
+            // assuming the material outside the lens is air [ior 1.0]
+            if (!calculateTransmissionVector(&ray_direction, ld->lenses[i].ior, 1.0, ray_direction, hit_point_normal, true)){
+                ld->totalInternalReflection++;
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+
+// snell's law for one lane of a packet, moves it to the hit point and marks it dead when it missed or reflected
+template <int LANES>
+inline void refractPacketLane(lanePacket<LANES> *p, int j, float dx, float dy, float dz, float hx, float hy, float hz,
+                              float nx, float ny, float nz, int hit, float eta, int canReflect, int *tir){
+    float c1 = -(dx * nx + dy * ny + dz * nz);
+    float cs2 = (eta * eta) * (1.0f - (c1 * c1));
+    int reflected = canReflect & (cs2 > 1.0f);
+    float k = (eta * c1) - std::sqrt(std::abs(1.0f - cs2));
+
+    *tir += p->alive[j] & hit & reflected;
+    p->alive[j] &= hit & (1 - reflected);
+
+    p->ox[j] = hx; p->oy[j] = hy; p->oz[j] = hz;
+    p->dx[j] = dx * eta + nx * k;
+    p->dy[j] = dy * eta + ny * k;
+    p->dz[j] = dz * eta + nz * k;
+}
+
+
+// packet version of traceThroughLensElements, every lane follows exactly the same math
+// lanes that get blocked are marked dead but keep being computed, which is cheaper than branching per lane
+// with SPECTRAL set lane j is refracted with the ior of hero wavelength j
+// returns the amount of lanes that made it through
+template <int LANES, bool SPECTRAL>
+int traceLanePacket(lanePacket<LANES> *p, Lensdata *ld){
+    int tir = 0;
+
+    for (int i = 0; i < ld->lensCount; i++){
+        const LensElement &element = ld->lenses[i];
+        float radius = element.curvature;
+        float radius2 = radius * radius;
+        float sign = (radius < 0.0f ? -1.0f : 1.0f);
+        float apertureRadius = element.aperture * 0.5f;
+        float maxHit2 = apertureRadius * apertureRadius;
+
+        // the aperture stop clips at the user aperture as well
+        if (i == ld->apertureElement){
+            maxHit2 = std::min(maxHit2, ld->userApertureRadius * ld->userApertureRadius);
+        }
+
+        // assuming the material outside the lens is air [ior 1.0]
+        float eta[LANES];
+        int canReflect[LANES];
+        for (int j = 0; j < LANES; j++){
+            float ior1 = SPECTRAL ? element.spectralIor[j] : element.ior;
+            float ior2 = (i != ld->lensCount - 1) ? (SPECTRAL ? ld->lenses[i + 1].spectralIor[j] : ld->lenses[i + 1].ior) : 1.0f;
+            eta[j] = (ior2 == 1.0f) ? ior1 : ior1 / ior2;
+            canReflect[j] = (ior1 > ior2);
+        }
+
+        // one lane loop per surface type, the type is the same for all lanes
+        switch (element.type){
+            case SURFACE_PLANE:
+                for (int j = 0; j < LANES; j++){
+                    float invLength = 1.0f / std::sqrt(p->dx[j] * p->dx[j] + p->dy[j] * p->dy[j] + p->dz[j] * p->dz[j]);
+                    float dx = p->dx[j] * invLength, dy = p->dy[j] * invLength, dz = p->dz[j] * invLength;
+                    float t = (element.vertex - p->oz[j]) / dz;
+                    float hx = p->ox[j] + dx * t, hy = p->oy[j] + dy * t;
+
+                    int hit = ((hx * hx + hy * hy) <= maxHit2);
+                    refractPacketLane(p, j, dx, dy, dz, hx, hy, element.vertex, 0.0f, 0.0f, -1.0f, hit, eta[j], canReflect[j], &tir);
+                }
+                break;
+
+            case SURFACE_ASPHERE:
+                // newton iterations differ per lane, this one doesn't vectorize
+                for (int j = 0; j < LANES; j++){
+                    float invLength = 1.0f / std::sqrt(p->dx[j] * p->dx[j] + p->dy[j] * p->dy[j] + p->dz[j] * p->dz[j]);
+                    float dx = p->dx[j] * invLength, dy = p->dy[j] * invLength, dz = p->dz[j] * invLength;
+                    float hx = p->ox[j], hy = p->oy[j], hz = p->oz[j], nx = 0.0f, ny = 0.0f, nz = -1.0f;
+
+                    int hit = rayAsphereIntersection(p->ox[j], p->oy[j], p->oz[j], dx, dy, dz, element, element.vertex, &hx, &hy, &hz);
+                    if (hit){ asphereNormal(element, hx, hy, &nx, &ny, &nz); }
+                    hit &= ((hx * hx + hy * hy) <= maxHit2);
+                    refractPacketLane(p, j, dx, dy, dz, hx, hy, hz, nx, ny, nz, hit, eta[j], canReflect[j], &tir);
+                }
+                break;
+
+            default:
+                for (int j = 0; j < LANES; j++){
+                    // ray sphere intersection
+                    float invLength = 1.0f / std::sqrt(p->dx[j] * p->dx[j] + p->dy[j] * p->dy[j] + p->dz[j] * p->dz[j]);
+                    float dx = p->dx[j] * invLength, dy = p->dy[j] * invLength, dz = p->dz[j] * invLength;
+                    float lx = -p->ox[j], ly = -p->oy[j], lz = element.center - p->oz[j];
+                    float tca = lx * dx + ly * dy + lz * dz;
+                    float d2 = (lx * lx + ly * ly + lz * lz) - (tca * tca);
+                    float thc = std::sqrt(std::abs(radius2 - d2));
+                    float t = tca + thc * sign;
+                    float hx = p->ox[j] + dx * t, hy = p->oy[j] + dy * t, hz = p->oz[j] + dz * t;
+
+                    // lens boundary and aperture
+                    int hit = (d2 <= radius2) & ((hx * hx + hy * hy) <= maxHit2);
+
+                    // normal at the intersection point
+                    float nx = -hx, ny = -hy, nz = element.center - hz;
+                    float invNormal = sign / std::sqrt(nx * nx + ny * ny + nz * nz);
+                    nx *= invNormal; ny *= invNormal; nz *= invNormal;
+
+                    refractPacketLane(p, j, dx, dy, dz, hx, hy, hz, nx, ny, nz, hit, eta[j], canReflect[j], &tir);
+                }
+                break;
+        }
+    }
+
+    if (tir){ ld->totalInternalReflection += tir; }
+
+    int succesful = 0;
+    for (int j = 0; j < LANES; j++){
+        succesful += p->alive[j];
+    }
+
+    return succesful;
+}
+
+
+int traceRayPacket(rayPacket *p, Lensdata *ld){
+    return traceLanePacket<rayPacketSize, false>(p, ld);
+}
+
+
+// traces a camera ray at all hero wavelengths at once and continues with one of those that made it through, picked at random
+// the weight makes up for the others: averaged over samples every channel gets the throughput of the wavelengths it stands for
+// the exit pupil LUT is built at the d line, so wavelengths that only get through outside of its bounds are never sampled
+bool traceSpectralCameraRay(AtVector *ray_origin, AtVector *ray_direction, Lensdata *ld, AtRGB *weight){
+    spectralPacket packet;
+    for (int j = 0; j < spectralLanes; j++){
+        packet.ox[j] = ray_origin->x;
+        packet.oy[j] = ray_origin->y;
+        packet.oz[j] = ray_origin->z;
+        packet.dx[j] = ray_direction->x;
+        packet.dy[j] = ray_direction->y;
+        packet.dz[j] = ray_direction->z;
+        packet.alive[j] = 1;
+    }
+
+    int succesful = traceLanePacket<spectralLanes, true>(&packet, ld);
+    if (succesful == 0){
+        return false;
+    }
+
+    int pick = static_cast<int>(xor128() % static_cast<uint32_t>(succesful));
+    int hero = 0;
+    for (int j = 0; j < spectralLanes; j++){
+        if (packet.alive[j] && pick-- == 0){
+            hero = j;
+            break;
+        }
+    }
+
+    *ray_origin = AtVector(packet.ox[hero], packet.oy[hero], packet.oz[hero]);
+    *ray_direction = AtVector(packet.dx[hero], packet.dy[hero], packet.dz[hero]);
+
+    float scale = static_cast<float>(succesful);
+    *weight = AtRGB(spectralResponse[hero][0] * scale, spectralResponse[hero][1] * scale, spectralResponse[hero][2] * scale);
+    return true;
+}
+
+
+// area sampled for a LUT entry: half extent in x and y, and the offset along x towards the field position
+// a planar LUT covers a square on the rear element, an angular LUT an ellipse of angles seen from the sensor,
+// which fits the thin crescent of exit pupil a wide angle lens leaves near the edge of its image circle
+void lutScales(Lensdata *ld, boundingBox2d bounds, float *scaleX, float *scaleY, float *translation){
+    if (ld->angularLUT){
+        *scaleX = (bounds.max.x - bounds.min.x) * 0.5f * samplingErrorCorrection;
+        *scaleY = std::max(std::abs(bounds.min.y), std::abs(bounds.max.y)) * samplingErrorCorrection;
+    }
+    else {
+        *scaleX = *scaleY = bounds.getMaxScale() * samplingErrorCorrection;
+    }
+
+    *translation = bounds.getCentroid().x;
+}
+
+
+// exit pupil bounds on the rear element plane turned into the angles they're seen under from the field position
+// atan is monotonic, so the box stays a box
+boundingBox2d angularBounds(Lensdata *ld, AtVector sampleOrigin, boundingBox2d bounds){
+    if (bounds.getMaxScale() == 0.0f){ return bounds; }
+
+    float dz = -ld->lenses[0].thickness;
+    boundingBox2d angles;
+    angles.min = AtVector2(std::atan((bounds.min.x - sampleOrigin.x) / dz), std::atan((bounds.min.y - sampleOrigin.y) / dz));
+    angles.max = AtVector2(std::atan((bounds.max.x - sampleOrigin.x) / dz), std::atan((bounds.max.y - sampleOrigin.y) / dz));
+    return angles;
+}
+
+
+// estimate the fraction of rays sampled over the LUT disk at this field position that make it through the lens
+// the rays are distributed exactly like they are in camera_create_ray, so this is the per-try success probability
+float estimateLUTAcceptance(Lensdata *ld, AtVector sampleOrigin, boundingBox2d &bounds, int acceptanceSamples){
+    // field positions in the LUT lie on the x axis, so the record keeps the identity rotation
+    sensorPositionRecord rec;
+    lutScales(ld, bounds, &rec.maxScale, &rec.scaleY, &rec.translation);
+
+    // no ray made it through while searching for the bounds, outside of the image circle
+    if (rec.maxScale == 0.0f){ return 0.0f; }
+
+    int succesful = 0;
+
+    // whole packets only, so round the sample count up
+    acceptanceSamples = ((acceptanceSamples + rayPacketSize - 1) / rayPacketSize) * rayPacketSize;
+
+    // generate all lens samples in one go
+    std::vector<float> u(acceptanceSamples), v(acceptanceSamples), lensx(acceptanceSamples), lensy(acceptanceSamples);
+    for (int k = 0; k < acceptanceSamples; k++){
+        u[k] = xor128() / 4294967296.0f;
+        v[k] = xor128() / 4294967296.0f;
+    }
+    concentricDiskSampleN(&u[0], &v[0], &lensx[0], &lensy[0], acceptanceSamples);
+
+    rayPacket packet;
+    for (int k = 0; k < acceptanceSamples; k += rayPacketSize){
+        for (int j = 0; j < rayPacketSize; j++){
+            AtVector dir = lutDirection(ld, lensx[k + j], lensy[k + j], &rec, sampleOrigin);
+            packet.ox[j] = sampleOrigin.x;
+            packet.oy[j] = sampleOrigin.y;
+            packet.oz[j] = sampleOrigin.z;
+            packet.dx[j] = dir.x;
+            packet.dy[j] = dir.y;
+            packet.dz[j] = dir.z;
+            packet.alive[j] = 1;
+        }
+
+        succesful += traceRayPacket(&packet, ld);
+    }
+
+    return static_cast<float>(succesful) / static_cast<float>(acceptanceSamples);
+}
+
+
+// amount of retries needed so that a ray with the given acceptance makes it through with retrySuccesProbability
+// solves 1 - (1 - acceptance)^(retries + 1) >= retrySuccesProbability, clamped to the global maximum.
+// The acceptance is measured on a limited amount of rays, where all of them making it doesn't mean every ray will,
+// so it's taken no higher than (k + 1) / (n + 2) and there is always at least one retry.
+int retryBudget(float acceptance, int samples){
+    if (acceptance <= 0.0f){ return 0; }
+
+    float n = static_cast<float>(std::max(samples, 1));
+    float conservative = std::min(acceptance, (acceptance * n + 1.0f) / (n + 2.0f));
+    float traces = std::ceil(std::log(1.0f - retrySuccesProbability) / std::log(1.0f - conservative));
+    int retries = static_cast<int>(traces) - 1;
+
+    return std::max(1, std::min(retries, maxtries));
+}
+
+
+// find the bounds of the exit pupil seen from a position on the sensor, by shooting rays over the whole first lens element
+// the samples are jittered on a grid, so no gap between them is wider than two grid cells
+// when no ray makes it through the bounds stay empty, with a max scale of 0
+boundingBox2d exitPupilBounds(Lensdata *ld, AtVector sampleOrigin, int boundsSamples){
+    // calculate bounds of aperture, to eventually find centroid and max scale
+    boundingBox2d apertureBounds;
+    apertureBounds.min = AI_P2_ZERO;
+    apertureBounds.max = AI_P2_ZERO;
+
+    rayPacket packet;
+    float packetU[rayPacketSize], packetV[rayPacketSize];
+    float lensU = 0.0, lensV = 0.0;
+    int grid = static_cast<int>(std::sqrt(static_cast<float>(boundsSamples)));
+    float cellSize = 1.0f / static_cast<float>(grid);
+
+    for (int b = 0; b < boundsSamples; b++){
+        int lane = b % rayPacketSize;
+
+        // jittered grid position in domain [-1, 1], whatever doesn't fit the grid is purely random
+        float u = xor128() / 4294967296.0f;
+        float v = xor128() / 4294967296.0f;
+        if (b < grid * grid){
+            u = (static_cast<float>(b % grid) + u) * cellSize;
+            v = (static_cast<float>(b / grid) + v) * cellSize;
+        }
+        packetU[lane] = (u * 2.0f) - 1.0f;
+        packetV[lane] = (v * 2.0f) - 1.0f;
+
+        // calculate direction vectors over whole first lens element
+        packet.ox[lane] = sampleOrigin.x;
+        packet.oy[lane] = sampleOrigin.y;
+        packet.oz[lane] = sampleOrigin.z;
+        packet.dx[lane] = (packetU[lane] * ld->lenses[0].aperture) - sampleOrigin.x;
+        packet.dy[lane] = (packetV[lane] * ld->lenses[0].aperture) - sampleOrigin.y;
+        packet.dz[lane] = -ld->lenses[0].thickness;
+        packet.alive[lane] = 1;
+
+        // trace once the packet is full, or pad the last one with dead lanes
+        if (lane != rayPacketSize - 1 && b != boundsSamples - 1){ continue; }
+
+        for (int j = lane + 1; j < rayPacketSize; j++){
+            packet.ox[j] = packet.oy[j] = packet.dx[j] = packet.dy[j] = 0.0f;
+            packet.oz[j] = sampleOrigin.z;
+            packet.dz[j] = -ld->lenses[0].thickness;
+            packet.alive[j] = 0;
+        }
+
+        traceRayPacket(&packet, ld);
+
+        for (int j = 0; j <= lane; j++){
+            if (!packet.alive[j]){ continue; }
+
+            lensU = packetU[j];
+            lensV = packetV[j];
+
+            // not sure if I need this check..
+            if ((apertureBounds.min.x + apertureBounds.min.y) == 0.0){
+                apertureBounds.min.x = lensU * ld->lenses[0].aperture;
+                apertureBounds.min.y = lensV * ld->lenses[0].aperture;
+                apertureBounds.max.x = lensU * ld->lenses[0].aperture;
+                apertureBounds.max.y = lensV * ld->lenses[0].aperture;
+            }
+
+            // if any of the bounds exceed previous bounds, replace to grow bbox
+            if ((lensU * ld->lenses[0].aperture) > apertureBounds.max.x){
+                apertureBounds.max.x = lensU * ld->lenses[0].aperture;
+            }
+
+            if ((lensV * ld->lenses[0].aperture) > apertureBounds.max.y){
+                apertureBounds.max.y = lensV * ld->lenses[0].aperture;
+            }
+
+            if ((lensU * ld->lenses[0].aperture) < apertureBounds.min.x){
+                apertureBounds.min.x = lensU * ld->lenses[0].aperture;
+            }
+
+            if ((lensV * ld->lenses[0].aperture) < apertureBounds.min.y){
+                apertureBounds.min.y = lensV * ld->lenses[0].aperture;
+            }
+        }
+    }
+
+    return apertureBounds;
+}
+
+
+// full quality LUT entry for a field position
+apertureLUTEntry computeLUTEntry(Lensdata *ld, AtVector sampleOrigin, int boundsSamples, int acceptanceSamples){
+    apertureLUTEntry entry;
+    entry.bounds = exitPupilBounds(ld, sampleOrigin, boundsSamples);
+    if (ld->angularLUT){ entry.bounds = angularBounds(ld, sampleOrigin, entry.bounds); }
+
+    // estimate how many rays get through at this field position, and how many retries that warrants
+    entry.acceptance = estimateLUTAcceptance(ld, sampleOrigin, entry.bounds, acceptanceSamples);
+    entry.maxTries = retryBudget(entry.acceptance, acceptanceSamples);
+    return entry;
+}
+
+
+// cheap stand in for a LUT entry until the full one is computed, from a few hundred rays
+// it has to be conservative: bounds that are too small would never sample part of the exit pupil
+apertureLUTEntry coarseLUTEntry(Lensdata *ld, AtVector sampleOrigin, int coarseSamples){
+    apertureLUTEntry entry;
+    entry.bounds = exitPupilBounds(ld, sampleOrigin, coarseSamples);
+    float elementRadius = ld->lenses[0].aperture;
+
+    if (entry.bounds.getMaxScale() == 0.0f){
+        // this few rays missing the exit pupil doesn't mean nothing gets through, cover the whole search domain
+        float domainRadius = elementRadius * 1.41421356f;
+        entry.bounds.min = AtVector2(-domainRadius, -domainRadius);
+        entry.bounds.max = AtVector2(domainRadius, domainRadius);
+    }
+    else {
+        // samples are never more than two grid cells apart, so growing by that much covers any
+        // exit pupil that isn't a sliver thinner than a cell
+        float margin = 2.0f * (2.0f * elementRadius / std::floor(std::sqrt(static_cast<float>(coarseSamples))));
+        entry.bounds.min.x -= margin;
+        entry.bounds.min.y -= margin;
+        entry.bounds.max.x += margin;
+        entry.bounds.max.y += margin;
+    }
+
+    if (ld->angularLUT){ entry.bounds = angularBounds(ld, sampleOrigin, entry.bounds); }
+
+    // a coarse entry is never treated as outside the image circle and gets the full retry budget
+    entry.acceptance = std::max(estimateLUTAcceptance(ld, sampleOrigin, entry.bounds, coarseSamples), 1.0f / static_cast<float>(coarseSamples));
+    entry.maxTries = maxtries;
+    return entry;
+}
+
+
+// amount of rays per coarse entry of a progressive LUT
+static const int coarseLUTSamples = 1024;
+
+
+// with progressive set only coarse entries are made here, each one gets refined the first time a camera ray needs it
+void exitPupilLUT(Lensdata *ld, int filmSamplesX, int boundsSamples, int acceptanceSamples, bool progressive){
+
+    float filmWidth = 4.0;
+    float filmSpacingX = filmWidth / static_cast<float>(filmSamplesX);
+    int deadPositions = 0;
+
+    // an angular LUT spans the sensor diagonal, with its positions closer together towards the edge
+    // where a wide angle lens' exit pupil changes fastest
+    float fieldRadius = (ld->filmDiagonal > 0.0f) ? ld->filmDiagonal * 0.5f * samplingErrorCorrection : filmWidth;
+    float fieldStep = AI_PIOVER2 / static_cast<float>(std::max(filmSamplesX - 1, 1));
+
+    AiMsgInfo("%-40s %12d", progressive ? "[ZOIC] Calculating progressive LUT of size" : "[ZOIC] Calculating LUT of size", filmSamplesX);
+
+    if (progressive){
+        std::vector<lutRefinement>(filmSamplesX).swap(ld->lutRefinements);
+        ld->lutBoundsSamples = boundsSamples;
+        ld->lutAcceptanceSamples = acceptanceSamples;
+    }
+
+    for (int i = 0; i < filmSamplesX; i++){
+        float position = ld->angularLUT ? fieldRadius * std::sin(fieldStep * static_cast<float>(i)) : filmSpacingX * static_cast<float>(i);
+        AtVector sampleOrigin(position, 0.0, ld->originShift);
+
+        apertureLUTEntry entry;
+        if (progressive){
+            entry = coarseLUTEntry(ld, sampleOrigin, coarseLUTSamples);
+            entry.refineIndex = i;
+        }
+        else {
+            entry = computeLUTEntry(ld, sampleOrigin, boundsSamples, acceptanceSamples);
+        }
+
+        if (entry.acceptance == 0.0f){
+            ++deadPositions;
+        }
+
+        // store bounds of this particular point on aperture in a map for easy lookup
+        ld->apertureMap.insert(std::pair<float, apertureLUTEntry>(sampleOrigin.x, entry));
+    }
+
+    AiMsgInfo("%-40s %12d", "[ZOIC] LUT positions outside image circle", deadPositions);
+}
+
+
+// best data available for a LUT entry, never blocks
+// the first thread to find a coarse entry computes the full one and publishes it, any other thread
+// needing it in the meantime carries on with the coarse entry
+const apertureLUTEntry& bestLUTEntry(Lensdata *ld, float position, const apertureLUTEntry &entry){
+    if (entry.refineIndex < 0){ return entry; }
+
+    lutRefinement &refinement = ld->lutRefinements[entry.refineIndex];
+    apertureLUTEntry *refined = refinement.refined.load(std::memory_order_acquire);
+    if (refined){ return *refined; }
+
+    int unclaimed = 0;
+    if (refinement.claimed.compare_exchange_strong(unclaimed, 1)){
+        refined = new apertureLUTEntry(computeLUTEntry(ld, AtVector(position, 0.0, ld->originShift), ld->lutBoundsSamples, ld->lutAcceptanceSamples));
+        refinement.refined.store(refined, std::memory_order_release);
+        return *refined;
+    }
+
+    return entry;
+}
+
+
+// look up everything needed to sample the exit pupil from a given position on the sensor
+void sensorPositionLookup(Lensdata *ld, float x, float y, sensorPositionRecord *rec){
+    float distanceFromOrigin = std::abs(std::sqrt(x * x + y * y));
+
+    // first LUT entry at or beyond this distance, and the one before it
+    std::map<float, apertureLUTEntry>::iterator low, prev;
+    low = ld->apertureMap.lower_bound(distanceFromOrigin);
+
+    // beyond the outermost LUT entry there is no data, that entry stands in for both neighbours
+    if (low == ld->apertureMap.end()){
+        --low;
+        prev = low;
+    }
+    else {
+        prev = low;
+        if (prev != ld->apertureMap.begin()){ --prev; }
+    }
+
+    const apertureLUTEntry &lowEntry = bestLUTEntry(ld, low->first, low->second);
+    const apertureLUTEntry &prevEntry = bestLUTEntry(ld, prev->first, prev->second);
+
+    // both neighbouring field positions are outside the image circle, don't waste any traces here
+    rec->skipped = (lowEntry.acceptance == 0.0f && prevEntry.acceptance == 0.0f);
+    if (rec->skipped){ return; }
+
+    float lowerBound = low->first;
+    float percentage = (prev->first != lowerBound) ? (distanceFromOrigin - lowerBound) / (prev->first - lowerBound) : 0.0f;
+
+    // at the edge of the image circle, blending towards an entry without light would aim next to the exit pupil
+    if (lowEntry.acceptance == 0.0f){ percentage = 1.0f; }
+    if (prevEntry.acceptance == 0.0f){ percentage = 0.0f; }
+
+    // rotation towards the sensor point, straight from its coordinates
+    fastmath::rotationFromPoint(x, y, &rec->cos, &rec->sin);
+
+    float lowX, lowY, lowTranslation, prevX, prevY, prevTranslation;
+    lutScales(ld, lowEntry.bounds, &lowX, &lowY, &lowTranslation);
+    lutScales(ld, prevEntry.bounds, &prevX, &prevY, &prevTranslation);
+    rec->maxScale = linearInterpolate(percentage, lowX, prevX);
+    rec->scaleY = linearInterpolate(percentage, lowY, prevY);
+    rec->translation = linearInterpolate(percentage, lowTranslation, prevTranslation);
+
+    // use the most conservative retry budget of both neighbouring field positions
+    rec->maxTries = std::max(lowEntry.maxTries, prevEntry.maxTries);
+
+    rec->bokehBin = static_cast<int>(std::distance(ld->apertureMap.begin(), (percentage <= 0.5f) ? low : prev));
+}
+
+
+// cells per side of the joint bokeh and exit pupil distribution, and rays traced per cell to find how much of it gets through
+static const int bokehPupilGrid = 64;
+
+
+static const int bokehPupilCellSamples = 4;
+
+
+// traces bokehPupilCellSamples rays stratified over every lit cell from one sensor position, a cell is marked
+// in passed as soon as one of them gets through
+static void traceBokehPupilCells(Lensdata *ld, const sensorPositionRecord &rec, AtVector sampleOrigin, const std::vector<float> &luminance, int grid, std::vector<int> *passed){
+    int cells = grid * grid;
+    float cellSize = 2.0f / static_cast<float>(grid);
+
+    rayPacket packet;
+    int packetCells[rayPacketSize];
+    int lane = 0;
+
+    for (int c = 0; c < cells; c++){
+        if (luminance[c] <= 0.0f || (*passed)[c]){ continue; }
+
+        // stratified over the cell, in bokehSample coordinates
+        float cellX = -1.0f + (c % grid) * cellSize + ld->bokehPupilOffsetX;
+        float cellY = 1.0f - (c / grid + 1) * cellSize + ld->bokehPupilOffsetY;
+        for (int k = 0; k < bokehPupilCellSamples; k++){
+            float u = cellX + ((k % 2) + xor128() / 4294967296.0f) * 0.5f * cellSize;
+            float v = cellY + ((k / 2) + xor128() / 4294967296.0f) * 0.5f * cellSize;
+
+            AtVector dir = lutDirection(ld, u, v, &rec, sampleOrigin);
+            packet.ox[lane] = sampleOrigin.x;
+            packet.oy[lane] = sampleOrigin.y;
+            packet.oz[lane] = sampleOrigin.z;
+            packet.dx[lane] = dir.x;
+            packet.dy[lane] = dir.y;
+            packet.dz[lane] = dir.z;
+            packet.alive[lane] = 1;
+            packetCells[lane] = c;
+
+            if (++lane < rayPacketSize){ continue; }
+
+            traceRayPacket(&packet, ld);
+            for (int j = 0; j < rayPacketSize; j++){
+                (*passed)[packetCells[j]] |= packet.alive[j];
+            }
+            lane = 0;
+        }
+    }
+
+    // trace whatever is left over, padded with dead lanes
+    if (lane > 0){
+        for (int j = lane; j < rayPacketSize; j++){
+            packet.ox[j] = packet.oy[j] = packet.dx[j] = packet.dy[j] = 0.0f;
+            packet.oz[j] = sampleOrigin.z;
+            packet.dz[j] = -ld->lenses[0].thickness;
+            packet.alive[j] = 0;
+        }
+        traceRayPacket(&packet, ld);
+        for (int j = 0; j < lane; j++){
+            (*passed)[packetCells[j]] |= packet.alive[j];
+        }
+    }
+}
+
+
+// with a bokeh image most samples it gives fall outside of the exit pupil, which is mostly not round
+// so for every LUT field position, the cells of the bokeh image no ray gets through are left out,
+// mapped to the lens exactly like camera_create_ray maps bokeh samples. The rest keep their plain luminance:
+// weighting them by how much gets through would count the pupil twice, the retries already reject what is blocked.
+// A distribution serves every sensor position nearer to its field position than to the next, so a cell stays in
+// when it passes anywhere in that range, or next to a cell that does, to not cut off the edge of the pupil.
+// Memory is bokehPupilGrid^2 floats per LUT entry, no matter the resolution of the image
+void buildBokehPupilSampling(Lensdata *ld, const imageData &image){
+    int grid = bokehPupilGrid;
+    int cells = grid * grid;
+    int bins = static_cast<int>(ld->apertureMap.size());
+
+    std::vector<float> luminance;
+    image.luminanceGrid(grid, &luminance);
+    std::vector<int> passed(cells);
+
+    std::vector<float> positions;
+    for (std::map<float, apertureLUTEntry>::iterator it = ld->apertureMap.begin(); it != ld->apertureMap.end(); ++it){
+        positions.push_back(it->first);
+    }
+
+    ld->bokehPupilGrid = grid;
+    ld->bokehPupilCdf.assign(bins * cells, 0.0f);
+    image.sampleOffset(&ld->bokehPupilOffsetX, &ld->bokehPupilOffsetY);
+
+    int64_t nbytes = static_cast<int64_t>(ld->bokehPupilCdf.size() * sizeof(float));
+    AiAddMemUsage(nbytes, AtString("zoic"));
+
+    for (int b = 0; b < bins; b++){
+        float *cdf = &ld->bokehPupilCdf[b * cells];
+
+        // the field position itself and both ends of the range it is the nearest for
+        float probes[3] = { positions[b], positions[b], positions[b] };
+        if (b > 0){ probes[1] = positions[b] + 0.49f * (positions[b - 1] - positions[b]); }
+        if (b + 1 < bins){ probes[2] = positions[b] + 0.49f * (positions[b + 1] - positions[b]); }
+
+        // outside the image circle only the bokeh image is left to go by
+        bool mask = false;
+        std::fill(passed.begin(), passed.end(), 0);
+        for (int p = 0; p < 3; p++){
+            if (p > 0 && probes[p] == probes[0]){ continue; }
+            sensorPositionRecord rec;
+            sensorPositionLookup(ld, probes[p], 0.0f, &rec);
+            if (rec.skipped || rec.bokehBin != b){ continue; }
+            mask = true;
+            traceBokehPupilCells(ld, rec, AtVector(probes[p], 0.0f, ld->originShift), luminance, grid, &passed);
+        }
+
+        float total = 0.0f;
+        for (int c = 0; c < cells; c++){
+            int x = c % grid, y = c / grid;
+            bool open = !mask;
+            for (int ny = std::max(y - 1, 0); !open && ny <= std::min(y + 1, grid - 1); ny++){
+                for (int nx = std::max(x - 1, 0); !open && nx <= std::min(x + 1, grid - 1); nx++){
+                    open = (passed[ny * grid + nx] != 0);
+                }
+            }
+            cdf[c] = open ? luminance[c] : 0.0f;
+            total += cdf[c];
+        }
+
+        // nothing of the bokeh image makes it through the few rays per cell, keep the image itself and let the retries sort it out
+        if (total <= 0.0f){
+            for (int c = 0; c < cells; c++){
+                total += (cdf[c] = luminance[c]);
+            }
+        }
+
+        float running = 0.0f;
+        float invTotal = (total > 0.0f) ? 1.0f / total : 0.0f;
+        for (int c = 0; c < cells; c++){
+            running += cdf[c] * invTotal;
+            cdf[c] = running;
+        }
+    }
+
+    AiMsgInfo("%-40s %12d", "[ZOIC] Joint bokeh pupil distributions", bins);
+    AiMsgInfo("%-40s %12.2f", "[ZOIC] Joint bokeh pupil memory [KB]", static_cast<float>(nbytes) / 1024.0f);
+}
+
+
+// point in the [-1, 1] bokehSample domain from the joint bokeh and exit pupil distribution of a LUT field position
+// u picks the cell and, rescaled within it, the x position in the cell, v the y position
+void sampleBokehPupil(const Lensdata *ld, int bin, float u, float v, AtVector2 *lens){
+    int grid = ld->bokehPupilGrid;
+    int cells = grid * grid;
+    const float *cdf = &ld->bokehPupilCdf[std::min(bin, static_cast<int>(ld->bokehPupilCdf.size()) / cells - 1) * cells];
+
+    int c = static_cast<int>(std::upper_bound(cdf, cdf + cells, u) - cdf);
+    c = std::min(c, cells - 1);
+
+    float lower = (c > 0) ? cdf[c - 1] : 0.0f;
+    float width = cdf[c] - lower;
+    float x = (width > 0.0f) ? std::min(std::max((u - lower) / width, 0.0f), 1.0f) : 0.5f;
+
+    float cellSize = 2.0f / static_cast<float>(grid);
+    lens->x = -1.0f + (static_cast<float>(c % grid) + x) * cellSize + ld->bokehPupilOffsetX;
+    lens->y = 1.0f - (static_cast<float>(c / grid) + v) * cellSize + ld->bokehPupilOffsetY;
+}
+
+
+// compiles a zoom lens (as read, before cleanup) at every zoom position of its description, LUT included
+// all positions share one scale, the one that gives zoom position 0 the requested focal length
+void buildZoomKeys(Lensdata *raw, float focalLength, float fStop, float focalDistance, bool useLUT, std::vector<Lensdata*> *keys){
+    int positions = static_cast<int>(raw->zoomThickness[0].size());
+    float focalLengthRatio = 1.0f;
+
+    for (int k = 0; k < positions; k++){
+        AiMsgDebug("%-40s %12d", "[ZOIC] Compiling zoom position", k);
+
+        Lensdata *key = new Lensdata();
+        setupPhase phase("zoom position", key);
+        key->lenses = raw->lenses;
+        key->lensCount = raw->lensCount;
+        key->filmDiagonal = raw->filmDiagonal;
+        key->angularLUT = raw->angularLUT;
+
+        for (size_t z = 0; z < raw->zoomElements.size(); z++){
+            key->lenses[raw->zoomElements[z]].thickness = raw->zoomThickness[z][k];
+        }
+
+        cleanupLensData(key);
+
+        if (k == 0){
+            focalLengthRatio = focalLength / traceThroughLensElementsForFocalLength(key, false);
+        }
+
+        key->focalLengthRatio = focalLengthRatio;
+        adjustFocalLength(key);
+        prepareLens(key, fStop, focalDistance);
+
+        // interpolated LUT entries can't be refined later, so the keys always get the full LUT
+        if (useLUT){
+            exitPupilLUT(key, 32, 100000, 4096, false);
+        }
+
+        keys->push_back(key);
+    }
+}
+
+
+// sets a lens up at a zoom position in between the compiled ones without tracing any LUT:
+// element thickness is interpolated, the lens refocused and the LUT entries of both neighbouring positions blended
+void interpolateZoom(const std::vector<Lensdata*> &keys, float zoom, float fStop, float focalDistance, Lensdata *ld){
+    int positions = static_cast<int>(keys.size());
+    float position = std::min(std::max(zoom, 0.0f), 1.0f) * static_cast<float>(positions - 1);
+    int k = std::min(static_cast<int>(position), std::max(positions - 2, 0));
+    float t = (positions > 1) ? position - static_cast<float>(k) : 0.0f;
+    const Lensdata &a = *keys[k];
+    const Lensdata &b = *keys[std::min(k + 1, positions - 1)];
+
+    ld->lenses = a.lenses;
+    ld->lensCount = a.lensCount;
+    ld->apertureElement = a.apertureElement;
+    ld->focalLengthRatio = a.focalLengthRatio;
+    ld->filmDiagonal = a.filmDiagonal;
+    ld->angularLUT = a.angularLUT;
+
+    for (int i = 0; i < ld->lensCount; i++){
+        ld->lenses[i].thickness = linearInterpolate(t, a.lenses[i].thickness, b.lenses[i].thickness);
+    }
+
+    prepareLens(ld, fStop, focalDistance);
+
+    // both keys have their LUT entries at the same field positions
+    std::map<float, apertureLUTEntry>::const_iterator ea = a.apertureMap.begin(), eb = b.apertureMap.begin();
+    for (; ea != a.apertureMap.end() && eb != b.apertureMap.end(); ++ea, ++eb){
+        apertureLUTEntry entry;
+        entry.bounds.min = AtVector2(linearInterpolate(t, ea->second.bounds.min.x, eb->second.bounds.min.x),
+                                     linearInterpolate(t, ea->second.bounds.min.y, eb->second.bounds.min.y));
+        entry.bounds.max = AtVector2(linearInterpolate(t, ea->second.bounds.max.x, eb->second.bounds.max.x),
+                                     linearInterpolate(t, ea->second.bounds.max.y, eb->second.bounds.max.y));
+
+        // light only gets through at one of both positions: keep its bounds and don't skip this field position
+        if (ea->second.acceptance == 0.0f){ entry.bounds = eb->second.bounds; }
+        if (eb->second.acceptance == 0.0f){ entry.bounds = ea->second.bounds; }
+
+        entry.acceptance = linearInterpolate(t, ea->second.acceptance, eb->second.acceptance);
+        if (ea->second.acceptance == 0.0f || eb->second.acceptance == 0.0f){
+            entry.acceptance = std::max(ea->second.acceptance, eb->second.acceptance);
+        }
+        entry.maxTries = std::max(ea->second.maxTries, eb->second.maxTries);
+
+        ld->apertureMap.insert(std::pair<float, apertureLUTEntry>(ea->first, entry));
+    }
+
+    AiMsgInfo("%-40s %12.8f", "[ZOIC] Zoom position", zoom);
+}
+
+
+// sets up copies of a lens at several focus distances between near and far, evenly spaced in 1 / distance
+// only the sensor position and the exit pupil LUT depend on focus, everything else is shared with the base lens
+void buildFocusCache(Lensdata *ld, float nearDistance, float farDistance, int keys, bool useLUT, bool progressive){
+    ld->focusInverseFar = 1.0f / farDistance;
+    ld->focusInverseStep = (1.0f / nearDistance - 1.0f / farDistance) / static_cast<float>(keys - 1);
+
+    AiMsgInfo("%-40s %12d", "[ZOIC] Building focus cache, keys", keys);
+
+    for (int k = 0; k < keys; k++){
+        Lensdata *key = new Lensdata();
+        setupPhase phase("focus key", key);
+        key->lenses = ld->lenses;
+        key->lensCount = ld->lensCount;
+        key->userApertureRadius = ld->userApertureRadius;
+        key->apertureElement = ld->apertureElement;
+        key->apertureDistance = ld->apertureDistance;
+        key->focalLengthRatio = ld->focalLengthRatio;
+        key->filmDiagonal = ld->filmDiagonal;
+        key->angularLUT = ld->angularLUT;
+        key->tracer = ld->tracer;
+
+        key->focalDistance = 1.0f / (ld->focusInverseFar + static_cast<float>(k) * ld->focusInverseStep);
+        key->originShift = calculateImageDistance(key->focalDistance, key);
+        buildReverseProjection(key);
+
+        if (useLUT){
+            exitPupilLUT(key, 32, 100000, 4096, progressive);
+        }
+
+        ld->focusKeys.push_back(key);
+    }
+}
+
+
+// the sensor moves smoothly with 1 / distance, so its position is a Catmull-Rom spline through the keys
+// the LUTs are interpolated linearly between the two surrounding keys
+focusPosition locateFocus(Lensdata *ld, float focalDistance){
+    focusPosition focus;
+    focus.key = 0;
+    focus.t = 0.0f;
+    focus.originShift = ld->originShift;
+
+    int keys = static_cast<int>(ld->focusKeys.size());
+    if (keys < 2){ return focus; }
+
+    // focus outside of the cached range is clamped to it
+    float position = (1.0f / focalDistance - ld->focusInverseFar) / ld->focusInverseStep;
+    position = std::min(std::max(position, 0.0f), static_cast<float>(keys - 1));
+    focus.key = std::min(static_cast<int>(position), keys - 2);
+    focus.t = position - static_cast<float>(focus.key);
+
+    // past the first and last key the neighbours are extrapolated linearly
+    float p1 = ld->focusKeys[focus.key]->originShift;
+    float p2 = ld->focusKeys[focus.key + 1]->originShift;
+    float p0 = (focus.key > 0) ? ld->focusKeys[focus.key - 1]->originShift : 2.0f * p1 - p2;
+    float p3 = (focus.key + 2 < keys) ? ld->focusKeys[focus.key + 2]->originShift : 2.0f * p2 - p1;
+    float t = focus.t, t2 = t * t, t3 = t2 * t;
+    focus.originShift = 0.5f * ((2.0f * p1) + (-p0 + p2) * t + (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * t2 + (-p0 + 3.0f * p1 - 3.0f * p2 + p3) * t3);
+
+    return focus;
+}
+
+
+// sensorPositionLookup for a focus distance, blends the LUTs of the two surrounding focus keys
+void focusedSensorPositionLookup(Lensdata *ld, const focusPosition &focus, float x, float y, sensorPositionRecord *rec){
+    if (ld->focusKeys.empty()){
+        sensorPositionLookup(ld, x, y, rec);
+        return;
+    }
+
+    sensorPositionRecord a, b;
+    sensorPositionLookup(ld->focusKeys[focus.key], x, y, &a);
+    sensorPositionLookup(ld->focusKeys[focus.key + 1], x, y, &b);
+
+    rec->skipped = a.skipped && b.skipped;
+    if (rec->skipped){ return; }
+
+    // light gets through at only one of both keys, its data is all there is
+    if (a.skipped){ a = b; }
+    if (b.skipped){ b = a; }
+
+    rec->cos = a.cos;
+    rec->sin = a.sin;
+    rec->maxScale = linearInterpolate(focus.t, a.maxScale, b.maxScale);
+    rec->scaleY = linearInterpolate(focus.t, a.scaleY, b.scaleY);
+    rec->translation = linearInterpolate(focus.t, a.translation, b.translation);
+    rec->maxTries = std::max(a.maxTries, b.maxTries);
+}
+
+
+// heap memory held by a compiled lens, focus keys included
+// map nodes are counted with the usual red black tree overhead of three pointers and a color
+size_t lensMemory(const Lensdata *ld){
+    size_t bytes = sizeof(Lensdata);
+    bytes += ld->lenses.capacity() * sizeof(LensElement);
+    bytes += ld->apertureMap.size() * (sizeof(std::pair<const float, apertureLUTEntry>) + 4 * sizeof(void*));
+    bytes += ld->lutRefinements.capacity() * sizeof(lutRefinement);
+    for (size_t i = 0; i < ld->lutRefinements.size(); i++){
+        bytes += ld->lutRefinements[i].refined.load() ? sizeof(apertureLUTEntry) : 0;
+    }
+    bytes += ld->zoomElements.capacity() * sizeof(int);
+    for (size_t i = 0; i < ld->zoomThickness.size(); i++){
+        bytes += sizeof(std::vector<float>) + ld->zoomThickness[i].capacity() * sizeof(float);
+    }
+    bytes += ld->bokehPupilCdf.capacity() * sizeof(float);
+    bytes += (ld->reverseRadius.capacity() + ld->reversePupil.capacity()) * sizeof(float);
+    for (size_t i = 0; i < ld->focusKeys.size(); i++){
+        bytes += lensMemory(ld->focusKeys[i]);
+    }
+    return bytes;
+}
+
+
+// bokeh that the LUT doesn't cover at some field position, above this it's warned about
+static const float lutMissedWarning = 0.01f;
+
+
+// compares the area the LUT samples with the real exit pupil at field positions from the center to the corner of the film
+// the pupil comes from rays traced on a grid over the rear element, the LUT area is the unit circle mapped through
+// lutDirection, exactly like camera_create_ray maps its samples. Both are measured on the rear element plane
+void lutAccuracy(Lensdata *ld, int fieldPositions, int pupilSamples, std::vector<lutAccuracyRecord> *records){
+    records->clear();
+    if (ld->apertureMap.empty() || fieldPositions < 1){ return; }
+
+    static const int outlinePoints = 256;
+    float rearAperture = ld->lenses[0].aperture;
+    float dz = -ld->lenses[0].thickness;
+    int grid = std::max(static_cast<int>(std::sqrt(static_cast<float>(pupilSamples))), 1);
+
+    for (int f = 0; f < fieldPositions; f++){
+        lutAccuracyRecord record;
+        record.fieldPosition = (fieldPositions > 1) ? ld->filmDiagonal * 0.5f * f / (fieldPositions - 1) : 0.0f;
+        AtVector origin(record.fieldPosition, 0.0f, ld->originShift);
+
+        sensorPositionRecord rec;
+        sensorPositionLookup(ld, origin.x, origin.y, &rec);
+        record.skipped = rec.skipped;
+
+        // outline of the LUT sampling area
+        std::vector<AtVector2> outline(outlinePoints);
+        if (!rec.skipped){
+            for (int k = 0; k < outlinePoints; k++){
+                float angle = 2.0f * AI_PI * k / outlinePoints;
+                AtVector dir = lutDirection(ld, std::cos(angle), std::sin(angle), &rec, origin);
+                float t = dz / dir.z;
+                outline[k] = AtVector2(origin.x + dir.x * t, origin.y + dir.y * t);
+            }
+
+            for (int k = 0, j = outlinePoints - 1; k < outlinePoints; j = k++){
+                record.lutArea += outline[j].x * outline[k].y - outline[k].x * outline[j].y;
+            }
+            record.lutArea = std::abs(record.lutArea) * 0.5f;
+        }
+
+        // rays through the pupil, and how many of those the LUT would have sampled
+        int passed = 0, covered = 0;
+        for (int i = 0; i < grid * grid; i++){
+            AtVector2 lens;
+            concentricDiskSample((i % grid + 0.5f) / grid, (i / grid + 0.5f) / grid, &lens);
+            lens *= rearAperture;
+
+            AtVector o = origin;
+            AtVector d(lens.x - origin.x, lens.y - origin.y, dz);
+            if (!traceThroughLensElements(&o, &d, ld, NULL)){ continue; }
+            ++passed;
+
+            bool inside = false;
+            for (int k = 0, j = outlinePoints - 1; k < outlinePoints && !rec.skipped; j = k++){
+                if ((outline[k].y > lens.y) != (outline[j].y > lens.y) &&
+                    lens.x < (outline[j].x - outline[k].x) * (lens.y - outline[k].y) / (outline[j].y - outline[k].y) + outline[k].x){
+                    inside = !inside;
+                }
+            }
+            covered += inside ? 1 : 0;
+        }
+
+        record.pupilArea = AI_PI * rearAperture * rearAperture * passed / (grid * grid);
+        record.missed = passed > 0 ? 1.0f - static_cast<float>(covered) / passed : 0.0f;
+        record.efficiency = record.lutArea > 0.0f ? std::min(record.pupilArea * (1.0f - record.missed) / record.lutArea, 1.0f) : 0.0f;
+        records->push_back(record);
+    }
+}
+
+
+void printLUTAccuracy(const std::vector<lutAccuracyRecord> &records){
+    AiMsgInfo("[ZOIC] LUT accuracy   %12s %12s %12s %10s %12s", "field [cm]", "pupil [cm2]", "LUT [cm2]", "missed", "efficiency");
+
+    float worstMissed = 0.0f, worstPosition = 0.0f;
+    for (size_t i = 0; i < records.size(); i++){
+        const lutAccuracyRecord &r = records[i];
+        if (r.skipped && r.pupilArea == 0.0f){
+            AiMsgInfo("[ZOIC] LUT accuracy   %12.4f %12s", r.fieldPosition, "outside image circle");
+            continue;
+        }
+
+        AiMsgInfo("[ZOIC] LUT accuracy   %12.4f %12.6f %12.6f %9.2f%% %11.2f%%",
+                  r.fieldPosition, r.pupilArea, r.lutArea, r.missed * 100.0f, r.efficiency * 100.0f);
+        if (r.missed > worstMissed){
+            worstMissed = r.missed;
+            worstPosition = r.fieldPosition;
+        }
+    }
+
+    if (worstMissed > lutMissedWarning){
+        AiMsgWarning("[ZOIC] LUT misses %.1f%% of the exit pupil at field position [%.4f], bokeh gets clipped there.", worstMissed * 100.0f, worstPosition);
+    }
+}
+
+
+static void exrInt(std::string &out, int32_t value){
+    uint32_t bits = static_cast<uint32_t>(value);
+    for (int i = 0; i < 4; i++){ out += static_cast<char>((bits >> (8 * i)) & 0xff); }
+}
+
+static void exrFloat(std::string &out, float value){
+    int32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    exrInt(out, bits);
+}
+
+static void exrAttribute(std::string &out, const char *name, const char *type, const std::string &value){
+    out += name; out += '\0';
+    out += type; out += '\0';
+    exrInt(out, static_cast<int32_t>(value.size()));
+    out += value;
+}
+
+
+// uncompressed scanline openexr with a float channel per name, pixel i of channel c is channels[c][i]
+// no library needed for diagnostics this way, every exr reader takes it
+bool writeEXR(const std::string &path, int width, int height, const std::vector<std::string> &names, const std::vector<std::vector<float> > &channels){
+    if (width < 1 || height < 1 || names.empty() || names.size() != channels.size()){ return false; }
+
+    // exr wants its channels sorted by name
+    std::vector<int> order(names.size());
+    for (size_t c = 0; c < order.size(); c++){ order[c] = static_cast<int>(c); }
+    std::sort(order.begin(), order.end(), [&](int a, int b){ return names[a] < names[b]; });
+
+    std::string header;
+    exrInt(header, 20000630);
+    exrInt(header, 2);
+
+    std::string channelList;
+    for (size_t c = 0; c < order.size(); c++){
+        channelList += names[order[c]]; channelList += '\0';
+        exrInt(channelList, 2); // FLOAT
+        channelList += std::string(4, '\0'); // pLinear and reserved
+        exrInt(channelList, 1);
+        exrInt(channelList, 1);
+    }
+    channelList += '\0';
+
+    std::string window, value;
+    exrInt(window, 0); exrInt(window, 0); exrInt(window, width - 1); exrInt(window, height - 1);
+
+    exrAttribute(header, "channels", "chlist", channelList);
+    exrAttribute(header, "compression", "compression", std::string(1, '\0'));
+    exrAttribute(header, "dataWindow", "box2i", window);
+    exrAttribute(header, "displayWindow", "box2i", window);
+    exrAttribute(header, "lineOrder", "lineOrder", std::string(1, '\0'));
+    value.clear(); exrFloat(value, 1.0f);
+    exrAttribute(header, "pixelAspectRatio", "float", value);
+    value.clear(); exrFloat(value, 0.0f); exrFloat(value, 0.0f);
+    exrAttribute(header, "screenWindowCenter", "v2f", value);
+    value.clear(); exrFloat(value, 1.0f);
+    exrAttribute(header, "screenWindowWidth", "float", value);
+    header += '\0';
+
+    // line offset table, then every scanline as its y, its size and the channels one after the other
+    int32_t lineBytes = static_cast<int32_t>(width * names.size() * sizeof(float));
+    uint64_t offset = header.size() + static_cast<uint64_t>(height) * 8;
+    for (int y = 0; y < height; y++){
+        uint64_t lineOffset = offset + static_cast<uint64_t>(y) * (8 + lineBytes);
+        exrInt(header, static_cast<int32_t>(lineOffset & 0xffffffff));
+        exrInt(header, static_cast<int32_t>(lineOffset >> 32));
+    }
+
+    std::ofstream file(path.c_str(), std::ios::binary | std::ios::trunc);
+    if (!file){ return false; }
+    file.write(header.data(), header.size());
+
+    std::string line;
+    for (int y = 0; y < height; y++){
+        line.clear();
+        exrInt(line, y);
+        exrInt(line, lineBytes);
+        for (size_t c = 0; c < order.size(); c++){
+            const float *row = &channels[order[c]][static_cast<size_t>(y) * width];
+            for (int x = 0; x < width; x++){
+                exrFloat(line, row[x]);
+            }
+        }
+        file.write(line.data(), line.size());
+    }
+
+    return static_cast<bool>(file);
+}
@@ -0,0 +1,1162 @@
+// ZOIC - lens model core
+// Lens data, tracing, the exit pupil LUT and bokeh image sampling: everything the camera shader does that isn't
+// the arnold node itself. Compiled against the arnold headers into the plugin, or with ZOIC_NO_ARNOLD against
+// src/arnoldShim.h into the zoic_core library, for benchmarks and tests on machines without arnold.
+
+// (C) Zeno Pelgrims, www.zenopelgrims.com/zoic
+
+#ifndef ZOIC_CORE_H
+#define ZOIC_CORE_H
+
+#ifdef ZOIC_NO_ARNOLD
+#  include "arnoldShim.h"
+#else
+#  include <ai.h>
+#endif
+#include "fastMath.h"
+#include <iostream>
+#include <cstdint>
+#include <climits>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <map>
+#include <iterator>
+#include <algorithm>
+
+#ifdef _MACBOOK
+#  define MACBOOK_ONLY(block) block
+#else
+#  define MACBOOK_ONLY(block)
+#endif
+
+#ifdef _WORK
+#  define WORK_ONLY(block) block
+#else
+#  define WORK_ONLY(block)
+#endif
+
+#ifdef _DEBUGIMAGESAMPLING
+#  define DEBUG_ONLY(block) block
+#else
+#  define DEBUG_ONLY(block)
+#endif
+
+
+struct Lensdata;
+size_t lensMemory(const Lensdata *ld);
+
+
+// time and memory of one phase of setting up a camera
+// depth 0 are the stages node_update marks itself, setupPhase scopes that ran within one are nested below it
+struct setupStage{
+    std::string name;
+    int depth;
+    double ms;
+    int64_t bytes; // change in memory held by the lens data being set up, 0 when not known
+};
+
+// setupPhase scopes on this thread are added to stages from here on, NULL stops it, returns what was collecting before
+std::vector<setupStage>* collectSetupStages(std::vector<setupStage> *stages);
+
+// times the scope it lives in, only when this thread collects setup stages, it's a pointer check otherwise
+class setupPhase{
+public:
+    explicit setupPhase(const char *name, const Lensdata *ld = NULL);
+    ~setupPhase();
+
+private:
+    const char *name;
+    const Lensdata *ld;
+    std::vector<setupStage> *stages;
+    size_t index; // a phase goes in front of the phases nested in it
+    std::chrono::steady_clock::time_point start;
+    size_t startBytes;
+};
+
+
+// arnold texture loading function
+inline bool LoadTexture(const AtString path, void *pixelData){
+    return AiTextureLoad(path, true, 0, pixelData);
+}
+
+
+struct arrayCompare{
+    const float *values;
+    inline arrayCompare(const float *_values) :values(_values) {}
+    inline bool operator()(int _lhs, int _rhs) const{
+        return values[_lhs] > values[_rhs];
+    }
+};
+
+
+class imageData{
+private:
+    int x, y, nchannels;
+    float *pixelData;
+    float *cdfRow;
+    float *cdfColumn;
+    int *rowIndices;
+    int *columnIndices;
+
+public:
+    imageData()
+        : x(0), y(0), nchannels(0)
+        , pixelData(0), cdfRow(0), cdfColumn(0)
+        , rowIndices(0), columnIndices(0) {
+    }
+
+    ~imageData(){
+        invalidate();
+    }
+
+    bool isValid() const{
+        return (x * y * nchannels > 0 && nchannels >= 3);
+    }
+
+    // bytes held by the pixels and the sampling tables
+    size_t memory() const{
+        size_t pixels = static_cast<size_t>(x) * static_cast<size_t>(y);
+        return pixels * (nchannels + 1) * sizeof(float) + y * sizeof(float) + (pixels + y) * sizeof(int);
+    }
+
+    void invalidate(){
+        if (pixelData){
+            AiAddMemUsage(-x * y * nchannels * sizeof(float), AtString("zoic"));
+            AiFree(pixelData);
+            pixelData = 0;
+        }
+        if (cdfRow){
+            AiAddMemUsage(-y * sizeof(float), AtString("zoic"));
+            AiFree(cdfRow);
+            cdfRow = 0;
+        }
+        if (cdfColumn){
+            AiAddMemUsage(-x * y * sizeof(float), AtString("zoic"));
+            AiFree(cdfColumn);
+            cdfColumn = 0;
+        }
+        if (rowIndices){
+            AiAddMemUsage(-y * sizeof(int), AtString("zoic"));
+            AiFree(rowIndices);
+            rowIndices = 0;
+        }
+        if (columnIndices){
+            AiAddMemUsage(-x * y * sizeof(int), AtString("zoic"));
+            AiFree(columnIndices);
+            columnIndices = 0;
+        }
+        x = y = nchannels = 0;
+    }
+
+    bool read(const char *bokeh_kernel_filename){
+        setupPhase phase("read bokeh image");
+        invalidate();
+        int64_t nbytes = 0;
+
+        AiMsgInfo("[ZOIC] Reading image using Arnold API: %s", bokeh_kernel_filename);
+        AtString path(bokeh_kernel_filename);
+
+        unsigned int iw, ih, nc;
+        if (!AiTextureGetResolution(path, &iw, &ih) || !AiTextureGetNumChannels(path, &nc)){ return false; }
+
+        x = static_cast<int>(iw);
+        y = static_cast<int>(ih);
+        nchannels = static_cast<int>(nc);
+
+        nbytes = x * y * nchannels * sizeof(float);
+        AiAddMemUsage(nbytes, AtString("zoic"));
+        pixelData = (float*)AiMalloc(nbytes);
+
+        if (!LoadTexture(path, pixelData)){
+            invalidate();
+            return false;
+        }
+
+        AiMsgDebug("[ZOIC] Bokeh Image Width: %d", x);
+        AiMsgDebug("[ZOIC] Bokeh Image Height: %d", y);
+        AiMsgDebug("[ZOIC] Bokeh Image Channels: %d", nchannels);
+        AiMsgDebug("[ZOIC] Total amount of bokeh pixels to process: %d", x * y);
+
+        DEBUG_ONLY({
+            // print out raw pixel data
+            int npixels = x * y;
+            for (int i = 0, j = 0; i < npixels; i++){
+                std::cout << "[";
+                for (int k = 0; k < nchannels; k++, j++){
+                    std::cout << pixelData[j];
+                    if (k + 1 < nchannels){
+                        std::cout << ", ";
+                    }
+                }
+                std::cout << "]";
+                if (i + 1 < npixels){
+                    std::cout << ", ";
+                }
+            }
+            std::cout << "----------------------------------------------" << std::endl;
+            std::cout << "----------------------------------------------" << std::endl;
+        })
+
+            bokehProbability();
+
+        return true;
+    }
+
+    // Importance sampling
+    void bokehProbability(){
+        if (!isValid()){ return; }
+        setupPhase phase("bokeh probability");
+
+        // initialize arrays
+        int64_t nbytes = x * y * sizeof(float);
+        int64_t totalTempBytes = 0;
+
+        AiAddMemUsage(nbytes, AtString("zoic"));
+        float *pixelValues = (float*)AiMalloc(nbytes);
+        totalTempBytes += nbytes;
+
+        AiAddMemUsage(nbytes, AtString("zoic"));
+        float *normalizedPixelValues = (float*)AiMalloc(nbytes);
+        totalTempBytes += nbytes;
+
+        int npixels = x * y;
+        int o1 = (nchannels >= 2 ? 1 : 0);
+        int o2 = (nchannels >= 3 ? 2 : o1);
+        float totalValue = 0.0f;
+
+        // for every pixel, stuff going wrong here
+        for (int i = 0, j = 0; i < npixels; ++i, j += nchannels){
+            // store pixel value in array
+            pixelValues[i] = pixelData[j] * 0.3f + pixelData[j + o1] * 0.59f + pixelData[j + o2] * 0.11f;
+            totalValue += pixelValues[i];
+
+            DEBUG_ONLY(std::cout << "Pixel Luminance: " << i << " -> " << pixelValues[i] << std::endl);
+        }
+
+        DEBUG_ONLY({
+            std::cout << "----------------------------------------------" << std::endl;
+            std::cout << "DEBUG: Total Pixel Value: " << totalValue << std::endl;
+            std::cout << "----------------------------------------------" << std::endl;
+            std::cout << "----------------------------------------------" << std::endl;
+        })
+
+            // normalize pixel values so sum = 1
+            float invTotalValue = 1.0f / totalValue;
+        float totalNormalizedValue = 0.0f;
+
+        for (int i = 0; i < npixels; ++i){
+            normalizedPixelValues[i] = pixelValues[i] * invTotalValue;
+
+            totalNormalizedValue += normalizedPixelValues[i];
+
+            DEBUG_ONLY(std::cout << "Normalized Pixel Value: " << i << ": " << normalizedPixelValues[i] << std::endl);
+        }
+
+        DEBUG_ONLY({
+            std::cout << "----------------------------------------------" << std::endl;
+            std::cout << "DEBUG: Total Normalized Pixel Value: " << totalNormalizedValue << std::endl;
+            std::cout << "----------------------------------------------" << std::endl;
+            std::cout << "----------------------------------------------" << std::endl;
+        })
+
+            // calculate sum for each row
+            nbytes = y * sizeof(float);
+        AiAddMemUsage(nbytes, AtString("zoic"));
+        float *summedRowValues = (float*)AiMalloc(nbytes);
+        totalTempBytes += nbytes;
+
+        for (int i = 0, k = 0; i < y; ++i){
+
+            summedRowValues[i] = 0.0f;
+
+            for (int j = 0; j < x; ++j, ++k){
+
+                summedRowValues[i] += normalizedPixelValues[k];
+            }
+
+            DEBUG_ONLY(std::cout << "Summed Values row [" << i << "]: " << summedRowValues[i] << std::endl);
+        }
+
+
+        DEBUG_ONLY({
+            // calculate sum of all row values, just to debug
+            float totalNormalizedRowValue = 0.0f;
+            for (int i = 0; i < y; ++i){
+                totalNormalizedRowValue += summedRowValues[i];
+            }
+            std::cout << "----------------------------------------------" << std::endl;
+            std::cout << "Debug: Summed Row Value: " << totalNormalizedRowValue << std::endl;
+            std::cout << "----------------------------------------------" << std::endl;
+        })
+
+
+            // make array of indices
+            nbytes = y * sizeof(int);
+        AiAddMemUsage(nbytes, AtString("zoic"));
+        rowIndices = (int*)AiMalloc(nbytes);
+
+        for (int i = 0; i < y; ++i){
+            rowIndices[i] = i;
+        }
+
+        std::sort(rowIndices, rowIndices + y, arrayCompare(summedRowValues));
+
+        DEBUG_ONLY({
+            // print values
+            for (int i = 0; i < y; ++i){
+                std::cout << "PDF row [" << rowIndices[i] << "]: " << summedRowValues[rowIndices[i]] << std::endl;
+            }
+            std::cout << "----------------------------------------------" << std::endl;
+            std::cout << "----------------------------------------------" << std::endl;
+        })
+
+            // For every row, add the sum of all previous row (cumulative distribution function)
+            nbytes = y * sizeof(float);
+        AiAddMemUsage(nbytes, AtString("zoic"));
+        cdfRow = (float*)AiMalloc(nbytes);
+
+        float prevVal = 0.0f;
+        for (int i = 0; i < y; ++i){
+            cdfRow[i] = prevVal + summedRowValues[rowIndices[i]];
+            prevVal = cdfRow[i];
+
+            DEBUG_ONLY(std::cout << "CDF row [" << rowIndices[i] << "]: " << cdfRow[i] << std::endl);
+        }
+
+        DEBUG_ONLY({
+            std::cout << "----------------------------------------------" << std::endl;
+            std::cout << "----------------------------------------------" << std::endl;
+        })
+
+            nbytes = npixels * sizeof(float);
+        AiAddMemUsage(nbytes, AtString("zoic"));
+        float *normalizedValuesPerRow = (float*)AiMalloc(nbytes);
+        totalTempBytes += nbytes;
+
+        // divide pixel values of each pixel by the sum of the pixel values of that row (Normalize)
+        for (int r = 0, i = 0; r < y; ++r){
+            for (int c = 0; c < x; ++c, ++i){
+                // avoid division by 0
+                if ((normalizedPixelValues[i] != 0) && (summedRowValues[r] != 0)){
+                    normalizedValuesPerRow[i] = normalizedPixelValues[i] / summedRowValues[r];
+                }
+                else {
+                    normalizedValuesPerRow[i] = 0;
+                }
+
+                DEBUG_ONLY(std::cout << "Normalized Pixel value per row: " << i << ": " << normalizedValuesPerRow[i] << std::endl);
+            }
+        }
+
+        DEBUG_ONLY({
+            std::cout << "----------------------------------------------" << std::endl;
+            std::cout << "----------------------------------------------" << std::endl;
+        })
+
+            // sort column values from highest to lowest per row (probability density function)
+            nbytes = npixels * sizeof(int);
+        AiAddMemUsage(nbytes, AtString("zoic"));
+        columnIndices = (int*)AiMalloc(nbytes);
+
+        for (int i = 0; i < npixels; i++){
+            columnIndices[i] = i;
+        }
+
+        for (int i = 0; i < npixels; i += x){
+            std::sort(columnIndices + i, columnIndices + i + x, arrayCompare(normalizedValuesPerRow));
+        }
+
+        DEBUG_ONLY({
+            for (int i = 0; i < npixels; ++i){
+                std::cout << "PDF column [" << columnIndices[i] << "]: " << normalizedValuesPerRow[columnIndices[i]] << std::endl;
+            }
+
+            std::cout << "----------------------------------------------" << std::endl;
+            std::cout << "----------------------------------------------" << std::endl;
+        })
+
+            // For every column per row, add the sum of all previous columns (cumulative distribution function)
+            nbytes = npixels * sizeof(float);
+        AiAddMemUsage(nbytes, AtString("zoic"));
+        cdfColumn = (float*)AiMalloc(nbytes);
+
+        for (int r = 0, i = 0; r < y; ++r){
+            prevVal = 0.0f;
+
+            for (int c = 0; c < x; ++c, ++i){
+                cdfColumn[i] = prevVal + normalizedValuesPerRow[columnIndices[i]];
+                prevVal = cdfColumn[i];
+
+                DEBUG_ONLY(std::cout << "CDF column [" << columnIndices[i] << "]: " << cdfColumn[i] << std::endl);
+            }
+        }
+
+        DEBUG_ONLY(std::cout << "----------------------------------------------" << std::endl);
+
+        // Release and untrack memory
+        AiAddMemUsage(-totalTempBytes, AtString("zoic"));
+        AiFree(pixelValues);
+        AiFree(normalizedPixelValues);
+        AiFree(summedRowValues);
+        AiFree(normalizedValuesPerRow);
+    }
+
+    // luminance of the image summed into grid x grid cells, laid out like the bokehSample domain:
+    // cell (i, j) covers x in [-1, 1] from left to right for j and y in [1, -1] from top to bottom for i
+    void luminanceGrid(int grid, std::vector<float> *cells) const{
+        cells->assign(grid * grid, 0.0f);
+        if (!isValid()){ return; }
+
+        int o1 = (nchannels >= 2 ? 1 : 0);
+        int o2 = (nchannels >= 3 ? 2 : o1);
+
+        for (int r = 0, j = 0; r < y; ++r){
+            int i = (r * grid) / y;
+            for (int c = 0; c < x; ++c, j += nchannels){
+                float luminance = pixelData[j] * 0.3f + pixelData[j + o1] * 0.59f + pixelData[j + o2] * 0.11f;
+                (*cells)[i * grid + (c * grid) / x] += luminance;
+            }
+        }
+    }
+
+    // where bokehSample puts a pixel, relative to the center of the pixel in the bokehSample domain
+    // it rounds to the pixel below the center of the image, so this is only off for even image sizes
+    void sampleOffset(float *dx, float *dy) const{
+        *dx = (x > 0) ? ((x * 0.5f - 0.5f) - static_cast<float>((y - 1) / 2)) * 2.0f / static_cast<float>(x) : 0.0f;
+        *dy = (y > 0) ? (static_cast<float>((x - 1) / 2) - (y * 0.5f - 0.5f)) * 2.0f / static_cast<float>(y) : 0.0f;
+    }
+
+    // Sample image
+    void bokehSample(float randomNumberRow, float randomNumberColumn, float *dx, float *dy){
+        if (!isValid()){
+            AiMsgWarning("Invalid bokeh image data.");
+            *dx = 0.0f;
+            *dy = 0.0f;
+            return;
+        }
+
+        // print random number between 0 and 1
+        DEBUG_ONLY(std::cout << "RANDOM NUMBER ROW: " << randomNumberRow << std::endl);
+
+        // find upper bound of random number in the array
+        float *pUpperBound = std::upper_bound(cdfRow, cdfRow + y, randomNumberRow);
+
+        int r = 0;
+        pUpperBound >= (cdfRow + y) ? r = y - 1 : r = static_cast<int>(pUpperBound - cdfRow);
+
+        // find actual pixel row
+        int actualPixelRow = rowIndices[r];
+
+        // recalculate pixel row so that the center pixel is (0,0) - might run into problems with images of dimensions like 2x2, 4x4, 6x6, etc
+        int recalulatedPixelRow = actualPixelRow - ((x - 1) / 2);
+
+        DEBUG_ONLY({
+            // print values
+            std::cout << "INDEX IN CDF ROW: " << r << std::endl;
+            std::cout << "ACTUAL PIXEL ROW: " << actualPixelRow << std::endl;
+            std::cout << "RECALCULATED PIXEL ROW: " << recalulatedPixelRow << std::endl;
+            std::cout << "----------------------------------------------" << std::endl;
+            std::cout << "----------------------------------------------" << std::endl;
+            std::cout << "RANDOM NUMBER COLUMN: " << randomNumberColumn << std::endl;
+        })
+
+            int startPixel = actualPixelRow * x;
+        DEBUG_ONLY(std::cout << "START PIXEL: " << startPixel << std::endl);
+
+
+        // find upper bound of random number in the array
+        float *pUpperBoundColumn = std::upper_bound(cdfColumn + startPixel, cdfColumn + startPixel + x, randomNumberColumn);
+
+        int c = 0;
+        pUpperBoundColumn >= cdfColumn + startPixel + x ? c = startPixel + x - 1 : c = static_cast<int>(pUpperBoundColumn - cdfColumn);
+
+        // find actual pixel column
+        int actualPixelColumn = columnIndices[c];
+        int relativePixelColumn = actualPixelColumn - startPixel;
+        int recalulatedPixelColumn = relativePixelColumn - ((y - 1) / 2);
+
+        DEBUG_ONLY({
+            // print values
+            std::cout << "INDEX IN CDF COLUMN: " << c << std::endl;
+            std::cout << "ACTUAL PIXEL COLUMN: " << actualPixelColumn << std::endl;
+            std::cout << "RELATIVE PIXEL COLUMN (starting from 0): " << relativePixelColumn << std::endl;
+            std::cout << "RECALCULATED PIXEL COLUMN: " << recalulatedPixelColumn << std::endl;
+            std::cout << "----------------------------------------------" << std::endl;
+            std::cout << "----------------------------------------------" << std::endl;
+        })
+
+            // to get the right image orientation, flip the x and y coordinates and then multiply the y values by -1 to flip the pixels vertically
+            float flippedRow = static_cast<float>(recalulatedPixelColumn);
+        float flippedColumn = recalulatedPixelRow * -1.0f;
+
+        // send values back
+        *dx = static_cast<float>(flippedRow) / static_cast<float>(x)* 2.0;
+        *dy = static_cast<float>(flippedColumn) / static_cast<float>(y)* 2.0;
+    }
+};
+
+
+// small 2d bounding box class for aperture LUT data
+class boundingBox2d{
+public:
+    AtVector2 max, min;
+
+    // get center of bounding box
+    AtVector2 getCentroid(){
+        AtVector2 rv((min.x + max.x) * 0.5f, (min.y + max.y) * 0.5f);
+        return rv;
+    }
+
+    // return either Xscale or Yscale depending on which one is largest
+    // needed since I scale the area over which I will shoot rays uniformly
+    // and it needs to cover all of the aperture
+    float getMaxScale(){
+        AtVector2 centroid = getCentroid();
+
+        float x1 = max.x - centroid.x;
+        float y2 = max.y - centroid.y;
+        float scaleX = std::sqrt(x1 * x1);
+        float scaleY = std::sqrt(y2 * y2);
+
+        if (scaleX >= scaleY){
+            return scaleX;
+        }
+        else {
+            return scaleY;
+        }
+    }
+};
+
+
+inline float linearInterpolate(float perc, float a, float b){
+    return a + perc * (b - a);
+}
+
+
+// exit pupil LUT entry for a single distance from the sensor center
+struct apertureLUTEntry{
+    boundingBox2d bounds;
+    float acceptance; // fraction of rays sampled inside the bounds that make it through the lens
+    int maxTries;     // retry budget needed to reach retrySuccesProbability at this field position
+    int refineIndex;  // progressive LUT only, slot in Lensdata::lutRefinements while this is still a coarse entry, -1 otherwise
+
+    apertureLUTEntry()
+        : acceptance(0.0f), maxTries(0), refineIndex(-1){
+    }
+};
+
+
+// full quality replacement of a coarse LUT entry, computed once by whichever thread needs it first
+struct lutRefinement{
+    std::atomic<int> claimed;
+    std::atomic<apertureLUTEntry*> refined;
+
+    lutRefinement()
+        : claimed(0), refined(NULL){
+    }
+
+    ~lutRefinement(){
+        delete refined.load();
+    }
+};
+
+
+// hero wavelengths traced together when dispersion is on, one SSE register wide
+static const int spectralLanes = 4;
+
+
+// shape of a lens surface, every type has its own intersection kernel
+enum SurfaceType{
+    SURFACE_SPHERE,
+    SURFACE_PLANE,   // the aperture stop
+    SURFACE_ASPHERE  // even asphere, conic plus polynomial terms in r^2
+};
+
+// polynomial terms of an even asphere, A4 r^4 up to A14 r^14
+static const int asphereTerms = 6;
+
+
+// lens element data structure
+struct LensElement{
+public:
+    float curvature, thickness, ior, aperture, abbe, center;
+    float vertex; // z position where the surface crosses the optical axis, see computeLensCenters
+    float spectralIor[spectralLanes]; // ior at each hero wavelength, from ior and abbe, see computeSpectralIor
+    int type;
+    float conic;
+    float asphere[asphereTerms];
+
+    LensElement()
+        : curvature(0.0f), thickness(0.0f), ior(0.0f), aperture(0.0f), abbe(0.0f), center(0.0f), vertex(0.0f)
+        , type(SURFACE_SPHERE), conic(0.0f){
+        for (int w = 0; w < spectralLanes; w++){ spectralIor[w] = 0.0f; }
+        for (int k = 0; k < asphereTerms; k++){ asphere[k] = 0.0f; }
+    }
+
+    // scales the surface uniformly, a sag of z(r) becomes s * z(r / s)
+    void scale(float s){
+        curvature *= s;
+        thickness *= s;
+        aperture *= s;
+
+        // A2n r^2n scales with s^(1 - 2n)
+        float termScale = 1.0f / (s * s * s);
+        for (int k = 0; k < asphereTerms; k++){
+            asphere[k] *= termScale;
+            termScale /= s * s;
+        }
+    }
+};
+
+struct Lensdata;
+
+// specialised tracing function for a lens with a known surface count, see builtinLensTracer
+typedef bool (*lensTracer)(AtVector *ray_origin, AtVector *ray_direction, Lensdata *ld);
+
+// lens data structure, to store variables I don´t want to compute every time
+struct Lensdata{
+    std::vector<LensElement> lenses;
+    int lensCount;
+    float userApertureRadius;
+    int apertureElement;
+    std::atomic<int> totalInternalReflection; // counted by every render thread tracing through this snapshot
+    float apertureDistance;
+    float focalLengthRatio;
+    float filmDiagonal;
+    float originShift;
+    float focalDistance;
+    std::map<float, apertureLUTEntry> apertureMap;
+    std::vector<lutRefinement> lutRefinements;
+    int lutBoundsSamples, lutAcceptanceSamples; // quality of the refined entries of a progressive LUT
+    bool angularLUT; // LUT positions and bounds parameterized by angle, for wide angle lenses
+    lensTracer tracer; // NULL when the generic traceThroughLensElements loop should be used
+    uint64_t snapshotId; // set when published, tells cached sensor positions of different snapshots apart
+
+    // zoom lens description, the elements whose thickness changes with zoom and their thickness [mm, as read]
+    // at zoom positions evenly spaced from 0 (first value) to 1 (last value)
+    std::vector<int> zoomElements;
+    std::vector<std::vector<float> > zoomThickness;
+
+    // focus cache, the same lens set up at focus distances evenly spaced in 1 / distance, from far to near
+    std::vector<Lensdata*> focusKeys;
+    float focusInverseFar, focusInverseStep;
+
+    // bokeh image masked by the exit pupil, a cumulative distribution over grid x grid cells per LUT field position
+    // the cells are shifted by bokehPupilOffset, to line up with the points bokehSample gives
+    std::vector<float> bokehPupilCdf;
+    int bokehPupilGrid;
+    float bokehPupilOffsetX, bokehPupilOffsetY;
+
+    // inverse chief ray table for camera_reverse_ray, at field angles evenly spaced from 0 to reverseMaxAngle:
+    // the sensor radius the chief ray comes from and where it crosses the optical axis in camera space
+    std::vector<float> reverseRadius, reversePupil;
+    float reverseMaxAngle;
+
+    Lensdata()
+        : lensCount(0), userApertureRadius(0.0f), apertureElement(0)
+        , totalInternalReflection(0)
+        , apertureDistance(0.0f), focalLengthRatio(0.0f), filmDiagonal(0.0f), originShift(0.0f), focalDistance(0.0f)
+        , lutBoundsSamples(0), lutAcceptanceSamples(0), angularLUT(false)
+        , tracer(NULL), snapshotId(0)
+        , focusInverseFar(0.0f), focusInverseStep(0.0f)
+        , bokehPupilGrid(0), bokehPupilOffsetX(0.0f), bokehPupilOffsetY(0.0f), reverseMaxAngle(0.0f){
+    }
+
+    ~Lensdata(){
+        if (!bokehPupilCdf.empty()){
+            AiAddMemUsage(-static_cast<int64_t>(bokehPupilCdf.size() * sizeof(float)), AtString("zoic"));
+        }
+
+        for (size_t i = 0; i < focusKeys.size(); i++){
+            delete focusKeys[i];
+        }
+    }
+};
+
+
+// how well the LUT covers the exit pupil at one field position, see lutAccuracy
+struct lutAccuracyRecord{
+    float fieldPosition; // distance from the sensor center [cm]
+    float pupilArea;     // area on the rear element plane that rays get through the lens from [cm^2]
+    float lutArea;       // area the LUT samples over on that same plane [cm^2]
+    float missed;        // fraction of the pupil outside of the LUT area, bokeh that never gets sampled
+    float efficiency;    // fraction of the LUT area inside the pupil, samples that make it on their first trace
+    bool skipped;        // outside of the image circle, no rays are traced there
+
+    lutAccuracyRecord()
+        : fieldPosition(0.0f), pupilArea(0.0f), lutArea(0.0f), missed(0.0f), efficiency(0.0f), skipped(false){
+    }
+};
+
+
+// path of a sampled camera ray through the lens, the origin on the sensor and every surface it hit
+// only filled in for the rays picked by the ray recorder, see traceThroughLensElements
+static const int maxRayPathPoints = 64;
+
+struct rayPath{
+    int count;
+    AtVector points[maxRayPathPoints];
+
+    rayPath()
+        : count(0){
+    }
+
+    void add(const AtVector &p){
+        if (count < maxRayPathPoints){ points[count++] = p; }
+    }
+};
+
+
+// exit pupil sampling data for a pixel sized cell on the sensor
+// cached per thread, so all camera AA samples of a pixel share the LUT lookup and rotation
+// exactly one cache line, so the records of different threads never share one when they're kept on cache line
+// boundaries, see cacheLineArray in zoic.cpp
+struct alignas(64) sensorPositionRecord{
+    uint64_t lensId;
+    uint32_t generation;
+    float focalDistance;
+    int cellX, cellY;
+    float cos, sin;
+    float maxScale;
+    float scaleY; // same as maxScale, except for an angular LUT
+    float translation;
+    int maxTries;
+    int bokehBin; // LUT field position nearest to this sensor position
+    bool skipped;
+
+    sensorPositionRecord()
+        : lensId(0), generation(0), focalDistance(0.0f), cellX(INT_MIN), cellY(INT_MIN)
+        , cos(1.0f), sin(0.0f), maxScale(0.0f), scaleY(0.0f), translation(0.0f)
+        , maxTries(0), bokehBin(0), skipped(false){
+    }
+};
+
+
+// maximum amount of resamples before a camera ray is considered vignetted
+static const int maxtries = 25;
+
+
+// probability with which a ray should make it through the lens within its retry budget
+static const float retrySuccesProbability = 0.9999f;
+
+
+// the LUT bounds are found by random sampling, so grow them a little to be sure the whole exit pupil is covered
+static const float samplingErrorCorrection = 1.05f;
+
+
+// newton iterations and convergence of the asphere intersection, it starts on the base sphere
+// and mildly aspheric surfaces converge in 2 - 4 steps
+static const int asphereMaxIterations = 12;
+static const float asphereTolerance = 1e-6f;
+
+
+// resolution of the inverse chief ray table, in sensor radii traced and in field angles stored
+static const int reverseTraceSamples = 256;
+static const int reverseTableSize = 512;
+
+
+// rays traced together through the lens, stored per component so every step vectorizes across the lanes
+static const int rayPacketSize = 8;
+
+template <int LANES>
+struct lanePacket{
+    float ox[LANES], oy[LANES], oz[LANES];
+    float dx[LANES], dy[LANES], dz[LANES];
+    int alive[LANES];
+};
+
+typedef lanePacket<rayPacketSize> rayPacket;
+typedef lanePacket<spectralLanes> spectralPacket;
+
+
+// steepest angle an angular LUT aims at, keeps the tangent finite
+static const float maxLUTAngle = 1.5f;
+
+
+// where a focus distance falls in the focus cache
+struct focusPosition{
+    int key;           // first of the two focus keys to interpolate between
+    float t;           // position between them
+    float originShift; // sensor position for this focus distance
+};
+
+
+// what reading a lens data file came to, see parseTabularLensData
+enum lensDataStatus{
+    LENSDATA_OK = 0,
+    LENSDATA_UNREADABLE,           // file missing or not readable
+    LENSDATA_NO_ELEMENTS,          // nothing but comments
+    LENSDATA_BAD_NUMBER,           // a value that isn't a finite number
+    LENSDATA_COLUMN_COUNT,         // the first element doesn't have 4 or 5 columns
+    LENSDATA_INCONSISTENT_COLUMNS, // an element with a different amount of columns than the first one
+    LENSDATA_MULTIPLE_APERTURES,   // more than one line with a radius of curvature of 0
+    LENSDATA_BAD_DIRECTIVE         // a #ZOOM or #ASPHERE line that doesn't fit the lens
+};
+
+
+struct lensDataResult{
+    lensDataStatus status;
+    int line;         // where it went wrong, from 1, 0 for the file as a whole
+    int column;       // value on that line, from 1, 0 for the line as a whole
+    int columns;      // 4 or 5, whether the file has abbe numbers
+    int commentLines; // comments and empty lines
+
+    lensDataResult()
+        : status(LENSDATA_OK), line(0), column(0), columns(0), commentLines(0){
+    }
+};
+
+
+// random numbers and lens sampling
+uint32_t xor128(void);
+void concentricDiskSampleN(const float *ox, const float *oy, float *lensx, float *lensy, int n);
+
+// lens data, from a file or the built-in catalog
+bool parseTabularLensData(const char *data, size_t size, Lensdata *ld, lensDataResult *result);
+bool readTabularLensData(const std::string &lensDataFileName, Lensdata *ld, lensDataResult *result);
+const char* lensDataStatusText(lensDataStatus status);
+void cleanupLensData(Lensdata *ld);
+void loadBuiltinLens(int index, Lensdata *ld);
+void computeLensCenters(Lensdata *ld);
+
+// lens setup: focal length, focus and the reverse projection
+AtVector2 lineLineIntersection(AtVector line1_origin, AtVector line1_direction, AtVector line2_origin, AtVector line2_direction);
+AtVector linePlaneIntersection(AtVector rayOrigin, AtVector rayDirection);
+float calculateImageDistance(float objectDistance, Lensdata *ld);
+lensTracer builtinLensTracer(int lensCount);
+float traceThroughLensElementsForFocalLength(Lensdata *ld, bool originShift);
+void adjustFocalLength(Lensdata *ld);
+void computeSpectralIor(Lensdata *ld);
+bool traceUnclipped(AtVector *ray_origin, AtVector *ray_direction, Lensdata *ld, int last);
+bool bundleCenterAim(Lensdata *ld, float radius, float *aim);
+void traceFieldAngles(Lensdata *ld, bool bundleCenters, std::vector<float> &angles, std::vector<float> &radii, std::vector<float> &pupils);
+void buildReverseProjection(Lensdata *ld);
+bool reverseProjectRadius(const Lensdata *ld, const AtVector &p, float *radius);
+void prepareLens(Lensdata *ld, float fStop, float focalDistance);
+
+// tracing camera rays
+bool empericalOpticalVignetting(AtVector origin, AtVector direction, float apertureRadius, float opticalVignettingRadius, float opticalVignettingDistance);
+bool traceThroughLensElementsForApertureSize(AtVector ray_origin, AtVector ray_direction, Lensdata *ld);
+int traceRayPacket(rayPacket *p, Lensdata *ld);
+bool traceSpectralCameraRay(AtVector *ray_origin, AtVector *ray_direction, Lensdata *ld, AtRGB *weight);
+
+// exit pupil LUT
+void lutScales(Lensdata *ld, boundingBox2d bounds, float *scaleX, float *scaleY, float *translation);
+boundingBox2d angularBounds(Lensdata *ld, AtVector sampleOrigin, boundingBox2d bounds);
+float estimateLUTAcceptance(Lensdata *ld, AtVector sampleOrigin, boundingBox2d &bounds, int acceptanceSamples);
+int retryBudget(float acceptance, int samples);
+boundingBox2d exitPupilBounds(Lensdata *ld, AtVector sampleOrigin, int boundsSamples);
+apertureLUTEntry computeLUTEntry(Lensdata *ld, AtVector sampleOrigin, int boundsSamples, int acceptanceSamples);
+apertureLUTEntry coarseLUTEntry(Lensdata *ld, AtVector sampleOrigin, int coarseSamples);
+void exitPupilLUT(Lensdata *ld, int filmSamplesX, int boundsSamples, int acceptanceSamples, bool progressive);
+const apertureLUTEntry& bestLUTEntry(Lensdata *ld, float position, const apertureLUTEntry &entry);
+void sensorPositionLookup(Lensdata *ld, float x, float y, sensorPositionRecord *rec);
+void lutAccuracy(Lensdata *ld, int fieldPositions, int pupilSamples, std::vector<lutAccuracyRecord> *records);
+void printLUTAccuracy(const std::vector<lutAccuracyRecord> &records);
+
+// bokeh image sampling jointly with the exit pupil
+void buildBokehPupilSampling(Lensdata *ld, const imageData &image);
+void sampleBokehPupil(const Lensdata *ld, int bin, float u, float v, AtVector2 *lens);
+
+// zoom and focus keys
+void buildZoomKeys(Lensdata *raw, float focalLength, float fStop, float focalDistance, bool useLUT, std::vector<Lensdata*> *keys);
+void interpolateZoom(const std::vector<Lensdata*> &keys, float zoom, float fStop, float focalDistance, Lensdata *ld);
+void buildFocusCache(Lensdata *ld, float nearDistance, float farDistance, int keys, bool useLUT, bool progressive);
+focusPosition locateFocus(Lensdata *ld, float focalDistance);
+void focusedSensorPositionLookup(Lensdata *ld, const focusPosition &focus, float x, float y, sensorPositionRecord *rec);
+size_t lensMemory(const Lensdata *ld);
+
+// diagnostic images
+bool writeEXR(const std::string &path, int width, int height, const std::vector<std::string> &names, const std::vector<std::vector<float> > &channels);
+
+
+// Improved concentric mapping code by Dave Cline [peter shirley´s blog]
+// maps points on the unit square onto the unit disk uniformly
+inline void concentricDiskSample(float ox, float oy, AtVector2 *lens) {
+    float phi, r;
+
+    // switch coordinate space from [0, 1] to [-1, 1]
+    float a = 2.0 * ox - 1.0;
+    float b = 2.0 * oy - 1.0;
+
+    if ((a * a) > (b * b)){
+        r = a;
+        phi = (0.78539816339f) * (b / a);
+    }
+    else if (b != 0.0f){
+        r = b;
+        phi = (AI_PIOVER2)-(0.78539816339f) * (a / b);
+    }
+    else { // center of the square, would be 0/0
+        r = 0.0f;
+        phi = 0.0f;
+    }
+
+    float sin, cos;
+    fastmath::fastSinCos(phi, &sin, &cos);
+    lens->x = r * cos;
+    lens->y = r * sin;
+}
+
+
+// ray sphere intersection for lens element intersections
+inline bool raySphereIntersection(AtVector *hit_point, AtVector ray_direction, AtVector ray_origin, AtVector sphere_center, float sphere_radius, bool reverse, bool tracingRealRays){
+    ray_direction = AiV3Normalize(ray_direction);
+    AtVector L = sphere_center - ray_origin;
+
+    float tca = AiV3Dot(L, ray_direction);
+    float radius2 = sphere_radius * sphere_radius;
+    float d2 = AiV3Dot(L, L) - (tca * tca);
+
+    // if the distance from the ray to the spherecenter is larger than its radius, don't worry about it
+    if (tracingRealRays && (d2 > radius2)){ return false; }
+
+    float thc = std::sqrt(std::abs(radius2 - d2));
+
+    float sign = (sphere_radius < 0.0f ? -1.0f : 1.0f);
+
+    if (reverse){
+        *hit_point = ray_origin + ray_direction * (tca - thc * sign);
+    } else {
+        *hit_point = ray_origin + ray_direction * (tca + thc * sign);
+    }
+
+    return true;
+}
+
+
+// compute normal at intersection point between ray and lens element
+inline bool intersectionNormal(AtVector hit_point, AtVector sphere_center, float sphere_radius, AtVector *hit_point_normal){
+    float sign = (sphere_radius < 0.0f ? -1.0f : 1.0f);
+
+    *hit_point_normal = AiV3Normalize(sphere_center - hit_point) * sign;
+    return true;
+}
+
+
+// sag of an even asphere at squared distance from the axis r2, the surface lies at z = vertex - sag
+// slope is d sag / dr divided by r, so the normal follows without a square root
+// returns false beyond the edge of the conic
+inline bool asphereSag(const LensElement &lens, float r2, float *sag, float *slope){
+    float c = 1.0f / lens.curvature;
+    float root = 1.0f - (1.0f + lens.conic) * c * c * r2;
+    if (root < 0.0f){ return false; }
+
+    root = std::sqrt(root);
+    *sag = (c * r2) / (1.0f + root);
+    *slope = c / root;
+
+    float power = r2;
+    for (int k = 0; k < asphereTerms; k++){
+        *slope += static_cast<float>(2 * k + 4) * lens.asphere[k] * power;
+        power *= r2;
+        *sag += lens.asphere[k] * power;
+    }
+
+    return true;
+}
+
+
+// ray asphere intersection by newton's method, ray_direction has to be normalized
+inline bool rayAsphereIntersection(float ox, float oy, float oz, float dx, float dy, float dz, const LensElement &lens, float vertex, float *hx, float *hy, float *hz){
+    if (dz == 0.0f){ return false; }
+
+    // start on the base sphere, same root as raySphereIntersection, or on the vertex plane when the ray misses it
+    float radius = lens.curvature;
+    float lz = (vertex - radius) - oz;
+    float tca = -ox * dx - oy * dy + lz * dz;
+    float d2 = (ox * ox + oy * oy + lz * lz) - (tca * tca);
+    float t = (d2 <= radius * radius) ? tca + std::sqrt(radius * radius - d2) * (radius < 0.0f ? -1.0f : 1.0f) : (vertex - oz) / dz;
+
+    for (int k = 0; k < asphereMaxIterations; k++){
+        float x = ox + dx * t, y = oy + dy * t, z = oz + dz * t;
+        float sag, slope;
+        if (!asphereSag(lens, x * x + y * y, &sag, &slope)){ return false; }
+
+        // distance along z to the surface and its derivative along the ray
+        float g = z - vertex + sag;
+        float dg = dz + slope * (x * dx + y * dy);
+        if (dg == 0.0f){ return false; }
+
+        float step = g / dg;
+        t -= step;
+
+        // relative to the distance travelled, float can't resolve t much finer than that
+        if (std::abs(step) <= asphereTolerance * (1.0f + std::abs(t))){
+            *hx = ox + dx * t;
+            *hy = oy + dy * t;
+            *hz = oz + dz * t;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+// normal of an asphere, oriented like intersectionNormal: along -z on the axis
+inline void asphereNormal(const LensElement &lens, float hx, float hy, float *nx, float *ny, float *nz){
+    float sag = 0.0f, slope = 0.0f;
+    asphereSag(lens, hx * hx + hy * hy, &sag, &slope);
+
+    float invLength = 1.0f / std::sqrt(slope * slope * (hx * hx + hy * hy) + 1.0f);
+    *nx = -slope * hx * invLength;
+    *ny = -slope * hy * invLength;
+    *nz = -invLength;
+}
+
+
+// intersection with a lens surface of any type crossing the axis at vertex, and its normal
+// reverse is for rays going from the object towards the sensor, their normal points the other way
+// switching on the surface type keeps every kernel inlined, there's no per ray indirection
+inline bool intersectSurface(AtVector *hit_point, AtVector *hit_point_normal, AtVector ray_direction, AtVector ray_origin, const LensElement &lens, float vertex, bool reverse, bool tracingRealRays){
+    switch (lens.type){
+        case SURFACE_PLANE:
+        {
+            ray_direction = AiV3Normalize(ray_direction);
+            if (ray_direction.z == 0.0f){ return false; }
+
+            *hit_point = ray_origin + ray_direction * ((vertex - ray_origin.z) / ray_direction.z);
+            *hit_point_normal = AtVector(0.0f, 0.0f, reverse ? 1.0f : -1.0f);
+            return true;
+        }
+
+        case SURFACE_ASPHERE:
+        {
+            ray_direction = AiV3Normalize(ray_direction);
+            if (!rayAsphereIntersection(ray_origin.x, ray_origin.y, ray_origin.z, ray_direction.x, ray_direction.y, ray_direction.z,
+                                        lens, vertex, &hit_point->x, &hit_point->y, &hit_point->z)){
+                // the paraxial traces go on regardless, like they do for spheres
+                if (tracingRealRays){ return false; }
+                *hit_point = ray_origin + ray_direction * ((vertex - ray_origin.z) / ray_direction.z);
+            }
+
+            asphereNormal(lens, hit_point->x, hit_point->y, &hit_point_normal->x, &hit_point_normal->y, &hit_point_normal->z);
+            if (reverse){ *hit_point_normal = -*hit_point_normal; }
+            return true;
+        }
+
+        default:
+        {
+            AtVector sphere_center(0.0f, 0.0f, vertex - lens.curvature);
+            if (!raySphereIntersection(hit_point, ray_direction, ray_origin, sphere_center, lens.curvature, reverse, tracingRealRays)){
+                return false;
+            }
+
+            intersectionNormal(*hit_point, sphere_center, reverse ? -lens.curvature : lens.curvature, hit_point_normal);
+            return true;
+        }
+    }
+}
+
+
+// snell's law
+inline bool calculateTransmissionVector(AtVector *ray_direction, float ior1, float ior2, AtVector incidentVector, AtVector normalVector, bool tracingRealRays){
+    incidentVector = AiV3Normalize(incidentVector);
+    normalVector = AiV3Normalize(normalVector);
+
+    float eta;
+    ior2 == 1.0 ? eta = ior1 : eta = ior1 / ior2;
+
+    float c1 = -AiV3Dot(incidentVector, normalVector);
+    float cs2 = (eta * eta) * (1.0 - (c1 * c1));
+
+    // total internal reflection, can only occur when ior1 > ior2
+    if ((tracingRealRays) && (ior1 > ior2) && (cs2 > 1.0)){
+        return false;
+    }
+
+    *ray_direction = (incidentVector * eta) + (normalVector * ((eta * c1) - std::sqrt(std::abs(1.0 - cs2))));
+    return true;
+}
+
+
+// main tracing function which will be called many, many times
+inline bool traceThroughLensElements(AtVector *ray_origin, AtVector *ray_direction, Lensdata *ld, rayPath *path){
+    AtVector hit_point, hit_point_normal;
+
+    if (path){
+        path->count = 0;
+        path->add(*ray_origin);
+    }
+
+    for (int i = 0; i < ld->lensCount; i++){
+        if (!intersectSurface(&hit_point, &hit_point_normal, *ray_direction, *ray_origin, ld->lenses[i], ld->lenses[i].vertex, false, true)){
+            return false;
+        }
+
+        float hitPoint2 = hit_point.x * hit_point.x + hit_point.y * hit_point.y;
+
+        // check if ray hits lens boundary or aperture
+        if ((hitPoint2 >(ld->lenses[i].aperture * 0.5) * (ld->lenses[i].aperture * 0.5))
+            || ((i == ld->apertureElement) && (hitPoint2 > (ld->userApertureRadius * ld->userApertureRadius)))){
+            return false;
+        }
+
+        if (path){ path->add(hit_point); }
+
+        *ray_origin = hit_point;
+
+        // if not last lens element
+        if (i != ld->lensCount - 1){
+            if (!calculateTransmissionVector(ray_direction, ld->lenses[i].ior, ld->lenses[i + 1].ior, *ray_direction, hit_point_normal, true)){
+                ld->totalInternalReflection++;
+                return false;
+            }
+        }
+        else { // last lens element
+            // assuming the material outside the lens is air [ior 1.0]
+            if (!calculateTransmissionVector(ray_direction, ld->lenses[i].ior, 1.0, *ray_direction, hit_point_normal, true)){
+                ld->totalInternalReflection++;
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+
+// camera rays go through the unrolled tracer when the lens has one
+// with a spectral weight given they are traced at the hero wavelengths instead, which sets the weight
+// recorded rays take the generic loop, the only one that keeps the path, dispersed rays keep no path
+inline bool traceCameraRay(AtVector *ray_origin, AtVector *ray_direction, Lensdata *ld, rayPath *path, AtRGB *spectralWeight){
+    if (spectralWeight){
+        if (path){ path->count = 0; }
+        return traceSpectralCameraRay(ray_origin, ray_direction, ld, spectralWeight);
+    }
+    if (ld->tracer && !path){
+        return ld->tracer(ray_origin, ray_direction, ld);
+    }
+    return traceThroughLensElements(ray_origin, ray_direction, ld, path);
+}
+
+
+// ray direction for a sample on the unit disk, mapped over the sampling area of a sensor position
+inline AtVector lutDirection(const Lensdata *ld, float lensx, float lensy, const sensorPositionRecord *rec, const AtVector &origin){
+    float dz = -ld->lenses[0].thickness;
+    float x = lensx * rec->maxScale + rec->translation;
+    float y = lensy * rec->scaleY;
+
+    if (ld->angularLUT){
+        // angles relative to the sensor position, the field position of the LUT lies on the x axis
+        float sinx, cosx, siny, cosy;
+        fastmath::fastSinCos(std::min(std::max(x, -maxLUTAngle), maxLUTAngle), &sinx, &cosx);
+        fastmath::fastSinCos(std::min(std::max(y, -maxLUTAngle), maxLUTAngle), &siny, &cosy);
+        float tx = (sinx / cosx) * dz;
+        float ty = (siny / cosy) * dz;
+        return AtVector(tx * rec->cos - ty * rec->sin, tx * rec->sin + ty * rec->cos, dz);
+    }
+
+    // point on the rear element plane, rotated towards the sensor position
+    return AtVector((x * rec->cos - y * rec->sin) - origin.x, (x * rec->sin + y * rec->cos) - origin.y, dz);
+}
+
+
+#endif